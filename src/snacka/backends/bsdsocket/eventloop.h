@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2013, Per Gantelius
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the copyright holders.
+ */
+
+#ifndef SN_EVENT_LOOP_H
+#define SN_EVENT_LOOP_H
+
+#include "../../websocket.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+    
+    /**
+     * Polls a number of websockets from a single thread, only touching
+     * websockets whose sockets are ready. Websockets added to a loop must
+     * use the BSD socket I/O callbacks, or I/O callbacks with a
+     * \c getFileDescriptorCallback, e.g the io_uring ones. Websockets
+     * sharing a file descriptor, see \c SN_IO_SHARED, have their timeouts
+     * checked before each wait and when it becomes ready, which also
+     * submits the operations they queued while being polled all at once.
+     * Currently only available on Linux, where it is implemented using
+     * edge-triggered epoll.
+     */
+    typedef struct snEventLoop snEventLoop;
+    
+    /**
+     * Creates an event loop.
+     * @return The new event loop or NULL on failure.
+     */
+    snEventLoop* snEventLoop_create(void);
+    
+    /**
+     * Deletes an event loop. Websockets added to the loop are not deleted.
+     * Those using \c snSocketWakeCallback must be removed, or still exist.
+     * @param loop The event loop to delete.
+     */
+    void snEventLoop_delete(snEventLoop* loop);
+    
+    /**
+     * Adds a websocket to an event loop. Call this after \c snWebsocket_connect.
+     * Adding a websocket that has reconnected since it was added refreshes
+     * its registration. Websockets connecting asynchronously are polled
+     * by the loop until connected.
+     * @param loop The event loop.
+     * @param ws The websocket. Each poll reads at most the websocket's
+     * \c maxBytesPerPoll bytes and \c maxFramesPerPoll frames, which keeps
+     * busy connections from starving the others. If its I/O callbacks include
+     * \c snSocketWakeCallback, frames posted with \c snWebsocket_postFrame wake
+     * up the loop, which then checks its websockets for posted frames.
+     * @return An error code.
+     */
+    snError snEventLoop_add(snEventLoop* loop, snWebsocket* ws);
+    
+    /**
+     * Removes a websocket from an event loop. Safe to call from websocket callbacks.
+     * @param loop The event loop.
+     * @param ws The websocket.
+     * @return An error code.
+     */
+    snError snEventLoop_remove(snEventLoop* loop, snWebsocket* ws);
+    
+    /**
+     * Waits for socket activity and polls the websockets that are ready.
+     * @param loop The event loop.
+     * @param timeoutMs The maximum time to wait in milliseconds. Waits
+     * indefinitely if negative, unless a websocket in the loop has a timer
+     * running, e.g to time out a closing handshake or to release a large
+     * receive buffer that has been idle for a while.
+     * @return An error code.
+     */
+    snError snEventLoop_runOnce(snEventLoop* loop, int timeoutMs);
+    
+    /**
+     * Runs the event loop until \c snEventLoop_stop is called or all
+     * websockets in the loop are closed.
+     * @param loop The event loop.
+     * @return An error code.
+     */
+    snError snEventLoop_run(snEventLoop* loop);
+    
+    /**
+     * Makes \c snEventLoop_run return after the current iteration. Safe to
+     * call from websocket callbacks.
+     * @param loop The event loop.
+     */
+    void snEventLoop_stop(snEventLoop* loop);
+    
+    /**
+     * Makes a call to \c snEventLoop_runOnce that is waiting return right
+     * away, or the next one if none is waiting. Safe to call from any thread.
+     * Call this after closing a websocket in the loop from outside its own
+     * callbacks, so the loop notices and times out its closing handshake.
+     * @param loop The event loop.
+     */
+    void snEventLoop_wake(snEventLoop* loop);
+    
+    /**
+     * Gets the number of websockets in an event loop, including closed
+     * ones that have not been removed.
+     * @param loop The event loop.
+     * @return The number of websockets.
+     */
+    int snEventLoop_getNumWebsockets(snEventLoop* loop);
+    
+    /**
+     * Gets the number of websockets in an event loop that are
+     * connecting or connected, i.e not closed.
+     * @param loop The event loop.
+     * @return The number of open websockets.
+     */
+    int snEventLoop_getNumOpenWebsockets(snEventLoop* loop);
+    
+    /**
+     * Gets the websockets in an event loop, in the order they were added.
+     * @param loop The event loop.
+     * @param websockets Receives the websockets.
+     * @param maxWebsockets The capacity of \c websockets.
+     * @return The number of websockets stored in \c websockets.
+     */
+    int snEventLoop_getWebsockets(snEventLoop* loop, snWebsocket** websockets, int maxWebsockets);
+    
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /*SN_EVENT_LOOP_H*/
@@ -0,0 +1,1101 @@
+/*
+ * Copyright (c) 2013, Per Gantelius
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the copyright holders.
+ */
+
+#ifdef __linux__
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "eventloop.h"
+#include "iocallbacks_socket.h"
+#include "socket.h"
+
+/** The maximum number of events to fetch per iteration. */
+#define SN_EVENT_LOOP_MAX_EVENTS 256
+
+/**
+ * Timers are rounded up to multiples of this, so that websockets
+ * due at about the same time are polled in a single pass.
+ */
+#define SN_EVENT_LOOP_TIMER_RESOLUTION 100 //in milliseconds
+
+/**
+ * A websocket added to an event loop.
+ */
+typedef struct snEventLoopEntry
+{
+    /** The websocket. */
+    snWebsocket* ws;
+    /**
+     * Non-zero if the I/O object is an \c stfSocket. Otherwise its file
+     * descriptor is found through \c getFileDescriptorCallback.
+     */
+    int isSocket;
+    /**
+     * Non-zero if the I/O object is an \c stfSocket woken up by
+     * \c snSocketWakeCallback, which then signals the loop.
+     */
+    int isWaking;
+    /** The file descriptor registered with epoll, or -1. */
+    int fileDescriptor;
+    /**
+     * Non-zero if \c fileDescriptor is shared with other I/O objects, in
+     * which case the entry is in the loop's list of shared entries.
+     */
+    int isSharingFileDescriptor;
+    /** The index of the entry in the list of shared entries. */
+    int sharedIndex;
+    /** Non-zero if the entry is in the ready list. */
+    int isReady;
+    /** Non-zero if the peer hung up. */
+    int hasHungUp;
+    /** Non-zero while the websocket is connecting. */
+    int isConnecting;
+    /** Non-zero if the websocket has been removed from the loop. */
+    int isRemoved;
+    /**
+     * When to poll the websocket even if its socket is not ready, e.g to time
+     * out a closing handshake, in milliseconds. -1 if there is no timer.
+     */
+    long long timerTime;
+} snEventLoopEntry;
+
+/**
+ * Registered with epoll in place of an entry for shared file descriptors.
+ */
+static char sharedFileDescriptorTag;
+
+struct snEventLoop
+{
+    /** */
+    int epollFileDescriptor;
+    /** Written to by \c snEventLoop_wake to interrupt \c epoll_wait. */
+    int wakeFileDescriptor;
+    /** All entries, including removed ones not yet freed. */
+    snEventLoopEntry** entries;
+    /** */
+    int numEntries;
+    /** Entries of websockets in the loop, hashed by websocket. Open addressing. */
+    snEventLoopEntry** entryIndex;
+    /** The capacity of \c entryIndex, a power of two. */
+    int entryIndexCapacity;
+    /** The number of websockets in the loop, i.e entries not removed. */
+    int numWebsockets;
+    /** The capacity of \c entries, \c readyEntries, \c pollEntries and \c sharedEntries. */
+    int entriesCapacity;
+    /** Entries to poll in the next iteration. */
+    snEventLoopEntry** readyEntries;
+    /** */
+    int numReadyEntries;
+    /** Entries being polled in the current iteration. */
+    snEventLoopEntry** pollEntries;
+    /** Entries whose file descriptor is shared, e.g an io_uring instance. */
+    snEventLoopEntry** sharedEntries;
+    /** */
+    int numSharedEntries;
+    /** The number of entries with a registered file descriptor. */
+    int numRegisteredEntries;
+    /** The number of entries that are connecting or have a file descriptor. */
+    int numOpenEntries;
+    /** The number of entries that are connecting. */
+    int numConnectingEntries;
+    /** The number of entries with a timer. */
+    int numTimerEntries;
+    /** */
+    int hasRemovedEntries;
+    /** */
+    int isStopped;
+    /** No later than the earliest timer of an entry, in milliseconds. */
+    long long nextTimerTime;
+};
+
+static long long currentTimeMs(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+static int hashWebsocket(snEventLoop* loop, snWebsocket* ws)
+{
+    const uint64_t h = (uint64_t)(uintptr_t)ws * 0x9e3779b97f4a7c15ull;
+    return (int)(h >> 32) & (loop->entryIndexCapacity - 1);
+}
+
+static snEventLoopEntry* findEntry(snEventLoop* loop, snWebsocket* ws)
+{
+    if (loop->entryIndexCapacity == 0)
+    {
+        return NULL;
+    }
+    
+    for (int i = hashWebsocket(loop, ws); loop->entryIndex[i] != NULL; i = (i + 1) & (loop->entryIndexCapacity - 1))
+    {
+        if (loop->entryIndex[i]->ws == ws)
+        {
+            return loop->entryIndex[i];
+        }
+    }
+    
+    return NULL;
+}
+
+static void insertIndexEntry(snEventLoop* loop, snEventLoopEntry* entry)
+{
+    int i = hashWebsocket(loop, entry->ws);
+    while (loop->entryIndex[i] != NULL)
+    {
+        i = (i + 1) & (loop->entryIndexCapacity - 1);
+    }
+    loop->entryIndex[i] = entry;
+}
+
+/**
+ * Makes room in the index for a number of websockets,
+ * keeping it at most half full.
+ */
+static snError reserveIndex(snEventLoop* loop, int numWebsockets)
+{
+    if (2 * numWebsockets <= loop->entryIndexCapacity)
+    {
+        return SN_NO_ERROR;
+    }
+    
+    int capacity = loop->entryIndexCapacity > 0 ? 2 * loop->entryIndexCapacity : 32;
+    while (2 * numWebsockets > capacity)
+    {
+        capacity *= 2;
+    }
+    
+    snEventLoopEntry** index = calloc(capacity, sizeof(snEventLoopEntry*));
+    if (index == NULL)
+    {
+        return SN_OUT_OF_MEMORY;
+    }
+    
+    snEventLoopEntry** oldIndex = loop->entryIndex;
+    const int oldCapacity = loop->entryIndexCapacity;
+    loop->entryIndex = index;
+    loop->entryIndexCapacity = capacity;
+    
+    for (int i = 0; i < oldCapacity; i++)
+    {
+        if (oldIndex[i] != NULL)
+        {
+            insertIndexEntry(loop, oldIndex[i]);
+        }
+    }
+    free(oldIndex);
+    
+    return SN_NO_ERROR;
+}
+
+static void removeIndexEntry(snEventLoop* loop, snEventLoopEntry* entry)
+{
+    const int mask = loop->entryIndexCapacity - 1;
+    int i = hashWebsocket(loop, entry->ws);
+    while (loop->entryIndex[i] != entry)
+    {
+        i = (i + 1) & mask;
+    }
+    
+    //move later entries of the same probe sequence into the gap,
+    //so lookups don't stop early
+    int gap = i;
+    for (i = (i + 1) & mask; loop->entryIndex[i] != NULL; i = (i + 1) & mask)
+    {
+        const int home = hashWebsocket(loop, loop->entryIndex[i]->ws);
+        const int distanceFromHome = (i - home) & mask;
+        const int distanceFromGap = (i - gap) & mask;
+        if (distanceFromHome >= distanceFromGap)
+        {
+            loop->entryIndex[gap] = loop->entryIndex[i];
+            gap = i;
+        }
+    }
+    loop->entryIndex[gap] = NULL;
+}
+
+static snError reserveEntries(snEventLoop* loop, int numEntries)
+{
+    if (numEntries <= loop->entriesCapacity)
+    {
+        return SN_NO_ERROR;
+    }
+    
+    int capacity = loop->entriesCapacity > 0 ? 2 * loop->entriesCapacity : 16;
+    
+    snEventLoopEntry** entries = realloc(loop->entries, capacity * sizeof(snEventLoopEntry*));
+    if (entries == NULL)
+    {
+        return SN_OUT_OF_MEMORY;
+    }
+    loop->entries = entries;
+    
+    entries = realloc(loop->readyEntries, capacity * sizeof(snEventLoopEntry*));
+    if (entries == NULL)
+    {
+        return SN_OUT_OF_MEMORY;
+    }
+    loop->readyEntries = entries;
+    
+    entries = realloc(loop->pollEntries, capacity * sizeof(snEventLoopEntry*));
+    if (entries == NULL)
+    {
+        return SN_OUT_OF_MEMORY;
+    }
+    loop->pollEntries = entries;
+    
+    entries = realloc(loop->sharedEntries, capacity * sizeof(snEventLoopEntry*));
+    if (entries == NULL)
+    {
+        return SN_OUT_OF_MEMORY;
+    }
+    loop->sharedEntries = entries;
+    
+    loop->entriesCapacity = capacity;
+    
+    return SN_NO_ERROR;
+}
+
+/**
+ * Checks if the websocket of an entry is connecting or connected.
+ */
+static int isOpen(snEventLoopEntry* entry)
+{
+    return entry->fileDescriptor >= 0 || entry->isConnecting;
+}
+
+static void setFileDescriptor(snEventLoop* loop, snEventLoopEntry* entry, int fileDescriptor, int isShared)
+{
+    const int wasOpen = isOpen(entry);
+    
+    if (entry->fileDescriptor < 0 && fileDescriptor >= 0)
+    {
+        loop->numRegisteredEntries++;
+    }
+    else if (entry->fileDescriptor >= 0 && fileDescriptor < 0)
+    {
+        loop->numRegisteredEntries--;
+    }
+    
+    isShared = isShared && fileDescriptor >= 0;
+    if (isShared && !entry->isSharingFileDescriptor)
+    {
+        entry->sharedIndex = loop->numSharedEntries;
+        loop->sharedEntries[loop->numSharedEntries++] = entry;
+    }
+    else if (!isShared && entry->isSharingFileDescriptor)
+    {
+        snEventLoopEntry* last = loop->sharedEntries[--loop->numSharedEntries];
+        loop->sharedEntries[entry->sharedIndex] = last;
+        last->sharedIndex = entry->sharedIndex;
+    }
+    
+    entry->fileDescriptor = fileDescriptor;
+    entry->isSharingFileDescriptor = isShared;
+    loop->numOpenEntries += isOpen(entry) - wasOpen;
+}
+
+static void setConnecting(snEventLoop* loop, snEventLoopEntry* entry, int isConnecting)
+{
+    const int wasOpen = isOpen(entry);
+    
+    if (isConnecting && !entry->isConnecting)
+    {
+        loop->numConnectingEntries++;
+    }
+    else if (!isConnecting && entry->isConnecting)
+    {
+        loop->numConnectingEntries--;
+    }
+    
+    entry->isConnecting = isConnecting;
+    loop->numOpenEntries += isOpen(entry) - wasOpen;
+}
+
+static void setTimer(snEventLoop* loop, snEventLoopEntry* entry, long long timerTime)
+{
+    if (timerTime >= 0 && entry->timerTime < 0)
+    {
+        loop->numTimerEntries++;
+    }
+    else if (timerTime < 0 && entry->timerTime >= 0)
+    {
+        loop->numTimerEntries--;
+    }
+    
+    entry->timerTime = timerTime;
+    
+    if (timerTime >= 0 && (loop->numTimerEntries == 1 || timerTime < loop->nextTimerTime))
+    {
+        loop->nextTimerTime = timerTime;
+    }
+}
+
+/**
+ * Gets the file descriptor of the I/O object of a websocket.
+ */
+static int getFileDescriptor(snEventLoopEntry* entry, int* isShared)
+{
+    if (entry->isSocket)
+    {
+        *isShared = 0;
+        return stfSocket_getFileDescriptor((stfSocket*)snWebsocket_getIOObject(entry->ws));
+    }
+    
+    *isShared = (snWebsocket_getInterest(entry->ws) & SN_IO_SHARED) != 0;
+    return snWebsocket_getFileDescriptor(entry->ws);
+}
+
+/**
+ * Registers the current socket of a websocket with epoll. While connecting,
+ * each address of the host is tried with a new socket, which may reuse
+ * the number of the previous one, so registering is always attempted.
+ */
+static snError registerFileDescriptor(snEventLoop* loop, snEventLoopEntry* entry)
+{
+    int isShared = 0;
+    const int fileDescriptor = getFileDescriptor(entry, &isShared);
+    
+    if (fileDescriptor >= 0 && isShared)
+    {
+        //the socket is still open, but now signals through the shared
+        //descriptor. other entries may have registered that already.
+        if (entry->fileDescriptor >= 0 && !entry->isSharingFileDescriptor)
+        {
+            epoll_ctl(loop->epollFileDescriptor, EPOLL_CTL_DEL, entry->fileDescriptor, NULL);
+        }
+        
+        struct epoll_event event;
+        memset(&event, 0, sizeof(struct epoll_event));
+        event.events = EPOLLIN | EPOLLET;
+        event.data.ptr = &sharedFileDescriptorTag;
+        
+        if (epoll_ctl(loop->epollFileDescriptor, EPOLL_CTL_ADD, fileDescriptor, &event) != 0 &&
+            errno != EEXIST)
+        {
+            return SN_SOCKET_IO_ERROR;
+        }
+    }
+    else if (fileDescriptor >= 0)
+    {
+        //edge-triggered, so the sockets only show up in
+        //epoll_wait when something changes
+        struct epoll_event event;
+        memset(&event, 0, sizeof(struct epoll_event));
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = entry;
+        
+        if (epoll_ctl(loop->epollFileDescriptor, EPOLL_CTL_ADD, fileDescriptor, &event) != 0 &&
+            errno != EEXIST)
+        {
+            return SN_SOCKET_IO_ERROR;
+        }
+    }
+    
+    setFileDescriptor(loop, entry, fileDescriptor, isShared);
+    
+    return SN_NO_ERROR;
+}
+
+static void markReady(snEventLoop* loop, snEventLoopEntry* entry)
+{
+    if (!entry->isReady && !entry->isRemoved)
+    {
+        entry->isReady = 1;
+        loop->readyEntries[loop->numReadyEntries++] = entry;
+    }
+}
+
+/**
+ * Sets the timer of an entry to when its websocket must be polled
+ * regardless of socket activity.
+ */
+static void updateTimer(snEventLoop* loop, snEventLoopEntry* entry)
+{
+    const int timeoutMs = snWebsocket_getTimeout(entry->ws);
+    if (timeoutMs < 0)
+    {
+        setTimer(loop, entry, -1);
+    }
+    else if (timeoutMs == 0)
+    {
+        setTimer(loop, entry, -1);
+        markReady(loop, entry);
+    }
+    else
+    {
+        const long long timerTime = currentTimeMs() + timeoutMs + SN_EVENT_LOOP_TIMER_RESOLUTION - 1;
+        setTimer(loop, entry, timerTime - timerTime % SN_EVENT_LOOP_TIMER_RESOLUTION);
+    }
+}
+
+/**
+ * Updates the bookkeeping of an entry whose websocket was closed.
+ */
+static void setClosed(snEventLoop* loop, snEventLoopEntry* entry)
+{
+    //closing the socket removed it from the epoll set. a shared
+    //descriptor stays registered for the other entries.
+    setFileDescriptor(loop, entry, -1, 0);
+    setConnecting(loop, entry, 0);
+    setTimer(loop, entry, -1);
+}
+
+/**
+ * Updates the timer of an entry after polling, and its registration if its
+ * I/O object started signalling through another file descriptor, e.g a
+ * socket that started using the io_uring instance of the thread.
+ */
+static void updateEntry(snEventLoop* loop, snEventLoopEntry* entry)
+{
+    if (!entry->isSocket && !entry->isConnecting)
+    {
+        int isShared = 0;
+        if (getFileDescriptor(entry, &isShared) != entry->fileDescriptor &&
+            registerFileDescriptor(loop, entry) != SN_NO_ERROR)
+        {
+            snWebsocket_disconnect(entry->ws, 1);
+            if (!entry->isRemoved)
+            {
+                setClosed(loop, entry);
+            }
+            return;
+        }
+    }
+    
+    updateTimer(loop, entry);
+}
+
+/**
+ * Polls the websocket of an entry once and decides if it needs to be
+ * polled again in the next iteration. Unless the websocket was closed,
+ * call \c updateEntry afterwards.
+ */
+static void pollEntry(snEventLoop* loop, snEventLoopEntry* entry)
+{
+    //so that frames posted from now on signal the loop again
+    if (entry->isWaking)
+    {
+        stfSocket_clearWake((stfSocket*)snWebsocket_getIOObject(entry->ws));
+    }
+    
+    snWebsocket_poll(entry->ws);
+    
+    //the websocket may have been removed, and even
+    //deleted, by one of its callbacks
+    if (entry->isRemoved)
+    {
+        return;
+    }
+    
+    const snReadyState state = snWebsocket_getState(entry->ws);
+    
+    if (state == SN_STATE_CLOSED)
+    {
+        setClosed(loop, entry);
+        return;
+    }
+    
+    if (entry->isConnecting)
+    {
+        //the socket may have changed
+        if (registerFileDescriptor(loop, entry) != SN_NO_ERROR)
+        {
+            snWebsocket_disconnect(entry->ws, 1);
+            setClosed(loop, entry);
+        }
+        else if (state != SN_STATE_CONNECTING)
+        {
+            setConnecting(loop, entry, 0);
+        }
+    }
+    else if (snWebsocket_hasPendingInput(entry->ws))
+    {
+        //the read budget ran out. there will be no new edge
+        //for the remaining data, so poll again next iteration.
+        markReady(loop, entry);
+    }
+    else if (entry->hasHungUp)
+    {
+        //everything the peer sent has been read
+        snWebsocket_disconnect(entry->ws, 1);
+        if (!entry->isRemoved)
+        {
+            setClosed(loop, entry);
+        }
+    }
+}
+
+/**
+ * Checks if an entry still has a websocket to poll.
+ */
+static int isActive(snEventLoopEntry* entry)
+{
+    return !entry->isRemoved && isOpen(entry);
+}
+
+/**
+ * Polls the websockets whose timers are due, so closing handshakes
+ * time out and idle receive buffers are released.
+ */
+static void runTimers(snEventLoop* loop, long long now)
+{
+    //lowered by timers set while polling, as well as by the ones found here
+    loop->nextTimerTime = LLONG_MAX;
+    
+    for (int i = 0; i < loop->numEntries; i++)
+    {
+        snEventLoopEntry* entry = loop->entries[i];
+        if (entry->timerTime < 0)
+        {
+            continue;
+        }
+        
+        if (entry->timerTime <= now)
+        {
+            setTimer(loop, entry, -1);
+            pollEntry(loop, entry);
+            if (isActive(entry))
+            {
+                updateEntry(loop, entry);
+            }
+        }
+        
+        if (entry->timerTime >= 0 && entry->timerTime < loop->nextTimerTime)
+        {
+            loop->nextTimerTime = entry->timerTime;
+        }
+    }
+}
+
+/**
+ * Notices websockets that were closed, or started a closing handshake,
+ * outside of their own callbacks.
+ */
+static void checkEntries(snEventLoop* loop)
+{
+    for (int i = 0; i < loop->numEntries; i++)
+    {
+        snEventLoopEntry* entry = loop->entries[i];
+        if (entry->isRemoved || (entry->fileDescriptor < 0 && !entry->isConnecting))
+        {
+            continue;
+        }
+        
+        if (snWebsocket_getState(entry->ws) == SN_STATE_CLOSED)
+        {
+            setClosed(loop, entry);
+        }
+        else
+        {
+            updateEntry(loop, entry);
+        }
+    }
+}
+
+/**
+ * Frees entries of removed websockets.
+ */
+static void purgeRemovedEntries(snEventLoop* loop)
+{
+    int numReadyEntries = 0;
+    for (int i = 0; i < loop->numReadyEntries; i++)
+    {
+        if (!loop->readyEntries[i]->isRemoved)
+        {
+            loop->readyEntries[numReadyEntries++] = loop->readyEntries[i];
+        }
+    }
+    loop->numReadyEntries = numReadyEntries;
+    
+    int numEntries = 0;
+    for (int i = 0; i < loop->numEntries; i++)
+    {
+        if (loop->entries[i]->isRemoved)
+        {
+            free(loop->entries[i]);
+        }
+        else
+        {
+            loop->entries[numEntries++] = loop->entries[i];
+        }
+    }
+    loop->numEntries = numEntries;
+    
+    loop->hasRemovedEntries = 0;
+}
+
+/**
+ * Marks connecting websockets that are due to check on host name lookups,
+ * give up on an address or race the next one as ready.
+ * @param elapsedMs The time waited since their timeouts were last checked.
+ * @return The time in milliseconds until the next one is due, or -1.
+ */
+static int markConnectingEntriesReady(snEventLoop* loop, int elapsedMs)
+{
+    int waitMs = -1;
+    if (loop->numConnectingEntries == 0)
+    {
+        return waitMs;
+    }
+    
+    for (int i = 0; i < loop->numEntries; i++)
+    {
+        snEventLoopEntry* entry = loop->entries[i];
+        if (!entry->isConnecting || entry->isRemoved)
+        {
+            continue;
+        }
+        
+        const int connectTimeout = entry->isSocket ?
+                                   stfSocket_getConnectTimeout((stfSocket*)snWebsocket_getIOObject(entry->ws)) :
+                                   snWebsocket_getTimeout(entry->ws);
+        if (connectTimeout >= 0 && connectTimeout <= elapsedMs)
+        {
+            markReady(loop, entry);
+        }
+        else if (connectTimeout > 0 && (waitMs < 0 || connectTimeout < waitMs))
+        {
+            waitMs = connectTimeout;
+        }
+    }
+    
+    return waitMs;
+}
+
+/**
+ * Marks the entries sharing a file descriptor as ready if they need
+ * polling. Checking any of them, or polling it, may collect the events of
+ * all of them, e.g the completions of an io_uring instance, without the
+ * descriptor signalling the others, so all of them are checked.
+ */
+static void markSharedEntriesReady(snEventLoop* loop)
+{
+    for (int i = 0; i < loop->numSharedEntries; i++)
+    {
+        snEventLoopEntry* entry = loop->sharedEntries[i];
+        if (snWebsocket_getTimeout(entry->ws) == 0)
+        {
+            markReady(loop, entry);
+        }
+    }
+}
+
+snEventLoop* snEventLoop_create(void)
+{
+    snEventLoop* loop = malloc(sizeof(snEventLoop));
+    if (loop == NULL)
+    {
+        return NULL;
+    }
+    memset(loop, 0, sizeof(snEventLoop));
+    
+    loop->epollFileDescriptor = epoll_create1(0);
+    if (loop->epollFileDescriptor < 0)
+    {
+        free(loop);
+        return NULL;
+    }
+    
+    //registered without an entry, which tells it apart from sockets
+    loop->wakeFileDescriptor = eventfd(0, EFD_NONBLOCK);
+    struct epoll_event event;
+    memset(&event, 0, sizeof(struct epoll_event));
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if (loop->wakeFileDescriptor < 0 ||
+        epoll_ctl(loop->epollFileDescriptor, EPOLL_CTL_ADD, loop->wakeFileDescriptor, &event) != 0)
+    {
+        if (loop->wakeFileDescriptor >= 0)
+        {
+            close(loop->wakeFileDescriptor);
+        }
+        close(loop->epollFileDescriptor);
+        free(loop);
+        return NULL;
+    }
+    
+    return loop;
+}
+
+void snEventLoop_delete(snEventLoop* loop)
+{
+    if (loop == NULL)
+    {
+        return;
+    }
+    
+    for (int i = 0; i < loop->numEntries; i++)
+    {
+        //frames posted from now on must not signal the closed descriptor
+        snEventLoopEntry* entry = loop->entries[i];
+        if (entry->isWaking && !entry->isRemoved)
+        {
+            stfSocket_setExternalWakeFileDescriptor((stfSocket*)snWebsocket_getIOObject(entry->ws), -1);
+        }
+        free(entry);
+    }
+    
+    close(loop->epollFileDescriptor);
+    close(loop->wakeFileDescriptor);
+    
+    free(loop->entries);
+    free(loop->entryIndex);
+    free(loop->readyEntries);
+    free(loop->pollEntries);
+    free(loop->sharedEntries);
+    free(loop);
+}
+
+snError snEventLoop_add(snEventLoop* loop, snWebsocket* ws)
+{
+    if (loop == NULL || ws == NULL)
+    {
+        return SN_BAD_ARGS;
+    }
+    
+    //websockets connecting asynchronously may not have a socket yet
+    const snIOGetFileDescriptorCallback getFileDescriptorCallback =
+        snWebsocket_getIOCallbacks(ws)->getFileDescriptorCallback;
+    const int isSocket = getFileDescriptorCallback == NULL ||
+                         getFileDescriptorCallback == snSocketGetFileDescriptorCallback;
+    const int fileDescriptor = isSocket ?
+                               stfSocket_getFileDescriptor((stfSocket*)snWebsocket_getIOObject(ws)) :
+                               snWebsocket_getFileDescriptor(ws);
+    const int isConnecting = snWebsocket_getState(ws) == SN_STATE_CONNECTING;
+    if (fileDescriptor < 0 && !isConnecting)
+    {
+        return SN_WEBSOCKET_CONNECTION_IS_NOT_OPEN;
+    }
+    
+    snEventLoopEntry* entry = findEntry(loop, ws);
+    if (entry == NULL)
+    {
+        snError e = reserveEntries(loop, loop->numEntries + 1);
+        if (e == SN_NO_ERROR)
+        {
+            e = reserveIndex(loop, loop->numWebsockets + 1);
+        }
+        if (e != SN_NO_ERROR)
+        {
+            return e;
+        }
+        
+        entry = malloc(sizeof(snEventLoopEntry));
+        if (entry == NULL)
+        {
+            return SN_OUT_OF_MEMORY;
+        }
+        memset(entry, 0, sizeof(snEventLoopEntry));
+        entry->ws = ws;
+        entry->isSocket = isSocket;
+        entry->isWaking = isSocket && snWebsocket_getIOCallbacks(ws)->wakeCallback == snSocketWakeCallback;
+        entry->fileDescriptor = -1;
+        entry->timerTime = -1;
+        
+        //frames posted from other threads wake up the loop, which then
+        //checks which websockets have any, instead of each socket
+        //having a descriptor of its own for this
+        if (entry->isWaking)
+        {
+            stfSocket_setExternalWakeFileDescriptor((stfSocket*)snWebsocket_getIOObject(ws), loop->wakeFileDescriptor);
+        }
+        
+        loop->entries[loop->numEntries++] = entry;
+        insertIndexEntry(loop, entry);
+        loop->numWebsockets++;
+    }
+    
+    snError e = registerFileDescriptor(loop, entry);
+    if (e != SN_NO_ERROR)
+    {
+        return e;
+    }
+    
+    entry->hasHungUp = 0;
+    setConnecting(loop, entry, isConnecting);
+    
+    //data may have arrived before the socket was registered
+    markReady(loop, entry);
+    
+    return SN_NO_ERROR;
+}
+
+snError snEventLoop_remove(snEventLoop* loop, snWebsocket* ws)
+{
+    if (loop == NULL || ws == NULL)
+    {
+        return SN_BAD_ARGS;
+    }
+    
+    snEventLoopEntry* entry = findEntry(loop, ws);
+    if (entry == NULL)
+    {
+        return SN_BAD_ARGS;
+    }
+    
+    if (entry->fileDescriptor >= 0)
+    {
+        if (!entry->isSharingFileDescriptor)
+        {
+            epoll_ctl(loop->epollFileDescriptor, EPOLL_CTL_DEL, entry->fileDescriptor, NULL);
+        }
+        setFileDescriptor(loop, entry, -1, 0);
+    }
+    if (entry->isWaking)
+    {
+        stfSocket_setExternalWakeFileDescriptor((stfSocket*)snWebsocket_getIOObject(ws), -1);
+    }
+    setConnecting(loop, entry, 0);
+    setTimer(loop, entry, -1);
+    
+    //the entry is freed at the end of the current iteration,
+    //since pending events may still refer to it
+    removeIndexEntry(loop, entry);
+    loop->numWebsockets--;
+    entry->isRemoved = 1;
+    entry->ws = NULL;
+    loop->hasRemovedEntries = 1;
+    
+    return SN_NO_ERROR;
+}
+
+snError snEventLoop_runOnce(snEventLoop* loop, int timeoutMs)
+{
+    //this also has shared descriptors submit operations queued
+    //since the last check, e.g sends outside of callbacks
+    markSharedEntriesReady(loop);
+    
+    long long now = currentTimeMs();
+    
+    //only wake up on our own if a timer is running
+    int waitMs = timeoutMs;
+    if (loop->numTimerEntries > 0)
+    {
+        const int timerWaitMs = loop->nextTimerTime > now ? (int)(loop->nextTimerTime - now) : 0;
+        if (waitMs < 0 || timerWaitMs < waitMs)
+        {
+            waitMs = timerWaitMs;
+        }
+    }
+    
+    //wake up when connecting sockets are due
+    const int connectWaitMs = markConnectingEntriesReady(loop, 0);
+    if (connectWaitMs >= 0 && (waitMs < 0 || connectWaitMs < waitMs))
+    {
+        waitMs = connectWaitMs;
+    }
+    
+    //don't wait if some websockets still have unread data
+    if (loop->numReadyEntries > 0)
+    {
+        waitMs = 0;
+    }
+    
+    struct epoll_event events[SN_EVENT_LOOP_MAX_EVENTS];
+    int numEvents = epoll_wait(loop->epollFileDescriptor, events, SN_EVENT_LOOP_MAX_EVENTS, waitMs);
+    if (numEvents < 0)
+    {
+        if (errno != EINTR)
+        {
+            return SN_SOCKET_IO_ERROR;
+        }
+        numEvents = 0;
+    }
+    
+    int isWoken = 0;
+    for (int i = 0; i < numEvents; i++)
+    {
+        snEventLoopEntry* entry = (snEventLoopEntry*)events[i].data.ptr;
+        const uint32_t flags = events[i].events;
+        
+        if (entry == NULL)
+        {
+            //woken up by snEventLoop_wake
+            uint64_t numWakes = 0;
+            if (read(loop->wakeFileDescriptor, &numWakes, sizeof(numWakes)) < 0)
+            {
+                //already reset by a previous read
+            }
+            isWoken = 1;
+            continue;
+        }
+        
+        if (events[i].data.ptr == &sharedFileDescriptorTag)
+        {
+            markSharedEntriesReady(loop);
+            continue;
+        }
+        
+        if (entry->isRemoved || entry->fileDescriptor < 0)
+        {
+            continue;
+        }
+        
+        //while connecting, errors mean trying the next address
+        if ((flags & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)) && !entry->isConnecting)
+        {
+            entry->hasHungUp = 1;
+        }
+        
+        //becoming writable only matters if there is queued
+        //output, or if it means a connection attempt completed
+        if ((flags & (EPOLLIN | EPOLLHUP | EPOLLERR | EPOLLRDHUP)) ||
+            entry->isConnecting ||
+            snWebsocket_getBufferedAmount(entry->ws) > 0)
+        {
+            markReady(loop, entry);
+        }
+    }
+    
+    if (isWoken)
+    {
+        checkEntries(loop);
+    }
+    
+    //host name lookups are checked on at fixed intervals
+    //rather than by deadline, so go by the time waited
+    const long long startTime = now;
+    now = currentTimeMs();
+    markConnectingEntriesReady(loop, (int)(now - startTime));
+    
+    if (loop->numTimerEntries > 0 && now >= loop->nextTimerTime)
+    {
+        runTimers(loop, now);
+    }
+    
+    //poll each ready websocket once. the ones that use up their
+    //budget are put back in the ready list for the next iteration.
+    snEventLoopEntry** pollEntries = loop->readyEntries;
+    loop->readyEntries = loop->pollEntries;
+    loop->pollEntries = pollEntries;
+    const int numPollEntries = loop->numReadyEntries;
+    loop->numReadyEntries = 0;
+    
+    for (int i = 0; i < numPollEntries; i++)
+    {
+        //callbacks adding websockets may reallocate the list
+        snEventLoopEntry* entry = loop->pollEntries[i];
+        entry->isReady = 0;
+        
+        if (isActive(entry))
+        {
+            pollEntry(loop, entry);
+        }
+    }
+    
+    //only then check when to poll each one again. I/O objects sharing a
+    //file descriptor may queue their operations, e.g on an io_uring
+    //instance, and the first check submits all of them at once.
+    for (int i = 0; i < numPollEntries; i++)
+    {
+        snEventLoopEntry* entry = loop->pollEntries[i];
+        if (isActive(entry))
+        {
+            updateEntry(loop, entry);
+        }
+    }
+    
+    if (loop->hasRemovedEntries)
+    {
+        purgeRemovedEntries(loop);
+    }
+    
+    return SN_NO_ERROR;
+}
+
+snError snEventLoop_run(snEventLoop* loop)
+{
+    loop->isStopped = 0;
+    
+    //websockets may have been closed since the last iteration
+    checkEntries(loop);
+    
+    while (!loop->isStopped && (loop->numRegisteredEntries > 0 || loop->numConnectingEntries > 0))
+    {
+        snError e = snEventLoop_runOnce(loop, -1);
+        if (e != SN_NO_ERROR)
+        {
+            return e;
+        }
+    }
+    
+    return SN_NO_ERROR;
+}
+
+void snEventLoop_stop(snEventLoop* loop)
+{
+    loop->isStopped = 1;
+}
+
+void snEventLoop_wake(snEventLoop* loop)
+{
+    const uint64_t one = 1;
+    if (write(loop->wakeFileDescriptor, &one, sizeof(one)) < 0)
+    {
+        //the counter is saturated, so a wake up is pending anyway
+    }
+}
+
+int snEventLoop_getNumWebsockets(snEventLoop* loop)
+{
+    return loop->numWebsockets;
+}
+
+int snEventLoop_getNumOpenWebsockets(snEventLoop* loop)
+{
+    return loop->numOpenEntries;
+}
+
+int snEventLoop_getWebsockets(snEventLoop* loop, snWebsocket** websockets, int maxWebsockets)
+{
+    int numWebsockets = 0;
+    for (int i = 0; i < loop->numEntries && numWebsockets < maxWebsockets; i++)
+    {
+        if (!loop->entries[i]->isRemoved)
+        {
+            websockets[numWebsockets++] = loop->entries[i]->ws;
+        }
+    }
+    
+    return numWebsockets;
+}
+
+#endif /* __linux__ */
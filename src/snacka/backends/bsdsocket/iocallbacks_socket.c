@@ -30,7 +30,12 @@
 #include "../../websocket.h"
 #include "iocallbacks_socket.h"
 #include "socket.h"
+#include <stdlib.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+
+/** Vectored writes with up to this many buffers don't allocate. */
+#define SN_SOCKET_MAX_STACK_BUFFERS 16
 
 snError snSocketInitCallback(void** socket)
 {
@@ -58,6 +63,31 @@ snError snSocketConnectCallback(void* userData,
     return SN_NO_ERROR;
 }
 
+snError snSocketStartConnectCallback(void* userData,
+                                     const char* host,
+                                     int port,
+                                     snIOCancelCallback cancelCallback)
+{
+    stfSocket* socket = (stfSocket*)userData;
+    int result = stfSocket_startConnect(socket, host, port);
+    if (result == 0)
+    {
+        return SN_SOCKET_FAILED_TO_CONNECT;
+    }
+    return SN_NO_ERROR;
+}
+
+snError snSocketPollConnectCallback(void* userData, int* isConnected)
+{
+    stfSocket* socket = (stfSocket*)userData;
+    int result = stfSocket_pollConnect(socket, isConnected);
+    if (result == 0)
+    {
+        return SN_SOCKET_FAILED_TO_CONNECT;
+    }
+    return SN_NO_ERROR;
+}
+
 snError snSocketDisconnectCallback(void* userData)
 {
     stfSocket* socket = (stfSocket*)userData;
@@ -88,20 +118,93 @@ snError snSocketWriteCallback(void* userData,
 {
     stfSocket* socket = (stfSocket*)userData;
     
-    const int success = stfSocket_sendData(socket,
-                                           buffer,
-                                           bufferSize,
-                                           numBytesWritten, 0, 0);
+    struct iovec vector;
+    vector.iov_base = (void*)buffer;
+    vector.iov_len = bufferSize;
+    
+    const int success = stfSocket_trySendData(socket, &vector, 1, numBytesWritten);
+    
+    return success ? SN_NO_ERROR : SN_SOCKET_IO_ERROR;
+}
+
+snError snSocketWritevCallback(void* userData,
+                               const snIOBuffer* buffers,
+                               int numBuffers,
+                               int* numBytesWritten,
+                               snIOCancelCallback cancelCallback)
+{
+    stfSocket* socket = (stfSocket*)userData;
+    struct iovec stackVectors[SN_SOCKET_MAX_STACK_BUFFERS];
+    struct iovec* vectors = stackVectors;
+    
+    if (numBuffers <= 0)
+    {
+        *numBytesWritten = 0;
+        return SN_NO_ERROR;
+    }
+    
+    if (numBuffers > SN_SOCKET_MAX_STACK_BUFFERS)
+    {
+        vectors = malloc(numBuffers * sizeof(struct iovec));
+        if (vectors == NULL)
+        {
+            return SN_OUT_OF_MEMORY;
+        }
+    }
+    
+    for (int i = 0; i < numBuffers; i++)
+    {
+        vectors[i].iov_base = (void*)buffers[i].data;
+        vectors[i].iov_len = buffers[i].size > 0 ? buffers[i].size : 0;
+    }
+    
+    const int success = stfSocket_trySendData(socket, vectors, numBuffers, numBytesWritten);
+    
+    if (vectors != stackVectors)
+    {
+        free(vectors);
+    }
     
     return success ? SN_NO_ERROR : SN_SOCKET_IO_ERROR;
 }
 
+snError snSocketWaitCallback(void* socket, int shouldWaitForWrite, int timeoutMs)
+{
+    return stfSocket_wait(socket, shouldWaitForWrite, timeoutMs) ? SN_NO_ERROR : SN_SOCKET_IO_ERROR;
+}
+
+int snSocketGetFileDescriptorCallback(void* socket, int* interest, int* timeoutMs)
+{
+    *timeoutMs = stfSocket_getConnectTimeout(socket);
+    return stfSocket_getFileDescriptor(socket);
+}
+
+void snSocketWakeCallback(void* socket)
+{
+    stfSocket_wake(socket);
+}
+
 float snSocketTimeCallback()
 {
+  //measured from the first call, since a float can't hold the
+  //time since the epoch with better than minute precision
+  static long long startTimeUs = 0;
+  
   struct timeval tv;
   gettimeofday(&tv, NULL);
 
-  float time = tv.tv_sec + tv.tv_usec / 1000000.0f;
+  const long long timeUs = tv.tv_sec * 1000000LL + tv.tv_usec;
+  long long startUs = __atomic_load_n(&startTimeUs, __ATOMIC_RELAXED);
+  if (startUs == 0)
+  {
+    //start at one second, since websockets treat zero as never polled.
+    //websockets may be polled from several threads, so the first call wins.
+    const long long newStartUs = timeUs - 1000000;
+    if (__atomic_compare_exchange_n(&startTimeUs, &startUs, newStartUs, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+      startUs = newStartUs;
+    }
+  }
 
-  return time;
+  return (float)((timeUs - startUs) / 1000000.0);
 }
@@ -48,6 +48,17 @@ extern "C"
                                     int port,
                                     snIOCancelCallback cancelCallback);
     
+    /**
+     * Starts connecting without blocking. Use together with
+     * \c snSocketPollConnectCallback as the \c pollConnectCallback.
+     */
+    snError snSocketStartConnectCallback(void* socket,
+                                         const char* url,
+                                         int port,
+                                         snIOCancelCallback cancelCallback);
+    
+    snError snSocketPollConnectCallback(void* socket, int* isConnected);
+    
     snError snSocketDisconnectCallback(void* socket);
     
     snError snSocketReadCallback(void* socket,
@@ -61,6 +72,29 @@ extern "C"
                                   int* numBytesWritten,
                                   snIOCancelCallback cancelCallback);
     
+    snError snSocketWritevCallback(void* socket,
+                                   const snIOBuffer* buffers,
+                                   int numBuffers,
+                                   int* numBytesWritten,
+                                   snIOCancelCallback cancelCallback);
+    
+    /**
+     * Waits for the socket to become readable, or writable if requested.
+     * Use as the \c waitCallback for \c snWebsocket_pollWait.
+     */
+    snError snSocketWaitCallback(void* socket, int shouldWaitForWrite, int timeoutMs);
+    
+    /**
+     * Use as the \c getFileDescriptorCallback to drive websockets from an external event loop.
+     */
+    int snSocketGetFileDescriptorCallback(void* socket, int* interest, int* timeoutMs);
+    
+    /**
+     * Use as the \c wakeCallback to have \c snWebsocket_postFrame wake up
+     * \c snWebsocket_pollWait and \c snEventLoop.
+     */
+    void snSocketWakeCallback(void* socket);
+    
     float snSocketTimeCallback(void);
 
 #ifdef __cplusplus
@@ -0,0 +1,770 @@
+/*
+ * Copyright (c) 2013, Per Gantelius
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the copyright holders.
+ */
+
+#ifdef __linux__
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reactor.h"
+#include "eventloop.h"
+#include "../../mpscqueue.h"
+
+/** NUMA nodes are looked for up to this node number. */
+#define SN_REACTOR_MAX_NUMA_NODES 64
+
+/**
+ * Kinds of work handed to a shard.
+ */
+typedef enum snReactorCommandType
+{
+    /** Start polling a websocket. */
+    SN_REACTOR_ADD,
+    /** Start polling a websocket moved from another shard. */
+    SN_REACTOR_MOVE_IN,
+    /** Move a websocket to another shard, once it's not being polled. */
+    SN_REACTOR_MOVE_OUT,
+    /** Move some websockets to another shard. */
+    SN_REACTOR_SHED,
+    /** Run a function. */
+    SN_REACTOR_CALL
+} snReactorCommandType;
+
+/**
+ * Work handed to a shard through its command queue.
+ */
+typedef struct snReactorCommand
+{
+    /** Must be first. */
+    snMpscNode node;
+    /** */
+    snReactorCommandType type;
+    /** The websocket to add. */
+    snWebsocket* ws;
+    /** The number of websockets to shed. */
+    int numWebsockets;
+    /** The shard to move or shed websockets to. */
+    int targetShard;
+    /** The function to run. */
+    snReactorCallback callback;
+    /** */
+    void* userData;
+} snReactorCommand;
+
+/**
+ * A worker thread with its own event loop.
+ */
+typedef struct snReactorShard
+{
+    /** Work from other threads. Popped by the shard only. */
+    snMpscQueue commands;
+    /** */
+    snReactor* reactor;
+    /** */
+    int index;
+    /** Only used on the thread of the shard. */
+    snEventLoop* loop;
+    /** */
+    pthread_t thread;
+    /** Non-zero if \c thread has been started. */
+    int hasThread;
+    /** Set to make the thread exit. */
+    int isStopping;
+    /** The number of websockets on their way to the shard. Updated atomically. */
+    int numIncoming;
+    /**
+     * The number of open websockets in the loop of the shard, as of the end
+     * of its last iteration. Closed websockets that are never removed don't
+     * count. Written by the shard only, read atomically.
+     */
+    int numOpen;
+    /** The CPUs to run on, if \c hasAffinity is set. */
+    cpu_set_t cpus;
+    /** */
+    int hasAffinity;
+    /** Keeps the loads of neighbouring shards on separate cache lines. */
+    char padding[SN_CACHE_LINE_SIZE];
+} snReactorShard;
+
+struct snReactor
+{
+    /** */
+    snReactorShard* shards;
+    /** */
+    int numShards;
+    /** */
+    snPlacementPolicy placementPolicy;
+    /** */
+    snReactorMoveCallback moveCallback;
+    /** */
+    void* callbackData;
+    /** The next shard for round-robin placement. Updated atomically. */
+    unsigned nextShard;
+};
+
+/** Refers to the shard running on the current thread, if any. */
+static pthread_key_t currentShardKey;
+
+static pthread_once_t currentShardKeyOnce = PTHREAD_ONCE_INIT;
+
+static void createCurrentShardKey(void)
+{
+    pthread_key_create(&currentShardKey, NULL);
+}
+
+static snReactorShard* getCurrentShard(snReactor* reactor)
+{
+    snReactorShard* shard = (snReactorShard*)pthread_getspecific(currentShardKey);
+    return shard != NULL && shard->reactor == reactor ? shard : NULL;
+}
+
+static void addIncoming(snReactorShard* shard, int numWebsockets)
+{
+    __atomic_add_fetch(&shard->numIncoming, numWebsockets, __ATOMIC_RELAXED);
+}
+
+/**
+ * Publishes the number of open websockets in the loop of the current shard.
+ */
+static void updateLoad(snReactorShard* shard)
+{
+    __atomic_store_n(&shard->numOpen, snEventLoop_getNumOpenWebsockets(shard->loop), __ATOMIC_RELAXED);
+}
+
+static snReactorCommand* newCommand(snReactorCommandType type)
+{
+    snReactorCommand* command = malloc(sizeof(snReactorCommand));
+    if (command != NULL)
+    {
+        memset(command, 0, sizeof(snReactorCommand));
+        command->type = type;
+    }
+    return command;
+}
+
+static void postCommand(snReactorShard* shard, snReactorCommand* command)
+{
+    snMpscQueue_push(&shard->commands, &command->node);
+    snEventLoop_wake(shard->loop);
+}
+
+/**
+ * Checks if a websocket can leave the thread of its shard. An I/O object
+ * sharing a file descriptor, e.g a socket using the io_uring instance of
+ * the thread, is tied to that thread.
+ */
+static int isMovable(snWebsocket* ws)
+{
+    return (snWebsocket_getInterest(ws) & SN_IO_SHARED) == 0;
+}
+
+/**
+ * Takes a websocket out of the loop of the current shard and hands it to
+ * another one. Must not be called while the loop is polling the websocket.
+ */
+static snError moveWebsocket(snReactorShard* shard, snWebsocket* ws, snReactorShard* target)
+{
+    if (target == shard)
+    {
+        return SN_NO_ERROR;
+    }
+    
+    if (!isMovable(ws))
+    {
+        return SN_BAD_ARGS;
+    }
+    
+    snReactorCommand* command = newCommand(SN_REACTOR_MOVE_IN);
+    if (command == NULL)
+    {
+        return SN_OUT_OF_MEMORY;
+    }
+    
+    snError e = snEventLoop_remove(shard->loop, ws);
+    if (e != SN_NO_ERROR)
+    {
+        free(command);
+        return e;
+    }
+    
+    updateLoad(shard);
+    addIncoming(target, 1);
+    
+    command->ws = ws;
+    postCommand(target, command);
+    
+    return SN_NO_ERROR;
+}
+
+static void addWebsocket(snReactorShard* shard, snWebsocket* ws, int isMove)
+{
+    snReactor* reactor = shard->reactor;
+    
+    const snError e = snEventLoop_add(shard->loop, ws);
+    addIncoming(shard, -1);
+    updateLoad(shard);
+    
+    if (e != SN_NO_ERROR)
+    {
+        //nothing would poll the websocket
+        if (snWebsocket_getState(ws) != SN_STATE_CLOSED)
+        {
+            snWebsocket_disconnect(ws, 1);
+        }
+        return;
+    }
+    
+    if (isMove && reactor->moveCallback)
+    {
+        reactor->moveCallback(reactor->callbackData, ws, shard->index);
+    }
+}
+
+/**
+ * Moves up to a given number of open websockets without
+ * queued output to another shard, most recently added first.
+ */
+static void shedWebsockets(snReactorShard* shard, int numWebsockets, int targetShard)
+{
+    const int numCandidates = snEventLoop_getNumWebsockets(shard->loop);
+    snWebsocket** candidates = malloc(numCandidates * sizeof(snWebsocket*) + 1);
+    if (candidates == NULL)
+    {
+        return;
+    }
+    snEventLoop_getWebsockets(shard->loop, candidates, numCandidates);
+    
+    snReactorShard* target = &shard->reactor->shards[targetShard];
+    int numMoved = 0;
+    
+    for (int i = numCandidates - 1; i >= 0 && numMoved < numWebsockets; i--)
+    {
+        snWebsocket* ws = candidates[i];
+        if (snWebsocket_getState(ws) == SN_STATE_OPEN &&
+            snWebsocket_getBufferedAmount(ws) == 0 &&
+            moveWebsocket(shard, ws, target) == SN_NO_ERROR)
+        {
+            numMoved++;
+        }
+    }
+    
+    free(candidates);
+}
+
+static void runCommands(snReactorShard* shard)
+{
+    snMpscNode* node = NULL;
+    while ((node = snMpscQueue_pop(&shard->commands)) != NULL)
+    {
+        snReactorCommand* command = (snReactorCommand*)node;
+        
+        switch (command->type)
+        {
+            case SN_REACTOR_ADD:
+            case SN_REACTOR_MOVE_IN:
+                addWebsocket(shard, command->ws, command->type == SN_REACTOR_MOVE_IN);
+                break;
+            case SN_REACTOR_MOVE_OUT:
+                moveWebsocket(shard, command->ws, &shard->reactor->shards[command->targetShard]);
+                break;
+            case SN_REACTOR_SHED:
+                shedWebsockets(shard, command->numWebsockets, command->targetShard);
+                break;
+            case SN_REACTOR_CALL:
+                command->callback(command->userData);
+                break;
+        }
+        
+        free(command);
+    }
+}
+
+static void* runShard(void* data)
+{
+    snReactorShard* shard = (snReactorShard*)data;
+    pthread_setspecific(currentShardKey, shard);
+    
+    while (!__atomic_load_n(&shard->isStopping, __ATOMIC_ACQUIRE))
+    {
+        snEventLoop_runOnce(shard->loop, -1);
+        runCommands(shard);
+        
+        //websockets may have closed without being removed
+        updateLoad(shard);
+    }
+    
+    return NULL;
+}
+
+/**
+ * Reads the CPUs of a NUMA node that the process may run on.
+ * @return Non-zero if the node exists and has any such CPUs.
+ */
+static int readNumaNodeCpus(int node, const cpu_set_t* allowedCpus, cpu_set_t* cpus)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+    {
+        return 0;
+    }
+    
+    CPU_ZERO(cpus);
+    
+    //a list of ranges, e.g "0-3,8-11"
+    int first = 0;
+    while (fscanf(file, "%d", &first) == 1)
+    {
+        int last = first;
+        int c = fgetc(file);
+        if (c == '-')
+        {
+            if (fscanf(file, "%d", &last) != 1)
+            {
+                break;
+            }
+            c = fgetc(file);
+        }
+        
+        for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, allowedCpus))
+            {
+                CPU_SET(cpu, cpus);
+            }
+        }
+        
+        if (c != ',')
+        {
+            break;
+        }
+    }
+    
+    fclose(file);
+    
+    return CPU_COUNT(cpus) > 0;
+}
+
+/**
+ * Decides which CPUs the thread of each shard runs on.
+ */
+static void assignCpus(snReactor* reactor, snShardAffinity affinity, const cpu_set_t* allowedCpus)
+{
+    if (affinity == SN_AFFINITY_CPU)
+    {
+        int allowed[CPU_SETSIZE];
+        int numAllowed = 0;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, allowedCpus))
+            {
+                allowed[numAllowed++] = cpu;
+            }
+        }
+        
+        for (int i = 0; i < reactor->numShards && numAllowed > 0; i++)
+        {
+            snReactorShard* shard = &reactor->shards[i];
+            CPU_ZERO(&shard->cpus);
+            CPU_SET(allowed[i % numAllowed], &shard->cpus);
+            shard->hasAffinity = 1;
+        }
+    }
+    else if (affinity == SN_AFFINITY_NUMA_NODE)
+    {
+        cpu_set_t* nodeCpus = malloc(SN_REACTOR_MAX_NUMA_NODES * sizeof(cpu_set_t));
+        if (nodeCpus == NULL)
+        {
+            return;
+        }
+        
+        //node numbers may have gaps
+        int numNodes = 0;
+        for (int node = 0; node < SN_REACTOR_MAX_NUMA_NODES; node++)
+        {
+            if (readNumaNodeCpus(node, allowedCpus, &nodeCpus[numNodes]))
+            {
+                numNodes++;
+            }
+        }
+        
+        for (int i = 0; i < reactor->numShards && numNodes > 0; i++)
+        {
+            snReactorShard* shard = &reactor->shards[i];
+            shard->cpus = nodeCpus[i % numNodes];
+            shard->hasAffinity = 1;
+        }
+        
+        free(nodeCpus);
+    }
+}
+
+snReactor* snReactor_create(const snReactorSettings* settings)
+{
+    snReactorSettings defaultSettings;
+    if (settings == NULL)
+    {
+        memset(&defaultSettings, 0, sizeof(snReactorSettings));
+        settings = &defaultSettings;
+    }
+    
+    pthread_once(&currentShardKeyOnce, createCurrentShardKey);
+    
+    cpu_set_t allowedCpus;
+    CPU_ZERO(&allowedCpus);
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &allowedCpus) != 0)
+    {
+        CPU_ZERO(&allowedCpus);
+    }
+    const int numCpus = CPU_COUNT(&allowedCpus);
+    
+    snReactor* reactor = malloc(sizeof(snReactor));
+    if (reactor == NULL)
+    {
+        return NULL;
+    }
+    memset(reactor, 0, sizeof(snReactor));
+    
+    reactor->numShards = settings->numShards > 0 ? settings->numShards : (numCpus > 0 ? numCpus : 1);
+    reactor->placementPolicy = settings->placementPolicy;
+    reactor->moveCallback = settings->moveCallback;
+    reactor->callbackData = settings->callbackData;
+    
+    reactor->shards = malloc(reactor->numShards * sizeof(snReactorShard));
+    if (reactor->shards == NULL)
+    {
+        free(reactor);
+        return NULL;
+    }
+    memset(reactor->shards, 0, reactor->numShards * sizeof(snReactorShard));
+    
+    for (int i = 0; i < reactor->numShards; i++)
+    {
+        snReactorShard* shard = &reactor->shards[i];
+        snMpscQueue_init(&shard->commands);
+        shard->reactor = reactor;
+        shard->index = i;
+        shard->loop = snEventLoop_create();
+        if (shard->loop == NULL)
+        {
+            snReactor_delete(reactor);
+            return NULL;
+        }
+    }
+    
+    assignCpus(reactor, settings->affinity, &allowedCpus);
+    
+    for (int i = 0; i < reactor->numShards; i++)
+    {
+        snReactorShard* shard = &reactor->shards[i];
+        
+        //pinned from the start, so the memory the thread
+        //touches first is allocated close to its CPUs
+        pthread_attr_t attributes;
+        pthread_attr_init(&attributes);
+        if (shard->hasAffinity)
+        {
+            pthread_attr_setaffinity_np(&attributes, sizeof(cpu_set_t), &shard->cpus);
+        }
+        
+        shard->hasThread = pthread_create(&shard->thread, &attributes, runShard, shard) == 0;
+        pthread_attr_destroy(&attributes);
+        
+        if (!shard->hasThread)
+        {
+            snReactor_delete(reactor);
+            return NULL;
+        }
+    }
+    
+    return reactor;
+}
+
+void snReactor_delete(snReactor* reactor)
+{
+    if (reactor == NULL)
+    {
+        return;
+    }
+    
+    for (int i = 0; i < reactor->numShards; i++)
+    {
+        snReactorShard* shard = &reactor->shards[i];
+        if (shard->hasThread)
+        {
+            __atomic_store_n(&shard->isStopping, 1, __ATOMIC_RELEASE);
+            snEventLoop_wake(shard->loop);
+        }
+    }
+    
+    for (int i = 0; i < reactor->numShards; i++)
+    {
+        snReactorShard* shard = &reactor->shards[i];
+        if (shard->hasThread)
+        {
+            pthread_join(shard->thread, NULL);
+        }
+        
+        //drop work that never ran
+        snMpscNode* node = NULL;
+        while ((node = snMpscQueue_pop(&shard->commands)) != NULL)
+        {
+            free(node);
+        }
+        
+        snEventLoop_delete(shard->loop);
+    }
+    
+    free(reactor->shards);
+    free(reactor);
+}
+
+/**
+ * Picks a shard for a new websocket according to the placement policy.
+ */
+static int pickShard(snReactor* reactor)
+{
+    const int start = (int)(__atomic_fetch_add(&reactor->nextShard, 1, __ATOMIC_RELAXED) % reactor->numShards);
+    
+    if (reactor->placementPolicy != SN_PLACEMENT_LEAST_LOADED)
+    {
+        return start;
+    }
+    
+    //start the search at a different shard each time, so concurrent
+    //placements don't all pick the first of several equally loaded shards
+    int best = start;
+    int bestLoad = snReactor_getShardLoad(reactor, start);
+    for (int i = 1; i < reactor->numShards; i++)
+    {
+        const int index = (start + i) % reactor->numShards;
+        const int load = snReactor_getShardLoad(reactor, index);
+        if (load < bestLoad)
+        {
+            best = index;
+            bestLoad = load;
+        }
+    }
+    
+    return best;
+}
+
+snError snReactor_add(snReactor* reactor, snWebsocket* ws, int* shard)
+{
+    if (reactor == NULL || ws == NULL)
+    {
+        return SN_BAD_ARGS;
+    }
+    
+    const int index = pickShard(reactor);
+    if (shard != NULL)
+    {
+        *shard = index;
+    }
+    
+    return snReactor_addToShard(reactor, ws, index);
+}
+
+snError snReactor_addToShard(snReactor* reactor, snWebsocket* ws, int shard)
+{
+    if (reactor == NULL || ws == NULL || shard < 0 || shard >= reactor->numShards)
+    {
+        return SN_BAD_ARGS;
+    }
+    
+    if (snWebsocket_getState(ws) == SN_STATE_CLOSED)
+    {
+        return SN_WEBSOCKET_CONNECTION_IS_NOT_OPEN;
+    }
+    
+    snReactorCommand* command = newCommand(SN_REACTOR_ADD);
+    if (command == NULL)
+    {
+        return SN_OUT_OF_MEMORY;
+    }
+    command->ws = ws;
+    
+    addIncoming(&reactor->shards[shard], 1);
+    postCommand(&reactor->shards[shard], command);
+    
+    return SN_NO_ERROR;
+}
+
+snError snReactor_remove(snReactor* reactor, snWebsocket* ws)
+{
+    snReactorShard* shard = getCurrentShard(reactor);
+    if (shard == NULL || ws == NULL)
+    {
+        return SN_BAD_ARGS;
+    }
+    
+    snError e = snEventLoop_remove(shard->loop, ws);
+    if (e == SN_NO_ERROR)
+    {
+        updateLoad(shard);
+    }
+    
+    return e;
+}
+
+snError snReactor_move(snReactor* reactor, snWebsocket* ws, int shard)
+{
+    snReactorShard* currentShard = getCurrentShard(reactor);
+    if (currentShard == NULL || ws == NULL || shard < 0 || shard >= reactor->numShards || !isMovable(ws))
+    {
+        return SN_BAD_ARGS;
+    }
+    
+    if (shard == currentShard->index)
+    {
+        return SN_NO_ERROR;
+    }
+    
+    snReactorCommand* command = newCommand(SN_REACTOR_MOVE_OUT);
+    if (command == NULL)
+    {
+        return SN_OUT_OF_MEMORY;
+    }
+    command->ws = ws;
+    command->targetShard = shard;
+    
+    //this is likely called from a callback of the websocket, while the
+    //loop is polling it. the shard runs its commands once the loop
+    //returns, so there's no need to wake it.
+    snMpscQueue_push(&currentShard->commands, &command->node);
+    
+    return SN_NO_ERROR;
+}
+
+void snReactor_rebalance(snReactor* reactor)
+{
+    const int numShards = reactor->numShards;
+    int* excess = malloc(numShards * sizeof(int));
+    if (excess == NULL)
+    {
+        return;
+    }
+    
+    int totalLoad = 0;
+    for (int i = 0; i < numShards; i++)
+    {
+        excess[i] = snReactor_getShardLoad(reactor, i);
+        totalLoad += excess[i];
+    }
+    
+    //shards above the rounded up average give to shards
+    //below the rounded down average
+    const int maxLoad = (totalLoad + numShards - 1) / numShards;
+    const int minLoad = totalLoad / numShards;
+    for (int i = 0; i < numShards; i++)
+    {
+        excess[i] = excess[i] > maxLoad ? excess[i] - maxLoad :
+                    excess[i] < minLoad ? excess[i] - minLoad : 0;
+    }
+    
+    int giver = 0;
+    int taker = 0;
+    while (1)
+    {
+        while (giver < numShards && excess[giver] <= 0)
+        {
+            giver++;
+        }
+        while (taker < numShards && excess[taker] >= 0)
+        {
+            taker++;
+        }
+        if (giver == numShards || taker == numShards)
+        {
+            break;
+        }
+        
+        const int numWebsockets = excess[giver] < -excess[taker] ? excess[giver] : -excess[taker];
+        
+        snReactorCommand* command = newCommand(SN_REACTOR_SHED);
+        if (command == NULL)
+        {
+            break;
+        }
+        command->numWebsockets = numWebsockets;
+        command->targetShard = taker;
+        postCommand(&reactor->shards[giver], command);
+        
+        excess[giver] -= numWebsockets;
+        excess[taker] += numWebsockets;
+    }
+    
+    free(excess);
+}
+
+snError snReactor_call(snReactor* reactor, int shard, snReactorCallback callback, void* userData)
+{
+    if (reactor == NULL || callback == NULL || shard < 0 || shard >= reactor->numShards)
+    {
+        return SN_BAD_ARGS;
+    }
+    
+    snReactorCommand* command = newCommand(SN_REACTOR_CALL);
+    if (command == NULL)
+    {
+        return SN_OUT_OF_MEMORY;
+    }
+    command->callback = callback;
+    command->userData = userData;
+    
+    postCommand(&reactor->shards[shard], command);
+    
+    return SN_NO_ERROR;
+}
+
+int snReactor_getNumShards(snReactor* reactor)
+{
+    return reactor->numShards;
+}
+
+int snReactor_getShardLoad(snReactor* reactor, int shard)
+{
+    snReactorShard* s = &reactor->shards[shard];
+    return __atomic_load_n(&s->numIncoming, __ATOMIC_RELAXED) + __atomic_load_n(&s->numOpen, __ATOMIC_RELAXED);
+}
+
+int snReactor_getCurrentShard(snReactor* reactor)
+{
+    snReactorShard* shard = getCurrentShard(reactor);
+    return shard != NULL ? shard->index : -1;
+}
+
+#endif /* __linux__ */
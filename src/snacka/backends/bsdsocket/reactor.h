@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2013, Per Gantelius
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the copyright holders.
+ */
+
+#ifndef SN_REACTOR_H
+#define SN_REACTOR_H
+
+#include "../../websocket.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+    
+    /**
+     * Spreads websockets over a number of shards, each being a worker thread
+     * running its own \c snEventLoop. A websocket added to a reactor belongs to
+     * its shard: its callbacks are invoked on the shard's thread, and other
+     * threads must only touch it through \c snReactor_call and
+     * \c snWebsocket_postFrame. Websockets must use I/O callbacks
+     * supported by \c snEventLoop. Currently only available on Linux.
+     */
+    typedef struct snReactor snReactor;
+    
+    /**
+     * How \c snReactor_add picks a shard.
+     */
+    typedef enum snPlacementPolicy
+    {
+        /** Cycle through the shards. */
+        SN_PLACEMENT_ROUND_ROBIN = 0,
+        /** Pick the shard with the fewest websockets. */
+        SN_PLACEMENT_LEAST_LOADED
+    } snPlacementPolicy;
+    
+    /**
+     * Where the thread of each shard runs.
+     */
+    typedef enum snShardAffinity
+    {
+        /** Let the scheduler decide. */
+        SN_AFFINITY_NONE = 0,
+        /** Pin each shard to a CPU of its own, as far as there are CPUs. */
+        SN_AFFINITY_CPU,
+        /**
+         * Pin each shard to the CPUs of a NUMA node, spreading shards evenly
+         * across nodes. Falls back to \c SN_AFFINITY_NONE if the system
+         * doesn't describe its nodes.
+         */
+        SN_AFFINITY_NUMA_NODE
+    } snShardAffinity;
+    
+    /**
+     * Called on the thread of a shard when a websocket has been moved to it.
+     * @param userData Custom user data.
+     * @param ws The websocket.
+     * @param shard The index of the shard the websocket now belongs to.
+     */
+    typedef void (*snReactorMoveCallback)(void* userData, snWebsocket* ws, int shard);
+    
+    /**
+     * A function to run on the thread of a shard.
+     * @param userData Custom user data.
+     */
+    typedef void (*snReactorCallback)(void* userData);
+    
+    /**
+     * Reactor settings. Zero initialize for defaults.
+     */
+    typedef struct snReactorSettings
+    {
+        /** The number of shards. If 0, there is one per CPU the process may run on. */
+        int numShards;
+        /** */
+        snPlacementPolicy placementPolicy;
+        /** */
+        snShardAffinity affinity;
+        /** Ignored if NULL. */
+        snReactorMoveCallback moveCallback;
+        /** Passed to \c moveCallback. */
+        void* callbackData;
+    } snReactorSettings;
+    
+    /**
+     * Creates a reactor and starts the threads of its shards.
+     * @param settings The settings, or NULL for defaults.
+     * @return The new reactor or NULL on failure.
+     */
+    snReactor* snReactor_create(const snReactorSettings* settings);
+    
+    /**
+     * Stops the threads of a reactor and deletes it. Websockets
+     * in the reactor are not deleted. Must not be called from a shard.
+     * @param reactor The reactor to delete.
+     */
+    void snReactor_delete(snReactor* reactor);
+    
+    /**
+     * Hands a websocket over to a shard picked by the placement policy. Call
+     * this after \c snWebsocket_connect. Safe to call from any thread. If the
+     * shard fails to add the websocket, the websocket is disconnected.
+     * @param reactor The reactor.
+     * @param ws The websocket.
+     * @param shard Set to the index of the chosen shard. Ignored if NULL.
+     * @return An error code.
+     */
+    snError snReactor_add(snReactor* reactor, snWebsocket* ws, int* shard);
+    
+    /**
+     * Hands a websocket over to a given shard. Safe to call from any thread.
+     * @param reactor The reactor.
+     * @param ws The websocket.
+     * @param shard The index of the shard.
+     * @return An error code.
+     */
+    snError snReactor_addToShard(snReactor* reactor, snWebsocket* ws, int shard);
+    
+    /**
+     * Removes a websocket from its shard, after which it may be deleted.
+     * Must be called on the thread of the shard, e.g from the close callback.
+     * @param reactor The reactor.
+     * @param ws The websocket.
+     * @return An error code.
+     */
+    snError snReactor_remove(snReactor* reactor, snWebsocket* ws);
+    
+    /**
+     * Moves a websocket to another shard. Must be called on the thread of
+     * the shard the websocket belongs to, e.g from one of its callbacks. The
+     * move happens once the shard is done polling, so the websocket must not
+     * be removed or deleted before that, and the move callback is invoked
+     * on the new shard once it has taken over the websocket. Websockets
+     * whose file descriptor is shared, reported as \c SN_IO_SHARED, e.g
+     * sockets using the io_uring instance of the shard, can't be moved.
+     * @param reactor The reactor.
+     * @param ws The websocket.
+     * @param shard The index of the shard to move to.
+     * @return An error code.
+     */
+    snError snReactor_move(snReactor* reactor, snWebsocket* ws, int shard);
+    
+    /**
+     * Evens out the number of websockets per shard by having the busiest
+     * shards move open websockets without queued output to the least busy
+     * ones. Safe to call from any thread. The moves happen asynchronously.
+     * @param reactor The reactor.
+     */
+    void snReactor_rebalance(snReactor* reactor);
+    
+    /**
+     * Runs a function on the thread of a shard, in the order of the calls.
+     * Safe to call from any thread.
+     * @param reactor The reactor.
+     * @param shard The index of the shard.
+     * @param callback The function to run.
+     * @param userData Passed to \c callback.
+     * @return An error code.
+     */
+    snError snReactor_call(snReactor* reactor, int shard, snReactorCallback callback, void* userData);
+    
+    /**
+     * @param reactor The reactor.
+     * @return The number of shards.
+     */
+    int snReactor_getNumShards(snReactor* reactor);
+    
+    /**
+     * Gets the number of websockets a shard has or is about to be handed.
+     * Websockets that have closed don't count, even if they haven't been
+     * removed.
+     * @param reactor The reactor.
+     * @param shard The index of the shard.
+     * @return The number of websockets.
+     */
+    int snReactor_getShardLoad(snReactor* reactor, int shard);
+    
+    /**
+     * @param reactor The reactor.
+     * @return The index of the shard running on the calling
+     * thread, or -1 if called from another thread.
+     */
+    int snReactor_getCurrentShard(snReactor* reactor);
+    
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /*SN_REACTOR_H*/
@@ -0,0 +1,492 @@
+/*
+ * Copyright (c) 2013, Per Gantelius
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the copyright holders.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+
+#include "resolver.h"
+
+/** The maximum number of hosts in the resolve cache. */
+#define STF_RESOLVE_CACHE_SIZE 64
+
+/** How long to keep found addresses by default. */
+#define STF_DEFAULT_RESOLVE_TTL 60.0 //in seconds
+
+/** How long to remember hosts that don't exist by default. */
+#define STF_DEFAULT_NEGATIVE_RESOLVE_TTL 5.0 //in seconds
+
+/**
+ * Shared by the thread doing the lookup, the sockets waiting for it and
+ * the resolve cache, and freed by whichever releases it last.
+ */
+struct stfResolveRequest
+{
+    char* host;
+    int port;
+    struct addrinfo* result;
+    int error;
+    int isDone;
+    int refCount;
+};
+
+/** The result of looking up a host and port. */
+typedef struct stfResolveCacheEntry
+{
+    char* host;
+    int port;
+    /** The addresses, or NULL if the host doesn't exist. */
+    struct addrinfo* addresses;
+    /** When to look up the host again. */
+    double expiryTime;
+    /** The lookup in progress, or NULL. */
+    stfResolveRequest* pendingRequest;
+} stfResolveCacheEntry;
+
+static pthread_mutex_t cacheMutex = PTHREAD_MUTEX_INITIALIZER;
+static stfResolveCacheEntry cache[STF_RESOLVE_CACHE_SIZE];
+static int numCacheEntries = 0;
+static double cacheTimeToLive = STF_DEFAULT_RESOLVE_TTL;
+static double cacheNegativeTimeToLive = STF_DEFAULT_NEGATIVE_RESOLVE_TTL;
+
+static double currentTime(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1.0e9;
+}
+
+static void getAddressHints(struct addrinfo* hints)
+{
+    memset(hints, 0, sizeof(struct addrinfo));
+    hints->ai_family = AF_UNSPEC;
+    hints->ai_socktype = SOCK_STREAM;
+    hints->ai_protocol = IPPROTO_TCP;
+}
+
+/**
+ * Copies a list of addresses into a single allocation, so the copy
+ * can be handed out and freed independently of the original.
+ */
+static struct addrinfo* copyAddresses(const struct addrinfo* addresses)
+{
+    int numAddresses = 0;
+    for (const struct addrinfo* p = addresses; p; p = p->ai_next)
+    {
+        numAddresses++;
+    }
+    
+    if (numAddresses == 0)
+    {
+        return NULL;
+    }
+    
+    struct addrinfo* copy = malloc(numAddresses * (sizeof(struct addrinfo) + sizeof(struct sockaddr_storage)));
+    if (copy == NULL)
+    {
+        return NULL;
+    }
+    
+    struct sockaddr_storage* socketAddresses = (struct sockaddr_storage*)(copy + numAddresses);
+    int i = 0;
+    for (const struct addrinfo* p = addresses; p; p = p->ai_next, i++)
+    {
+        copy[i] = *p;
+        copy[i].ai_canonname = NULL;
+        copy[i].ai_addr = (struct sockaddr*)&socketAddresses[i];
+        copy[i].ai_next = i + 1 < numAddresses ? &copy[i + 1] : NULL;
+        memcpy(&socketAddresses[i], p->ai_addr, p->ai_addrlen);
+    }
+    
+    return copy;
+}
+
+/**
+ * Returns non-zero if a lookup error means the host doesn't
+ * exist, as opposed to a temporary failure.
+ */
+static int isNonexistentHostError(int error)
+{
+#ifdef EAI_NODATA
+    if (error == EAI_NODATA)
+    {
+        return 1;
+    }
+#endif
+    return error == EAI_NONAME;
+}
+
+static void releaseRequest(stfResolveRequest* r)
+{
+    if (__atomic_sub_fetch(&r->refCount, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        if (r->result)
+        {
+            freeaddrinfo(r->result);
+        }
+        free(r->host);
+        free(r);
+    }
+}
+
+/** Must be called with \c cacheMutex locked. */
+static int findEntry(const char* host, int port)
+{
+    for (int i = 0; i < numCacheEntries; i++)
+    {
+        if (cache[i].port == port && strcmp(cache[i].host, host) == 0)
+        {
+            return i;
+        }
+    }
+    
+    return -1;
+}
+
+/** Must be called with \c cacheMutex locked. */
+static void removeEntry(int index)
+{
+    stfResolveCacheEntry* entry = &cache[index];
+    
+    free(entry->host);
+    free(entry->addresses);
+    if (entry->pendingRequest)
+    {
+        //the lookup thread won't find the entry when it's done
+        releaseRequest(entry->pendingRequest);
+    }
+    
+    *entry = cache[--numCacheEntries];
+}
+
+/**
+ * Adds an empty entry, making room by dropping the entry that expires
+ * first if the cache is full. Must be called with \c cacheMutex locked.
+ */
+static stfResolveCacheEntry* addEntry(const char* host, int port)
+{
+    if (numCacheEntries == STF_RESOLVE_CACHE_SIZE)
+    {
+        int first = -1;
+        for (int i = 0; i < numCacheEntries; i++)
+        {
+            if (cache[i].pendingRequest == NULL &&
+                (first < 0 || cache[i].expiryTime < cache[first].expiryTime))
+            {
+                first = i;
+            }
+        }
+        
+        if (first < 0)
+        {
+            return NULL;
+        }
+        removeEntry(first);
+    }
+    
+    char* hostCopy = strdup(host);
+    if (hostCopy == NULL)
+    {
+        return NULL;
+    }
+    
+    stfResolveCacheEntry* entry = &cache[numCacheEntries++];
+    memset(entry, 0, sizeof(stfResolveCacheEntry));
+    entry->host = hostCopy;
+    entry->port = port;
+    
+    return entry;
+}
+
+/** Caches the result of a lookup. Must be called with \c cacheMutex locked. */
+static void storeResult(const char* host, int port, const struct addrinfo* addresses, int error)
+{
+    //temporary failures are not cached
+    if (error != 0 && !isNonexistentHostError(error))
+    {
+        return;
+    }
+    
+    const double ttl = error == 0 ? cacheTimeToLive : cacheNegativeTimeToLive;
+    const int index = findEntry(host, port);
+    stfResolveCacheEntry* entry = index >= 0 ? &cache[index] : NULL;
+    
+    if (ttl <= 0.0)
+    {
+        if (entry && entry->pendingRequest == NULL)
+        {
+            removeEntry(index);
+        }
+        return;
+    }
+    
+    if (entry == NULL)
+    {
+        entry = addEntry(host, port);
+        if (entry == NULL)
+        {
+            return;
+        }
+    }
+    
+    free(entry->addresses);
+    entry->addresses = error == 0 ? copyAddresses(addresses) : NULL;
+    entry->expiryTime = currentTime() + ttl;
+}
+
+static void* resolveThread(void* data)
+{
+    stfResolveRequest* r = (stfResolveRequest*)data;
+    
+    struct addrinfo hints;
+    getAddressHints(&hints);
+    char service[16];
+    sprintf(service, "%d", r->port);
+    r->error = getaddrinfo(r->host, service, &hints, &r->result);
+    
+    pthread_mutex_lock(&cacheMutex);
+    const int index = findEntry(r->host, r->port);
+    if (index >= 0 && cache[index].pendingRequest == r)
+    {
+        cache[index].pendingRequest = NULL;
+        releaseRequest(r);
+        
+        if (r->error == 0 || isNonexistentHostError(r->error))
+        {
+            storeResult(r->host, r->port, r->result, r->error);
+        }
+        else
+        {
+            //temporary failure, try again next time
+            removeEntry(index);
+        }
+    }
+    pthread_mutex_unlock(&cacheMutex);
+    
+    __atomic_store_n(&r->isDone, 1, __ATOMIC_RELEASE);
+    releaseRequest(r);
+    
+    return NULL;
+}
+
+/**
+ * Starts looking up a host on a separate thread, since getaddrinfo
+ * blocks. Must be called with \c cacheMutex locked.
+ */
+static stfResolveRequest* startRequest(const char* host, int port)
+{
+    stfResolveRequest* r = malloc(sizeof(stfResolveRequest));
+    if (r == NULL)
+    {
+        return NULL;
+    }
+    memset(r, 0, sizeof(stfResolveRequest));
+    r->host = strdup(host);
+    r->port = port;
+    //one reference for the caller and one for the thread
+    r->refCount = 2;
+    
+    if (r->host == NULL)
+    {
+        free(r);
+        return NULL;
+    }
+    
+    //let lookups of the same host join this one
+    stfResolveCacheEntry* entry = addEntry(host, port);
+    if (entry)
+    {
+        entry->pendingRequest = r;
+        r->refCount++;
+    }
+    
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    
+    pthread_t thread;
+    const int threadResult = pthread_create(&thread, &attributes, resolveThread, r);
+    pthread_attr_destroy(&attributes);
+    
+    if (threadResult != 0)
+    {
+        if (entry)
+        {
+            removeEntry(findEntry(host, port));
+        }
+        free(r->host);
+        free(r);
+        return NULL;
+    }
+    
+    return r;
+}
+
+int stfResolver_lookup(const char* host,
+                       int port,
+                       int shouldBlock,
+                       struct addrinfo** addresses,
+                       stfResolveRequest** request)
+{
+    *addresses = NULL;
+    *request = NULL;
+    
+    struct addrinfo hints;
+    getAddressHints(&hints);
+    char service[16];
+    sprintf(service, "%d", port);
+    struct addrinfo* result;
+    
+    //numeric addresses don't need a lookup
+    hints.ai_flags = AI_NUMERICHOST;
+    if (getaddrinfo(host, service, &hints, &result) == 0)
+    {
+        *addresses = copyAddresses(result);
+        freeaddrinfo(result);
+        return *addresses != NULL;
+    }
+    hints.ai_flags = 0;
+    
+    pthread_mutex_lock(&cacheMutex);
+    
+    const int index = findEntry(host, port);
+    if (index >= 0)
+    {
+        stfResolveCacheEntry* entry = &cache[index];
+        
+        if (entry->pendingRequest && !shouldBlock)
+        {
+            //join the lookup in progress
+            __atomic_add_fetch(&entry->pendingRequest->refCount, 1, __ATOMIC_ACQ_REL);
+            *request = entry->pendingRequest;
+            pthread_mutex_unlock(&cacheMutex);
+            return 1;
+        }
+        
+        if (entry->pendingRequest == NULL)
+        {
+            if (currentTime() < entry->expiryTime)
+            {
+                const int isFound = entry->addresses != NULL;
+                if (isFound)
+                {
+                    *addresses = copyAddresses(entry->addresses);
+                }
+                pthread_mutex_unlock(&cacheMutex);
+                return *addresses != NULL;
+            }
+            
+            removeEntry(index);
+        }
+    }
+    
+    if (!shouldBlock)
+    {
+        *request = startRequest(host, port);
+        pthread_mutex_unlock(&cacheMutex);
+        return *request != NULL;
+    }
+    
+    pthread_mutex_unlock(&cacheMutex);
+    
+    const int error = getaddrinfo(host, service, &hints, &result);
+    
+    pthread_mutex_lock(&cacheMutex);
+    storeResult(host, port, error == 0 ? result : NULL, error);
+    pthread_mutex_unlock(&cacheMutex);
+    
+    if (error != 0)
+    {
+        return 0;
+    }
+    
+    *addresses = copyAddresses(result);
+    freeaddrinfo(result);
+    
+    return *addresses != NULL;
+}
+
+int stfResolver_poll(stfResolveRequest* request, struct addrinfo** addresses)
+{
+    *addresses = NULL;
+    
+    if (!__atomic_load_n(&request->isDone, __ATOMIC_ACQUIRE))
+    {
+        return 0;
+    }
+    
+    if (request->error == 0)
+    {
+        *addresses = copyAddresses(request->result);
+    }
+    releaseRequest(request);
+    
+    return 1;
+}
+
+void stfResolver_cancel(stfResolveRequest* request)
+{
+    releaseRequest(request);
+}
+
+void stfResolver_freeAddresses(struct addrinfo* addresses)
+{
+    free(addresses);
+}
+
+void stfResolver_setTimeToLive(double timeToLive, double negativeTimeToLive)
+{
+    pthread_mutex_lock(&cacheMutex);
+    cacheTimeToLive = timeToLive;
+    cacheNegativeTimeToLive = negativeTimeToLive;
+    pthread_mutex_unlock(&cacheMutex);
+}
+
+void stfResolver_invalidate(const char* host)
+{
+    pthread_mutex_lock(&cacheMutex);
+    
+    //go backwards, since removing an entry moves the last one into its place
+    for (int i = numCacheEntries - 1; i >= 0; i--)
+    {
+        if (host == NULL || strcmp(cache[i].host, host) == 0)
+        {
+            removeEntry(i);
+        }
+    }
+    
+    pthread_mutex_unlock(&cacheMutex);
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2013, Per Gantelius
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the copyright holders.
+ */
+
+#ifndef STF_RESOLVER_H
+#define STF_RESOLVER_H
+
+/*! \file */
+
+#include <netdb.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+    
+    /**
+     * A host name lookup running on a separate thread. Lookups
+     * of the same host and port that overlap share a request.
+     */
+    typedef struct stfResolveRequest stfResolveRequest;
+    
+    /**
+     * Looks up the addresses of a host. Numeric hosts and hosts in the
+     * resolve cache are answered right away. Otherwise the lookup either
+     * blocks or is started on a separate thread, to be checked on with
+     * \c stfResolver_poll.
+     * @param host The host to look up.
+     * @param port The port to connect to.
+     * @param shouldBlock Non-zero to wait for the lookup instead of starting a request.
+     * @param addresses Set to the addresses if they are known right away, otherwise NULL.
+     * Free them with \c stfResolver_freeAddresses.
+     * @param request Set to the started request, or NULL.
+     * @return 1 on success, 0 if the lookup failed or the host is known not to exist.
+     */
+    int stfResolver_lookup(const char* host,
+                           int port,
+                           int shouldBlock,
+                           struct addrinfo** addresses,
+                           stfResolveRequest** request);
+    
+    /**
+     * Checks if a lookup started by \c stfResolver_lookup is done.
+     * The request is released once it is done.
+     * @param request The request.
+     * @param addresses Set to the addresses if the lookup succeeded, otherwise NULL.
+     * Free them with \c stfResolver_freeAddresses.
+     * @return 1 if the lookup is done, 0 if it's still in progress.
+     */
+    int stfResolver_poll(stfResolveRequest* request, struct addrinfo** addresses);
+    
+    /**
+     * Releases a request that is no longer needed. The lookup
+     * itself finishes in the background.
+     * @param request The request.
+     */
+    void stfResolver_cancel(stfResolveRequest* request);
+    
+    /**
+     * Frees addresses returned by \c stfResolver_lookup or \c stfResolver_poll.
+     * @param addresses The addresses to free. Can be NULL.
+     */
+    void stfResolver_freeAddresses(struct addrinfo* addresses);
+    
+    /**
+     * Sets how long lookup results stay in the resolve cache, which is
+     * shared by all sockets. Defaults to 60 seconds for hosts that were
+     * found and 5 seconds for hosts that don't exist.
+     * @param timeToLive Seconds to keep found addresses. 0 disables caching them.
+     * @param negativeTimeToLive Seconds to remember that a host doesn't exist.
+     * 0 disables negative caching.
+     */
+    void stfResolver_setTimeToLive(double timeToLive, double negativeTimeToLive);
+    
+    /**
+     * Removes a host from the resolve cache, e.g after failing
+     * to connect to any of its cached addresses.
+     * @param host The host to remove, or NULL to empty the cache.
+     */
+    void stfResolver_invalidate(const char* host);
+    
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /*STF_RESOLVER_H*/
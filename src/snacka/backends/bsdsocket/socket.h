@@ -32,6 +32,8 @@
 
 /*! \file */
 
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #ifdef __cplusplus
 extern "C"
@@ -55,7 +57,8 @@ extern "C"
     void stfSocket_delete(stfSocket* socket);
     
     /** 
-     * Connects to a socket at a given host and port. 
+     * Connects to a socket at a given host and port. The addresses of
+     * the host are raced like in \c stfSocket_pollConnect.
      * @param s The socket to connect.
      * @param host The host to connect to.
      * @param port The port to connect to.
@@ -67,19 +70,135 @@ extern "C"
     int stfSocket_connect(stfSocket* s, const char* host, int port,
                           stfSocketCancelCallback cancelCallback, void* callbackData);
     
+    /**
+     * Starts connecting to a host without blocking. Host names are looked
+     * up on a separate thread. Call \c stfSocket_pollConnect to drive the
+     * connection attempt.
+     * @param s The socket to connect.
+     * @param host The host to connect to.
+     * @param port The port to connect to.
+     * @return 1 if the connection attempt was started, 0 on failure.
+     */
+    int stfSocket_startConnect(stfSocket* s, const char* host, int port);
+    
+    /**
+     * Checks on a connection attempt started by \c stfSocket_startConnect.
+     * The addresses of the host are tried in parallel, alternating between
+     * address families, with each attempt starting 250 ms after the previous
+     * one or as soon as it fails. The first to connect wins. Never blocks.
+     * @param s The socket being connected.
+     * @param isConnected Set to non-zero once the socket is connected.
+     * @return 1 if connected or still connecting, 0 if the connection attempt failed.
+     */
+    int stfSocket_pollConnect(stfSocket* s, int* isConnected);
+    
     /** */
     void stfSocket_disconnect(stfSocket* socket);
     
     /** */
     int stfSocket_isConnected(stfSocket* socket);
     
+    /**
+     * Gets the file descriptor of a socket. While several connection attempts
+     * are racing, this is the file descriptor of the most recent one, and it
+     * may change with each call to \c stfSocket_pollConnect.
+     * @param s The socket.
+     * @return The file descriptor, or -1 if the socket is not connected.
+     */
+    int stfSocket_getFileDescriptor(stfSocket* s);
+    
+    /**
+     * Gets how long to wait before calling \c stfSocket_pollConnect again,
+     * to look for a finished host name lookup, give up on an address or
+     * race another one.
+     * @param s The socket.
+     * @return The timeout in milliseconds, 0 to poll right away, or -1
+     * if the socket is not connecting.
+     */
+    int stfSocket_getConnectTimeout(stfSocket* s);
+    
+    /**
+     * Gets the address a socket connected to, i.e the one that
+     * won the race between the addresses of the host.
+     * @param s The socket.
+     * @param addressLength Set to the size of the address.
+     * @return The address, or NULL if the socket is not connected.
+     */
+    const struct sockaddr* stfSocket_getPeerAddress(stfSocket* s, socklen_t* addressLength);
+    
+    /**
+     * Gets how long it took to connect, including the host name lookup.
+     * @param s The socket.
+     * @return The time in seconds.
+     */
+    double stfSocket_getConnectDuration(stfSocket* s);
+    
     /** */
     int stfSocket_sendData(stfSocket* socket, const char* data, int numBytes, int* numSentBytes,
                            stfSocketCancelCallback cancelCallback, void* callbackData);
 
+    /**
+     * Sends as much of a number of buffers as the socket accepts without blocking.
+     * @param s The socket to send to.
+     * @param buffers The buffers to send.
+     * @param numBuffers The number of buffers.
+     * @param numSentBytes The total number of bytes sent, possibly 0.
+     * @return 1 on success, 0 on failure.
+     */
+    int stfSocket_trySendData(stfSocket* s, const struct iovec* buffers, int numBuffers, int* numSentBytes);
+
     /** */    
     int stfSocket_receiveData(stfSocket* s, char* data, int maxNumBytes, int* numBytesReceived);
     
+    /**
+     * Blocks until the socket has data to read, or can be written to if
+     * requested, or until a timeout expires. While connecting, waits until
+     * \c stfSocket_pollConnect should be called again.
+     * @param s The socket.
+     * @param shouldWaitForWrite Non-zero to also wake up when the socket is writable.
+     * @param timeoutMs The maximum time to wait in milliseconds, or -1 to wait indefinitely.
+     * @return 1 on success, 0 on failure.
+     */
+    int stfSocket_wait(stfSocket* s, int shouldWaitForWrite, int timeoutMs);
+    
+    /**
+     * Gets a file descriptor that becomes readable when \c stfSocket_wake is
+     * called, creating it on first use. Must be called from the thread
+     * waiting on the socket. Stays the same until the socket is deleted.
+     * @param s The socket.
+     * @return The file descriptor, or -1 if it could not be created.
+     */
+    int stfSocket_getWakeFileDescriptor(stfSocket* s);
+    
+    /**
+     * Has \c stfSocket_wake signal a descriptor owned by the caller instead of
+     * the one returned by \c stfSocket_getWakeFileDescriptor, so that many
+     * sockets can share one, e.g the wake descriptor of an event loop. The
+     * caller then has to find out which sockets were woken. Must be called
+     * from the thread waiting on the socket.
+     * @param s The socket.
+     * @param fileDescriptor An eventfd or the write end of a pipe,
+     * or -1 to go back to the socket's own descriptor.
+     */
+    void stfSocket_setExternalWakeFileDescriptor(stfSocket* s, int fileDescriptor);
+    
+    /**
+     * Makes \c stfSocket_wait return early and signals the wake file
+     * descriptor, once until \c stfSocket_clearWake is called. Wakes that
+     * happen before the descriptor is created are remembered. Safe to call
+     * from any thread.
+     * @param s The socket.
+     */
+    void stfSocket_wake(stfSocket* s);
+    
+    /**
+     * Acknowledges calls to \c stfSocket_wake. Must be called from the
+     * thread waiting on the socket, before handling what the wake was for.
+     * @param s The socket.
+     * @return Non-zero if the socket had been woken.
+     */
+    int stfSocket_clearWake(stfSocket* s);
+    
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
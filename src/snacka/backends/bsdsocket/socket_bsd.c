@@ -28,24 +28,79 @@
  * either expressed or implied, of the copyright holders.
  */
 
+#define _DEFAULT_SOURCE
+
 #include <assert.h>
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <sys/poll.h>
+#include <sys/select.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/tcp.h>
 #include <string.h>
 #include <time.h>
 #include <stdarg.h>
 #include <unistd.h>
 #include <netdb.h>
+#include <poll.h>
+#include <stdint.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 
 #include "socket.h"
+#include "resolver.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 16
+#endif
+
+/** Give up on an address if connecting to it takes longer than this. */
+#define STF_CONNECT_TIMEOUT 3.0 //in seconds
+
+/**
+ * How long to wait for a connection attempt before racing it against
+ * the next address, as recommended by RFC 8305.
+ */
+#define STF_CONNECTION_ATTEMPT_DELAY 0.25 //in seconds
+
+/** The maximum number of simultaneous connection attempts. */
+#define STF_MAX_CONNECTION_ATTEMPTS 4
+
+/** How often to check if a host name lookup has finished. */
+#define STF_RESOLVE_CHECK_INTERVAL 1 //in milliseconds
+
+/**
+ * How often to check on earlier connection attempts while racing, since
+ * only the descriptor of the most recent one is handed out for waiting.
+ */
+#define STF_ATTEMPT_CHECK_INTERVAL 10 //in milliseconds
+
+/** The state of an asynchronous connection attempt. */
+typedef enum stfConnectState
+{
+    STF_CONNECT_IDLE = 0,
+    STF_CONNECT_RESOLVING,
+    STF_CONNECT_CONNECTING,
+    STF_CONNECT_CONNECTED,
+    STF_CONNECT_FAILED
+} stfConnectState;
+
+/** A connection attempt to one of the addresses of a host. */
+typedef struct stfConnectionAttempt
+{
+    int fileDescriptor;
+    struct addrinfo* address;
+    /** When to give up on this attempt. */
+    double deadline;
+} stfConnectionAttempt;
 
 struct stfSocket
 {
@@ -53,6 +108,45 @@ struct stfSocket
     char* host;
     int port;
     int logErrors;
+    stfConnectState connectState;
+    /** A pending host name lookup, or NULL. */
+    stfResolveRequest* resolveRequest;
+    /** The resolved addresses. */
+    struct addrinfo* addresses;
+    /** The resolved addresses in the order to try them. */
+    struct addrinfo** sortedAddresses;
+    /** The number of addresses in \c sortedAddresses. */
+    int numAddresses;
+    /** The index in \c sortedAddresses of the next address to try. */
+    int nextAddress;
+    /** Connection attempts in progress. */
+    stfConnectionAttempt attempts[STF_MAX_CONNECTION_ATTEMPTS];
+    /** The number of attempts in \c attempts. */
+    int numAttempts;
+    /** When to start an attempt on the next address. */
+    double nextAttemptTime;
+    /** When connecting started. */
+    double connectStartTime;
+    /** How long it took to connect, in seconds. */
+    double connectDuration;
+    /** The address of the connected peer. */
+    struct sockaddr_storage peerAddress;
+    /** The size of \c peerAddress, or 0 if not connected. */
+    socklen_t peerAddressLength;
+    /** Readable after \c stfSocket_wake, or -1 if not created yet. */
+    int wakeFileDescriptor;
+    /**
+     * The end of the wake pipe to write to, or -1. The same as
+     * \c wakeFileDescriptor where eventfd is available.
+     */
+    int wakeWriteFileDescriptor;
+    /**
+     * Signalled instead of the socket's own wake descriptor if not -1,
+     * e.g the wake descriptor of an event loop. Not owned by the socket.
+     */
+    int externalWakeFileDescriptor;
+    /** Non-zero if woken since the last \c stfSocket_clearWake. */
+    int isWakePending;
 };
 
 #ifdef DEBUG
@@ -197,6 +291,9 @@ stfSocket* stfSocket_new()
     memset(newSocket, 0, sizeof(stfSocket));
     newSocket->logErrors = 1;
     newSocket->fileDescriptor = -1;
+    newSocket->wakeFileDescriptor = -1;
+    newSocket->wakeWriteFileDescriptor = -1;
+    newSocket->externalWakeFileDescriptor = -1;
     return newSocket;
 }
 
@@ -210,140 +307,399 @@ void stfSocket_delete(stfSocket* socket)
         {
             free(socket->host);
         }
+        
+        if (socket->wakeFileDescriptor != -1)
+        {
+            close(socket->wakeFileDescriptor);
+        }
+        if (socket->wakeWriteFileDescriptor != socket->wakeFileDescriptor)
+        {
+            close(socket->wakeWriteFileDescriptor);
+        }
         memset(socket, 0, sizeof(stfSocket));
         free(socket);
     }
 }
 
-int stfSocket_connect(stfSocket* s,
-                      const char* host,
-                      int port,
-                      stfSocketCancelCallback cancelCallback,
-                      void* callbackData)
+static double currentTime(void)
 {
-    errno = 0;
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1.0e9;
+}
+
+/**
+ * Sorts the resolved addresses so that address families alternate,
+ * starting with the family of the first address (RFC 8305 section 4).
+ */
+static int sortAddresses(stfSocket* s, struct addrinfo* addresses)
+{
+    int numAddresses = 0;
+    for (struct addrinfo* p = addresses; p; p = p->ai_next)
+    {
+        numAddresses++;
+    }
     
-    if (s->fileDescriptor != -1)
+    s->addresses = addresses;
+    s->sortedAddresses = malloc(numAddresses * sizeof(struct addrinfo*));
+    if (s->sortedAddresses == NULL)
     {
-        //shut down existing connection
-        stfSocket_disconnect(s);
+        return 0;
+    }
+    
+    struct addrinfo* preferred = addresses;
+    struct addrinfo* other = addresses;
+    int n = 0;
+    while (n < numAddresses)
+    {
+        while (preferred && preferred->ai_family != addresses->ai_family)
+        {
+            preferred = preferred->ai_next;
+        }
+        if (preferred)
+        {
+            s->sortedAddresses[n++] = preferred;
+            preferred = preferred->ai_next;
+        }
+        
+        while (other && other->ai_family == addresses->ai_family)
+        {
+            other = other->ai_next;
+        }
+        if (other)
+        {
+            s->sortedAddresses[n++] = other;
+            other = other->ai_next;
+        }
     }
     
-    struct addrinfo* addrinfoResult;
-    struct addrinfo hints;
-    memset(&hints, 0, sizeof(struct addrinfo));
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_protocol = IPPROTO_TCP;
-    char service[256];
-    sprintf(service, "%d", port);
+    s->numAddresses = numAddresses;
+    s->nextAddress = 0;
     
-    //TODO: this call is blocking...
-    int error = getaddrinfo(host, service, &hints, &addrinfoResult);
-    if (error != 0)
+    return 1;
+}
+
+static void closeAttempt(stfSocket* s, int index)
+{
+    close(s->attempts[index].fileDescriptor);
+    s->attempts[index] = s->attempts[--s->numAttempts];
+}
+
+static void closeAllAttempts(stfSocket* s)
+{
+    while (s->numAttempts > 0)
     {
-        return 0;
+        closeAttempt(s, s->numAttempts - 1);
     }
+}
+
+/**
+ * Makes a connection attempt the connected socket and closes the others.
+ */
+static void finishAttempt(stfSocket* s, int index)
+{
+    stfConnectionAttempt winner = s->attempts[index];
+    s->attempts[index] = s->attempts[--s->numAttempts];
+    closeAllAttempts(s);
     
-    // loop through all the results and connect to the first we can
-    for(struct addrinfo* p = addrinfoResult; p != NULL; p = p->ai_next)
+    s->fileDescriptor = winner.fileDescriptor;
+    s->connectState = STF_CONNECT_CONNECTED;
+    s->connectDuration = currentTime() - s->connectStartTime;
+    memcpy(&s->peerAddress, winner.address->ai_addr, winner.address->ai_addrlen);
+    s->peerAddressLength = winner.address->ai_addrlen;
+}
+
+/**
+ * Starts a non-blocking connect to the next address that accepts one.
+ */
+static void startNextAttempt(stfSocket* s)
+{
+    const double now = currentTime();
+    
+    while (s->nextAddress < s->numAddresses &&
+           s->numAttempts < STF_MAX_CONNECTION_ATTEMPTS)
     {
-        int connected = 0;
+        struct addrinfo* p = s->sortedAddresses[s->nextAddress++];
         
-        s->fileDescriptor = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
-        if (s->fileDescriptor == -1)
+        const int fileDescriptor = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+        if (fileDescriptor == -1)
         {
-            //printf("client: socket, errno %d\n", errno);
             continue;
         }
         
         //set socket to non-blocking
-        int flags = fcntl(s->fileDescriptor, F_GETFL, 0);
-        fcntl(s->fileDescriptor, F_SETFL, flags | O_NONBLOCK);
+        int flags = fcntl(fileDescriptor, F_GETFL, 0);
+        fcntl(fileDescriptor, F_SETFL, flags | O_NONBLOCK);
         
-        //attempt async connect, regularly
-        //invoking cancelCallback to see if we should
-        //abort the connection attempt
-        const float timeout = 3.0f;
-        float t = 0.0f;
-        float dt = 0.01f;
+        stfConnectionAttempt* attempt = &s->attempts[s->numAttempts++];
+        attempt->fileDescriptor = fileDescriptor;
+        attempt->address = p;
+        attempt->deadline = now + STF_CONNECT_TIMEOUT;
         
-        /*const int connectResult = */connect(s->fileDescriptor, p->ai_addr, p->ai_addrlen);
+        if (connect(fileDescriptor, p->ai_addr, p->ai_addrlen) == 0)
+        {
+            finishAttempt(s, s->numAttempts - 1);
+            return;
+        }
         
-        while (t < timeout)
+        if (errno == EINPROGRESS)
         {
-            if (cancelCallback)
-            {
-                if (cancelCallback(callbackData) == 0)
-                {
-                    //caller requested timeout
-                    stfSocket_disconnect(s);
-                    return 0;
-                }
-            }
-            
-            struct fd_set fdset;
-            FD_ZERO(&fdset);
-            FD_SET(s->fileDescriptor, &fdset);
-            assert(FD_ISSET(s->fileDescriptor, &fdset));
-            struct timeval timeoutStruct = { 0, 1000000 * dt };
-            int selRes = select(s->fileDescriptor + 1, NULL, &fdset, NULL, &timeoutStruct);
-            
-            assert(selRes >= 0);
+            s->nextAttemptTime = now + STF_CONNECTION_ATTEMPT_DELAY;
+            return;
+        }
+        
+        closeAttempt(s, s->numAttempts - 1);
+    }
+    
+    if (s->numAttempts == 0)
+    {
+        s->connectState = STF_CONNECT_FAILED;
+    }
+}
+
+/**
+ * Starts connecting to resolved addresses.
+ */
+static void startConnecting(stfSocket* s, struct addrinfo* addresses)
+{
+    if (!sortAddresses(s, addresses))
+    {
+        s->connectState = STF_CONNECT_FAILED;
+        return;
+    }
+    
+    s->connectState = STF_CONNECT_CONNECTING;
+    startNextAttempt(s);
+}
+
+/**
+ * Checks which connection attempts have completed, waiting up to a given
+ * time for one of them. The first attempt to succeed wins. A new attempt
+ * is started when one fails or the current one takes too long.
+ */
+static void checkConnection(stfSocket* s, int timeoutMs)
+{
+    struct pollfd pfds[STF_MAX_CONNECTION_ATTEMPTS];
+    for (int i = 0; i < s->numAttempts; i++)
+    {
+        pfds[i].fd = s->attempts[i].fileDescriptor;
+        pfds[i].events = POLLOUT;
+        pfds[i].revents = 0;
+    }
+    
+    const int numAttempts = s->numAttempts;
+    const int result = poll(pfds, numAttempts, timeoutMs);
+    
+    if (result < 0)
+    {
+        if (errno != EINTR)
+        {
+            closeAllAttempts(s);
+            s->connectState = STF_CONNECT_FAILED;
+        }
+        return;
+    }
+    
+    const double now = currentTime();
+    int hasFailedAttempt = 0;
+    
+    //go backwards, since closing an attempt moves the last one into its place
+    for (int i = numAttempts - 1; i >= 0; i--)
+    {
+        if (pfds[i].revents != 0)
+        {
+            //the socket becomes writable when the connection
+            //attempt completes, successfully or not
+            int error = 0;
+            socklen_t len = sizeof(error);
+            getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR, &error, &len);
             
-            if (selRes > 0)
+            if (error == 0)
             {
-                socklen_t len = sizeof(errno);
-                
-                getsockopt(s->fileDescriptor, SOL_SOCKET, SO_ERROR, &errno, &len);
-                
-                if (errno == 0)
-                {
-                    //connected
-                    connected = 1;
-                    break;
-                }
-                else
-                {
-                    //sn_log(s, "select() following non blocking connect() failed, errno %d\n", errno);
-                    s->fileDescriptor = -1;
-                    break;
-                }
+                finishAttempt(s, i);
+                return;
             }
-            
-            t += dt;
-            usleep(1000 * dt);
         }
-        
-        if (t >= timeout)
+        else if (now < s->attempts[i].deadline)
         {
-            close(s->fileDescriptor);
-            s->fileDescriptor = -1;
+            //still connecting
+            continue;
         }
         
-        if (connected)
-        {
-            break;
-        }
+        closeAttempt(s, i);
+        hasFailedAttempt = 1;
     }
     
-    if (s->fileDescriptor < 0)
+    if (hasFailedAttempt || now >= s->nextAttemptTime)
     {
-        return 0;
+        startNextAttempt(s);
+    }
+}
+
+/**
+ * Releases what was needed while connecting and configures the connected socket.
+ */
+static void finishConnecting(stfSocket* s)
+{
+    closeAllAttempts(s);
+    
+    if (s->connectState == STF_CONNECT_FAILED && s->numAddresses > 0 && s->host)
+    {
+        //none of the addresses worked, so they may be stale. look
+        //the host up again instead of using the cached addresses.
+        stfResolver_invalidate(s->host);
+    }
+    
+    stfResolver_freeAddresses(s->addresses);
+    s->addresses = NULL;
+    free(s->sortedAddresses);
+    s->sortedAddresses = NULL;
+    s->numAddresses = 0;
+    s->nextAddress = 0;
+    
+    if (s->connectState != STF_CONNECT_CONNECTED)
+    {
+        return;
     }
     
     //disable nagle's algrithm
     int flag = 1;
     int result = setsockopt(s->fileDescriptor, IPPROTO_TCP, TCP_NODELAY, (char*)&flag, sizeof flag);
     assert(result == 0);
+    (void)result;
+}
+
+/**
+ * Remembers the host being connected to, so that its cached addresses can
+ * be invalidated if connecting fails. A failed lookup leaves the socket
+ * idle, so the previous host may still be set.
+ */
+static void setHost(stfSocket* s, const char* host, int port)
+{
+    free(s->host);
+    s->host = strdup(host);
+    s->port = port;
+}
+
+int stfSocket_connect(stfSocket* s,
+                      const char* host,
+                      int port,
+                      stfSocketCancelCallback cancelCallback,
+                      void* callbackData)
+{
+    if (s->fileDescriptor != -1 || s->connectState != STF_CONNECT_IDLE)
+    {
+        //shut down existing connection
+        stfSocket_disconnect(s);
+    }
+    
+    s->connectStartTime = currentTime();
+    
+    setHost(s, host, port);
+    
+    struct addrinfo* addresses;
+    stfResolveRequest* request;
+    if (!stfResolver_lookup(host, port, 1, &addresses, &request))
+    {
+        return 0;
+    }
+    
+    startConnecting(s, addresses);
+    
+    //wait for the connection in short steps,
+    //invoking cancelCallback in between to see
+    //if we should abort the connection attempt
+    while (s->connectState == STF_CONNECT_CONNECTING)
+    {
+        if (cancelCallback)
+        {
+            if (cancelCallback(callbackData) == 0)
+            {
+                //caller requested timeout
+                stfSocket_disconnect(s);
+                return 0;
+            }
+        }
+        
+        checkConnection(s, 10);
+    }
+    
+    finishConnecting(s);
+    
+    return s->connectState == STF_CONNECT_CONNECTED;
+}
+
+int stfSocket_startConnect(stfSocket* s, const char* host, int port)
+{
+    if (s->fileDescriptor != -1 || s->connectState != STF_CONNECT_IDLE)
+    {
+        //shut down existing connection
+        stfSocket_disconnect(s);
+    }
+    
+    s->connectStartTime = currentTime();
+    
+    setHost(s, host, port);
     
-    //disable sigpipe
-//    int set = 1;
-//    result = setsockopt(s->fileDescriptor, SOL_SOCKET, SO_NOSIGPIPE, (void *)&set, sizeof(int));
-//    assert(result == 0);
+    struct addrinfo* addresses;
+    stfResolveRequest* request;
+    if (!stfResolver_lookup(host, port, 0, &addresses, &request))
+    {
+        return 0;
+    }
+    
+    if (addresses)
+    {
+        //numeric or cached host
+        startConnecting(s, addresses);
+        return s->connectState != STF_CONNECT_FAILED;
+    }
+    
+    s->resolveRequest = request;
+    s->connectState = STF_CONNECT_RESOLVING;
     
     return 1;
-   
+}
+
+int stfSocket_pollConnect(stfSocket* s, int* isConnected)
+{
+    *isConnected = 0;
+    
+    if (s->connectState == STF_CONNECT_RESOLVING)
+    {
+        struct addrinfo* addresses;
+        if (!stfResolver_poll(s->resolveRequest, &addresses))
+        {
+            return 1;
+        }
+        s->resolveRequest = NULL;
+        
+        if (addresses == NULL)
+        {
+            s->connectState = STF_CONNECT_FAILED;
+            return 0;
+        }
+        
+        startConnecting(s, addresses);
+    }
+    
+    if (s->connectState == STF_CONNECT_CONNECTING)
+    {
+        checkConnection(s, 0);
+    }
+    
+    if (s->connectState == STF_CONNECT_CONNECTED ||
+        s->connectState == STF_CONNECT_FAILED)
+    {
+        if (s->addresses)
+        {
+            finishConnecting(s);
+        }
+    }
+    
+    *isConnected = s->connectState == STF_CONNECT_CONNECTED;
+    
+    return s->connectState != STF_CONNECT_FAILED;
 }
 
 void stfSocket_disconnect(stfSocket* socket)
@@ -351,12 +707,85 @@ void stfSocket_disconnect(stfSocket* socket)
     free(socket->host);
     socket->host = 0;
     socket->port = 0;
-    shutdown(socket->fileDescriptor, SHUT_RDWR);
-    close(socket->fileDescriptor);
+    
+    if (socket->resolveRequest)
+    {
+        //the lookup finishes in the background
+        stfResolver_cancel(socket->resolveRequest);
+        socket->resolveRequest = NULL;
+    }
+    
+    finishConnecting(socket);
+    socket->connectState = STF_CONNECT_IDLE;
+    socket->peerAddressLength = 0;
+    
+    if (socket->fileDescriptor != -1)
+    {
+        shutdown(socket->fileDescriptor, SHUT_RDWR);
+        close(socket->fileDescriptor);
+    }
     
     socket->fileDescriptor = -1;
 }
 
+int stfSocket_getFileDescriptor(stfSocket* s)
+{
+    if (s->connectState == STF_CONNECT_CONNECTING && s->numAttempts > 0)
+    {
+        //the most recent connection attempt
+        return s->attempts[s->numAttempts - 1].fileDescriptor;
+    }
+    
+    return s->fileDescriptor;
+}
+
+int stfSocket_getConnectTimeout(stfSocket* s)
+{
+    if (s->connectState == STF_CONNECT_RESOLVING)
+    {
+        return STF_RESOLVE_CHECK_INTERVAL;
+    }
+    
+    if (s->connectState != STF_CONNECT_CONNECTING)
+    {
+        return -1;
+    }
+    
+    const int canStartAttempt = s->nextAddress < s->numAddresses &&
+                                s->numAttempts < STF_MAX_CONNECTION_ATTEMPTS;
+    double deadline = canStartAttempt ? s->nextAttemptTime : -1.0;
+    for (int i = 0; i < s->numAttempts; i++)
+    {
+        if (deadline < 0.0 || s->attempts[i].deadline < deadline)
+        {
+            deadline = s->attempts[i].deadline;
+        }
+    }
+    
+    const double remaining = deadline - currentTime();
+    
+    //round up, so the deadline has passed when polling again
+    const int timeoutMs = remaining > 0.0 ? (int)(remaining * 1000.0) + 1 : 0;
+    
+    if (s->numAttempts > 1 && timeoutMs > STF_ATTEMPT_CHECK_INTERVAL)
+    {
+        return STF_ATTEMPT_CHECK_INTERVAL;
+    }
+    
+    return timeoutMs;
+}
+
+const struct sockaddr* stfSocket_getPeerAddress(stfSocket* s, socklen_t* addressLength)
+{
+    *addressLength = s->peerAddressLength;
+    return s->peerAddressLength > 0 ? (const struct sockaddr*)&s->peerAddress : NULL;
+}
+
+double stfSocket_getConnectDuration(stfSocket* s)
+{
+    return s->connectDuration;
+}
+
 int stfSocket_sendData(stfSocket* s, const char* data, int numBytes, int* numSentBytes,
                        stfSocketCancelCallback cancelCallback, void* callbackData)
 {
@@ -422,6 +851,34 @@ int stfSocket_sendData(stfSocket* s, const char* data, int numBytes, int* numSen
     return 1;
 }
 
+int stfSocket_trySendData(stfSocket* s, const struct iovec* buffers, int numBuffers, int* numSentBytes)
+{
+    errno = 0;
+    *numSentBytes = 0;
+    
+    struct msghdr message;
+    memset(&message, 0, sizeof(struct msghdr));
+    message.msg_iov = (struct iovec*)buffers;
+    message.msg_iovlen = numBuffers < IOV_MAX ? numBuffers : IOV_MAX;
+    
+    int flags = 0;
+#ifdef MSG_NOSIGNAL
+    flags |= MSG_NOSIGNAL;
+#endif
+    
+    ssize_t ret = sendmsg(s->fileDescriptor, &message, flags);
+    
+    int ignores[2] = {EAGAIN, EWOULDBLOCK};
+    if (shouldStopOnError(s, errno, ignores, 2))
+    {
+        return 0;
+    }
+    
+    *numSentBytes = ret < 0 ? 0 : (int)ret;
+    
+    return 1;
+}
+
 int stfSocket_receiveData(stfSocket* s, char* data, int maxNumBytes, int* numBytesReceived)
 {
     errno = 0;
@@ -442,3 +899,167 @@ int stfSocket_receiveData(stfSocket* s, char* data, int maxNumBytes, int* numByt
     
     return success;
 }
+
+/**
+ * Resets the wake file descriptor, which may have
+ * been signalled more than once.
+ */
+static void drainWakeFileDescriptor(stfSocket* s)
+{
+    uint64_t numWakes = 0;
+    while (read(s->wakeFileDescriptor, &numWakes, sizeof(numWakes)) > 0)
+    {
+    }
+}
+
+int stfSocket_wait(stfSocket* s, int shouldWaitForWrite, int timeoutMs)
+{
+    //created before checking for wakes, so a wake either
+    //shows up here or signals the descriptor
+    struct pollfd wakePfd;
+    wakePfd.fd = stfSocket_getWakeFileDescriptor(s);
+    wakePfd.events = POLLIN;
+    wakePfd.revents = 0;
+    
+    if (stfSocket_clearWake(s))
+    {
+        return 1;
+    }
+    
+    if (s->connectState == STF_CONNECT_RESOLVING ||
+        s->connectState == STF_CONNECT_CONNECTING)
+    {
+        //wake up when a connection attempt completes or
+        //it's time to check on the lookup or the attempts
+        const int connectTimeout = stfSocket_getConnectTimeout(s);
+        if (connectTimeout >= 0 && (timeoutMs < 0 || connectTimeout < timeoutMs))
+        {
+            timeoutMs = connectTimeout;
+        }
+        
+        struct pollfd pfds[STF_MAX_CONNECTION_ATTEMPTS + 1];
+        for (int i = 0; i < s->numAttempts; i++)
+        {
+            pfds[i].fd = s->attempts[i].fileDescriptor;
+            pfds[i].events = POLLOUT;
+            pfds[i].revents = 0;
+        }
+        pfds[s->numAttempts] = wakePfd;
+        
+        //failures show up when polling the connection attempts
+        poll(pfds, s->numAttempts + 1, timeoutMs);
+        
+        if ((pfds[s->numAttempts].revents & POLLIN) && !stfSocket_clearWake(s))
+        {
+            drainWakeFileDescriptor(s);
+        }
+        
+        return 1;
+    }
+    
+    if (s->fileDescriptor == -1)
+    {
+        return 0;
+    }
+    
+    struct pollfd pfds[2];
+    pfds[0].fd = s->fileDescriptor;
+    pfds[0].events = POLLIN | (shouldWaitForWrite ? POLLOUT : 0);
+    pfds[0].revents = 0;
+    pfds[1] = wakePfd;
+    
+    if (poll(pfds, 2, timeoutMs) < 0 && errno != EINTR)
+    {
+        return 0;
+    }
+    
+    //drained even if the wake was already cleared, since a descriptor
+    //left readable would end every following wait right away
+    if ((pfds[1].revents & POLLIN) && !stfSocket_clearWake(s))
+    {
+        drainWakeFileDescriptor(s);
+    }
+    
+    return 1;
+}
+
+int stfSocket_getWakeFileDescriptor(stfSocket* s)
+{
+    if (s->wakeFileDescriptor != -1)
+    {
+        return s->wakeFileDescriptor;
+    }
+    
+#ifdef __linux__
+    const int fileDescriptor = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fileDescriptor < 0)
+    {
+        return -1;
+    }
+    s->wakeFileDescriptor = fileDescriptor;
+    __atomic_store_n(&s->wakeWriteFileDescriptor, fileDescriptor, __ATOMIC_SEQ_CST);
+#else
+    int fileDescriptors[2];
+    if (pipe(fileDescriptors) != 0)
+    {
+        return -1;
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        fcntl(fileDescriptors[i], F_SETFL, fcntl(fileDescriptors[i], F_GETFL) | O_NONBLOCK);
+        fcntl(fileDescriptors[i], F_SETFD, FD_CLOEXEC);
+    }
+    s->wakeFileDescriptor = fileDescriptors[0];
+    __atomic_store_n(&s->wakeWriteFileDescriptor, fileDescriptors[1], __ATOMIC_SEQ_CST);
+#endif
+    
+    return s->wakeFileDescriptor;
+}
+
+void stfSocket_setExternalWakeFileDescriptor(stfSocket* s, int fileDescriptor)
+{
+    //the socket's own descriptor is kept open, since
+    //other threads may still be about to signal it
+    __atomic_store_n(&s->externalWakeFileDescriptor, fileDescriptor, __ATOMIC_SEQ_CST);
+}
+
+void stfSocket_wake(stfSocket* s)
+{
+    //the descriptor is signalled once until the wake is cleared
+    if (__atomic_exchange_n(&s->isWakePending, 1, __ATOMIC_SEQ_CST))
+    {
+        return;
+    }
+    
+    //if there is no descriptor yet, the waiting thread
+    //sees isWakePending once it has created one
+    int fileDescriptor = __atomic_load_n(&s->externalWakeFileDescriptor, __ATOMIC_SEQ_CST);
+    if (fileDescriptor == -1)
+    {
+        fileDescriptor = __atomic_load_n(&s->wakeWriteFileDescriptor, __ATOMIC_SEQ_CST);
+    }
+    if (fileDescriptor != -1)
+    {
+        const uint64_t numWakes = 1;
+        if (write(fileDescriptor, &numWakes, sizeof(numWakes)) < 0)
+        {
+            //already signalled
+        }
+    }
+}
+
+int stfSocket_clearWake(stfSocket* s)
+{
+    if (!__atomic_load_n(&s->isWakePending, __ATOMIC_SEQ_CST) ||
+        !__atomic_exchange_n(&s->isWakePending, 0, __ATOMIC_SEQ_CST))
+    {
+        return 0;
+    }
+    
+    if (s->wakeFileDescriptor != -1)
+    {
+        drainWakeFileDescriptor(s);
+    }
+    
+    return 1;
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2013, Per Gantelius
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the copyright holders.
+ */
+
+#include "../../websocket.h"
+#include "iocallbacks_uring.h"
+#include "uringsocket.h"
+#include <stdlib.h>
+#include <sys/uio.h>
+
+/** Vectored writes with up to this many buffers don't allocate. */
+#define SN_URING_MAX_STACK_BUFFERS 16
+
+snError snUringInitCallback(void** socket)
+{
+    *socket = snUringSocket_new();
+    return *socket ? SN_NO_ERROR : SN_OUT_OF_MEMORY;
+}
+
+snError snUringDeinitCallback(void* socket)
+{
+    snUringSocket_delete(socket);
+    return SN_NO_ERROR;
+}
+
+snError snUringConnectCallback(void* userData,
+                               const char* host,
+                               int port,
+                               snIOCancelCallback cancelCallback)
+{
+    snUringSocket* socket = (snUringSocket*)userData;
+    int result = snUringSocket_connect(socket, host, port);
+    if (result == 0)
+    {
+        return SN_SOCKET_FAILED_TO_CONNECT;
+    }
+    return SN_NO_ERROR;
+}
+
+snError snUringStartConnectCallback(void* userData,
+                                    const char* host,
+                                    int port,
+                                    snIOCancelCallback cancelCallback)
+{
+    snUringSocket* socket = (snUringSocket*)userData;
+    int result = snUringSocket_startConnect(socket, host, port);
+    if (result == 0)
+    {
+        return SN_SOCKET_FAILED_TO_CONNECT;
+    }
+    return SN_NO_ERROR;
+}
+
+snError snUringPollConnectCallback(void* userData, int* isConnected)
+{
+    snUringSocket* socket = (snUringSocket*)userData;
+    int result = snUringSocket_pollConnect(socket, isConnected);
+    if (result == 0)
+    {
+        return SN_SOCKET_FAILED_TO_CONNECT;
+    }
+    return SN_NO_ERROR;
+}
+
+snError snUringDisconnectCallback(void* userData)
+{
+    snUringSocket* socket = (snUringSocket*)userData;
+    snUringSocket_disconnect(socket);
+    return SN_NO_ERROR;
+}
+
+snError snUringReadCallback(void* userData,
+                            char* buffer,
+                            int bufferSize,
+                            int* numBytesRead)
+{
+    snUringSocket* socket = (snUringSocket*)userData;
+    
+    const int success = snUringSocket_receiveData(socket,
+                                                  buffer,
+                                                  bufferSize,
+                                                  numBytesRead);
+    
+    return success ? SN_NO_ERROR : SN_SOCKET_IO_ERROR;
+}
+
+snError snUringWriteCallback(void* userData,
+                             const char* buffer,
+                             int bufferSize,
+                             int* numBytesWritten,
+                             snIOCancelCallback cancelCallback)
+{
+    snUringSocket* socket = (snUringSocket*)userData;
+    
+    struct iovec vector;
+    vector.iov_base = (void*)buffer;
+    vector.iov_len = bufferSize;
+    
+    const int success = snUringSocket_sendData(socket, &vector, 1, numBytesWritten);
+    
+    return success ? SN_NO_ERROR : SN_SOCKET_IO_ERROR;
+}
+
+snError snUringWritevCallback(void* userData,
+                              const snIOBuffer* buffers,
+                              int numBuffers,
+                              int* numBytesWritten,
+                              snIOCancelCallback cancelCallback)
+{
+    snUringSocket* socket = (snUringSocket*)userData;
+    struct iovec stackVectors[SN_URING_MAX_STACK_BUFFERS];
+    struct iovec* vectors = stackVectors;
+    
+    if (numBuffers <= 0)
+    {
+        *numBytesWritten = 0;
+        return SN_NO_ERROR;
+    }
+    
+    if (numBuffers > SN_URING_MAX_STACK_BUFFERS)
+    {
+        vectors = malloc(numBuffers * sizeof(struct iovec));
+        if (vectors == NULL)
+        {
+            return SN_OUT_OF_MEMORY;
+        }
+    }
+    
+    for (int i = 0; i < numBuffers; i++)
+    {
+        vectors[i].iov_base = (void*)buffers[i].data;
+        vectors[i].iov_len = buffers[i].size > 0 ? buffers[i].size : 0;
+    }
+    
+    const int success = snUringSocket_sendData(socket, vectors, numBuffers, numBytesWritten);
+    
+    if (vectors != stackVectors)
+    {
+        free(vectors);
+    }
+    
+    return success ? SN_NO_ERROR : SN_SOCKET_IO_ERROR;
+}
+
+snError snUringWaitCallback(void* socket, int shouldWaitForWrite, int timeoutMs)
+{
+    return snUringSocket_wait(socket, shouldWaitForWrite, timeoutMs) ? SN_NO_ERROR : SN_SOCKET_IO_ERROR;
+}
+
+int snUringGetFileDescriptorCallback(void* socket, int* interest, int* timeoutMs)
+{
+    int shouldWaitForWrite = (*interest & SN_IO_WRITE) != 0;
+    int isShared = 0;
+    const int fileDescriptor = snUringSocket_getFileDescriptor(socket, &shouldWaitForWrite, &isShared, timeoutMs);
+    if (!shouldWaitForWrite)
+    {
+        *interest &= ~SN_IO_WRITE;
+    }
+    if (isShared)
+    {
+        *interest |= SN_IO_SHARED;
+    }
+    return fileDescriptor;
+}
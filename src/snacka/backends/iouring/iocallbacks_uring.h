@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2013, Per Gantelius
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the copyright holders.
+ */
+
+#ifndef SN_IOCALLBACKS_URING_H
+#define SN_IOCALLBACKS_URING_H
+
+
+#include "../../websocket.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+    
+    /*
+     * I/O callbacks doing socket I/O through io_uring, see snUringSocket.
+     * Falls back to plain socket calls where io_uring is not available.
+     * Use \c snSocketTimeCallback from iocallbacks_socket.h as the time callback.
+     */
+    
+    snError snUringInitCallback(void** socket);
+    
+    snError snUringDeinitCallback(void* socket);
+    
+    snError snUringConnectCallback(void* socket,
+                                   const char* url,
+                                   int port,
+                                   snIOCancelCallback cancelCallback);
+    
+    /**
+     * Starts connecting without blocking. Use together with
+     * \c snUringPollConnectCallback as the \c pollConnectCallback.
+     */
+    snError snUringStartConnectCallback(void* socket,
+                                        const char* url,
+                                        int port,
+                                        snIOCancelCallback cancelCallback);
+    
+    snError snUringPollConnectCallback(void* socket, int* isConnected);
+    
+    snError snUringDisconnectCallback(void* socket);
+    
+    snError snUringReadCallback(void* socket,
+                                char* buffer,
+                                int bufferSize,
+                                int* numBytesRead);
+    
+    snError snUringWriteCallback(void* socket,
+                                 const char* buffer,
+                                 int bufferSize,
+                                 int* numBytesWritten,
+                                 snIOCancelCallback cancelCallback);
+    
+    snError snUringWritevCallback(void* socket,
+                                  const snIOBuffer* buffers,
+                                  int numBuffers,
+                                  int* numBytesWritten,
+                                  snIOCancelCallback cancelCallback);
+    
+    /**
+     * Waits for the socket to become readable, or writable if requested.
+     * Use as the \c waitCallback for \c snWebsocket_pollWait.
+     */
+    snError snUringWaitCallback(void* socket, int shouldWaitForWrite, int timeoutMs);
+    
+    /**
+     * Use as the \c getFileDescriptorCallback to drive websockets from an
+     * external event loop, such as \c snEventLoop. Once open, the descriptor
+     * is the ring shared by the sockets of the polling thread, reported
+     * with \c SN_IO_SHARED.
+     */
+    int snUringGetFileDescriptorCallback(void* socket, int* interest, int* timeoutMs);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /*SN_IOCALLBACKS_URING_H*/
@@ -0,0 +1,1155 @@
+/*
+ * Copyright (c) 2013, Per Gantelius
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the copyright holders.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "uringsocket.h"
+#include "../bsdsocket/socket.h"
+
+//multishot receive is the newest feature used, added in linux 6.0
+#if defined(__linux__) && defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+#define SN_HAS_IO_URING
+#endif
+
+#ifdef SN_HAS_IO_URING
+
+/** The number of submission queue entries of a ring. */
+#define SN_URING_NUM_ENTRIES 256
+
+/**
+ * The number of receive buffers provided to the kernel, shared by
+ * all sockets using a ring. Must be a power of two.
+ */
+#define SN_URING_NUM_RECV_BUFFERS 256
+
+/** The size of each provided receive buffer. */
+#define SN_URING_RECV_BUFFER_SIZE 4096
+
+/** The maximum size of the send buffer of a socket. */
+#define SN_URING_SEND_BUFFER_SIZE (1 << 16)
+
+/** The size a send buffer starts out with. */
+#define SN_URING_MIN_SEND_BUFFER_SIZE 4096
+
+/** The buffer group id of the provided receive buffers. */
+#define SN_URING_RECV_BUFFER_GROUP 0
+
+/**
+ * Operation tags. The user data of a completion is the socket the
+ * operation belongs to, with the tag in the low bits.
+ */
+enum
+{
+    SN_URING_RECV = 1,
+    SN_URING_SEND,
+    SN_URING_CANCEL
+};
+
+/** */
+#define SN_URING_TAG_MASK ((uint64_t)3)
+
+/**
+ * An io_uring instance shared by the sockets of a thread, along with
+ * the receive buffers provided to it.
+ */
+typedef struct snUringRing
+{
+    /** */
+    int fileDescriptor;
+    /** The submission and completion queue rings, possibly the same mapping. */
+    void* sqRing;
+    /** */
+    size_t sqRingSize;
+    /** */
+    void* cqRing;
+    /** */
+    size_t cqRingSize;
+    /** */
+    struct io_uring_sqe* sqes;
+    /** */
+    size_t sqesSize;
+    /** */
+    unsigned* sqHead;
+    /** */
+    unsigned* sqTail;
+    /** */
+    unsigned* sqMask;
+    /** */
+    unsigned* sqFlags;
+    /** */
+    unsigned* sqArray;
+    /** The submission queue tail, including entries not yet made visible to the kernel. */
+    unsigned sqLocalTail;
+    /** The number of prepared entries not yet submitted. */
+    unsigned numUnsubmitted;
+    /** */
+    unsigned* cqHead;
+    /** */
+    unsigned* cqTail;
+    /** */
+    unsigned* cqMask;
+    /** */
+    struct io_uring_cqe* cqes;
+    /** Ring through which receive buffers are handed to the kernel. */
+    struct io_uring_buf_ring* recvBufferRing;
+    /** */
+    uint16_t recvBufferRingTail;
+    /** The memory of the provided receive buffers. */
+    char* recvBuffers;
+    /** The number of receive buffers held by the kernel. */
+    int numFreeRecvBuffers;
+    /** Links the received buffers of each socket into a list, by buffer id. */
+    int nextReceived[SN_URING_NUM_RECV_BUFFERS];
+    /** The number of bytes in each received buffer. */
+    int receivedSizes[SN_URING_NUM_RECV_BUFFERS];
+    /** Sockets whose receive stopped because the kernel ran out of buffers. */
+    snUringSocket* waitingSockets;
+    /** Non-zero if waiting for completions can time out, see \c IORING_FEAT_EXT_ARG. */
+    int canWaitWithTimeout;
+    /**
+     * One for each socket using the ring, plus one held by the
+     * thread that created it until the thread exits.
+     */
+    int numRefs;
+} snUringRing;
+
+#endif /* SN_HAS_IO_URING */
+
+struct snUringSocket
+{
+    /** Sets up the connection and does the I/O if io_uring is not used. */
+    stfSocket* socket;
+    /** The file descriptor of the connected socket. */
+    int fileDescriptor;
+#ifdef SN_HAS_IO_URING
+    /**
+     * The ring of the thread that first read from the socket, or NULL if
+     * no data has been read yet or if plain socket calls are used.
+     */
+    snUringRing* ring;
+    /** Non-zero once it has been decided if the socket uses a ring. */
+    int hasChosenRing;
+    /**
+     * Non-zero once \c snUringSocket_wait or \c snUringSocket_getFileDescriptor
+     * has been called, after which operations are only submitted by those.
+     */
+    int isSubmitDeferred;
+    /** Non-zero while a multishot receive is armed. */
+    int isReceiving;
+    /** Non-zero while in the list of sockets waiting for receive buffers. */
+    int isWaitingForBuffers;
+    /** */
+    snUringSocket* nextWaitingSocket;
+    /** The id of the first buffer holding received data, or -1. */
+    int firstReceived;
+    /** The id of the last buffer holding received data, or -1. */
+    int lastReceived;
+    /** The number of bytes already read from the first received buffer. */
+    int receivedOffset;
+    /** */
+    int hasReceivedEOF;
+    /** errno of a failed receive, or 0. */
+    int receiveError;
+    /** Data waiting to be sent, starting with the data being sent. */
+    char* sendBuffer;
+    /** The capacity of \c sendBuffer. */
+    int sendBufferSize;
+    /** The number of bytes in \c sendBuffer. */
+    int numSendBytes;
+    /** The number of bytes at the start of \c sendBuffer being sent. */
+    int numInFlight;
+    /** errno of a failed send, or 0. */
+    int sendError;
+#endif /* SN_HAS_IO_URING */
+};
+
+#ifdef SN_HAS_IO_URING
+
+/** Holds the ring of each thread. */
+static pthread_key_t ringKey;
+
+/** */
+static pthread_once_t ringKeyOnce = PTHREAD_ONCE_INIT;
+
+/** Stored instead of a ring by threads that failed to create one. */
+static char noRing;
+
+static int enterRing(snUringRing* ring, unsigned toSubmit, unsigned minComplete)
+{
+    int result;
+    do
+    {
+        result = (int)syscall(__NR_io_uring_enter,
+                              ring->fileDescriptor,
+                              toSubmit,
+                              minComplete,
+                              IORING_ENTER_GETEVENTS,
+                              NULL,
+                              0);
+    }
+    while (result < 0 && errno == EINTR);
+    
+    return result;
+}
+
+/**
+ * Submits prepared entries.
+ * @return 1 on success, 0 on failure.
+ */
+static int submit(snUringRing* ring)
+{
+    if (ring->numUnsubmitted == 0)
+    {
+        return 1;
+    }
+    
+    __atomic_store_n(ring->sqTail, ring->sqLocalTail, __ATOMIC_RELEASE);
+    
+    if (enterRing(ring, ring->numUnsubmitted, 0) < 0)
+    {
+        return 0;
+    }
+    
+    ring->numUnsubmitted = 0;
+    
+    return 1;
+}
+
+/**
+ * Gets the next submission queue entry, cleared. Submits the
+ * prepared entries first if the submission queue is full.
+ */
+static struct io_uring_sqe* getSqe(snUringRing* ring)
+{
+    unsigned head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+    if (ring->sqLocalTail - head >= SN_URING_NUM_ENTRIES)
+    {
+        if (!submit(ring))
+        {
+            return NULL;
+        }
+        
+        head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+        if (ring->sqLocalTail - head >= SN_URING_NUM_ENTRIES)
+        {
+            return NULL;
+        }
+    }
+    
+    const unsigned index = ring->sqLocalTail & *ring->sqMask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sqArray[index] = index;
+    ring->sqLocalTail++;
+    ring->numUnsubmitted++;
+    
+    return sqe;
+}
+
+static void armReceive(snUringSocket* s)
+{
+    struct io_uring_sqe* sqe = getSqe(s->ring);
+    if (sqe == NULL)
+    {
+        s->receiveError = EAGAIN;
+        return;
+    }
+    
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = s->fileDescriptor;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = SN_URING_RECV_BUFFER_GROUP;
+    sqe->user_data = (uint64_t)(uintptr_t)s | SN_URING_RECV;
+    
+    s->isReceiving = 1;
+}
+
+/**
+ * Sends everything in the send buffer. Only one send is in progress at a
+ * time, so data written in the meantime goes out with the next send.
+ */
+static void queueSend(snUringSocket* s)
+{
+    struct io_uring_sqe* sqe = getSqe(s->ring);
+    if (sqe == NULL)
+    {
+        s->sendError = EAGAIN;
+        return;
+    }
+    
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = s->fileDescriptor;
+    sqe->addr = (uint64_t)(uintptr_t)s->sendBuffer;
+    sqe->len = s->numSendBytes;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->user_data = (uint64_t)(uintptr_t)s | SN_URING_SEND;
+    
+    s->numInFlight = s->numSendBytes;
+}
+
+/**
+ * Hands a receive buffer back to the kernel.
+ */
+static void provideRecvBuffer(snUringRing* ring, int bufferId)
+{
+    const unsigned index = ring->recvBufferRingTail & (SN_URING_NUM_RECV_BUFFERS - 1);
+    struct io_uring_buf* buffer = &ring->recvBufferRing->bufs[index];
+    buffer->addr = (uint64_t)(uintptr_t)&ring->recvBuffers[bufferId * SN_URING_RECV_BUFFER_SIZE];
+    buffer->len = SN_URING_RECV_BUFFER_SIZE;
+    buffer->bid = (uint16_t)bufferId;
+    
+    ring->recvBufferRingTail++;
+    __atomic_store_n(&ring->recvBufferRing->tail, ring->recvBufferRingTail, __ATOMIC_RELEASE);
+    ring->numFreeRecvBuffers++;
+}
+
+/**
+ * Re-arms the receive of a socket that stopped, unless it has to wait
+ * for other sockets of the ring to hand back receive buffers.
+ */
+static void resumeReceive(snUringSocket* s)
+{
+    if (s->isReceiving ||
+        s->isWaitingForBuffers ||
+        s->hasReceivedEOF ||
+        s->receiveError != 0)
+    {
+        return;
+    }
+    
+    if (s->ring->numFreeRecvBuffers > 0)
+    {
+        armReceive(s);
+    }
+    else
+    {
+        s->isWaitingForBuffers = 1;
+        s->nextWaitingSocket = s->ring->waitingSockets;
+        s->ring->waitingSockets = s;
+    }
+}
+
+/**
+ * Re-arms the receives that stopped for lack of buffers, once there are some.
+ */
+static void resumeWaitingSockets(snUringRing* ring)
+{
+    while (ring->waitingSockets && ring->numFreeRecvBuffers > 0)
+    {
+        snUringSocket* s = ring->waitingSockets;
+        ring->waitingSockets = s->nextWaitingSocket;
+        s->nextWaitingSocket = NULL;
+        s->isWaitingForBuffers = 0;
+        resumeReceive(s);
+    }
+}
+
+static void removeWaitingSocket(snUringSocket* s)
+{
+    snUringSocket** link = &s->ring->waitingSockets;
+    while (*link != s)
+    {
+        link = &(*link)->nextWaitingSocket;
+    }
+    *link = s->nextWaitingSocket;
+    s->nextWaitingSocket = NULL;
+    s->isWaitingForBuffers = 0;
+}
+
+static void handleCompletion(snUringRing* ring, const struct io_uring_cqe* cqe)
+{
+    snUringSocket* s = (snUringSocket*)(uintptr_t)(cqe->user_data & ~SN_URING_TAG_MASK);
+    
+    switch (cqe->user_data & SN_URING_TAG_MASK)
+    {
+
+        case SN_URING_RECV:
+        {
+            if (!(cqe->flags & IORING_CQE_F_MORE))
+            {
+                s->isReceiving = 0;
+            }
+            
+            if (cqe->res > 0)
+            {
+                const int bufferId = (int)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+                ring->numFreeRecvBuffers--;
+                ring->receivedSizes[bufferId] = cqe->res;
+                ring->nextReceived[bufferId] = -1;
+                if (s->lastReceived >= 0)
+                {
+                    ring->nextReceived[s->lastReceived] = bufferId;
+                }
+                else
+                {
+                    s->firstReceived = bufferId;
+                }
+                s->lastReceived = bufferId;
+            }
+            else if (cqe->res == 0)
+            {
+                s->hasReceivedEOF = 1;
+            }
+            else if (cqe->res != -ENOBUFS && cqe->res != -ECANCELED)
+            {
+                //running out of buffers just means the receive
+                //is armed again once buffers have been read
+                s->receiveError = -cqe->res;
+            }
+            break;
+        }
+        case SN_URING_SEND:
+        {
+            s->numInFlight = 0;
+            
+            if (cqe->res >= 0)
+            {
+                memmove(s->sendBuffer, &s->sendBuffer[cqe->res], s->numSendBytes - cqe->res);
+                s->numSendBytes -= cqe->res;
+            }
+            else if (cqe->res != -ECANCELED)
+            {
+                s->sendError = -cqe->res;
+            }
+            
+            if (s->numSendBytes > 0 && s->sendError == 0)
+            {
+                queueSend(s);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+/**
+ * Handles all available completions, for all sockets using the ring.
+ */
+static void reapCompletions(snUringRing* ring)
+{
+    //completions that didn't fit in the queue are flushed on entering
+    const unsigned flags = __atomic_load_n(ring->sqFlags, __ATOMIC_RELAXED);
+    if (flags & IORING_SQ_CQ_OVERFLOW)
+    {
+        enterRing(ring, 0, 0);
+    }
+    
+    unsigned head = *ring->cqHead;
+    const unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+    
+    while (head != tail)
+    {
+        handleCompletion(ring, &ring->cqes[head & *ring->cqMask]);
+        head++;
+    }
+    
+    __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * Blocks until there is at least one completion, or until a timeout expires.
+ */
+static int waitForCompletion(snUringRing* ring, int timeoutMs)
+{
+    if (!submit(ring))
+    {
+        return 0;
+    }
+    
+    int result;
+    if (timeoutMs < 0)
+    {
+        result = enterRing(ring, 0, 1);
+    }
+    else if (ring->canWaitWithTimeout)
+    {
+        struct __kernel_timespec timeout;
+        timeout.tv_sec = timeoutMs / 1000;
+        timeout.tv_nsec = (timeoutMs % 1000) * 1000000LL;
+        
+        struct io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(struct io_uring_getevents_arg));
+        arg.ts = (uint64_t)(uintptr_t)&timeout;
+        
+        result = (int)syscall(__NR_io_uring_enter,
+                              ring->fileDescriptor,
+                              0,
+                              1,
+                              IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                              &arg,
+                              sizeof(struct io_uring_getevents_arg));
+        if (result < 0 && (errno == ETIME || errno == EINTR))
+        {
+            result = 0;
+        }
+    }
+    else
+    {
+        //the ring becomes readable when it has completions
+        struct pollfd pfd;
+        pfd.fd = ring->fileDescriptor;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        
+        result = poll(&pfd, 1, timeoutMs);
+        if (result < 0 && errno == EINTR)
+        {
+            result = 0;
+        }
+    }
+    
+    return result >= 0;
+}
+
+static void deleteRing(snUringRing* ring)
+{
+    if (ring->sqes)
+    {
+        munmap(ring->sqes, ring->sqesSize);
+    }
+    if (ring->cqRing && ring->cqRing != ring->sqRing)
+    {
+        munmap(ring->cqRing, ring->cqRingSize);
+    }
+    if (ring->sqRing)
+    {
+        munmap(ring->sqRing, ring->sqRingSize);
+    }
+    if (ring->fileDescriptor >= 0)
+    {
+        close(ring->fileDescriptor);
+    }
+    
+    free(ring->recvBufferRing);
+    free(ring->recvBuffers);
+    free(ring);
+}
+
+static void releaseRing(snUringRing* ring)
+{
+    if (__atomic_sub_fetch(&ring->numRefs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        deleteRing(ring);
+    }
+}
+
+/**
+ * Called when a thread that created a ring exits. The ring lives on
+ * until the sockets using it are disconnected.
+ */
+static void releaseThreadRing(void* value)
+{
+    if (value != &noRing)
+    {
+        releaseRing((snUringRing*)value);
+    }
+}
+
+static void createRingKey(void)
+{
+    pthread_key_create(&ringKey, releaseThreadRing);
+}
+
+/**
+ * Creates a ring with all receive buffers provided to the kernel.
+ * @return The ring, or NULL if io_uring can't be used.
+ */
+static snUringRing* createRing(void)
+{
+    snUringRing* ring = malloc(sizeof(snUringRing));
+    if (ring == NULL)
+    {
+        return NULL;
+    }
+    memset(ring, 0, sizeof(snUringRing));
+    ring->numRefs = 1;
+    
+    //the buffer ring must be page aligned
+    const long pageSize = sysconf(_SC_PAGESIZE);
+    const size_t bufferRingSize = SN_URING_NUM_RECV_BUFFERS * sizeof(struct io_uring_buf);
+    if (posix_memalign((void**)&ring->recvBufferRing, pageSize, bufferRingSize) != 0)
+    {
+        ring->recvBufferRing = NULL;
+    }
+    ring->recvBuffers = malloc(SN_URING_NUM_RECV_BUFFERS * SN_URING_RECV_BUFFER_SIZE);
+    
+    //completions wake up the thread, so the ring can
+    //be watched with epoll along with other descriptors
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(struct io_uring_params));
+    ring->fileDescriptor = (int)syscall(__NR_io_uring_setup, SN_URING_NUM_ENTRIES, &params);
+    
+    if (ring->recvBufferRing == NULL || ring->recvBuffers == NULL || ring->fileDescriptor < 0)
+    {
+        deleteRing(ring);
+        return NULL;
+    }
+    memset(ring->recvBufferRing, 0, bufferRingSize);
+    
+    ring->canWaitWithTimeout = (params.features & IORING_FEAT_EXT_ARG) != 0;
+    
+    //map the rings
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cqRingSize > ring->sqRingSize)
+        {
+            ring->sqRingSize = ring->cqRingSize;
+        }
+        ring->cqRingSize = ring->sqRingSize;
+    }
+    
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fileDescriptor, IORING_OFF_SQ_RING);
+    if (ring->sqRing == MAP_FAILED)
+    {
+        ring->sqRing = NULL;
+        deleteRing(ring);
+        return NULL;
+    }
+    
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->cqRing = ring->sqRing;
+    }
+    else
+    {
+        ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->fileDescriptor, IORING_OFF_CQ_RING);
+        if (ring->cqRing == MAP_FAILED)
+        {
+            ring->cqRing = NULL;
+            deleteRing(ring);
+            return NULL;
+        }
+    }
+    
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fileDescriptor, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        ring->sqes = NULL;
+        deleteRing(ring);
+        return NULL;
+    }
+    
+    char* sq = (char*)ring->sqRing;
+    ring->sqHead = (unsigned*)(sq + params.sq_off.head);
+    ring->sqTail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sqFlags = (unsigned*)(sq + params.sq_off.flags);
+    ring->sqArray = (unsigned*)(sq + params.sq_off.array);
+    ring->sqLocalTail = *ring->sqTail;
+    
+    char* cq = (char*)ring->cqRing;
+    ring->cqHead = (unsigned*)(cq + params.cq_off.head);
+    ring->cqTail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    
+    //hand all receive buffers to the kernel
+    struct io_uring_buf_reg bufferRingRegistration;
+    memset(&bufferRingRegistration, 0, sizeof(struct io_uring_buf_reg));
+    bufferRingRegistration.ring_addr = (uint64_t)(uintptr_t)ring->recvBufferRing;
+    bufferRingRegistration.ring_entries = SN_URING_NUM_RECV_BUFFERS;
+    bufferRingRegistration.bgid = SN_URING_RECV_BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, ring->fileDescriptor,
+                IORING_REGISTER_PBUF_RING, &bufferRingRegistration, 1) != 0)
+    {
+        deleteRing(ring);
+        return NULL;
+    }
+    
+    for (int i = 0; i < SN_URING_NUM_RECV_BUFFERS; i++)
+    {
+        provideRecvBuffer(ring, i);
+    }
+    
+    return ring;
+}
+
+/**
+ * Gets the ring of the calling thread, creating it on first use.
+ * @return The ring, or NULL if io_uring can't be used.
+ */
+static snUringRing* getThreadRing(void)
+{
+    pthread_once(&ringKeyOnce, createRingKey);
+    
+    void* value = pthread_getspecific(ringKey);
+    if (value == NULL)
+    {
+        value = createRing();
+        pthread_setspecific(ringKey, value ? value : &noRing);
+    }
+    
+    return value == &noRing ? NULL : (snUringRing*)value;
+}
+
+/**
+ * Decides if a connected socket uses the ring of the calling thread, which
+ * is the thread polling it. Called on the first read or wait rather than on
+ * connecting, since the connecting thread may hand the socket to another.
+ */
+static void chooseRing(snUringSocket* s)
+{
+    if (s->hasChosenRing || s->fileDescriptor < 0)
+    {
+        return;
+    }
+    s->hasChosenRing = 1;
+    
+    snUringRing* ring = getThreadRing();
+    if (ring == NULL)
+    {
+        return;
+    }
+    
+    //data sent with plain socket calls before this has already been
+    //handed to the kernel, so sends through the ring stay in order
+    s->sendBuffer = malloc(SN_URING_MIN_SEND_BUFFER_SIZE);
+    if (s->sendBuffer == NULL)
+    {
+        return;
+    }
+    s->sendBufferSize = SN_URING_MIN_SEND_BUFFER_SIZE;
+    
+    __atomic_add_fetch(&ring->numRefs, 1, __ATOMIC_ACQ_REL);
+    s->ring = ring;
+    s->firstReceived = -1;
+    s->lastReceived = -1;
+    s->receivedOffset = 0;
+    s->hasReceivedEOF = 0;
+    s->receiveError = 0;
+    s->numSendBytes = 0;
+    s->numInFlight = 0;
+    s->sendError = 0;
+    
+    //the ring waits for the socket, so the socket itself should block
+    int flags = fcntl(s->fileDescriptor, F_GETFL, 0);
+    fcntl(s->fileDescriptor, F_SETFL, flags & ~O_NONBLOCK);
+    
+    //unsupported operations fail right away
+    resumeReceive(s);
+    if (submit(ring))
+    {
+        reapCompletions(ring);
+    }
+    else
+    {
+        s->receiveError = EINVAL;
+    }
+    
+    if (s->receiveError != 0)
+    {
+        //no multishot receive. go back to plain socket calls.
+        fcntl(s->fileDescriptor, F_SETFL, flags | O_NONBLOCK);
+        free(s->sendBuffer);
+        s->sendBuffer = NULL;
+        s->ring = NULL;
+        releaseRing(ring);
+    }
+}
+
+/**
+ * Submits the operations of a socket, unless its owner submits them
+ * in batches before waiting.
+ */
+static int finishCall(snUringSocket* s)
+{
+    return s->isSubmitDeferred || submit(s->ring);
+}
+
+/**
+ * Checks if a socket using a ring has something to do without waiting.
+ */
+static int needsPolling(snUringSocket* s, int shouldWaitForWrite)
+{
+    return s->firstReceived >= 0 ||
+           s->hasReceivedEOF ||
+           s->receiveError != 0 ||
+           s->sendError != 0 ||
+           (shouldWaitForWrite && s->numSendBytes < SN_URING_SEND_BUFFER_SIZE);
+}
+
+#endif /* SN_HAS_IO_URING */
+
+snUringSocket* snUringSocket_new(void)
+{
+    snUringSocket* s = malloc(sizeof(snUringSocket));
+    if (s == NULL)
+    {
+        return NULL;
+    }
+    memset(s, 0, sizeof(snUringSocket));
+    
+    s->socket = stfSocket_new();
+    s->fileDescriptor = -1;
+    
+    return s;
+}
+
+void snUringSocket_delete(snUringSocket* s)
+{
+    if (s == NULL)
+    {
+        return;
+    }
+    
+    snUringSocket_disconnect(s);
+    stfSocket_delete(s->socket);
+    
+    free(s);
+}
+
+int snUringSocket_connect(snUringSocket* s, const char* host, int port)
+{
+    snUringSocket_disconnect(s);
+    
+    if (!stfSocket_connect(s->socket, host, port, NULL, NULL))
+    {
+        return 0;
+    }
+    
+    s->fileDescriptor = stfSocket_getFileDescriptor(s->socket);
+    
+    return 1;
+}
+
+int snUringSocket_startConnect(snUringSocket* s, const char* host, int port)
+{
+    snUringSocket_disconnect(s);
+    
+    return stfSocket_startConnect(s->socket, host, port);
+}
+
+int snUringSocket_pollConnect(snUringSocket* s, int* isConnected)
+{
+    if (s->fileDescriptor >= 0)
+    {
+        *isConnected = 1;
+        return 1;
+    }
+    
+    if (!stfSocket_pollConnect(s->socket, isConnected))
+    {
+        return 0;
+    }
+    
+    if (*isConnected)
+    {
+        s->fileDescriptor = stfSocket_getFileDescriptor(s->socket);
+    }
+    
+    return 1;
+}
+
+void snUringSocket_disconnect(snUringSocket* s)
+{
+    if (s->fileDescriptor < 0)
+    {
+        //may be in the middle of connecting
+        stfSocket_disconnect(s->socket);
+        return;
+    }
+    
+#ifdef SN_HAS_IO_URING
+    snUringRing* ring = s->ring;
+    if (ring)
+    {
+        //stop all operations on the socket and wait for them to finish,
+        //since their completions refer to the socket and its buffers
+        shutdown(s->fileDescriptor, SHUT_RDWR);
+        s->sendError = EPIPE;
+        
+        if (s->isWaitingForBuffers)
+        {
+            removeWaitingSocket(s);
+        }
+        
+        struct io_uring_sqe* sqe = getSqe(ring);
+        if (sqe)
+        {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = s->fileDescriptor;
+            sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+            sqe->user_data = SN_URING_CANCEL;
+        }
+        
+        int canWait = submit(ring);
+        reapCompletions(ring);
+        
+        while (canWait && (s->isReceiving || s->numInFlight > 0))
+        {
+            canWait = enterRing(ring, 0, 1) >= 0;
+            reapCompletions(ring);
+        }
+        
+        //hand back the buffers nobody is going to read
+        while (s->firstReceived >= 0)
+        {
+            const int bufferId = s->firstReceived;
+            s->firstReceived = ring->nextReceived[bufferId];
+            provideRecvBuffer(ring, bufferId);
+        }
+        s->lastReceived = -1;
+        resumeWaitingSockets(ring);
+        submit(ring);
+        
+        free(s->sendBuffer);
+        s->sendBuffer = NULL;
+        s->sendBufferSize = 0;
+        s->isReceiving = 0;
+        s->ring = NULL;
+        releaseRing(ring);
+    }
+    s->hasChosenRing = 0;
+#endif /* SN_HAS_IO_URING */
+    
+    stfSocket_disconnect(s->socket);
+    s->fileDescriptor = -1;
+}
+
+int snUringSocket_getFileDescriptor(snUringSocket* s, int* shouldWaitForWrite, int* isShared, int* timeoutMs)
+{
+    *isShared = 0;
+    
+#ifdef SN_HAS_IO_URING
+    chooseRing(s);
+    
+    if (s->ring)
+    {
+        s->isSubmitDeferred = 1;
+        *isShared = 1;
+        *timeoutMs = -1;
+        
+        //this is where operations queued since the last call are
+        //submitted. completions reaped earlier, e.g while polling
+        //another socket, won't make the ring readable again, so
+        //ask to be polled if there are any.
+        reapCompletions(s->ring);
+        resumeReceive(s);
+        if (!submit(s->ring) || needsPolling(s, *shouldWaitForWrite))
+        {
+            *timeoutMs = 0;
+        }
+        
+        *shouldWaitForWrite = 0;
+        return s->ring->fileDescriptor;
+    }
+#endif /* SN_HAS_IO_URING */
+    
+    *timeoutMs = stfSocket_getConnectTimeout(s->socket);
+    return stfSocket_getFileDescriptor(s->socket);
+}
+
+int snUringSocket_isUsingRing(snUringSocket* s)
+{
+#ifdef SN_HAS_IO_URING
+    return s->ring != NULL;
+#else
+    return 0;
+#endif /* SN_HAS_IO_URING */
+}
+
+int snUringSocket_sendData(snUringSocket* s, const struct iovec* buffers, int numBuffers, int* numSentBytes)
+{
+#ifdef SN_HAS_IO_URING
+    if (s->ring)
+    {
+        *numSentBytes = 0;
+        
+        reapCompletions(s->ring);
+        if (s->sendError != 0)
+        {
+            return 0;
+        }
+        
+        //the buffer being sent from can't move, so
+        //only grow it while no send is in progress
+        int numBytes = 0;
+        for (int i = 0; i < numBuffers; i++)
+        {
+            numBytes += (int)buffers[i].iov_len;
+        }
+        if (s->numInFlight == 0 &&
+            s->numSendBytes + numBytes > s->sendBufferSize &&
+            s->sendBufferSize < SN_URING_SEND_BUFFER_SIZE)
+        {
+            int size = s->sendBufferSize;
+            while (size < s->numSendBytes + numBytes && size < SN_URING_SEND_BUFFER_SIZE)
+            {
+                size *= 2;
+            }
+            
+            char* sendBuffer = realloc(s->sendBuffer, size);
+            if (sendBuffer)
+            {
+                s->sendBuffer = sendBuffer;
+                s->sendBufferSize = size;
+            }
+        }
+        
+        //copy as much as fits. the caller keeps the rest.
+        for (int i = 0; i < numBuffers && s->numSendBytes < s->sendBufferSize; i++)
+        {
+            const int space = s->sendBufferSize - s->numSendBytes;
+            const int size = (int)buffers[i].iov_len < space ? (int)buffers[i].iov_len : space;
+            memcpy(&s->sendBuffer[s->numSendBytes], buffers[i].iov_base, size);
+            s->numSendBytes += size;
+            *numSentBytes += size;
+        }
+        
+        if (s->numInFlight == 0 && s->numSendBytes > 0)
+        {
+            queueSend(s);
+        }
+        
+        return finishCall(s);
+    }
+#endif /* SN_HAS_IO_URING */
+    
+    return stfSocket_trySendData(s->socket, buffers, numBuffers, numSentBytes);
+}
+
+int snUringSocket_receiveData(snUringSocket* s, char* data, int maxNumBytes, int* numBytesReceived)
+{
+#ifdef SN_HAS_IO_URING
+    chooseRing(s);
+    
+    snUringRing* ring = s->ring;
+    if (ring)
+    {
+        *numBytesReceived = 0;
+        
+        reapCompletions(ring);
+        
+        int numProvided = 0;
+        while (*numBytesReceived < maxNumBytes && s->firstReceived >= 0)
+        {
+            const int bufferId = s->firstReceived;
+            const int size = ring->receivedSizes[bufferId];
+            
+            int numBytes = size - s->receivedOffset;
+            if (numBytes > maxNumBytes - *numBytesReceived)
+            {
+                numBytes = maxNumBytes - *numBytesReceived;
+            }
+            
+            const char* buffer = &ring->recvBuffers[bufferId * SN_URING_RECV_BUFFER_SIZE];
+            memcpy(&data[*numBytesReceived], &buffer[s->receivedOffset], numBytes);
+            *numBytesReceived += numBytes;
+            s->receivedOffset += numBytes;
+            
+            if (s->receivedOffset == size)
+            {
+                s->firstReceived = ring->nextReceived[bufferId];
+                if (s->firstReceived < 0)
+                {
+                    s->lastReceived = -1;
+                }
+                s->receivedOffset = 0;
+                provideRecvBuffer(ring, bufferId);
+                numProvided++;
+            }
+        }
+        
+        if (numProvided > 0)
+        {
+            resumeWaitingSockets(ring);
+        }
+        
+        if (*numBytesReceived == 0 && (s->receiveError != 0 || s->hasReceivedEOF))
+        {
+            //there is no hang up to watch for on the ring,
+            //so report the end of the stream as an error
+            return 0;
+        }
+        
+        resumeReceive(s);
+        
+        return finishCall(s);
+    }
+#endif /* SN_HAS_IO_URING */
+    
+    return stfSocket_receiveData(s->socket, data, maxNumBytes, numBytesReceived);
+}
+
+int snUringSocket_wait(snUringSocket* s, int shouldWaitForWrite, int timeoutMs)
+{
+#ifdef SN_HAS_IO_URING
+    chooseRing(s);
+    
+    if (s->ring)
+    {
+        s->isSubmitDeferred = 1;
+        
+        reapCompletions(s->ring);
+        resumeReceive(s);
+        
+        //don't wait if there's something to do already
+        if (needsPolling(s, shouldWaitForWrite))
+        {
+            return submit(s->ring);
+        }
+        
+        if (!waitForCompletion(s->ring, timeoutMs))
+        {
+            return 0;
+        }
+        
+        reapCompletions(s->ring);
+        
+        return 1;
+    }
+#endif /* SN_HAS_IO_URING */
+    
+    return stfSocket_wait(s->socket, shouldWaitForWrite, timeoutMs);
+}
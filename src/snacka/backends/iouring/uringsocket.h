@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2013, Per Gantelius
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the copyright holders.
+ */
+
+#ifndef SN_URING_SOCKET_H
+#define SN_URING_SOCKET_H
+
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+    
+    /**
+     * A TCP socket doing its I/O through an io_uring instance. Each thread
+     * has one ring, shared by the sockets it reads from. Received data is
+     * delivered by multishot receives into a pool of buffers provided to
+     * the ring, and sends are copied to a per-socket buffer and submitted
+     * in batches, so reading and writing mostly avoids system calls. A
+     * socket stays with the ring of the thread that first read from it, so
+     * once open it must not be polled from other threads, e.g by moving
+     * its websocket to another \c snReactor shard. Falls back to plain
+     * non-blocking socket calls if io_uring is not available, e.g on kernels
+     * older than 6.0, on other platforms or when io_uring is blocked by a
+     * seccomp policy.
+     */
+    typedef struct snUringSocket snUringSocket;
+    
+    /** */
+    snUringSocket* snUringSocket_new(void);
+    
+    /** */
+    void snUringSocket_delete(snUringSocket* s);
+    
+    /**
+     * Connects to a host. The socket starts using the ring of the thread
+     * that polls it the first time it is read from or waited for.
+     * @param s The socket to connect.
+     * @param host The host to connect to.
+     * @param port The port to connect to.
+     * @return 1 on success, 0 on failure.
+     */
+    int snUringSocket_connect(snUringSocket* s, const char* host, int port);
+    
+    /**
+     * Starts connecting to a host without blocking. Call
+     * \c snUringSocket_pollConnect to drive the connection attempt.
+     * @param s The socket to connect.
+     * @param host The host to connect to.
+     * @param port The port to connect to.
+     * @return 1 if the connection attempt was started, 0 on failure.
+     */
+    int snUringSocket_startConnect(snUringSocket* s, const char* host, int port);
+    
+    /**
+     * Checks on a connection attempt started by \c snUringSocket_startConnect.
+     * Never blocks.
+     * @param s The socket being connected.
+     * @param isConnected Set to non-zero once the socket is connected.
+     * @return 1 if connected or still connecting, 0 if the connection attempt failed.
+     */
+    int snUringSocket_pollConnect(snUringSocket* s, int* isConnected);
+    
+    /**
+     * Waits for outstanding operations to finish and closes the connection.
+     * Call from the thread polling the socket, since it uses that thread's ring.
+     * @param s The socket to disconnect.
+     */
+    void snUringSocket_disconnect(snUringSocket* s);
+    
+    /**
+     * Checks if a connected socket uses io_uring or has fallen back to plain socket calls.
+     * @param s The socket.
+     * @return Non-zero if io_uring is used.
+     */
+    int snUringSocket_isUsingRing(snUringSocket* s);
+    
+    /**
+     * Queues as much of a number of buffers as fits in the send buffer
+     * and starts a send if none is in progress. Never blocks. Operations
+     * are submitted right away unless \c snUringSocket_wait or
+     * \c snUringSocket_getFileDescriptor has been called, which then
+     * submit the operations of all sockets on the ring at once.
+     * @param s The socket to send to.
+     * @param buffers The buffers to send.
+     * @param numBuffers The number of buffers.
+     * @param numSentBytes The total number of bytes accepted, possibly 0.
+     * @return 1 on success, 0 on failure.
+     */
+    int snUringSocket_sendData(snUringSocket* s, const struct iovec* buffers, int numBuffers, int* numSentBytes);
+    
+    /**
+     * Copies received data to a buffer. Never blocks.
+     * @param s The socket to receive from.
+     * @param data The buffer to copy to.
+     * @param maxNumBytes The size of \c data.
+     * @param numBytesReceived The number of bytes copied, possibly 0.
+     * @return 1 on success, 0 on failure.
+     */
+    int snUringSocket_receiveData(snUringSocket* s, char* data, int maxNumBytes, int* numBytesReceived);
+    
+    /**
+     * Blocks until received data is available, or there is room to send
+     * if requested, or until a timeout expires. With io_uring, this waits
+     * for completions on the ring, after submitting queued operations.
+     * @param s The socket.
+     * @param shouldWaitForWrite Non-zero to also wake up when data can be sent.
+     * @param timeoutMs The maximum time to wait in milliseconds, or -1 to wait indefinitely.
+     * @return 1 on success, 0 on failure.
+     */
+    int snUringSocket_wait(snUringSocket* s, int shouldWaitForWrite, int timeoutMs);
+    
+    /**
+     * Gets a file descriptor to wait for with an external event loop. Once
+     * using io_uring, this is the descriptor of the ring, which becomes
+     * readable when operations of any of its sockets complete. Completions
+     * are collected for all sockets of the ring by whichever socket is used
+     * first, so before waiting, call this for each socket sharing the
+     * descriptor and check the timeout. Operations queued since the last
+     * call are submitted.
+     * @param s The socket.
+     * @param shouldWaitForWrite On input, non-zero to wait until data can be
+     * sent. Cleared if the returned descriptor only needs watching for reading.
+     * @param isShared Set to non-zero if the descriptor is the ring's, which
+     * is shared with the other sockets using the ring.
+     * @param timeoutMs Set to the number of milliseconds until the socket
+     * needs polling even if the descriptor is not ready, or -1 for no limit.
+     * @return The file descriptor, or -1 if there is none.
+     */
+    int snUringSocket_getFileDescriptor(snUringSocket* s, int* shouldWaitForWrite, int* isShared, int* timeoutMs);
+    
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /*SN_URING_SOCKET_H*/
@@ -74,7 +74,14 @@ extern "C"
         /** The websocket connection is required to be open but wasn't.*/
         SN_WEBSOCKET_CONNECTION_IS_NOT_OPEN,
         /** Failed to parse the opening handshake HTTP response header.*/
-        SN_OPENING_HANDSHAKE_FAILED
+        SN_OPENING_HANDSHAKE_FAILED,
+        /** Failed to allocate memory. */
+        SN_OUT_OF_MEMORY,
+        /** A message was sent while sending a fragmented message, or a
+         fragmented message was continued or ended without being begun. */
+        SN_INVALID_MESSAGE_SEQUENCE,
+        /** The operation timed out. */
+        SN_TIMED_OUT
     } snError;
     
 #ifdef __cplusplus
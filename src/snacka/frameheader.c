@@ -28,11 +28,20 @@
  */
 
 #include <assert.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "frame.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SN_MASK_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/** Payloads shorter than this are masked a byte at a time. */
+#define SN_MASK_MIN_VECTOR_SIZE 64
+
 
 static int isOpcodeValid(snOpcode oc)
 {
@@ -175,7 +184,7 @@ snError snFrameHeader_fromBytes(snFrameHeader* h,
         //the payload size is given by the next 8 bytes
         for (i = 0; i < 8; i++)
         {
-            h->payloadSize |= (((unsigned char*)headerBytes)[readIdx++] << ((7 - i) * 8));
+            h->payloadSize |= ((unsigned long long)((unsigned char*)headerBytes)[readIdx++] << ((7 - i) * 8));
         }
     }
     else
@@ -189,7 +198,7 @@ snError snFrameHeader_fromBytes(snFrameHeader* h,
     {
         for (i = 0; i < 4; i++)
         {
-            h->maskingKey |= (((unsigned char*)headerBytes)[readIdx++] << ((3 - i) * 8));
+            h->maskingKey |= (int)((uint32_t)((unsigned char*)headerBytes)[readIdx++] << ((3 - i) * 8));
         }
     }
     
@@ -245,15 +254,129 @@ snError snFrameHeader_validate(const snFrameHeader* h)
     
 }
 
-snError snFrameHeader_applyMask(snFrameHeader* h, char* payload, int numBytes, int offset)
+/**
+ * XORs a buffer with a 4 byte key, eight bytes at a time, writing the
+ * result to another buffer, which may be the same as the source. The key
+ * is given in the order it applies to the first byte of the buffer.
+ */
+static void applyMaskWords(unsigned char* dst, const unsigned char* src, size_t numBytes, const unsigned char* key)
 {
-    int i;
+    uint32_t key32;
+    uint64_t key64;
+    size_t i = 0;
+    
+    memcpy(&key32, key, 4);
+    key64 = ((uint64_t)key32 << 32) | key32;
+    
+    for (; i + 8 <= numBytes; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, src + i, 8);
+        word ^= key64;
+        memcpy(dst + i, &word, 8);
+    }
+    
+    for (; i < numBytes; i++)
+    {
+        dst[i] = src[i] ^ key[i & 3];
+    }
+}
 
-    if (h->isMasked == 0)
+#ifdef SN_MASK_X86_SIMD
+
+/**
+ * SSE2 version of applyMaskWords, 16 bytes at a time.
+ */
+__attribute__((target("sse2")))
+static void applyMaskSSE2(unsigned char* dst, const unsigned char* src, size_t numBytes, const unsigned char* key)
+{
+    int32_t key32;
+    size_t i = 0;
+    
+    memcpy(&key32, key, 4);
+    const __m128i mask = _mm_set1_epi32(key32);
+    
+    for (; i + 16 <= numBytes; i += 16)
     {
-        return SN_NO_ERROR;
+        __m128i block = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(block, mask));
+    }
+    
+    applyMaskWords(dst + i, src + i, numBytes - i, key);
+}
+
+/**
+ * AVX2 version of applyMaskWords, 64 bytes at a time.
+ */
+__attribute__((target("avx2")))
+static void applyMaskAVX2(unsigned char* dst, const unsigned char* src, size_t numBytes, const unsigned char* key)
+{
+    int32_t key32;
+    size_t i = 0;
+    
+    memcpy(&key32, key, 4);
+    const __m256i mask = _mm256_set1_epi32(key32);
+    
+    for (; i + 64 <= numBytes; i += 64)
+    {
+        __m256i block0 = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i block1 = _mm256_loadu_si256((const __m256i*)(src + i + 32));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(block0, mask));
+        _mm256_storeu_si256((__m256i*)(dst + i + 32), _mm256_xor_si256(block1, mask));
+    }
+    
+    for (; i + 32 <= numBytes; i += 32)
+    {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(src + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(block, mask));
+    }
+    
+    applyMaskWords(dst + i, src + i, numBytes - i, key);
+}
+
+#endif /* SN_MASK_X86_SIMD */
+
+typedef void (*snMaskKernel)(unsigned char* dst, const unsigned char* src, size_t numBytes, const unsigned char* key);
+
+/**
+ * Picks the widest masking kernel supported by the CPU we're running on,
+ * along with the alignment it prefers.
+ */
+static snMaskKernel getMaskKernel(size_t* alignment)
+{
+    static int initialized = 0;
+    static snMaskKernel kernel = applyMaskWords;
+    static size_t kernelAlignment = 8;
+    
+    if (!initialized)
+    {
+#ifdef SN_MASK_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+            kernel = applyMaskAVX2;
+            kernelAlignment = 32;
+        }
+        else if (__builtin_cpu_supports("sse2"))
+        {
+            kernel = applyMaskSSE2;
+            kernelAlignment = 16;
+        }
+#endif /* SN_MASK_X86_SIMD */
+        initialized = 1;
     }
     
+    *alignment = kernelAlignment;
+    return kernel;
+}
+
+/**
+ * Masks \c numBytes bytes from \c src into \c dst, which may be the same buffer.
+ */
+static snError copyMasked(const snFrameHeader* h, char* dst, const char* src, int numBytes, int offset)
+{
+    int i;
+    
     if (h->maskingKey == 0)
     {
         return SN_MASKING_KEY_IS_ZERO;
@@ -261,16 +384,76 @@ snError snFrameHeader_applyMask(snFrameHeader* h, char* payload, int numBytes, i
     
     assert(offset >= 0);
     
-    //apply the mask to the payload
-    unsigned char* maskBytes = (unsigned char*)(&h->maskingKey);
-    for (i = 0; i < numBytes; i++)
+    if (numBytes <= 0)
     {
-        payload[i] = payload[i] ^ maskBytes[3 - ((i + offset) % 4)];
+        return SN_NO_ERROR;
     }
     
+    //the key bytes in the order they appear on the wire, rotated so
+    //that the first one applies to the first payload byte
+    const uint32_t maskingKey = (uint32_t)h->maskingKey;
+    unsigned char key[4];
+    for (i = 0; i < 4; i++)
+    {
+        key[i] = (unsigned char)(maskingKey >> ((3 - ((i + offset) & 3)) * 8));
+    }
+    
+    unsigned char* dstBytes = (unsigned char*)dst;
+    const unsigned char* srcBytes = (const unsigned char*)src;
+    size_t size = (size_t)numBytes;
+    
+    if (size < SN_MASK_MIN_VECTOR_SIZE)
+    {
+        applyMaskWords(dstBytes, srcBytes, size, key);
+        return SN_NO_ERROR;
+    }
+    
+    size_t alignment;
+    snMaskKernel kernel = getMaskKernel(&alignment);
+    
+    //mask the head a byte at a time until the destination is
+    //aligned, then rotate the key past it
+    const size_t headSize = (size_t)(-(uintptr_t)dstBytes) & (alignment - 1);
+    for (i = 0; i < (int)headSize; i++)
+    {
+        dstBytes[i] = srcBytes[i] ^ key[i & 3];
+    }
+    
+    unsigned char rotatedKey[4];
+    for (i = 0; i < 4; i++)
+    {
+        rotatedKey[i] = key[(i + headSize) & 3];
+    }
+    
+    kernel(dstBytes + headSize, srcBytes + headSize, size - headSize, rotatedKey);
+    
     return SN_NO_ERROR;
 }
 
+snError snFrameHeader_applyMask(snFrameHeader* h, char* payload, int numBytes, int offset)
+{
+    if (h->isMasked == 0)
+    {
+        return SN_NO_ERROR;
+    }
+    
+    return copyMasked(h, payload, payload, numBytes, offset);
+}
+
+snError snFrameHeader_copyMasked(const snFrameHeader* h, char* dst, const char* src, int numBytes, int offset)
+{
+    if (h->isMasked == 0)
+    {
+        if (numBytes > 0)
+        {
+            memcpy(dst, src, numBytes);
+        }
+        return SN_NO_ERROR;
+    }
+    
+    return copyMasked(h, dst, src, numBytes, offset);
+}
+
 #ifdef DEBUG
 static const char* opcodeToString(snOpcode o)
 {
@@ -132,13 +132,27 @@ extern "C"
      * the header's mask flag is not set, this function does nothing.
      * @param h The header providing the mask flag.
      * @param payload The payload to mask.
-     * @param numBytes
-     * @param offset
+     * @param numBytes The number of bytes to mask.
+     * @param offset The position of \c payload relative to the start of the
+     * frame payload, used to pick the key byte for the first byte.
      * @return An error code.
      * @see https://tools.ietf.org/html/rfc6455#section-5.3
      */
     snError snFrameHeader_applyMask(snFrameHeader* h, char* payload, int numBytes, int offset);
     
+    /**
+     * Copies a portion of a payload, applying the mask in a given header
+     * on the way. Faster than a copy followed by \c snFrameHeader_applyMask.
+     * @param h The header providing the mask flag.
+     * @param dst The buffer to write the masked bytes to.
+     * @param src The bytes to mask.
+     * @param numBytes The number of bytes to mask.
+     * @param offset The position of \c src relative to the start of the
+     * frame payload.
+     * @return An error code.
+     */
+    snError snFrameHeader_copyMasked(const snFrameHeader* h, char* dst, const char* src, int numBytes, int offset);
+    
     /**
      * Compares two websocket frame headers.
      * @param h1 The first header.
@@ -35,19 +35,249 @@
 #include "frameparser.h"
 #include "utf8.h"
 
-static snError onFinishedParsingFrame(snFrameParser* parser)
+/** The smallest size of a reassembly buffer owned by the parser. */
+#define SN_MIN_PARSER_BUFFER_SIZE 1024
+
+/*
+ * Big endian loads used by the whole header fast path. The memcpy calls
+ * compile to single unaligned loads on the platforms we care about.
+ */
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+static inline uint16_t readUInt16BE(const unsigned char* b)
+{
+    uint16_t v;
+    memcpy(&v, b, sizeof(v));
+    return __builtin_bswap16(v);
+}
+
+static inline uint32_t readUInt32BE(const unsigned char* b)
+{
+    uint32_t v;
+    memcpy(&v, b, sizeof(v));
+    return __builtin_bswap32(v);
+}
+
+static inline uint64_t readUInt64BE(const unsigned char* b)
+{
+    uint64_t v;
+    memcpy(&v, b, sizeof(v));
+    return __builtin_bswap64(v);
+}
+#else
+static inline uint16_t readUInt16BE(const unsigned char* b)
+{
+    return (uint16_t)((b[0] << 8) | b[1]);
+}
+
+static inline uint32_t readUInt32BE(const unsigned char* b)
+{
+    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) |
+           ((uint32_t)b[2] << 8) | ((uint32_t)b[3] << 0);
+}
+
+static inline uint64_t readUInt64BE(const unsigned char* b)
+{
+    return ((uint64_t)readUInt32BE(b) << 32) | readUInt32BE(&b[4]);
+}
+#endif
+
+/**
+ * Decodes a complete header from at least \c SN_MAX_HEADER_SIZE
+ * contiguous bytes without going through the per byte state machine.
+ * @param header The header to fill in.
+ * @param bytes The header bytes.
+ * @param headerSize On output, the actual size of the header in bytes.
+ * @return An error code.
+ */
+static snError parseWholeHeader(snFrameHeader* header,
+                                const unsigned char* bytes,
+                                int* headerSize)
+{
+    if (bytes[0] & 0x70)
+    {
+        return SN_NONZERO_RESVERVED_BIT;
+    }
+    
+    const unsigned int payloadSize7 = bytes[1] & 0x7f;
+    const int isMasked = bytes[1] >> 7;
+    const int has16BitSize = payloadSize7 == 126;
+    const int has64BitSize = payloadSize7 == 127;
+    
+    //both extended sizes lie within SN_MAX_HEADER_SIZE bytes, so load them
+    //unconditionally and select the right one afterwards.
+    const unsigned long long payloadSize16 = readUInt16BE(&bytes[2]);
+    const unsigned long long payloadSize64 = readUInt64BE(&bytes[2]);
+    const int maskingKeyOffset = 2 + (has16BitSize << 1) + (has64BitSize << 3);
+    
+    header->isFinal = bytes[0] >> 7;
+    header->opcode = bytes[0] & 0xf;
+    header->isMasked = isMasked;
+    header->payloadSize = has64BitSize ? payloadSize64 : (has16BitSize ? payloadSize16 : payloadSize7);
+    header->maskingKey = isMasked ? (int)readUInt32BE(&bytes[maskingKeyOffset]) : 0;
+    
+    *headerSize = maskingKeyOffset + (isMasked << 2);
+    
+    return SN_NO_ERROR;
+}
+
+static int isControlFrame(const snFrameHeader* header)
+{
+    return header->opcode == SN_OPCODE_PING ||
+           header->opcode == SN_OPCODE_PONG ||
+           header->opcode == SN_OPCODE_CONNECTION_CLOSE;
+}
+
+static int isTextFrame(const snFrameParser* parser)
+{
+    return parser->currentFrameHeader.opcode == SN_OPCODE_TEXT ||
+           (parser->currentFrameHeader.opcode == SN_OPCODE_CONTINUATION &&
+            parser->continuationOpcode == SN_OPCODE_TEXT);
+}
+
+/**
+ * Checks that the text received so far does not end in the
+ * middle of a code point.
+ */
+static int isCompleteUTF8(snFrameParser* parser)
+{
+    char b = '\0';
+    return snUTF8ValidateStringIncremental(&b, 1, &parser->utf8State);
+}
+
+/**
+ * Non-zero if the payload of the current frame is passed to the chunk
+ * callback instead of being stored in the parser buffer.
+ */
+static int isStreamingFrame(const snFrameParser* parser)
+{
+    return parser->chunkCallback != NULL &&
+           !isControlFrame(&parser->currentFrameHeader);
+}
+
+/**
+ * Makes sure the reassembly buffer can hold a given number of bytes,
+ * growing it geometrically if the parser owns it.
+ * @param parser The parser.
+ * @param size The required buffer size in bytes.
+ * @return An error code.
+ */
+static snError reserveBuffer(snFrameParser* parser, unsigned long long size)
+{
+    if (size <= parser->bufferSize)
+    {
+        return SN_NO_ERROR;
+    }
+    
+    if (!parser->ownsBuffer || size > parser->maxFrameSize)
+    {
+        return SN_EXCEEDED_MAX_PAYLOAD_SIZE;
+    }
+    
+    unsigned long long newSize = parser->bufferSize < SN_MIN_PARSER_BUFFER_SIZE ?
+                                 SN_MIN_PARSER_BUFFER_SIZE : parser->bufferSize;
+    while (newSize < size)
+    {
+        newSize *= 2;
+    }
+    
+    if (newSize > parser->maxFrameSize)
+    {
+        newSize = parser->maxFrameSize;
+    }
+    
+    char* newBuffer = realloc(parser->buffer, newSize);
+    if (newBuffer == NULL)
+    {
+        return SN_OUT_OF_MEMORY;
+    }
+    
+    parser->buffer = newBuffer;
+    parser->bufferSize = (uint32_t)newSize;
+    
+    return SN_NO_ERROR;
+}
+
+/**
+ * Passes a chunk of text or binary payload bytes to the chunk callback.
+ * @param parser The parser.
+ * @param chunk The payload bytes.
+ * @param chunkSize The number of payload bytes.
+ * @param isEndOfFrame Non-zero if \c chunk ends the current frame.
+ */
+static snError deliverMessageChunk(snFrameParser* parser,
+                                   const char* chunk,
+                                   int chunkSize,
+                                   int isEndOfFrame)
+{
+    const int isLast = isEndOfFrame && parser->currentFrameHeader.isFinal;
+    
+    if (chunkSize == 0 && !isLast)
+    {
+        //nothing to report for empty non-final fragments
+        return SN_NO_ERROR;
+    }
+    
+    if (isLast && isTextFrame(parser) && !isCompleteUTF8(parser))
+    {
+        return SN_INVALID_UTF8;
+    }
+    
+    const snOpcode opcode = parser->currentFrameHeader.opcode == SN_OPCODE_CONTINUATION ?
+                            parser->continuationOpcode : parser->currentFrameHeader.opcode;
+    const int isFirst = !parser->isStreamingMessage;
+    parser->isStreamingMessage = !isLast;
+    
+    parser->chunkCallback(parser->messageCallbackData,
+                          opcode,
+                          chunk,
+                          chunkSize,
+                          isFirst,
+                          isLast);
+    
+    return SN_NO_ERROR;
+}
+
+/**
+ * Passes a fully parsed frame on to the frame and message callbacks.
+ * @param parser The parser.
+ * @param inPlacePayload If not NULL, the complete payload of the current
+ * frame, pointing into the bytes being processed. Otherwise the payload
+ * is read from the parser's buffers.
+ */
+static snError onFinishedParsingFrame(snFrameParser* parser, const char* inPlacePayload)
 {
     //pass the frame to the frame callback,
     //even if it's a continuation frame
     snFrame f;
     memcpy(&f.header, &parser->currentFrameHeader, sizeof(snFrameHeader));
-    char* messageBuffer = NULL;
+    const char* messageBuffer = NULL;
     
-    const int isUTF8 = (parser->continuationOpcode == SN_OPCODE_TEXT && f.header.opcode == SN_OPCODE_CONTINUATION) ||
-                        f.header.opcode == SN_OPCODE_TEXT;
+    const int isUTF8 = isTextFrame(parser);
+    const int isControl = isControlFrame(&f.header);
+    const int isStreaming = isStreamingFrame(parser);
     
-    if (parser->currentFrameHeader.opcode == SN_OPCODE_PING ||
-        parser->currentFrameHeader.opcode == SN_OPCODE_PONG)
+    if (!isStreaming && !inPlacePayload && !isControl)
+    {
+        //make room for the payload and a null terminator,
+        //even if the payload is empty
+        snError result = reserveBuffer(parser, parser->continuationOffset + f.header.payloadSize + 1);
+        if (result != SN_NO_ERROR)
+        {
+            return result;
+        }
+    }
+    
+    if (isStreaming)
+    {
+        //streamed payload bytes have already been passed to the chunk callback
+        f.payload = NULL;
+    }
+    else if (inPlacePayload)
+    {
+        messageBuffer = inPlacePayload;
+        f.payload = inPlacePayload;
+    }
+    else if (isControl)
     {
         messageBuffer = parser->pingPongPayloadBuffer;
         f.payload = parser->pingPongPayloadBuffer;
@@ -58,7 +288,7 @@ static snError onFinishedParsingFrame(snFrameParser* parser)
         f.payload = &parser->buffer[parser->continuationOffset];
     }
     
-    if (!f.header.isFinal)
+    if (!f.header.isFinal && !isStreaming)
     {
         parser->continuationOffset += f.header.payloadSize;
     }
@@ -69,19 +299,30 @@ static snError onFinishedParsingFrame(snFrameParser* parser)
         parser->frameCallback(parser->frameCallbackData, &f);
     }
     
+    if (isStreaming && f.header.payloadSize == 0)
+    {
+        //empty frames have no payload chunk to report the end of the message with
+        snError result = deliverMessageChunk(parser, NULL, 0, 1);
+        if (result != SN_NO_ERROR)
+        {
+            return result;
+        }
+    }
+    
     //invoke the message callback if
-    if (f.header.isFinal)
+    if (f.header.isFinal && !isStreaming)
     {
-        int totalPayloadSize = parser->continuationOffset + f.header.payloadSize;
-        if (isUTF8)
+        int totalPayloadSize = isControl ? f.header.payloadSize : parser->continuationOffset + f.header.payloadSize;
+        if (isUTF8 && !inPlacePayload)
         {
             parser->buffer[totalPayloadSize] = '\0';
             //totalPayloadSize++;
         }
         
-        char b = '\0';
-        int v =snUTF8ValidateStringIncremental(&b, 1, &parser->utf8State);
-        if (v == 0)
+        //only text messages need the final UTF-8 state check. skipping it
+        //for other frames also keeps pings and pongs arriving in between
+        //text fragments from being checked against a partial code point.
+        if (isUTF8 && !isCompleteUTF8(parser))
         {
             return SN_INVALID_UTF8;
         }
@@ -101,23 +342,22 @@ static snError onFinishedParsingFrame(snFrameParser* parser)
                                         totalPayloadSize);
             }
         }
-        
-        //allow pings, pongs and close frames in between continuation frames
-        if (f.header.opcode != SN_OPCODE_PONG &&
-            f.header.opcode != SN_OPCODE_PING &&
-            f.header.opcode != SN_OPCODE_CONNECTION_CLOSE)
-        {
-            parser->isWaitingForFinalFrame = 0;
-        }
     }
     
+    //allow pings, pongs and close frames in between continuation frames
+    if (f.header.isFinal && !isControl)
+    {
+        parser->isWaitingForFinalFrame = 0;
+        parser->continuationOffset = 0;
+    }
+    
+    //every header field is overwritten while parsing the next header,
+    //so there is no need to clear the header or the size/key bytes here.
     parser->isParsingHeader = 1;
     parser->currentFrameByte = 0;
     parser->bufferPosition = 0;
     parser->firstPayloadSizeByte = 0;
     parser->numPayloadSizeBytes = 0;
-    memset(parser->payloadSizeBytes, 0, 8);
-    memset(&parser->currentFrameHeader, 0, sizeof(snFrameHeader));
         
     return SN_NO_ERROR;
 }
@@ -146,7 +386,13 @@ static snError onFinishedParsingHeader(snFrameParser* parser)
         return SN_EXPECTED_CONTINUATION_FRAME;
     }
     
-    if (header->payloadSize > parser->maxFrameSize - SN_MAX_HEADER_SIZE)
+    //streamed messages are never stored, so their size is not limited.
+    //fragments of a message must fit in the buffer together.
+    const unsigned long long storedSize = header->opcode == SN_OPCODE_CONTINUATION ?
+                                          parser->continuationOffset + header->payloadSize :
+                                          header->payloadSize;
+    if (!isStreamingFrame(parser) &&
+        storedSize > parser->maxFrameSize - SN_MAX_HEADER_SIZE)
     {
         return SN_EXCEEDED_MAX_PAYLOAD_SIZE;
     }
@@ -178,13 +424,13 @@ static snError onFinishedParsingHeader(snFrameParser* parser)
         }
     }
 
-    parser->currentHeaderSize = parser->currentFrameByte;
+    parser->currentHeaderSize = (int)parser->currentFrameByte;
     
     parser->isParsingHeader = 0;
     
     if (parser->currentFrameHeader.payloadSize == 0)
     {
-        snError result = onFinishedParsingFrame(parser);
+        snError result = onFinishedParsingFrame(parser, NULL);
         if (result != SN_NO_ERROR)
         {
             return result;
@@ -203,11 +449,19 @@ void snFrameParser_init(snFrameParser* parser,
                         int maxFrameSize)
 {
     memset(parser, 0, sizeof(snFrameParser));
-    parser->buffer = readBuffer;
-    
-    memset(parser->buffer, 0, maxFrameSize);
     parser->maxFrameSize = maxFrameSize;
     
+    if (readBuffer)
+    {
+        parser->buffer = readBuffer;
+        parser->bufferSize = maxFrameSize;
+    }
+    else
+    {
+        //allocated on demand when the first message arrives
+        parser->ownsBuffer = 1;
+    }
+    
     parser->frameCallback = frameCallback;
     parser->frameCallbackData = frameCallbackData;
     
@@ -219,9 +473,38 @@ void snFrameParser_init(snFrameParser* parser,
 
 void snFrameParser_deinit(snFrameParser* parser)
 {
+    if (parser->ownsBuffer)
+    {
+        free(parser->buffer);
+    }
+    
     memset(parser, 0, sizeof(snFrameParser));
 }
 
+int snFrameParser_canShrinkBuffer(const snFrameParser* parser)
+{
+    //there must be something to shrink, and the buffer must not be in use
+    return parser->ownsBuffer &&
+           parser->bufferSize > SN_MIN_PARSER_BUFFER_SIZE &&
+           parser->isParsingHeader &&
+           !parser->isWaitingForFinalFrame;
+}
+
+void snFrameParser_shrinkBuffer(snFrameParser* parser)
+{
+    if (!snFrameParser_canShrinkBuffer(parser))
+    {
+        return;
+    }
+    
+    char* newBuffer = realloc(parser->buffer, SN_MIN_PARSER_BUFFER_SIZE);
+    if (newBuffer)
+    {
+        parser->buffer = newBuffer;
+        parser->bufferSize = SN_MIN_PARSER_BUFFER_SIZE;
+    }
+}
+
 void snFrameParser_reset(snFrameParser* parser)
 {
     parser->isWaitingForFinalFrame = 0;
@@ -233,6 +516,7 @@ void snFrameParser_reset(snFrameParser* parser)
     parser->firstPayloadSizeByte = 0;
     parser->numPayloadSizeBytes = 0;
     parser->utf8State = 0;
+    parser->isStreamingMessage = 0;
     memset(parser->payloadSizeBytes, 0, 8);
     memset(&parser->currentFrameHeader, 0, sizeof(snFrameHeader));
 }
@@ -241,7 +525,6 @@ snError snFrameParser_processBytes(snFrameParser* parser,
                                    const char* bytes,
                                    int numBytes)
 {
-    int i;
     //https://tools.ietf.org/html/rfc6455#section-5.2
     
     int currentSrcByte = 0;
@@ -250,8 +533,32 @@ snError snFrameParser_processBytes(snFrameParser* parser,
     
     while (currentSrcByte < numBytes)
     {
-        if (parser->isParsingHeader)
+        if (parser->isParsingHeader &&
+            parser->currentFrameByte == 0 &&
+            numBytes - currentSrcByte >= SN_MAX_HEADER_SIZE)
+        {
+            //the whole header is available, decode it in one go
+            int headerSize = 0;
+            snError result = parseWholeHeader(&parser->currentFrameHeader,
+                                              (const unsigned char*)&bytes[currentSrcByte],
+                                              &headerSize);
+            if (result != SN_NO_ERROR)
+            {
+                return result;
+            }
+            
+            parser->currentFrameByte = headerSize;
+            currentSrcByte += headerSize;
+            
+            result = onFinishedParsingHeader(parser);
+            if (result != SN_NO_ERROR)
+            {
+                return result;
+            }
+        }
+        else if (parser->isParsingHeader)
         {
+            //the header is split across reads. parse it one byte at a time
             int doneParsingHeader = 0;
             //parse header bytes one at a time
             if (parser->currentFrameByte == 0)
@@ -279,6 +586,8 @@ snError snFrameParser_processBytes(snFrameParser* parser,
                 const char b = bytes[currentSrcByte];
                 const int isMasked = (b & 0x80) >> 7;
                 parser->currentFrameHeader.isMasked = isMasked;
+                parser->currentFrameHeader.maskingKey = 0;
+                parser->currentFrameHeader.payloadSize = 0;
                 unsigned int payloadSize = b & 0x7f;
                 
                 if (payloadSize == 126)
@@ -320,10 +629,7 @@ snError snFrameParser_processBytes(snFrameParser* parser,
                     }
                     else if (parser->numPayloadSizeBytes == 8)
                     {
-                        for (i = 0; i < 8; i++)
-                        {
-                            parser->currentFrameHeader.payloadSize |= (((unsigned char*)parser->payloadSizeBytes)[i] << ((7 - i) * 8));
-                        }
+                        parser->currentFrameHeader.payloadSize = readUInt64BE((unsigned char*)parser->payloadSizeBytes);
                     }
                     else
                     {
@@ -344,10 +650,7 @@ snError snFrameParser_processBytes(snFrameParser* parser,
                     parser->maskingKeyBytes[idx] = bytes[currentSrcByte];
                     if (idx == 3)
                     {
-                        for (i = 0; i < 4; i++)
-                        {
-                            parser->currentFrameHeader.maskingKey |= ((unsigned char*)parser->maskingKeyBytes)[i] << (3 - i) * 8;
-                        }
+                        parser->currentFrameHeader.maskingKey = (int)readUInt32BE((unsigned char*)parser->maskingKeyBytes);
                         doneParsingHeader = 1;
                     }
                 }
@@ -378,33 +681,60 @@ snError snFrameParser_processBytes(snFrameParser* parser,
             parser->currentHeaderSize - parser->currentFrameByte;
             const uint32_t bytesLeft = numBytes - currentSrcByte;
             unsigned long long chunkSize = bytesLeft < payloadBytesLeft ? bytesLeft : payloadBytesLeft;
+            const char* chunk = &bytes[currentSrcByte];
             
+            const int isStreaming = isStreamingFrame(parser);
             
-            if (parser->currentFrameHeader.opcode == SN_OPCODE_TEXT ||
-                (parser->currentFrameHeader.opcode == SN_OPCODE_CONTINUATION &&
-                 parser->continuationOpcode == SN_OPCODE_TEXT))
+            //a complete, unfragmented frame that lies entirely within
+            //the input can be delivered without copying its payload.
+            const int deliverInPlace = parser->zeroCopy &&
+                                       !isStreaming &&
+                                       parser->currentFrameByte == parser->currentHeaderSize &&
+                                       parser->currentFrameHeader.isFinal &&
+                                       parser->currentFrameHeader.opcode != SN_OPCODE_CONTINUATION &&
+                                       chunkSize == payloadBytesLeft;
+            
+            if (isTextFrame(parser))
             {
-                const int validUTF8 = snUTF8ValidateStringIncremental(&bytes[currentSrcByte], chunkSize, &parser->utf8State);
+                const int validUTF8 = snUTF8ValidateStringIncremental(chunk, chunkSize, &parser->utf8State);
                 if (!validUTF8)
                 {
                     return SN_INVALID_UTF8;
                 }
             }
             
-            //store ping/pong payload bytes in a separate buffer to allow for
-            //pings/pongs in between continuation frames.
-            if (parser->currentFrameHeader.opcode == SN_OPCODE_PING ||
-                parser->currentFrameHeader.opcode == SN_OPCODE_PONG)
+            if (isStreaming)
             {
-                memcpy(&parser->pingPongPayloadBuffer[parser->currentFrameByte - parser->currentHeaderSize],
-                       &bytes[currentSrcByte],
-                       chunkSize);
+                snError result = deliverMessageChunk(parser, chunk, (int)chunkSize, chunkSize == payloadBytesLeft);
+                if (result != SN_NO_ERROR)
+                {
+                    return result;
+                }
             }
-            else
+            else if (!deliverInPlace)
             {
-                memcpy(&parser->buffer[parser->continuationOffset + parser->currentFrameByte - parser->currentHeaderSize],
-                       &bytes[currentSrcByte],
-                       chunkSize);
+                //store control frame payload bytes in a separate buffer to allow for
+                //control frames in between continuation frames.
+                if (isControlFrame(&parser->currentFrameHeader))
+                {
+                    memcpy(&parser->pingPongPayloadBuffer[parser->currentFrameByte - parser->currentHeaderSize],
+                           chunk,
+                           chunkSize);
+                }
+                else
+                {
+                    //make room for the whole frame and a null terminator
+                    snError result = reserveBuffer(parser, parser->continuationOffset +
+                                                           parser->currentFrameHeader.payloadSize + 1);
+                    if (result != SN_NO_ERROR)
+                    {
+                        return result;
+                    }
+                    
+                    memcpy(&parser->buffer[parser->continuationOffset + parser->currentFrameByte - parser->currentHeaderSize],
+                           chunk,
+                           chunkSize);
+                }
             }
             
             parser->currentFrameByte += chunkSize;
@@ -414,7 +744,7 @@ snError snFrameParser_processBytes(snFrameParser* parser,
             
             if (parser->currentFrameByte == parser->currentFrameHeader.payloadSize + parser->currentHeaderSize)
             {
-                snError result = onFinishedParsingFrame(parser);
+                snError result = onFinishedParsingFrame(parser, deliverInPlace ? chunk : NULL);
                 if (result != SN_NO_ERROR)
                 {
                     return result;
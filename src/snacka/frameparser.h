@@ -53,17 +53,30 @@ extern "C"
         void* frameCallbackData;
         /** */
         snMessageCallback messageCallback;
+        /**
+         * If not NULL, text and binary payload bytes are passed to this
+         * callback as they arrive instead of being stored in \c buffer.
+         * Receives \c messageCallbackData.
+         */
+        snMessageChunkCallback chunkCallback;
         /** */
         void* messageCallbackData;
         /** */
         uint32_t maxFrameSize;
-        /** */
+        /** Stores the payloads of text and binary messages. */
         char* buffer;
+        /** The current size of \c buffer in bytes. */
+        uint32_t bufferSize;
+        /**
+         * Non-zero if \c buffer was allocated by the parser and grows
+         * on demand, up to \c maxFrameSize bytes.
+         */
+        int ownsBuffer;
         /** */
         char payloadSizeBytes[8];
         /** */
         char maskingKeyBytes[4];
-        /** */
+        /** Payloads of control frames, i.e pings, pongs and close frames. */
         char pingPongPayloadBuffer[128];
 
         /** */
@@ -74,8 +87,11 @@ extern "C"
         int currentHeaderSize;
         /** */
         int isParsingHeader;
-        /** */
-        uint32_t currentFrameByte;
+        /**
+         * The offset in the current frame, header included. Streamed
+         * frames are not limited in size, so it may exceed 32 bits.
+         */
+        unsigned long long currentFrameByte;
         /** */
         uint32_t firstPayloadSizeByte;
         /** */
@@ -88,6 +104,15 @@ extern "C"
         snOpcode continuationOpcode;
         /** */
         uint32_t utf8State;
+        /** Non-zero while a message is being passed to \c chunkCallback. */
+        int isStreamingMessage;
+        /**
+         * If non-zero, complete unfragmented frames lying entirely within
+         * the bytes passed to \c snFrameParser_processBytes are delivered
+         * as pointers into those bytes instead of being copied. Text
+         * payloads delivered this way are not null terminated.
+         */
+        int zeroCopy;
     } snFrameParser;
     
     /**
@@ -98,7 +123,9 @@ extern "C"
      * @param messageCallback A function to invoke when receiving a ping or pong
      * or a full text or binary message.
      * @param messageCallbackData A pointer to pass to \c messageCallback.
-     * @param readBuffer A buffer to store received payloads in.
+     * @param readBuffer A buffer of \c maxFrameSize bytes to store received payloads in.
+     * If NULL, the parser allocates a small buffer when the first message arrives
+     * and grows it as larger messages arrive.
      * @param maxFrameSize The maximum allowed frame size.
      */
     void snFrameParser_init(snFrameParser* parser,
@@ -115,6 +142,20 @@ extern "C"
      */
     void snFrameParser_deinit(snFrameParser* parser);
     
+    /**
+     * Shrinks a reassembly buffer allocated by the parser back to its
+     * initial size, unless a message is being received.
+     * @param parser The parser.
+     */
+    void snFrameParser_shrinkBuffer(snFrameParser* parser);
+    
+    /**
+     * Checks if \c snFrameParser_shrinkBuffer would release memory.
+     * @param parser The parser.
+     * @return Non-zero if the buffer can be shrunk.
+     */
+    int snFrameParser_canShrinkBuffer(const snFrameParser* parser);
+    
     /**
      * Resets the parser state.
      * @param parser The parser to reset.
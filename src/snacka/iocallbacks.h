@@ -40,6 +40,25 @@ extern "C"
 {
 #endif /* __cplusplus */
     
+    /**
+     * Kinds of I/O a websocket or I/O object waits for.
+     */
+    typedef enum snIOInterest
+    {
+        /** Waiting for data to read. */
+        SN_IO_READ = 1 << 0,
+        /** Waiting to be able to write. */
+        SN_IO_WRITE = 1 << 1,
+        /**
+         * Set by \c snIOGetFileDescriptorCallback if the descriptor is shared
+         * with other I/O objects, e.g an io_uring instance. Using one of them
+         * may take in events for the others, so before waiting and when the
+         * descriptor becomes ready, check the timeouts of all of them to find
+         * the ones to poll.
+         */
+        SN_IO_SHARED = 1 << 2
+    } snIOInterest;
+    
     /** Return zero to cancel. */
     typedef int (*snIOCancelCallback)(void* data);
     
@@ -61,6 +80,47 @@ extern "C"
                                            int port,
                                            snIOCancelCallback cancelCallback);
     
+    /**
+     * Checks if a connection started by \c snIOConnectCallback has been established.
+     * Must not block.
+     * @param ioObject The I/O object being connected.
+     * @param isConnected Set to non-zero once the connection is established.
+     * @return An error code if the connection attempt failed.
+     */
+    typedef snError (*snIOPollConnectCallback)(void* ioObject, int* isConnected);
+    
+    /**
+     * Blocks until data can be read from a custom I/O object, or until
+     * the object can be written to if requested, or until a timeout expires.
+     * While connecting, waits until the connection attempt needs polling.
+     * Waking up early is allowed.
+     * @param ioObject The I/O object to wait for.
+     * @param shouldWaitForWrite Non-zero to also wake up when data can be written.
+     * @param timeoutMs The maximum time to wait in milliseconds, or -1 to wait indefinitely.
+     * @return An error code.
+     */
+    typedef snError (*snIOWaitCallback)(void* ioObject, int shouldWaitForWrite, int timeoutMs);
+    
+    /**
+     * Gets a file descriptor that signals when a custom I/O object needs
+     * polling, for use with an external event loop. Must not block.
+     * @param ioObject The I/O object.
+     * @param interest On input, the \c snIOInterest flags the websocket is
+     * waiting for. On output, the events to watch the descriptor for.
+     * @param timeoutMs Set to the number of milliseconds until the I/O object
+     * needs polling even if the descriptor is not ready, or -1 for no limit.
+     * @return The file descriptor, or -1 if there is none at the moment.
+     */
+    typedef int (*snIOGetFileDescriptorCallback)(void* ioObject, int* interest, int* timeoutMs);
+    
+    /**
+     * Makes a call to \c snIOWaitCallback that is blocking return early, or
+     * the next call if none is blocking. Called from the thread posting a frame
+     * with \c snWebsocket_postFrame, so it must be safe to call from any thread.
+     * @param ioObject The I/O object to wake up.
+     */
+    typedef void (*snIOWakeCallback)(void* ioObject);
+    
     /**
      * Disconnects from a custom IO object.
      */
@@ -77,7 +137,9 @@ extern "C"
     typedef snError (*snIOReadCallback)(void* ioObject, char* buffer, int bufferSize, int* numBytesRead);
     
     /**
-     * Attempts to write data to a custom IO object
+     * Attempts to write data to a custom IO object. Should not block; if the
+     * I/O object can't take all of the data, \c numBytesWritten is set to the
+     * number of bytes actually written and the rest is retried later.
      */
     typedef snError (*snIOWriteCallback)(void* ioObject,
                                          const char* buffer,
@@ -85,6 +147,34 @@ extern "C"
                                          int* numBytesWritten,
                                          snIOCancelCallback cancelCallback);
     
+    /**
+     * One of the buffers of a vectored write.
+     */
+    typedef struct snIOBuffer
+    {
+        /** The bytes to write. */
+        const char* data;
+        /** The number of bytes to write. */
+        int size;
+    } snIOBuffer;
+    
+    /**
+     * Attempts to write the contents of a number of buffers, in order, to a
+     * custom IO object, preferably using a single system call. Partial writes
+     * are reported the same way as for \c snIOWriteCallback.
+     * @param ioObject The I/O object to write to.
+     * @param buffers The buffers to write.
+     * @param numBuffers The number of buffers.
+     * @param numBytesWritten The total number of bytes actually written.
+     * @param cancelCallback Called while waiting for the I/O object to become writable.
+     * @return An error code.
+     */
+    typedef snError (*snIOWritevCallback)(void* ioObject,
+                                          const snIOBuffer* buffers,
+                                          int numBuffers,
+                                          int* numBytesWritten,
+                                          snIOCancelCallback cancelCallback);
+    
     typedef float (*snTimeCallback)(void);
 
     /**
@@ -106,6 +196,20 @@ extern "C"
         snIOWriteCallback writeCallback;
         /** */
         snTimeCallback timeCallback;
+        /** Optional. If NULL, \c writeCallback is invoked once per buffer. */
+        snIOWritevCallback writevCallback;
+        /**
+         * Optional. If set, \c connectCallback only starts connecting without
+         * waiting for the connection, and this callback is invoked from
+         * \c snWebsocket_poll until the connection is established.
+         */
+        snIOPollConnectCallback pollConnectCallback;
+        /** Optional. Used by \c snWebsocket_pollWait to block until there is I/O to do. */
+        snIOWaitCallback waitCallback;
+        /** Optional. Used by \c snWebsocket_getFileDescriptor and friends. */
+        snIOGetFileDescriptorCallback getFileDescriptorCallback;
+        /** Optional. Used by \c snWebsocket_postFrame to wake up the polling thread. */
+        snIOWakeCallback wakeCallback;
 
     } snIOCallbacks;
     
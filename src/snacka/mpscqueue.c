@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2013, Per Gantelius
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the copyright holders.
+ */
+
+#include <stddef.h>
+
+#include "mpscqueue.h"
+
+void snMpscQueue_init(snMpscQueue* queue)
+{
+    queue->stub.next = NULL;
+    queue->head = &queue->stub;
+    queue->tail = &queue->stub;
+}
+
+void snMpscQueue_push(snMpscQueue* queue, snMpscNode* node)
+{
+    __atomic_store_n(&node->next, NULL, __ATOMIC_RELAXED);
+    
+    //the node is in the queue once it is the head. consumers
+    //see it once the previous head links to it.
+    snMpscNode* prev = __atomic_exchange_n(&queue->head, node, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+}
+
+snMpscNode* snMpscQueue_pop(snMpscQueue* queue)
+{
+    snMpscNode* tail = queue->tail;
+    snMpscNode* next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    
+    //skip the stub
+    if (tail == &queue->stub)
+    {
+        if (next == NULL)
+        {
+            return NULL;
+        }
+        queue->tail = next;
+        tail = next;
+        next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+    }
+    
+    if (next != NULL)
+    {
+        queue->tail = next;
+        return tail;
+    }
+    
+    //a producer has swapped in a new head but not yet linked it
+    if (tail != __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE))
+    {
+        return NULL;
+    }
+    
+    //tail is the last node. put the stub behind it so it can be popped.
+    snMpscQueue_push(queue, &queue->stub);
+    
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next != NULL)
+    {
+        queue->tail = next;
+        return tail;
+    }
+    
+    return NULL;
+}
+
+int snMpscQueue_isEmpty(snMpscQueue* queue)
+{
+    return queue->tail == &queue->stub &&
+           __atomic_load_n(&queue->stub.next, __ATOMIC_ACQUIRE) == NULL;
+}
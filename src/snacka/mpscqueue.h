@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2013, Per Gantelius
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the copyright holders.
+ */
+
+#ifndef SN_MPSC_QUEUE_H
+#define SN_MPSC_QUEUE_H
+
+/*! \file */
+
+/** The size to pad data written by different threads to. */
+#define SN_CACHE_LINE_SIZE 64
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+    
+    /**
+     * A link in a \c snMpscQueue, embedded as the first
+     * member of the items put in the queue.
+     */
+    typedef struct snMpscNode
+    {
+        /** The next node, towards the most recently pushed one. */
+        struct snMpscNode* next;
+    } snMpscNode;
+    
+    /**
+     * An intrusive lock-free queue that any number of threads can push
+     * to and a single thread pops from. Pushing never blocks or allocates.
+     */
+    typedef struct snMpscQueue
+    {
+        /** The most recently pushed node. Written by producers. */
+        snMpscNode* head;
+        /** Keeps \c head and \c tail on separate cache lines. */
+        char padding[SN_CACHE_LINE_SIZE - sizeof(snMpscNode*)];
+        /** The next node to pop. Only touched by the consumer. */
+        snMpscNode* tail;
+        /** Keeps the queue non-empty, so pushing is a single exchange. */
+        snMpscNode stub;
+    } snMpscQueue;
+    
+    /**
+     * Initializes an empty queue.
+     * @param queue The queue.
+     */
+    void snMpscQueue_init(snMpscQueue* queue);
+    
+    /**
+     * Pushes a node. Safe to call from any thread.
+     * @param queue The queue.
+     * @param node The node to push. Owned by the queue until popped.
+     */
+    void snMpscQueue_push(snMpscQueue* queue, snMpscNode* node);
+    
+    /**
+     * Pops the least recently pushed node. Must only be called from
+     * the consuming thread.
+     * @param queue The queue.
+     * @return The node, or NULL if the queue is empty or the next node is
+     * still being pushed, in which case it shows up once its push returns.
+     */
+    snMpscNode* snMpscQueue_pop(snMpscQueue* queue);
+    
+    /**
+     * Checks if there is anything to pop. Must only be called from the
+     * consuming thread.
+     * @param queue The queue.
+     * @return Non-zero if the queue is empty, or its only node is still being pushed.
+     */
+    int snMpscQueue_isEmpty(snMpscQueue* queue);
+    
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /*SN_MPSC_QUEUE_H*/
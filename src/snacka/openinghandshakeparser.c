@@ -29,6 +29,7 @@
 
 #include <assert.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
@@ -46,39 +47,61 @@ static const char* HTTP_WS_EXTENSIONS_NAME = "Sec-WebSocket-Extensions";
 
 static int on_header_field(http_parser* p, const char *at, size_t length)
 {
-    (void)length;
     snOpeningHandshakeParser* parser = (snOpeningHandshakeParser*)p->data;
     
-    parser->currentHeaderField = SN_UNRECOGNIZED_HTTP_FIELD;
+    //a header name may be split across several calls
+    if (!parser->isReadingHeaderName)
+    {
+        snMutableString_deinit(&parser->currentHeaderName);
+        parser->isReadingHeaderName = 1;
+    }
     
-    if (strncasecmp(at, HTTP_ACCEPT_FIELD_NAME, strlen(HTTP_ACCEPT_FIELD_NAME)) == 0)
+    snMutableString_appendBytes(&parser->currentHeaderName, at, (int)length);
+    
+    return 0;
+}
+
+/**
+ * Looks up the header whose name has been received.
+ */
+static snHandshakeResponseHTTPField getHeaderField(snOpeningHandshakeParser* parser)
+{
+    const char* name = snMutableString_getString(&parser->currentHeaderName);
+    
+    if (strcasecmp(name, HTTP_ACCEPT_FIELD_NAME) == 0)
     {
-        parser->currentHeaderField = SN_HTTP_ACCEPT;
+        return SN_HTTP_ACCEPT;
     }
-    else if (strncasecmp(at, HTTP_UPGRADE_FIELD_NAME, strlen(HTTP_UPGRADE_FIELD_NAME)) == 0)
+    else if (strcasecmp(name, HTTP_UPGRADE_FIELD_NAME) == 0)
     {
-        parser->currentHeaderField = SN_HTTP_UPGRADE;
+        return SN_HTTP_UPGRADE;
     }
-    else if (strncasecmp(at, HTTP_CONNECTION_FIELD_NAME, strlen(HTTP_CONNECTION_FIELD_NAME)) == 0)
+    else if (strcasecmp(name, HTTP_CONNECTION_FIELD_NAME) == 0)
     {
-        parser->currentHeaderField = SN_HTTP_CONNECTION;
+        return SN_HTTP_CONNECTION;
     }
-    else if (strncasecmp(at, HTTP_WS_PROTOCOL_NAME, strlen(HTTP_WS_PROTOCOL_NAME)) == 0)
+    else if (strcasecmp(name, HTTP_WS_PROTOCOL_NAME) == 0)
     {
-        parser->currentHeaderField = SN_HTTP_WS_PROTOCOL;
+        return SN_HTTP_WS_PROTOCOL;
     }
-    else if (strncasecmp(at, HTTP_WS_EXTENSIONS_NAME, strlen(HTTP_WS_EXTENSIONS_NAME)) == 0)
+    else if (strcasecmp(name, HTTP_WS_EXTENSIONS_NAME) == 0)
     {
-        parser->currentHeaderField = SN_HTTP_WS_EXTENSIONS;
+        return SN_HTTP_WS_EXTENSIONS;
     }
     
-    return 0;
+    return SN_UNRECOGNIZED_HTTP_FIELD;
 }
 
 static int on_header_value(http_parser* p, const char *at, size_t length)
 {
     snOpeningHandshakeParser* parser = (snOpeningHandshakeParser*)p->data;
     
+    if (parser->isReadingHeaderName)
+    {
+        parser->currentHeaderField = getHeaderField(parser);
+        parser->isReadingHeaderName = 0;
+    }
+    
     if (parser->currentHeaderField == SN_HTTP_ACCEPT)
     {
         snMutableString_appendBytes(&parser->acceptValue, at, length);
@@ -194,6 +217,7 @@ void snOpeningHandshakeParser_init(snOpeningHandshakeParser* p, snCryptoCallback
 
     p->cryptoCallbacks = cryptoCallbacks;
 
+    snMutableString_init(&p->currentHeaderName);
     snMutableString_init(&p->acceptValue);
     snMutableString_init(&p->connectionValue);
     snMutableString_init(&p->upgradeValue);
@@ -205,6 +229,8 @@ void snOpeningHandshakeParser_init(snOpeningHandshakeParser* p, snCryptoCallback
 
 void snOpeningHandshakeParser_deinit(snOpeningHandshakeParser* p)
 {
+    snMutableString_deinit(&p->expectedAcceptValue);
+    snMutableString_deinit(&p->currentHeaderName);
     snMutableString_deinit(&p->acceptValue);
     snMutableString_deinit(&p->connectionValue);
     snMutableString_deinit(&p->upgradeValue);
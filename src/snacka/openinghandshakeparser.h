@@ -72,6 +72,10 @@ extern "C"
         snError errorCode;
         /** */
         snHandshakeResponseHTTPField currentHeaderField;
+        /** The name of the header being parsed, which may arrive in pieces. */
+        snMutableString currentHeaderName;
+        /** Non-zero while receiving the name of a header, as opposed to its value. */
+        int isReadingHeaderName;
         /** */
         int reachedHeaderEnd;
         /** */
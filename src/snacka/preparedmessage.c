@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2013, Per Gantelius
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the copyright holders.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "preparedmessage.h"
+#include "utf8.h"
+
+snError snPreparedMessage_init(snPreparedMessage* message,
+                               snOpcode opcode,
+                               int payloadSize,
+                               const char* payload)
+{
+    memset(message, 0, sizeof(snPreparedMessage));
+    
+    if (payloadSize < 0 || (payloadSize > 0 && payload == NULL))
+    {
+        return SN_BAD_ARGS;
+    }
+    
+    message->header.opcode = opcode;
+    message->header.isFinal = 1;
+    message->header.isMasked = 1;
+    message->header.maskingKey = 1; //replaced when sending
+    message->header.payloadSize = payloadSize;
+    
+    snError result = snFrameHeader_validate(&message->header);
+    if (result != SN_NO_ERROR)
+    {
+        return result;
+    }
+    
+    if (opcode == SN_OPCODE_TEXT)
+    {
+        uint32_t state = 0;
+        if (!snUTF8ValidateStringIncremental(payload, payloadSize, &state) || state != 0)
+        {
+            return SN_INVALID_UTF8;
+        }
+    }
+    
+    result = snFrameHeader_toBytes(&message->header, message->headerBytes, &message->headerSize);
+    if (result != SN_NO_ERROR)
+    {
+        return result;
+    }
+    
+    message->payload = malloc(payloadSize > 0 ? payloadSize : 1);
+    if (message->payload == NULL)
+    {
+        return SN_OUT_OF_MEMORY;
+    }
+    
+    if (payloadSize > 0)
+    {
+        memcpy(message->payload, payload, payloadSize);
+    }
+    
+    return SN_NO_ERROR;
+}
+
+void snPreparedMessage_deinit(snPreparedMessage* message)
+{
+    free(message->payload);
+    memset(message, 0, sizeof(snPreparedMessage));
+}
+
+void snPreparedMessage_writeHeader(const snPreparedMessage* message, int maskingKey, char* headerBytes)
+{
+    const uint32_t key = (uint32_t)maskingKey;
+    const uint32_t keyOffset = message->headerSize - 4;
+    
+    memcpy(headerBytes, message->headerBytes, keyOffset);
+    headerBytes[keyOffset + 0] = (char)(key >> 24);
+    headerBytes[keyOffset + 1] = (char)(key >> 16);
+    headerBytes[keyOffset + 2] = (char)(key >> 8);
+    headerBytes[keyOffset + 3] = (char)(key >> 0);
+}
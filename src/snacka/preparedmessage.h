@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2013, Per Gantelius
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the copyright holders.
+ */
+
+#ifndef SN_PREPARED_MESSAGE_H
+#define SN_PREPARED_MESSAGE_H
+
+#include "errorcodes.h"
+#include "frameheader.h"
+
+/*! \file */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+    
+    /**
+     * A message that is validated and encoded once and can then be
+     * sent to any number of websockets. Only the masking key and the
+     * masking of the payload differ between connections.
+     */
+    typedef struct snPreparedMessage
+    {
+        /** The frame header. Its masking key is a placeholder. */
+        snFrameHeader header;
+        /** The serialized header. The last 4 bytes are the masking key placeholder. */
+        char headerBytes[SN_MAX_HEADER_SIZE];
+        /** The size of the serialized header. */
+        uint32_t headerSize;
+        /** A copy of the unmasked payload. */
+        char* payload;
+    } snPreparedMessage;
+    
+    /**
+     * Validates and encodes a message.
+     * @param message The message to initialize.
+     * @param opcode The opcode of the message.
+     * @param payloadSize The size of the payload in bytes.
+     * @param payload The payload, which is copied.
+     * @return An error code. \c SN_INVALID_UTF8 if a text payload is not valid UTF-8.
+     */
+    snError snPreparedMessage_init(snPreparedMessage* message,
+                                   snOpcode opcode,
+                                   int payloadSize,
+                                   const char* payload);
+    
+    /**
+     * Releases the resources held by a prepared message.
+     * @param message The message.
+     */
+    void snPreparedMessage_deinit(snPreparedMessage* message);
+    
+    /**
+     * Writes the serialized header of a prepared message with a given masking key.
+     * @param message The message.
+     * @param maskingKey The masking key to use.
+     * @param headerBytes Receives \c headerSize bytes.
+     */
+    void snPreparedMessage_writeHeader(const snPreparedMessage* message, int maskingKey, char* headerBytes);
+    
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /*SN_PREPARED_MESSAGE_H*/
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2013, Per Gantelius
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the copyright holders.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "spscring.h"
+
+snError snSpscRing_init(snSpscRing* ring, int elementSize, int capacity)
+{
+    memset(ring, 0, sizeof(snSpscRing));
+    
+    if (elementSize <= 0 || capacity <= 0)
+    {
+        return SN_BAD_ARGS;
+    }
+    
+    //positions wrap around, so indices are found by masking
+    unsigned roundedCapacity = 1;
+    while (roundedCapacity < (unsigned)capacity)
+    {
+        roundedCapacity *= 2;
+    }
+    
+    ring->elements = malloc((size_t)roundedCapacity * elementSize);
+    if (ring->elements == NULL)
+    {
+        return SN_OUT_OF_MEMORY;
+    }
+    
+    ring->elementSize = elementSize;
+    ring->capacity = roundedCapacity;
+    
+    return SN_NO_ERROR;
+}
+
+void snSpscRing_deinit(snSpscRing* ring)
+{
+    free(ring->elements);
+    ring->elements = NULL;
+}
+
+int snSpscRing_isFull(snSpscRing* ring)
+{
+    if (ring->head - ring->cachedTail < ring->capacity)
+    {
+        return 0;
+    }
+    
+    ring->cachedTail = __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST);
+    return ring->head - ring->cachedTail >= ring->capacity;
+}
+
+int snSpscRing_push(snSpscRing* ring, const void* element)
+{
+    if (snSpscRing_isFull(ring))
+    {
+        return 0;
+    }
+    
+    const unsigned index = ring->head & (ring->capacity - 1);
+    memcpy(ring->elements + (size_t)index * ring->elementSize, element, ring->elementSize);
+    
+    //sequentially consistent, so a consumer about to wait
+    //either sees the element or is seen waiting
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_SEQ_CST);
+    
+    return 1;
+}
+
+int snSpscRing_isEmpty(snSpscRing* ring)
+{
+    if (ring->cachedHead != ring->tail)
+    {
+        return 0;
+    }
+    
+    ring->cachedHead = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+    return ring->cachedHead == ring->tail;
+}
+
+int snSpscRing_pop(snSpscRing* ring, void* elements, int maxElements)
+{
+    if (maxElements <= 0 || snSpscRing_isEmpty(ring))
+    {
+        return 0;
+    }
+    
+    unsigned numElements = ring->cachedHead - ring->tail;
+    if (numElements > (unsigned)maxElements)
+    {
+        numElements = (unsigned)maxElements;
+    }
+    
+    //in at most two pieces, as the elements may wrap around
+    const unsigned index = ring->tail & (ring->capacity - 1);
+    const unsigned numFirst = ring->capacity - index < numElements ? ring->capacity - index : numElements;
+    memcpy(elements, ring->elements + (size_t)index * ring->elementSize, (size_t)numFirst * ring->elementSize);
+    memcpy((char*)elements + (size_t)numFirst * ring->elementSize,
+           ring->elements,
+           (size_t)(numElements - numFirst) * ring->elementSize);
+    
+    //sequentially consistent, so a producer about to wait
+    //for room either sees the room or is seen waiting
+    __atomic_store_n(&ring->tail, ring->tail + numElements, __ATOMIC_SEQ_CST);
+    
+    return (int)numElements;
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2013, Per Gantelius
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the copyright holders.
+ */
+
+#ifndef SN_SPSC_RING_H
+#define SN_SPSC_RING_H
+
+/*! \file */
+
+#include "errorcodes.h"
+
+#ifndef SN_CACHE_LINE_SIZE
+/** The size to pad data written by different threads to. */
+#define SN_CACHE_LINE_SIZE 64
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+    
+    /**
+     * A bounded lock-free queue of fixed size elements, pushed to by one
+     * thread and popped from by another. Each side keeps a copy of the
+     * other side's position and only reads the real one when the copy says
+     * the ring is full or empty, so the two threads rarely touch the same
+     * cache line.
+     */
+    typedef struct snSpscRing
+    {
+        /** The elements, \c capacity times \c elementSize bytes. */
+        char* elements;
+        /** The size of an element in bytes. */
+        int elementSize;
+        /** The number of elements the ring holds, a power of two. */
+        unsigned capacity;
+        /** Keeps the fields above from sharing a cache line with \c head. */
+        char padding0[SN_CACHE_LINE_SIZE];
+        /** The number of elements pushed so far. Written by the producer. */
+        unsigned head;
+        /** The producer's copy of \c tail. */
+        unsigned cachedTail;
+        /** Keeps \c head and \c tail on separate cache lines. */
+        char padding1[SN_CACHE_LINE_SIZE - 2 * sizeof(unsigned)];
+        /** The number of elements popped so far. Written by the consumer. */
+        unsigned tail;
+        /** The consumer's copy of \c head. */
+        unsigned cachedHead;
+    } snSpscRing;
+    
+    /**
+     * Initializes an empty ring.
+     * @param ring The ring.
+     * @param elementSize The size of an element in bytes.
+     * @param capacity The minimum number of elements to make room for.
+     * @return An error code.
+     */
+    snError snSpscRing_init(snSpscRing* ring, int elementSize, int capacity);
+    
+    /**
+     * Releases the memory of a ring. The elements are not touched.
+     * @param ring The ring.
+     */
+    void snSpscRing_deinit(snSpscRing* ring);
+    
+    /**
+     * Copies an element into the ring. Must only be called from the producing thread.
+     * @param ring The ring.
+     * @param element The element to push.
+     * @return Non-zero if the element was pushed, 0 if the ring is full.
+     */
+    int snSpscRing_push(snSpscRing* ring, const void* element);
+    
+    /**
+     * Copies elements out of the ring, least recently pushed first. Must
+     * only be called from the consuming thread.
+     * @param ring The ring.
+     * @param elements Receives the elements.
+     * @param maxElements The number of elements \c elements has room for.
+     * @return The number of elements popped.
+     */
+    int snSpscRing_pop(snSpscRing* ring, void* elements, int maxElements);
+    
+    /**
+     * Must only be called from the producing thread.
+     * @param ring The ring.
+     * @return Non-zero if there is no room for another element.
+     */
+    int snSpscRing_isFull(snSpscRing* ring);
+    
+    /**
+     * Must only be called from the consuming thread.
+     * @param ring The ring.
+     * @return Non-zero if there is nothing to pop.
+     */
+    int snSpscRing_isEmpty(snSpscRing* ring);
+    
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /*SN_SPSC_RING_H*/
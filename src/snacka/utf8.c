@@ -1,6 +1,12 @@
+#include <stddef.h>
 #include <string.h>
 #include "utf8.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SN_UTF8_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
 // Copyright (c) 2008-2009 Bjoern Hoehrmann <bjoern@hoehrmann.de>
 // See http://bjoern.hoehrmann.de/utf-8/decoder/dfa/ for details.
 
@@ -46,7 +52,7 @@ static int countCodePoints(const char* s, size_t* count)
     
     for (*count = 0; *s; ++s)
     {
-        if (!decode(&state, &codepoint, *s))
+        if (!decode(&state, &codepoint, (unsigned char)*s))
         {
             *count += 1;
         }
@@ -55,22 +61,350 @@ static int countCodePoints(const char* s, size_t* count)
     return state != UTF8_ACCEPT;
 }
 
-int snUTF8ValidateStringIncremental(const char* firstByte, int numBytes, uint32_t* state)
+/**
+ * Returns the number of leading ASCII bytes in a buffer, testing
+ * eight bytes at a time.
+ */
+static size_t countLeadingASCII(const unsigned char* bytes, size_t numBytes)
 {
-    int i;
+    size_t i = 0;
+    
+    for (; i + 8 <= numBytes; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        if (word & 0x8080808080808080ULL)
+        {
+            break;
+        }
+    }
+    
+    while (i < numBytes && bytes[i] < 0x80)
+    {
+        i++;
+    }
+    
+    return i;
+}
 
-    for (i = 0; i < numBytes; i++)
+/**
+ * Scalar validation. Runs of ASCII are skipped a word at a time and
+ * everything else goes through the DFA.
+ */
+static int validateScalar(const unsigned char* bytes, size_t numBytes, uint32_t* state)
+{
+    size_t i = 0;
+    uint32_t codepoint = 0;
+    
+    while (i < numBytes)
     {
-        uint32_t codepoint;
-        if (decode(state, &codepoint, firstByte[i]) == UTF8_REJECT)
+        if (*state == UTF8_ACCEPT)
         {
-            return 0;
+            i += countLeadingASCII(bytes + i, numBytes - i);
+            if (i == numBytes)
+            {
+                break;
+            }
         }
+        
+        do
+        {
+            if (decode(state, &codepoint, bytes[i++]) == UTF8_REJECT)
+            {
+                return 0;
+            }
+        } while (i < numBytes && *state != UTF8_ACCEPT);
     }
     
     return 1;
 }
 
+#ifdef SN_UTF8_X86_SIMD
+
+/** Inputs shorter than this are validated with the scalar code. */
+#define SN_UTF8_SIMD_MIN_SIZE 64
+
+/*
+ * The vectorized validators below implement the lookup algorithm
+ * described in "Validating UTF-8 In Less Than One Instruction Per Byte"
+ * by John Keiser and Daniel Lemire. Each byte is classified by looking
+ * up its high nibble, the low nibble of the previous byte and the high
+ * nibble of the previous byte in three 16 entry tables. The AND of the
+ * three lookups is non-zero for every two byte error pattern. Errors
+ * spanning three or four bytes (missing or superfluous continuation
+ * bytes) are caught by comparing against the positions that must be
+ * continuations. The validators take a buffer that ends on a code point
+ * boundary, so anything left incomplete at the end is an error.
+ */
+
+#define SN_UTF8_TOO_SHORT (1 << 0)
+#define SN_UTF8_TOO_LONG (1 << 1)
+#define SN_UTF8_OVERLONG_3 (1 << 2)
+#define SN_UTF8_TOO_LARGE (1 << 3)
+#define SN_UTF8_SURROGATE (1 << 4)
+#define SN_UTF8_OVERLONG_2 (1 << 5)
+#define SN_UTF8_TOO_LARGE_1000 (1 << 6)
+#define SN_UTF8_OVERLONG_4 (1 << 6)
+#define SN_UTF8_TWO_CONTS (1 << 7)
+#define SN_UTF8_CARRY (SN_UTF8_TOO_SHORT | SN_UTF8_TOO_LONG | SN_UTF8_TWO_CONTS)
+
+#define SN_UTF8_BYTE_1_HIGH_TABLE \
+    SN_UTF8_TOO_LONG, SN_UTF8_TOO_LONG, SN_UTF8_TOO_LONG, SN_UTF8_TOO_LONG, \
+    SN_UTF8_TOO_LONG, SN_UTF8_TOO_LONG, SN_UTF8_TOO_LONG, SN_UTF8_TOO_LONG, \
+    SN_UTF8_TWO_CONTS, SN_UTF8_TWO_CONTS, SN_UTF8_TWO_CONTS, SN_UTF8_TWO_CONTS, \
+    SN_UTF8_TOO_SHORT | SN_UTF8_OVERLONG_2, \
+    SN_UTF8_TOO_SHORT, \
+    SN_UTF8_TOO_SHORT | SN_UTF8_OVERLONG_3 | SN_UTF8_SURROGATE, \
+    SN_UTF8_TOO_SHORT | SN_UTF8_TOO_LARGE | SN_UTF8_TOO_LARGE_1000 | SN_UTF8_OVERLONG_4
+
+#define SN_UTF8_BYTE_1_LOW_TABLE \
+    SN_UTF8_CARRY | SN_UTF8_OVERLONG_3 | SN_UTF8_OVERLONG_2 | SN_UTF8_OVERLONG_4, \
+    SN_UTF8_CARRY | SN_UTF8_OVERLONG_2, \
+    SN_UTF8_CARRY, \
+    SN_UTF8_CARRY, \
+    SN_UTF8_CARRY | SN_UTF8_TOO_LARGE, \
+    SN_UTF8_CARRY | SN_UTF8_TOO_LARGE | SN_UTF8_TOO_LARGE_1000, \
+    SN_UTF8_CARRY | SN_UTF8_TOO_LARGE | SN_UTF8_TOO_LARGE_1000, \
+    SN_UTF8_CARRY | SN_UTF8_TOO_LARGE | SN_UTF8_TOO_LARGE_1000, \
+    SN_UTF8_CARRY | SN_UTF8_TOO_LARGE | SN_UTF8_TOO_LARGE_1000, \
+    SN_UTF8_CARRY | SN_UTF8_TOO_LARGE | SN_UTF8_TOO_LARGE_1000, \
+    SN_UTF8_CARRY | SN_UTF8_TOO_LARGE | SN_UTF8_TOO_LARGE_1000, \
+    SN_UTF8_CARRY | SN_UTF8_TOO_LARGE | SN_UTF8_TOO_LARGE_1000, \
+    SN_UTF8_CARRY | SN_UTF8_TOO_LARGE | SN_UTF8_TOO_LARGE_1000, \
+    SN_UTF8_CARRY | SN_UTF8_TOO_LARGE | SN_UTF8_TOO_LARGE_1000 | SN_UTF8_SURROGATE, \
+    SN_UTF8_CARRY | SN_UTF8_TOO_LARGE | SN_UTF8_TOO_LARGE_1000, \
+    SN_UTF8_CARRY | SN_UTF8_TOO_LARGE | SN_UTF8_TOO_LARGE_1000
+
+#define SN_UTF8_BYTE_2_HIGH_TABLE \
+    SN_UTF8_TOO_SHORT, SN_UTF8_TOO_SHORT, SN_UTF8_TOO_SHORT, SN_UTF8_TOO_SHORT, \
+    SN_UTF8_TOO_SHORT, SN_UTF8_TOO_SHORT, SN_UTF8_TOO_SHORT, SN_UTF8_TOO_SHORT, \
+    SN_UTF8_TOO_LONG | SN_UTF8_OVERLONG_2 | SN_UTF8_TWO_CONTS | SN_UTF8_OVERLONG_3 | SN_UTF8_TOO_LARGE_1000 | SN_UTF8_OVERLONG_4, \
+    SN_UTF8_TOO_LONG | SN_UTF8_OVERLONG_2 | SN_UTF8_TWO_CONTS | SN_UTF8_OVERLONG_3 | SN_UTF8_TOO_LARGE, \
+    SN_UTF8_TOO_LONG | SN_UTF8_OVERLONG_2 | SN_UTF8_TWO_CONTS | SN_UTF8_SURROGATE | SN_UTF8_TOO_LARGE, \
+    SN_UTF8_TOO_LONG | SN_UTF8_OVERLONG_2 | SN_UTF8_TWO_CONTS | SN_UTF8_SURROGATE | SN_UTF8_TOO_LARGE, \
+    SN_UTF8_TOO_SHORT, SN_UTF8_TOO_SHORT, SN_UTF8_TOO_SHORT, SN_UTF8_TOO_SHORT
+
+/**
+ * Validates a buffer ending on a code point boundary, 16 bytes at a time.
+ * @return 1 if the buffer is valid UTF-8, 0 otherwise.
+ */
+__attribute__((target("sse4.1")))
+static int validateSSE41(const unsigned char* bytes, size_t numBytes)
+{
+    const __m128i byte1HighTable = _mm_setr_epi8(SN_UTF8_BYTE_1_HIGH_TABLE);
+    const __m128i byte1LowTable = _mm_setr_epi8(SN_UTF8_BYTE_1_LOW_TABLE);
+    const __m128i byte2HighTable = _mm_setr_epi8(SN_UTF8_BYTE_2_HIGH_TABLE);
+    const __m128i lowNibbleMask = _mm_set1_epi8(0x0f);
+    const __m128i highBitMask = _mm_set1_epi8((char)0x80);
+    const __m128i incompleteMax = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+                                                -1, -1, -1, -1, -1, (char)0xef, (char)0xdf, (char)0xbf);
+    __m128i error = _mm_setzero_si128();
+    __m128i prevInput = _mm_setzero_si128();
+    __m128i prevIncomplete = _mm_setzero_si128();
+    size_t i = 0;
+    
+    while (i < numBytes)
+    {
+        __m128i input;
+        
+        if (i + 16 <= numBytes)
+        {
+            input = _mm_loadu_si128((const __m128i*)(bytes + i));
+        }
+        else
+        {
+            unsigned char last[16] = {0};
+            memcpy(last, bytes + i, numBytes - i);
+            input = _mm_loadu_si128((const __m128i*)last);
+        }
+        i += 16;
+        
+        if (_mm_movemask_epi8(input) == 0)
+        {
+            /* All ASCII. Only need to check that the previous block ended cleanly. */
+            error = _mm_or_si128(error, prevIncomplete);
+        }
+        else
+        {
+            __m128i prev1 = _mm_alignr_epi8(input, prevInput, 15);
+            __m128i prev2 = _mm_alignr_epi8(input, prevInput, 14);
+            __m128i prev3 = _mm_alignr_epi8(input, prevInput, 13);
+            __m128i byte1High = _mm_shuffle_epi8(byte1HighTable,
+                                                 _mm_and_si128(_mm_srli_epi16(prev1, 4), lowNibbleMask));
+            __m128i byte1Low = _mm_shuffle_epi8(byte1LowTable,
+                                                _mm_and_si128(prev1, lowNibbleMask));
+            __m128i byte2High = _mm_shuffle_epi8(byte2HighTable,
+                                                 _mm_and_si128(_mm_srli_epi16(input, 4), lowNibbleMask));
+            __m128i specialCases = _mm_and_si128(_mm_and_si128(byte1High, byte1Low), byte2High);
+            __m128i isThirdByte = _mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xe0 - 0x80)));
+            __m128i isFourthByte = _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xf0 - 0x80)));
+            __m128i mustBeContinuation = _mm_and_si128(_mm_or_si128(isThirdByte, isFourthByte), highBitMask);
+            
+            error = _mm_or_si128(error, _mm_xor_si128(mustBeContinuation, specialCases));
+            prevIncomplete = _mm_subs_epu8(input, incompleteMax);
+        }
+        prevInput = input;
+    }
+    
+    error = _mm_or_si128(error, prevIncomplete);
+    return _mm_testz_si128(error, error);
+}
+
+/**
+ * AVX2 version of validateSSE41, processing 32 bytes at a time.
+ */
+__attribute__((target("avx2")))
+static int validateAVX2(const unsigned char* bytes, size_t numBytes)
+{
+    const __m256i byte1HighTable = _mm256_setr_epi8(SN_UTF8_BYTE_1_HIGH_TABLE, SN_UTF8_BYTE_1_HIGH_TABLE);
+    const __m256i byte1LowTable = _mm256_setr_epi8(SN_UTF8_BYTE_1_LOW_TABLE, SN_UTF8_BYTE_1_LOW_TABLE);
+    const __m256i byte2HighTable = _mm256_setr_epi8(SN_UTF8_BYTE_2_HIGH_TABLE, SN_UTF8_BYTE_2_HIGH_TABLE);
+    const __m256i lowNibbleMask = _mm256_set1_epi8(0x0f);
+    const __m256i highBitMask = _mm256_set1_epi8((char)0x80);
+    const __m256i incompleteMax = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+                                                   -1, -1, -1, -1, -1, -1, -1, -1,
+                                                   -1, -1, -1, -1, -1, -1, -1, -1,
+                                                   -1, -1, -1, -1, -1, (char)0xef, (char)0xdf, (char)0xbf);
+    __m256i error = _mm256_setzero_si256();
+    __m256i prevInput = _mm256_setzero_si256();
+    __m256i prevIncomplete = _mm256_setzero_si256();
+    size_t i = 0;
+    
+    while (i < numBytes)
+    {
+        __m256i input;
+        
+        if (i + 32 <= numBytes)
+        {
+            input = _mm256_loadu_si256((const __m256i*)(bytes + i));
+        }
+        else
+        {
+            unsigned char last[32] = {0};
+            memcpy(last, bytes + i, numBytes - i);
+            input = _mm256_loadu_si256((const __m256i*)last);
+        }
+        i += 32;
+        
+        if (_mm256_movemask_epi8(input) == 0)
+        {
+            error = _mm256_or_si256(error, prevIncomplete);
+        }
+        else
+        {
+            /* The high lane of prevInput followed by the low lane of input. */
+            __m256i shifted = _mm256_permute2x128_si256(prevInput, input, 0x21);
+            __m256i prev1 = _mm256_alignr_epi8(input, shifted, 15);
+            __m256i prev2 = _mm256_alignr_epi8(input, shifted, 14);
+            __m256i prev3 = _mm256_alignr_epi8(input, shifted, 13);
+            __m256i byte1High = _mm256_shuffle_epi8(byte1HighTable,
+                                                    _mm256_and_si256(_mm256_srli_epi16(prev1, 4), lowNibbleMask));
+            __m256i byte1Low = _mm256_shuffle_epi8(byte1LowTable,
+                                                   _mm256_and_si256(prev1, lowNibbleMask));
+            __m256i byte2High = _mm256_shuffle_epi8(byte2HighTable,
+                                                    _mm256_and_si256(_mm256_srli_epi16(input, 4), lowNibbleMask));
+            __m256i specialCases = _mm256_and_si256(_mm256_and_si256(byte1High, byte1Low), byte2High);
+            __m256i isThirdByte = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xe0 - 0x80)));
+            __m256i isFourthByte = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xf0 - 0x80)));
+            __m256i mustBeContinuation = _mm256_and_si256(_mm256_or_si256(isThirdByte, isFourthByte), highBitMask);
+            
+            error = _mm256_or_si256(error, _mm256_xor_si256(mustBeContinuation, specialCases));
+            prevIncomplete = _mm256_subs_epu8(input, incompleteMax);
+        }
+        prevInput = input;
+    }
+    
+    error = _mm256_or_si256(error, prevIncomplete);
+    return _mm256_testz_si256(error, error);
+}
+
+typedef int (*snUTF8BlockValidator)(const unsigned char* bytes, size_t numBytes);
+
+/**
+ * Picks the widest validator supported by the CPU we're running on.
+ * Returns NULL if only the scalar code can be used.
+ */
+static snUTF8BlockValidator getBlockValidator(void)
+{
+    static int initialized = 0;
+    static snUTF8BlockValidator validator = NULL;
+    
+    if (!initialized)
+    {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+            validator = validateAVX2;
+        }
+        else if (__builtin_cpu_supports("sse4.1"))
+        {
+            validator = validateSSE41;
+        }
+        initialized = 1;
+    }
+    
+    return validator;
+}
+
+#endif /* SN_UTF8_X86_SIMD */
+
+int snUTF8ValidateStringIncremental(const char* firstByte, int numBytes, uint32_t* state)
+{
+    const unsigned char* bytes = (const unsigned char*)firstByte;
+    size_t size = numBytes > 0 ? (size_t)numBytes : 0;
+    size_t i = 0;
+    
+    if (*state == UTF8_REJECT)
+    {
+        return 0;
+    }
+    
+#ifdef SN_UTF8_X86_SIMD
+    if (size >= SN_UTF8_SIMD_MIN_SIZE)
+    {
+        snUTF8BlockValidator validator = getBlockValidator();
+        if (validator)
+        {
+            uint32_t codepoint = 0;
+            size_t end = size;
+            size_t j;
+            
+            /* Finish a code point left open by a previous call. */
+            while (i < size && *state != UTF8_ACCEPT)
+            {
+                if (decode(state, &codepoint, bytes[i++]) == UTF8_REJECT)
+                {
+                    return 0;
+                }
+            }
+            
+            /* Stop the vectorized part at the start of the last code point,
+             which may be continued in the next call. */
+            for (j = size; j > i && j + 4 > size; j--)
+            {
+                end = j - 1;
+                if ((bytes[j - 1] & 0xc0) != 0x80)
+                {
+                    break;
+                }
+            }
+            
+            if (end > i)
+            {
+                if (!validator(bytes + i, end - i))
+                {
+                    *state = UTF8_REJECT;
+                    return 0;
+                }
+                i = end;
+            }
+        }
+    }
+#endif /* SN_UTF8_X86_SIMD */
+    
+    return validateScalar(bytes + i, size - i, state);
+}
+
 int snUTF8ValidateString(const char* string)
 {
     size_t numCodePoints = 0;
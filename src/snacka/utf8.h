@@ -47,6 +47,9 @@ extern "C"
      * @param numBytes The number of bytes to process.
      * @param state On input, the initial validator state. On output, the validator
      * state after processing the data. 
+     * @return 0 if the bytes are not valid UTF-8, non-zero otherwise. A sequence
+     * that is cut off at the end of the bytes is valid; the validator state
+     * is non-zero in that case.
      */
     int snUTF8ValidateStringIncremental(const char* firstByte, int numBytes, uint32_t* state);
     
@@ -28,6 +28,9 @@
  */
 
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 #include <string.h>
 #include <sys/time.h>
 
@@ -38,6 +41,8 @@
 #include "logging.h"
 
 #include "frame.h"
+#include "mpscqueue.h"
+#include "spscring.h"
 #include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -46,8 +51,99 @@
 
 #define SN_DEFAULT_WRITE_CHUNK_SIZE 2048
 
+#define SN_DEFAULT_READ_BUFFER_SIZE 1024
+
+#define SN_DEFAULT_MAX_READS_PER_POLL 64
+
 #define SN_CLOSING_HANDSHAKE_TIMEOUT 2.0 //in seconds
 
+#define SN_READ_BUFFER_SHRINK_DELAY 10.0 //in seconds
+
+#define SN_MIN_OUTPUT_QUEUE_SIZE 4096
+
+#define SN_MAX_IDLE_OUTPUT_QUEUE_SIZE (1 << 16)
+
+#define SN_DEFAULT_FRAGMENT_SIZE (1 << 14)
+
+#define SN_MASKING_KEY_POOL_SIZE 64
+
+#define SN_MAX_MASKING_KEY_REFILLS 4
+
+#define SN_MIN_RECEIVE_QUEUE_SIZE 4096
+
+#define SN_DEFAULT_MESSAGE_RING_SIZE 256
+
+#define SN_DEFAULT_MAX_RECEIVE_QUEUE_SIZE (1 << 20)
+
+#define SN_READ_PAUSED_WRITE_RETRY_MS 10
+
+/**
+ * The header of a message in the receive queue, followed
+ * by the null terminated message data.
+ */
+typedef struct snQueuedMessage
+{
+    snOpcode opcode;
+    int numBytes;
+} snQueuedMessage;
+
+/**
+ * A frame posted with \c snWebsocket_postFrame,
+ * followed by the payload.
+ */
+typedef struct snPostedFrame
+{
+    /** Must be first. */
+    snMpscNode node;
+    snOpcode opcode;
+    int payloadSize;
+    char payload[];
+} snPostedFrame;
+
+/**
+ * The thread polling a websocket created with
+ * \c snWebsocketSettings.useIOThread set.
+ */
+typedef struct snIOThread
+{
+    pthread_t thread;
+    /** Held by the thread except while it's waiting. Guards the websocket. */
+    pthread_mutex_t mutex;
+    /** Signalled on \c mutex when the thread or other threads can go on. */
+    pthread_cond_t stateChanged;
+    /** Non-zero when the thread should exit. Guarded by \c mutex. */
+    int isStopping;
+    /** Non-zero while the thread is in the wait callback. Guarded by \c mutex. */
+    int isWaitingForIO;
+    /** The number of other threads waiting to use the websocket. Guarded by \c mutex. */
+    int numPendingCalls;
+    /** Non-zero while the thread is waiting for room in \c messages. */
+    int isProducerWaiting;
+    /**
+     * Non-zero while messages that didn't fit in \c messages wait in the
+     * receive queue of the websocket, while the thread waits for I/O.
+     */
+    int hasOverflow;
+    /** The number of bytes in the receive queue at which the thread stops reading. */
+    size_t maxOverflowSize;
+    /** Guards waiting for \c messageAvailable. */
+    pthread_mutex_t ringMutex;
+    /** Signalled on \c ringMutex when a message or state is published. */
+    pthread_cond_t messageAvailable;
+    /** Non-zero while a thread is waiting for \c messageAvailable. */
+    int isConsumerWaiting;
+    /** The state returned by \c snWebsocket_getState on other threads. */
+    snReadyState publishedState;
+    /** Received messages, with data allocated by the thread and freed by the consumer. */
+    snSpscRing messages;
+    /** The messages last returned by a receive function, freed by the next call. */
+    snReceivedMessage* heldMessages;
+    /** The number of messages in \c heldMessages. */
+    int numHeldMessages;
+    /** The allocated number of messages in \c heldMessages. */
+    int heldMessagesCapacity;
+} snIOThread;
+
 /** */
 struct snWebsocket
 {
@@ -71,18 +167,47 @@ struct snWebsocket
     snMutableString query;
     /** The maximum size of a frame, i.e header + payload. */
     uint32_t maxFrameSize;
-    /** Buffer used for storing frames. */
-    char* readBuffer;
     /** */
     int writeChunkSize;
     /** */
     char* writeChunkBuffer;
+    /** Bytes waiting to be written, from \c outputQueueStart to \c outputQueueEnd. */
+    char* outputQueue;
+    /** The allocated size of \c outputQueue. */
+    size_t outputQueueCapacity;
+    /** The offset of the first unwritten byte in \c outputQueue. */
+    size_t outputQueueStart;
+    /** The offset just past the last unwritten byte in \c outputQueue. */
+    size_t outputQueueEnd;
+    /** While greater than 0, outgoing frames are queued instead of written. */
+    int corkDepth;
+    /** Non-zero between \c snWebsocket_beginMessage and \c snWebsocket_endMessage. */
+    int isSendingMessage;
+    /** The opcode of the message being sent. */
+    snOpcode messageOpcode;
+    /** Non-zero if a frame of the message being sent has been sent. */
+    int hasSentMessageFrame;
+    /** The maximum payload size of the frames of a fragmented message. */
+    int fragmentSize;
+    /** Collects message data until there's enough for a frame. */
+    char* fragmentBuffer;
+    /** The number of bytes in \c fragmentBuffer. */
+    int numFragmentBytes;
     /** */
     int hasCompletedOpeningHandshake;
     /** */
     int hasSentCloseFrame;
+    /**
+     * Non-zero if the closing handshake is done but the close frame is
+     * still in the output queue. The connection is dropped once it's written.
+     */
+    int isDisconnectPending;
+    /** The status to disconnect with once the output queue is written. */
+    snStatusCode pendingCloseStatus;
     /** Timer used to force disconnect if the closing handshake is too slow. */
     float closingHandshakeTimer;
+    /** Time since data was last received, used to shrink the frame parser buffer. */
+    float readIdleTimer;
     /** */
     snReadyState websocketState;
     /** */
@@ -101,15 +226,124 @@ struct snWebsocket
     snLogCallback logCallback;
     /** */
     double prevPollTime;
-    /** */
-    char recvBuffer[1024];
+    /** Buffer used for reading from the I/O object. */
+    char* recvBuffer;
+    /** The size of \c recvBuffer in bytes. */
+    int recvBufferSize;
+    /** Stop reading in \c snWebsocket_poll after receiving this many bytes. */
+    int maxBytesPerPoll;
+    /** Stop reading in \c snWebsocket_poll after receiving this many frames. Ignored if 0. */
+    int maxFramesPerPoll;
+    /** The number of frames received during the current poll. */
+    int numFramesPolled;
+    /** Non-zero if the last poll stopped reading because its budget was used up. */
+    int hasPendingInput;
+    /** Non-zero while waiting for the I/O object to finish connecting. */
+    int isConnectingIOObject;
+    /** Non-zero masking keys for upcoming frames, used from the end. */
+    uint32_t maskingKeys[SN_MASKING_KEY_POOL_SIZE];
+    /** The number of unused keys in \c maskingKeys. */
+    int numMaskingKeys;
+    /** Messages waiting for \c snWebsocket_receive, from \c receiveQueueStart to \c receiveQueueEnd. */
+    char* receiveQueue;
+    /** The allocated size of \c receiveQueue. */
+    size_t receiveQueueCapacity;
+    /** The offset of the first message in \c receiveQueue. */
+    size_t receiveQueueStart;
+    /** The offset just past the last message in \c receiveQueue. */
+    size_t receiveQueueEnd;
+    /** The queue space of the messages last returned by a receive function. */
+    size_t receivedMessageSize;
+    /**
+     * Non-zero if created without I/O callbacks, in which case received bytes
+     * are passed in with \c snWebsocket_feed and output stays queued until
+     * taken with \c snWebsocket_drainOutput.
+     */
+    int isSansIO;
+    /** Frames posted from any thread, sent by the thread polling the websocket. */
+    snMpscQueue postedFrames;
+    /**
+     * The thread polling the websocket, or NULL if the application polls it.
+     * Messages that don't fit in its ring are kept in \c receiveQueue.
+     */
+    snIOThread* ioThread;
 };
 
 
-static int generateMaskingKey(void);
+static int generateMaskingKey(snWebsocket* ws);
+
+static snError sansIOInit(void** ioObject)
+{
+    *ioObject = NULL;
+    return SN_NO_ERROR;
+}
+
+static snError sansIODeinit(void* ioObject)
+{
+    return SN_NO_ERROR;
+}
+
+static snError sansIOConnect(void* ioObject, const char* host, int port, snIOCancelCallback cancelCallback)
+{
+    return SN_NO_ERROR;
+}
+
+static snError sansIODisconnect(void* ioObject)
+{
+    return SN_NO_ERROR;
+}
+
+static snError sansIORead(void* ioObject, char* buffer, int bufferSize, int* numBytesRead)
+{
+    *numBytesRead = 0;
+    return SN_NO_ERROR;
+}
+
+static snError sansIOWrite(void* ioObject,
+                           const char* buffer,
+                           int bufferSize,
+                           int* numBytesWritten,
+                           snIOCancelCallback cancelCallback)
+{
+    //keep everything in the output queue for snWebsocket_drainOutput
+    *numBytesWritten = 0;
+    return SN_NO_ERROR;
+}
+
+static float sansIOTime(void)
+{
+    return 0.0f;
+}
+
+/**
+ * Stands in for the I/O callbacks of websockets created without any,
+ * so the rest of the code doesn't need to tell the two kinds apart.
+ */
+static const snIOCallbacks sansIOCallbacks =
+{
+    sansIOInit,
+    sansIODeinit,
+    sansIOConnect,
+    sansIODisconnect,
+    sansIORead,
+    sansIOWrite,
+    sansIOTime
+};
 
 static void disconnectWithStatus(snWebsocket* ws, snStatusCode status, snError error);
 
+static void sendPostedFrames(snWebsocket* ws);
+
+static snError startIOThread(snWebsocket* ws, int messageRingSize, size_t maxOverflowSize);
+
+static void stopIOThread(snWebsocket* ws);
+
+static int isOnIOThread(snWebsocket* ws);
+
+static void beginCallFromOtherThread(snWebsocket* ws);
+
+static void endCallFromOtherThread(snWebsocket* ws);
+
 
 static void sn_log(snWebsocket* sn, const char* message, ...)
 {
@@ -123,558 +357,2418 @@ static void sn_log(snWebsocket* sn, const char* message, ...)
 }
 
 
-static int generateMaskingKey()
+/**
+ * Refills the masking key pool with a single call to the random callback.
+ * Zero keys are dropped, since they are not valid masking keys.
+ */
+static void refillMaskingKeys(snWebsocket* ws)
 {
-    return rand();
+    uint32_t keys[SN_MASKING_KEY_POOL_SIZE];
+    ws->cryptoCallbacks.randCallback((uint8_t*)keys, sizeof(keys));
+    
+    ws->numMaskingKeys = 0;
+    for (int i = 0; i < SN_MASKING_KEY_POOL_SIZE; i++)
+    {
+        if (keys[i] != 0)
+        {
+            ws->maskingKeys[ws->numMaskingKeys++] = keys[i];
+        }
+    }
 }
 
-
-snError snWebsocket_sendFrame(snWebsocket* ws, snOpcode opcode, int numPayloadBytes, const char* payload)
+/**
+ * Returns a non-zero masking key for the next outgoing frame. Keys come
+ * from a per connection pool, so the random callback is only invoked
+ * once every \c SN_MASKING_KEY_POOL_SIZE frames.
+ * @return The masking key, or 0 if the random callback keeps producing
+ * nothing but zeros, in which case the frame must not be sent.
+ */
+static int generateMaskingKey(snWebsocket* ws)
 {
-    if (ws->hasSentCloseFrame)
+    for (int i = 0; i < SN_MAX_MASKING_KEY_REFILLS && ws->numMaskingKeys == 0; i++)
     {
-        return SN_NO_ERROR;
+        refillMaskingKeys(ws);
     }
     
-    if (ws->websocketState != SN_STATE_OPEN)
+    if (ws->numMaskingKeys == 0)
     {
-        return SN_WEBSOCKET_CONNECTION_IS_NOT_OPEN;
+        return 0;
     }
     
-    snFrame f;
-    f.header.opcode = opcode;
-    f.header.isMasked = 1;
-    f.header.maskingKey = generateMaskingKey();
-    f.header.isFinal = 1;
-    f.header.payloadSize = numPayloadBytes;
+    return (int)ws->maskingKeys[--ws->numMaskingKeys];
+}
+
+
+/**
+ * Writes a number of buffers using the vectored write callback if there is one,
+ * or one write per buffer otherwise. Stops at the first partial write.
+ * @param ws The websocket.
+ * @param buffers The buffers to write.
+ * @param numBuffers The number of buffers.
+ * @param numBytesWritten The total number of bytes written.
+ * @return An error code.
+ */
+static snError writeBuffers(snWebsocket* ws, const snIOBuffer* buffers, int numBuffers, size_t* numBytesWritten)
+{
+    int n = 0;
     
-    snError validationResult = snFrameHeader_validate(&f.header);
+    *numBytesWritten = 0;
     
-    if (validationResult != SN_NO_ERROR)
+    if (ws->ioCallbacks.writevCallback)
     {
-        return validationResult;
+        snError result = ws->ioCallbacks.writevCallback(ws->ioObject,
+                                                        buffers,
+                                                        numBuffers,
+                                                        &n,
+                                                        ws->cancelCallback);
+        *numBytesWritten = n > 0 ? n : 0;
+        return result;
     }
     
-    f.payload = payload;
-    
-    unsigned long long payloadSize = f.header.payloadSize;
-    char headerBytes[SN_MAX_HEADER_SIZE];
-    uint32_t headerSize = 0;
-    snFrameHeader_toBytes(&f.header, headerBytes, &headerSize);
+    for (int i = 0; i < numBuffers; i++)
+    {
+        if (buffers[i].size <= 0)
+        {
+            continue;
+        }
+        
+        n = 0;
+        snError result = ws->ioCallbacks.writeCallback(ws->ioObject,
+                                                       buffers[i].data,
+                                                       buffers[i].size,
+                                                       &n,
+                                                       ws->cancelCallback);
+        if (result != SN_NO_ERROR)
+        {
+            return result;
+        }
+        
+        *numBytesWritten += n > 0 ? n : 0;
+        
+        if (n < buffers[i].size)
+        {
+            break;
+        }
+    }
     
-    assert(payloadSize + headerSize <= ws->maxFrameSize);
+    return SN_NO_ERROR;
+}
+
+/**
+ * Makes room for a number of bytes at the end of the output queue.
+ * @return A pointer to the free space or NULL if out of memory.
+ */
+static char* reserveOutput(snWebsocket* ws, size_t numBytes)
+{
+    if (ws->outputQueueStart == ws->outputQueueEnd)
+    {
+        ws->outputQueueStart = ws->outputQueueEnd = 0;
+    }
     
-    //send header
-    int nBytesWritten = 0;
-    snError sendResult = ws->ioCallbacks.writeCallback(ws->ioObject,
-                                                       headerBytes,
-                                                       headerSize,
-                                                       &nBytesWritten,
-                                                       ws->cancelCallback);
-    if (sendResult != SN_NO_ERROR)
+    if (ws->outputQueueStart > 0 && ws->outputQueueCapacity - ws->outputQueueEnd < numBytes)
     {
-        disconnectWithStatus(ws, SN_STATUS_UNEXPECTED_ERROR, sendResult);
-        return sendResult;
+        //move the unwritten bytes to the front
+        const size_t numQueued = ws->outputQueueEnd - ws->outputQueueStart;
+        memmove(ws->outputQueue, &ws->outputQueue[ws->outputQueueStart], numQueued);
+        ws->outputQueueStart = 0;
+        ws->outputQueueEnd = numQueued;
     }
     
-    //send masked payload in chunks
-    uint32_t numBytesSent = 0;
-    while (numBytesSent < payloadSize)
+    if (ws->outputQueueCapacity - ws->outputQueueEnd < numBytes)
     {
-        const int numBytesLeft = payloadSize - numBytesSent;
-        const int chunkSize = numBytesLeft < ws->writeChunkSize ? numBytesLeft : ws->writeChunkSize;
-        //copy the current chunk into the write buffer
-        memcpy(ws->writeChunkBuffer, &f.payload[numBytesSent], chunkSize);
-        //apply mask in place
-        snFrameHeader_applyMask(&f.header, ws->writeChunkBuffer, chunkSize, numBytesSent);
-        //send masked bytes
-        snError sendResult = ws->ioCallbacks.writeCallback(ws->ioObject,
-                                                           ws->writeChunkBuffer,
-                                                           chunkSize,
-                                                           &nBytesWritten,
-                                                           ws->cancelCallback);
-        if (sendResult != SN_NO_ERROR)
+        size_t newCapacity = ws->outputQueueCapacity > 0 ? ws->outputQueueCapacity : SN_MIN_OUTPUT_QUEUE_SIZE;
+        while (newCapacity - ws->outputQueueEnd < numBytes)
         {
-            disconnectWithStatus(ws, SN_STATUS_UNEXPECTED_ERROR, sendResult);
-            return sendResult;
+            newCapacity *= 2;
         }
-        //move to the next chunk
-        numBytesSent += chunkSize;
+        
+        char* newQueue = realloc(ws->outputQueue, newCapacity);
+        if (newQueue == NULL)
+        {
+            return NULL;
+        }
+        ws->outputQueue = newQueue;
+        ws->outputQueueCapacity = newCapacity;
+    }
+    
+    return &ws->outputQueue[ws->outputQueueEnd];
+}
+
+/**
+ * Appends bytes to the output queue.
+ */
+static snError queueOutput(snWebsocket* ws, const char* bytes, size_t numBytes)
+{
+    char* dst = reserveOutput(ws, numBytes);
+    if (dst == NULL)
+    {
+        return SN_OUT_OF_MEMORY;
     }
     
+    memcpy(dst, bytes, numBytes);
+    ws->outputQueueEnd += numBytes;
+    
     return SN_NO_ERROR;
 }
 
-static void sendCloseFrame(snWebsocket* ws, snStatusCode code)
+/**
+ * Removes written bytes from the front of the output queue.
+ */
+static void removeOutput(snWebsocket* ws, size_t numBytes)
 {
-    if (ws->hasSentCloseFrame)
+    ws->outputQueueStart += numBytes;
+    
+    if (ws->outputQueueStart < ws->outputQueueEnd)
     {
         return;
     }
     
-    ws->closingHandshakeTimer = 0.0f;
+    //don't hold on to a large queue after a burst
+    ws->outputQueueStart = ws->outputQueueEnd = 0;
+    if (ws->outputQueueCapacity > SN_MAX_IDLE_OUTPUT_QUEUE_SIZE)
+    {
+        free(ws->outputQueue);
+        ws->outputQueue = NULL;
+        ws->outputQueueCapacity = 0;
+    }
+}
 
-    char payload[2] = { (code >> 8) , (code >> 0) };
-    
-    snWebsocket_sendFrame(ws, SN_OPCODE_CONNECTION_CLOSE, 2, payload);
+/**
+ * Writes as much of the output queue as the I/O object accepts.
+ */
+static snError flushOutput(snWebsocket* ws)
+{
+    while (ws->outputQueueStart < ws->outputQueueEnd)
+    {
+        const size_t numQueued = ws->outputQueueEnd - ws->outputQueueStart;
+        const int numBytes = numQueued < INT_MAX ? (int)numQueued : INT_MAX;
+        int numBytesWritten = 0;
+        snError result = ws->ioCallbacks.writeCallback(ws->ioObject,
+                                                       &ws->outputQueue[ws->outputQueueStart],
+                                                       numBytes,
+                                                       &numBytesWritten,
+                                                       ws->cancelCallback);
+        if (result != SN_NO_ERROR)
+        {
+            return result;
+        }
+        
+        removeOutput(ws, numBytesWritten > 0 ? numBytesWritten : 0);
+        
+        if (numBytesWritten < numBytes)
+        {
+            return SN_NO_ERROR;
+        }
+    }
     
-    ws->hasSentCloseFrame = 1;
+    return SN_NO_ERROR;
 }
 
 /**
- * Intercepts state changes before passing them on to the user defined callback.
+ * Returns non-zero if outgoing data can be written without going through
+ * the output queue, i.e if the queue is empty and the websocket isn't corked.
  */
-void invokeStateCallback(snWebsocket* ws, snReadyState state)
+static int canWriteDirectly(snWebsocket* ws)
 {
-    if (state == SN_STATE_OPEN && ws->openCallback)
+    return ws->corkDepth == 0 && ws->outputQueueStart == ws->outputQueueEnd;
+}
+
+/**
+ * Writes a number of buffers, queueing whatever the I/O object doesn't accept
+ * right away. If the queue is not empty or the websocket is corked, all buffers
+ * are queued.
+ */
+static snError sendBuffers(snWebsocket* ws, const snIOBuffer* buffers, int numBuffers)
+{
+    size_t numBytesWritten = 0;
+    
+    if (canWriteDirectly(ws))
     {
-        ws->websocketState = state;
-        ws->openCallback(ws->callbackData);
+        snError result = writeBuffers(ws, buffers, numBuffers, &numBytesWritten);
+        if (result != SN_NO_ERROR)
+        {
+            return result;
+        }
     }
-    else if (state == SN_STATE_CLOSED && ws->websocketState == SN_STATE_CONNECTING && ws->closeCallback)
+    
+    for (int i = 0; i < numBuffers; i++)
     {
-        ws->websocketState = state;
-        //an error occurred before completing the opening handshake
-        ws->closeCallback(ws->callbackData, SN_STATUS_UNEXPECTED_ERROR);
+        const size_t size = buffers[i].size > 0 ? buffers[i].size : 0;
+        if (numBytesWritten >= size)
+        {
+            numBytesWritten -= size;
+            continue;
+        }
+        
+        snError result = queueOutput(ws, &buffers[i].data[numBytesWritten], size - numBytesWritten);
+        if (result != SN_NO_ERROR)
+        {
+            return result;
+        }
+        numBytesWritten = 0;
     }
-    else
+    
+    return SN_NO_ERROR;
+}
+
+/**
+ * Copies bytes from a list of buffers, starting at a given position,
+ * masking them on the way.
+ * @param header The header of the frame the bytes belong to.
+ * @param payloadOffset The position of the first byte in the frame payload.
+ * @param dst The destination.
+ * @param maxBytes The maximum number of bytes to copy.
+ * @param buffers The buffers to copy from.
+ * @param numBuffers The number of buffers.
+ * @param bufferIdx The buffer to start at. Updated to the next position to copy from.
+ * @param bufferOffset The offset into the start buffer. Updated to the next position to copy from.
+ * @return The number of bytes copied.
+ */
+static size_t gatherMasked(const snFrameHeader* header,
+                           unsigned long long payloadOffset,
+                           char* dst,
+                           size_t maxBytes,
+                           const snIOBuffer* buffers,
+                           int numBuffers,
+                           int* bufferIdx,
+                           int* bufferOffset)
+{
+    size_t numCopied = 0;
+    
+    while (*bufferIdx < numBuffers && numCopied < maxBytes)
     {
-        ws->websocketState = state;
+        const size_t numBytesLeft = buffers[*bufferIdx].size - *bufferOffset;
+        const size_t numBytes = numBytesLeft < maxBytes - numCopied ? numBytesLeft : maxBytes - numCopied;
+        snFrameHeader_copyMasked(header,
+                                 &dst[numCopied],
+                                 &buffers[*bufferIdx].data[*bufferOffset],
+                                 (int)numBytes,
+                                 (int)((payloadOffset + numCopied) & 3));
+        numCopied += numBytes;
+        *bufferOffset += (int)numBytes;
+        if (*bufferOffset == buffers[*bufferIdx].size)
+        {
+            (*bufferIdx)++;
+            *bufferOffset = 0;
+        }
     }
+    
+    return numCopied;
 }
 
 /**
- *
+ * Checks that a frame can be sent and creates its header.
+ * @param ws The websocket.
+ * @param opcode The opcode of the frame.
+ * @param isFinal Non-zero if this is the last frame of a message.
+ * @param payloadSize The payload size of the frame.
+ * @param header The header to create.
+ * @param headerBytes Receives the serialized header, at least \c SN_MAX_HEADER_SIZE bytes.
+ * @param headerSize Receives the size of the serialized header.
+ * @return An error code, \c SN_BAD_ARGS if the frame exceeds the max frame size.
  */
-static void disconnectWithStatus(snWebsocket* ws, snStatusCode status, snError error)
+static snError beginFrame(snWebsocket* ws,
+                          snOpcode opcode,
+                          int isFinal,
+                          unsigned long long payloadSize,
+                          snFrameHeader* header,
+                          char* headerBytes,
+                          uint32_t* headerSize)
 {
-    if (error == SN_NO_ERROR)
+    if (ws->websocketState != SN_STATE_OPEN)
     {
-        sendCloseFrame(ws, status);
+        return SN_WEBSOCKET_CONNECTION_IS_NOT_OPEN;
     }
     
-    ws->ioCallbacks.disconnectCallback(ws->ioObject);
+    header->opcode = opcode;
+    header->isMasked = 1;
+    header->maskingKey = generateMaskingKey(ws);
+    header->isFinal = isFinal;
+    header->payloadSize = payloadSize;
     
-    if (ws->closeCallback)
+    //fails with SN_MASKING_KEY_IS_ZERO if no key could be generated
+    snError validationResult = snFrameHeader_validate(header);
+    
+    if (validationResult != SN_NO_ERROR)
     {
-        ws->closeCallback(ws->callbackData, status);
+        return validationResult;
     }
     
-    invokeStateCallback(ws, SN_STATE_CLOSED);
+    *headerSize = 0;
+    snFrameHeader_toBytes(header, headerBytes, headerSize);
     
-    if (error != SN_NO_ERROR && ws->errorCallback)
+    if (payloadSize + *headerSize > ws->maxFrameSize)
     {
-        ws->errorCallback(ws->callbackData, error);
+        return SN_BAD_ARGS;
     }
+    
+    return SN_NO_ERROR;
 }
 
-static int isValidCloseCode(int code)
+/**
+ * Sends a frame header followed by a payload gathered from a number of buffers.
+ * @param ws The websocket.
+ * @param header The frame header.
+ * @param headerBytes The serialized frame header.
+ * @param headerSize The size of the serialized header.
+ * @param payloadSize The total size of the buffers.
+ * @param buffers The payload buffers.
+ * @param numBuffers The number of payload buffers.
+ * @return An error code.
+ */
+static snError sendMaskedPayload(snWebsocket* ws,
+                                 const snFrameHeader* header,
+                                 const char* headerBytes,
+                                 uint32_t headerSize,
+                                 unsigned long long payloadSize,
+                                 const snIOBuffer* buffers,
+                                 int numBuffers)
 {
-    switch (code)
+    snError result;
+    int bufferIdx = 0;
+    int bufferOffset = 0;
+    
+    if (canWriteDirectly(ws) && payloadSize <= (unsigned long long)ws->writeChunkSize)
     {
-        case SN_STATUS_NORMAL_CLOSURE:
-        case SN_STATUS_ENDPOINT_GOING_AWAY:
-        case SN_STATUS_PROTOCOL_ERROR:
-        case SN_STATUS_INVALID_DATA:
-        case SN_STATUS_INCONSISTENT_DATA:
-        case SN_STATUS_POLICY_VIOLATION:
-        case SN_STATUS_MESSAGE_TOO_BIG:
-        case SN_STATUS_MISSING_EXTENSION:
-        case SN_STATUS_UNEXPECTED_ERROR:
+        //mask the payload into the write buffer and send it along with the header
+        snIOBuffer out[2];
+        out[0].data = headerBytes;
+        out[0].size = (int)headerSize;
+        out[1].data = ws->writeChunkBuffer;
+        out[1].size = (int)gatherMasked(header, 0, ws->writeChunkBuffer, ws->writeChunkSize,
+                                        buffers, numBuffers, &bufferIdx, &bufferOffset);
+        
+        result = sendBuffers(ws, out, 2);
+        if (result != SN_NO_ERROR)
         {
-            return 1;
+            disconnectWithStatus(ws, SN_STATUS_UNEXPECTED_ERROR, result);
         }
-        default:
-            break;
+        
+        return result;
     }
     
-    //https://tools.ietf.org/html/rfc6455#section-7.4.2
+    //larger payloads are masked straight into the output queue and written
+    //with a single call, instead of one call per write buffer sized chunk
+    const int shouldFlush = canWriteDirectly(ws);
     
-    if (code >= 3000 && code <= 4999)
+    char* dst = reserveOutput(ws, headerSize + (size_t)payloadSize);
+    if (dst == NULL)
     {
-        return 1;
+        return SN_OUT_OF_MEMORY;
     }
+    memcpy(dst, headerBytes, headerSize);
+    gatherMasked(header, 0, dst + headerSize, (size_t)payloadSize, buffers, numBuffers, &bufferIdx, &bufferOffset);
+    ws->outputQueueEnd += headerSize + (size_t)payloadSize;
     
-    return 0;
+    if (shouldFlush)
+    {
+        result = flushOutput(ws);
+        if (result != SN_NO_ERROR)
+        {
+            disconnectWithStatus(ws, SN_STATUS_UNEXPECTED_ERROR, result);
+            return result;
+        }
+    }
+    
+    return SN_NO_ERROR;
 }
 
 /**
- * Intercepts parsed frames before passing them on to the user defined callback.
+ * Sends a frame with a payload gathered from a number of buffers.
  */
-void invokeFrameCallback(void* data, const snFrame* frame)
+static snError sendFrameBuffers(snWebsocket* ws,
+                                snOpcode opcode,
+                                int isFinal,
+                                const snIOBuffer* buffers,
+                                int numBuffers)
 {
-    snWebsocket* ws = (snWebsocket*)data;
-    
-    snError headerValidationResult = snFrameHeader_validate(&frame->header);
-    if (headerValidationResult != SN_NO_ERROR)
+    if (numBuffers < 0 || (numBuffers > 0 && buffers == NULL))
     {
-        //TODO: error handling
-        return;
+        return SN_BAD_ARGS;
     }
-        
-    if (ws->frameCallback)
+    
+    if (ws->hasSentCloseFrame)
     {
-        ws->frameCallback(ws->callbackData, frame);
+        return SN_NO_ERROR;
     }
     
-    if (frame->header.opcode == SN_OPCODE_CONNECTION_CLOSE)
+    unsigned long long payloadSize = 0;
+    for (int i = 0; i < numBuffers; i++)
     {
-        
-        int closeCode = SN_STATUS_NORMAL_CLOSURE;
-        if (frame->header.payloadSize == 1)
+        if (buffers[i].size < 0)
         {
-            closeCode = SN_STATUS_PROTOCOL_ERROR;
+            return SN_BAD_ARGS;
         }
-        else if (frame->header.payloadSize >= 2)
-        {
-            closeCode = (((unsigned char*)frame->payload)[0] << 8) |
-                        (((unsigned char*)frame->payload)[1] << 0);
-            if (!isValidCloseCode(closeCode))
-            {
-                closeCode = SN_STATUS_PROTOCOL_ERROR;
-            }
-            
-            const int messageSize = frame->header.payloadSize - 2;
-            char* temp = malloc(messageSize + 1);
-            memcpy(temp, &frame->payload[2], messageSize);
-            temp[messageSize] = '\0';
-            if (!snUTF8ValidateString(temp))
-            {
-                closeCode = SN_STATUS_INCONSISTENT_DATA;
-            }
-            free(temp);
-        }
-        
-        sendCloseFrame(ws, closeCode);
-        disconnectWithStatus(ws, closeCode, SN_NO_ERROR);
+        payloadSize += buffers[i].size;
     }
-    else if (frame->header.opcode == SN_OPCODE_PING)
+    
+    snFrameHeader header;
+    char headerBytes[SN_MAX_HEADER_SIZE];
+    uint32_t headerSize = 0;
+    snError result = beginFrame(ws, opcode, isFinal, payloadSize, &header, headerBytes, &headerSize);
+    if (result != SN_NO_ERROR)
     {
-        snWebsocket_sendFrame(ws, SN_OPCODE_PONG, frame->header.payloadSize, frame->payload);
+        return result;
     }
+    
+    return sendMaskedPayload(ws, &header, headerBytes, headerSize, payloadSize, buffers, numBuffers);
 }
 
-snWebsocket* snWebsocket_create(snOpenCallback openCallback,
-                                snMessageCallback messageCallback,
-                                snCloseCallback closeCallback,
-                                snErrorCallback errorCallback,
-                                void* callbackData,
-                                const snWebsocketSettings* settings)
+/**
+ * Sends a frame, masking the payload in place.
+ */
+static snError sendFrameInPlace(snWebsocket* ws, snOpcode opcode, int isFinal, int payloadSize, char* payload)
 {
-    if (settings == NULL ||
-        settings->ioCallbacks == NULL ||
-        settings->cryptoCallbacks == NULL)
-      return NULL;
-
-    snWebsocket* ws = (snWebsocket*)malloc(sizeof(snWebsocket));
-    memset(ws, 0, sizeof(snWebsocket));
-
-    memcpy(&ws->ioCallbacks, settings->ioCallbacks, sizeof(snIOCallbacks));
-    memcpy(&ws->cryptoCallbacks, settings->cryptoCallbacks, sizeof(snCryptoCallbacks));
-
-    ws->ioCallbacks.initCallback(&ws->ioObject);
-
-    ws->callbackData = callbackData;
-    ws->openCallback = openCallback;
-    ws->closeCallback = closeCallback;
-    ws->errorCallback = errorCallback;
-
-    ws->maxFrameSize = SN_DEFAULT_MAX_FRAME_SIZE;
-
-    ws->websocketState = SN_STATE_CLOSED;
-
-    ws->logCallback = snSilentLogCallback;
-
-    if (settings->maxFrameSize != 0)
+    if (payloadSize < 0 || (payloadSize > 0 && payload == NULL))
     {
-        ws->maxFrameSize = settings->maxFrameSize;
+        return SN_BAD_ARGS;
     }
-
-    if (settings->logCallback)
+    
+    if (ws->hasSentCloseFrame)
     {
-        ws->logCallback = settings->logCallback;
+        return SN_NO_ERROR;
     }
-
-    if (settings->frameCallback)
+    
+    snFrameHeader header;
+    char headerBytes[SN_MAX_HEADER_SIZE];
+    uint32_t headerSize = 0;
+    snError result = beginFrame(ws, opcode, isFinal, payloadSize, &header, headerBytes, &headerSize);
+    if (result != SN_NO_ERROR)
     {
-        ws->frameCallback = settings->frameCallback;
+        return result;
     }
-
-    if (settings->cancelCallback)
+    
+    //mask the caller's buffer and send it along with the header
+    snFrameHeader_applyMask(&header, payload, payloadSize, 0);
+    
+    snIOBuffer out[2];
+    out[0].data = headerBytes;
+    out[0].size = (int)headerSize;
+    out[1].data = payload;
+    out[1].size = payloadSize;
+    
+    result = sendBuffers(ws, out, 2);
+    if (result != SN_NO_ERROR)
     {
-        ws->cancelCallback = settings->cancelCallback;
+        disconnectWithStatus(ws, SN_STATUS_UNEXPECTED_ERROR, result);
     }
+    
+    return result;
+}
+
+/**
+ * Returns non-zero if a frame with a given opcode can be sent now, i.e if
+ * it's a control frame or no fragmented message is being sent.
+ */
+static int canSendFrame(snWebsocket* ws, snOpcode opcode)
+{
+    const int isControlFrame = (opcode & 0x8) != 0;
+    return isControlFrame || !ws->isSendingMessage;
+}
 
-    if (ws->readBuffer == 0)
+snError snWebsocket_sendFrameVectored(snWebsocket* ws, snOpcode opcode, const snIOBuffer* buffers, int numBuffers)
+{
+    if (!canSendFrame(ws, opcode))
     {
-        ws->readBuffer = malloc(ws->maxFrameSize);
-        memset(ws->readBuffer, 0, ws->maxFrameSize);
+        return SN_INVALID_MESSAGE_SEQUENCE;
     }
+    
+    return sendFrameBuffers(ws, opcode, 1, buffers, numBuffers);
+}
 
-    ws->writeChunkSize = SN_DEFAULT_WRITE_CHUNK_SIZE;
-    ws->writeChunkBuffer = malloc(ws->writeChunkSize);
-
-    snFrameParser_init(&ws->frameParser,
-                       invokeFrameCallback,
-                       ws,
-                       messageCallback,
-                       callbackData,
-                       ws->readBuffer,
-                       ws->maxFrameSize);
+snError snWebsocket_sendFrameInPlace(snWebsocket* ws, snOpcode opcode, int payloadSize, char* payload)
+{
+    if (!canSendFrame(ws, opcode))
+    {
+        return SN_INVALID_MESSAGE_SEQUENCE;
+    }
     
-    return ws;
+    return sendFrameInPlace(ws, opcode, 1, payloadSize, payload);
 }
 
+snError snWebsocket_sendFrame(snWebsocket* ws, snOpcode opcode, int numPayloadBytes, const char* payload)
+{
+    snIOBuffer buffer;
+    buffer.data = payload;
+    buffer.size = numPayloadBytes;
+    
+    return snWebsocket_sendFrameVectored(ws, opcode, &buffer, 1);
+}
 
-void snWebsocket_delete(snWebsocket* ws)
+snError snWebsocket_sendPreparedMessage(snWebsocket* ws, const snPreparedMessage* message)
 {
-    if (ws->ioObject)
+    if (!canSendFrame(ws, message->header.opcode))
     {
-        ws->ioCallbacks.deinitCallback(ws->ioObject);
+        return SN_INVALID_MESSAGE_SEQUENCE;
     }
     
-    snFrameParser_deinit(&ws->frameParser);
-    snOpeningHandshakeParser_deinit(&ws->openingHandshakeParser);
+    if (ws->hasSentCloseFrame)
+    {
+        return SN_NO_ERROR;
+    }
     
-    snMutableString_deinit(&ws->host);
-    snMutableString_deinit(&ws->path);
-    snMutableString_deinit(&ws->query);
+    if (ws->websocketState != SN_STATE_OPEN)
+    {
+        return SN_WEBSOCKET_CONNECTION_IS_NOT_OPEN;
+    }
     
-    free(ws->readBuffer);
+    if (message->headerSize + message->header.payloadSize > ws->maxFrameSize)
+    {
+        return SN_BAD_ARGS;
+    }
     
-    free(ws->writeChunkBuffer);
-
-    free(ws);
+    //the header only needs a new masking key
+    snFrameHeader header = message->header;
+    header.maskingKey = generateMaskingKey(ws);
+    if (header.maskingKey == 0)
+    {
+        return SN_MASKING_KEY_IS_ZERO;
+    }
+    char headerBytes[SN_MAX_HEADER_SIZE];
+    snPreparedMessage_writeHeader(message, header.maskingKey, headerBytes);
+    
+    snIOBuffer payload;
+    payload.data = message->payload;
+    payload.size = (int)header.payloadSize;
+    
+    return sendMaskedPayload(ws, &header, headerBytes, message->headerSize, header.payloadSize, &payload, 1);
 }
 
-static void sendOpeningHandshake(snWebsocket* ws)
+snError snWebsocket_broadcastPreparedMessage(snWebsocket** websockets,
+                                             int numWebsockets,
+                                             const snPreparedMessage* message)
 {
-    snMutableString* req = malloc(sizeof(snMutableString));
-    snMutableString_init(req);
-    
-    snOpeningHandshakeParser_createOpeningHandshakeRequest(&ws->openingHandshakeParser,
-                                                           snMutableString_getString(&ws->host),
-                                                           ws->port,
-                                                           snMutableString_getString(&ws->path),
-                                                           snMutableString_getString(&ws->query),
-                                                           req);
+    snError firstError = SN_NO_ERROR;
     
-    const char* reqStr = snMutableString_getString(req);
-    
-    int numBytesWritten = 0;
-    ws->ioCallbacks.writeCallback(ws->ioObject,
-                                  reqStr,
-                                  (int)strlen(reqStr),
-                                  &numBytesWritten,
-                                  ws->cancelCallback);
+    for (int i = 0; i < numWebsockets; i++)
+    {
+        snError result = snWebsocket_sendPreparedMessage(websockets[i], message);
+        if (firstError == SN_NO_ERROR)
+        {
+            firstError = result;
+        }
+    }
     
-    snMutableString_deinit(req);
-    free(req);
+    return firstError;
 }
 
-snError snWebsocket_connect(snWebsocket* ws, const char* host, const char* path, const char* query, int port, snHTTPHeader* headers, int numHeaders)
+/**
+ * Sends the collected message data as the next frame of the message being
+ * sent. Fails the connection if the peer has already received part of the
+ * message, since any data frame sent after that would have to continue it.
+ */
+static snError sendFragment(snWebsocket* ws, int isFinal)
 {
-    if (host == NULL)
-      return SN_BAD_ARGS;
-
-    snMutableString_deinit(&ws->host);
-    snMutableString_deinit(&ws->path);
-    snMutableString_deinit(&ws->query);
+    const int hasSentMessageFrame = ws->hasSentMessageFrame;
+    const snOpcode opcode = hasSentMessageFrame ? SN_OPCODE_CONTINUATION : ws->messageOpcode;
+    snError result = sendFrameInPlace(ws, opcode, isFinal, ws->numFragmentBytes, ws->fragmentBuffer);
     
-    snFrameParser_reset(&ws->frameParser);
-    snOpeningHandshakeParser_init(&ws->openingHandshakeParser, &ws->cryptoCallbacks, headers, numHeaders);
+    ws->hasSentMessageFrame = 1;
+    ws->numFragmentBytes = 0;
     
-    invokeStateCallback(ws, SN_STATE_CONNECTING);
+    if (result != SN_NO_ERROR && hasSentMessageFrame && ws->websocketState != SN_STATE_CLOSED)
+    {
+        disconnectWithStatus(ws, SN_STATUS_UNEXPECTED_ERROR, result);
+    }
     
-    ws->port = port;
-    snMutableString_append(&ws->host, host);
-
-    if (path != NULL)
-        snMutableString_append(&ws->path, path);
+    return result;
+}
 
-    if (query != NULL)
-        snMutableString_append(&ws->query, query);
-        
-    if (ws->port < 0)
+snError snWebsocket_beginMessage(snWebsocket* ws, snOpcode opcode)
+{
+    if (opcode != SN_OPCODE_TEXT && opcode != SN_OPCODE_BINARY)
     {
-        //no port given in the url. use default port 80
-        ws->port = 80;
+        return SN_BAD_ARGS;
     }
-        
-    snError e = ws->ioCallbacks.connectCallback(ws->ioObject,
-                                                snMutableString_getString(&ws->host),
-                                                ws->port,
-                                                ws->cancelCallback);
     
-    if (e != SN_NO_ERROR)
+    if (ws->isSendingMessage)
     {
-        invokeStateCallback(ws, SN_STATE_CLOSED);
-        return e;
+        return SN_INVALID_MESSAGE_SEQUENCE;
     }
     
-    ws->hasCompletedOpeningHandshake = 0;
-    ws->hasSentCloseFrame = 0;
+    if (ws->websocketState != SN_STATE_OPEN)
+    {
+        return SN_WEBSOCKET_CONNECTION_IS_NOT_OPEN;
+    }
     
-    sendOpeningHandshake(ws);
+    if (ws->fragmentBuffer == NULL)
+    {
+        ws->fragmentBuffer = malloc(ws->fragmentSize);
+        if (ws->fragmentBuffer == NULL)
+        {
+            return SN_OUT_OF_MEMORY;
+        }
+    }
+    
+    ws->isSendingMessage = 1;
+    ws->messageOpcode = opcode;
+    ws->hasSentMessageFrame = 0;
+    ws->numFragmentBytes = 0;
     
     return SN_NO_ERROR;
 }
 
-void snWebsocket_disconnect(snWebsocket* ws, int disconnectImmediately)
+snError snWebsocket_appendMessage(snWebsocket* ws, int numBytes, const char* bytes)
 {
-    if (disconnectImmediately)
+    if (numBytes < 0 || (numBytes > 0 && bytes == NULL))
     {
-        disconnectWithStatus(ws, SN_STATUS_ENDPOINT_GOING_AWAY, SN_NO_ERROR);
+        return SN_BAD_ARGS;
     }
-    else
+    
+    if (!ws->isSendingMessage)
     {
-        sendCloseFrame(ws, SN_STATUS_NORMAL_CLOSURE);
-        invokeStateCallback(ws, SN_STATE_CLOSING);
+        return SN_INVALID_MESSAGE_SEQUENCE;
     }
+    
+    while (numBytes > 0)
+    {
+        //a full fragment is only sent when more data arrives, so
+        //that there's always a frame left for endMessage to send
+        if (ws->numFragmentBytes == ws->fragmentSize)
+        {
+            snError result = sendFragment(ws, 0);
+            if (result != SN_NO_ERROR)
+            {
+                ws->isSendingMessage = 0;
+                return result;
+            }
+        }
+        
+        const int spaceLeft = ws->fragmentSize - ws->numFragmentBytes;
+        const int n = numBytes < spaceLeft ? numBytes : spaceLeft;
+        memcpy(&ws->fragmentBuffer[ws->numFragmentBytes], bytes, n);
+        ws->numFragmentBytes += n;
+        bytes += n;
+        numBytes -= n;
+    }
+    
+    return SN_NO_ERROR;
 }
 
-snReadyState snWebsocket_getState(snWebsocket* ws)
-{
-    return ws->websocketState;
-}
-
-snError snWebsocket_sendPing(snWebsocket* ws, int payloadSize, const char* payload)
-{
-    return snWebsocket_sendFrame(ws, SN_OPCODE_PING, payloadSize, payload);
-}
-
-snError snWebsocket_sendTextData(snWebsocket* ws, const char* payload)
+snError snWebsocket_endMessage(snWebsocket* ws)
 {
-    return snWebsocket_sendFrame(ws, SN_OPCODE_TEXT, strlen(payload), payload);
+    if (!ws->isSendingMessage)
+    {
+        return SN_INVALID_MESSAGE_SEQUENCE;
+    }
+    
+    ws->isSendingMessage = 0;
+    
+    snError e = sendFragment(ws, 1);
+    
+    //frames posted while sending the message had to wait for it
+    if (e == SN_NO_ERROR)
+    {
+        sendPostedFrames(ws);
+    }
+    
+    return e;
 }
 
-snError snWebsocket_sendBinaryData(snWebsocket* ws, int payloadSize, const char* payload)
+void snWebsocket_cork(snWebsocket* ws)
 {
-    return snWebsocket_sendFrame(ws, SN_OPCODE_BINARY, payloadSize, payload);
+    ws->corkDepth++;
 }
 
-static void handlePaserResult(snWebsocket* ws, snError error)
+snError snWebsocket_uncork(snWebsocket* ws)
 {
-    if (error == SN_NO_ERROR)
+    if (ws->corkDepth == 0)
     {
-        return;
+        return SN_NO_ERROR;
     }
     
-    //printf("handle parser result: error %d\n", error);
-    
-    snStatusCode status = SN_STATUS_PROTOCOL_ERROR;
+    ws->corkDepth--;
     
-    if (error == SN_INVALID_UTF8)
+    if (ws->corkDepth > 0 || ws->websocketState == SN_STATE_CLOSED)
     {
-        status = SN_STATUS_INCONSISTENT_DATA;
+        return SN_NO_ERROR;
     }
     
-    if (ws->errorCallback)
+    snError result = flushOutput(ws);
+    if (result != SN_NO_ERROR)
     {
-        ws->errorCallback(ws->callbackData, error);
+        disconnectWithStatus(ws, SN_STATUS_UNEXPECTED_ERROR, result);
     }
     
-    disconnectWithStatus(ws, status, error);
+    return result;
 }
 
-void snWebsocket_poll(snWebsocket* ws)
+snError snWebsocket_sendBatch(snWebsocket* ws, const snOutgoingMessage* messages, int numMessages)
 {
-    int i;
-
-    if (ws->websocketState == SN_STATE_CLOSED)
+    if (numMessages < 0 || (numMessages > 0 && messages == NULL))
     {
-        return;
+        return SN_BAD_ARGS;
     }
-
-    //update timer
+    
+    snError result = SN_NO_ERROR;
+    
+    snWebsocket_cork(ws);
+    
+    for (int i = 0; i < numMessages && result == SN_NO_ERROR; i++)
     {
-        int firstPoll = ws->prevPollTime == 0.0f;
+        result = snWebsocket_sendFrame(ws, messages[i].opcode, messages[i].payloadSize, messages[i].payload);
+    }
+    
+    snError flushResult = snWebsocket_uncork(ws);
+    
+    return result != SN_NO_ERROR ? result : flushResult;
+}
+
+/**
+ * Returns non-zero if there are posted frames that can be sent now.
+ */
+static int hasPostedFramesToSend(snWebsocket* ws)
+{
+    return ws->websocketState == SN_STATE_OPEN &&
+           !ws->isSendingMessage &&
+           !snMpscQueue_isEmpty(&ws->postedFrames);
+}
+
+/**
+ * Sends the frames posted from other threads using a single write.
+ */
+static void sendPostedFrames(snWebsocket* ws)
+{
+    if (!hasPostedFramesToSend(ws))
+    {
+        return;
+    }
+    
+    snWebsocket_cork(ws);
+    
+    snMpscNode* node = NULL;
+    while ((node = snMpscQueue_pop(&ws->postedFrames)) != NULL)
+    {
+        snPostedFrame* frame = (snPostedFrame*)node;
+        snError e = snWebsocket_sendFrame(ws, frame->opcode, frame->payloadSize, frame->payload);
+        free(frame);
+        
+        //there is no caller to return the error to
+        if (e != SN_NO_ERROR && ws->errorCallback)
+        {
+            ws->errorCallback(ws->callbackData, e);
+        }
+    }
+    
+    snWebsocket_uncork(ws);
+}
+
+static void discardPostedFrames(snWebsocket* ws)
+{
+    snMpscNode* node = NULL;
+    while ((node = snMpscQueue_pop(&ws->postedFrames)) != NULL)
+    {
+        free(node);
+    }
+}
+
+snError snWebsocket_postFrame(snWebsocket* ws, snOpcode opcode, int payloadSize, const char* payload)
+{
+    if (payloadSize < 0 || (payloadSize > 0 && payload == NULL))
+    {
+        return SN_BAD_ARGS;
+    }
+    
+    //reject the frame here, where the caller sees the error, rather than when it's sent
+    if ((uint32_t)payloadSize > ws->maxFrameSize - SN_MAX_HEADER_SIZE)
+    {
+        return SN_BAD_ARGS;
+    }
+    
+    snPostedFrame* frame = malloc(sizeof(snPostedFrame) + payloadSize);
+    if (frame == NULL)
+    {
+        return SN_OUT_OF_MEMORY;
+    }
+    
+    frame->opcode = opcode;
+    frame->payloadSize = payloadSize;
+    if (payloadSize > 0)
+    {
+        memcpy(frame->payload, payload, payloadSize);
+    }
+    
+    snMpscQueue_push(&ws->postedFrames, &frame->node);
+    
+    if (ws->ioCallbacks.wakeCallback)
+    {
+        ws->ioCallbacks.wakeCallback(ws->ioObject);
+    }
+    
+    //an I/O thread that stopped reading waits for the application instead
+    if (ws->ioThread && __atomic_load_n(&ws->ioThread->isProducerWaiting, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock(&ws->ioThread->mutex);
+        pthread_cond_broadcast(&ws->ioThread->stateChanged);
+        pthread_mutex_unlock(&ws->ioThread->mutex);
+    }
+    
+    return SN_NO_ERROR;
+}
+
+unsigned long long snWebsocket_getBufferedAmount(snWebsocket* ws)
+{
+    return ws->outputQueueEnd - ws->outputQueueStart;
+}
+
+static void sendCloseFrame(snWebsocket* ws, snStatusCode code)
+{
+    if (ws->hasSentCloseFrame)
+    {
+        return;
+    }
+    
+    ws->closingHandshakeTimer = 0.0f;
+
+    char payload[2] = { (code >> 8) , (code >> 0) };
+    
+    snWebsocket_sendFrame(ws, SN_OPCODE_CONNECTION_CLOSE, 2, payload);
+    
+    ws->hasSentCloseFrame = 1;
+}
+
+/**
+ * Intercepts state changes before passing them on to the user defined callback.
+ */
+void invokeStateCallback(snWebsocket* ws, snReadyState state)
+{
+    if (state == SN_STATE_OPEN && ws->openCallback)
+    {
+        ws->websocketState = state;
+        ws->openCallback(ws->callbackData);
+    }
+    else if (state == SN_STATE_CLOSED && ws->websocketState == SN_STATE_CONNECTING && ws->closeCallback)
+    {
+        ws->websocketState = state;
+        //an error occurred before completing the opening handshake
+        ws->closeCallback(ws->callbackData, SN_STATUS_UNEXPECTED_ERROR);
+    }
+    else
+    {
+        ws->websocketState = state;
+    }
+}
+
+/**
+ *
+ */
+static void disconnectWithStatus(snWebsocket* ws, snStatusCode status, snError error)
+{
+    //there is no connection to send a close frame on
+    //if the I/O object is still connecting
+    if (error == SN_NO_ERROR && !ws->isConnectingIOObject)
+    {
+        sendCloseFrame(ws, status);
+        flushOutput(ws);
+    }
+    
+    ws->isConnectingIOObject = 0;
+    ws->isDisconnectPending = 0;
+    
+    discardPostedFrames(ws);
+    
+    //without an I/O object, the close frame is left for snWebsocket_drainOutput
+    if (!ws->isSansIO)
+    {
+        ws->outputQueueStart = ws->outputQueueEnd = 0;
+    }
+    ws->ioCallbacks.disconnectCallback(ws->ioObject);
+    
+    if (ws->closeCallback)
+    {
+        ws->closeCallback(ws->callbackData, status);
+    }
+    
+    //the close callback was just invoked, so don't go through
+    //invokeStateCallback, which would invoke it again for
+    //websockets that were still connecting
+    ws->websocketState = SN_STATE_CLOSED;
+    
+    if (error != SN_NO_ERROR && ws->errorCallback)
+    {
+        ws->errorCallback(ws->callbackData, error);
+    }
+}
+
+/**
+ * Sends a close frame and disconnects once it has been written, or when
+ * the closing handshake times out if the I/O object doesn't accept it.
+ */
+static void disconnectAfterFlushing(snWebsocket* ws, snStatusCode status)
+{
+    sendCloseFrame(ws, status);
+    
+    snError e = flushOutput(ws);
+    if (e != SN_NO_ERROR)
+    {
+        disconnectWithStatus(ws, SN_STATUS_UNEXPECTED_ERROR, e);
+        return;
+    }
+    
+    if (ws->outputQueueStart == ws->outputQueueEnd || ws->isSansIO)
+    {
+        disconnectWithStatus(ws, status, SN_NO_ERROR);
+        return;
+    }
+    
+    ws->isDisconnectPending = 1;
+    ws->pendingCloseStatus = status;
+    invokeStateCallback(ws, SN_STATE_CLOSING);
+}
+
+static int isValidCloseCode(int code)
+{
+    switch (code)
+    {
+        case SN_STATUS_NORMAL_CLOSURE:
+        case SN_STATUS_ENDPOINT_GOING_AWAY:
+        case SN_STATUS_PROTOCOL_ERROR:
+        case SN_STATUS_INVALID_DATA:
+        case SN_STATUS_INCONSISTENT_DATA:
+        case SN_STATUS_POLICY_VIOLATION:
+        case SN_STATUS_MESSAGE_TOO_BIG:
+        case SN_STATUS_MISSING_EXTENSION:
+        case SN_STATUS_UNEXPECTED_ERROR:
+        {
+            return 1;
+        }
+        default:
+            break;
+    }
+    
+    //https://tools.ietf.org/html/rfc6455#section-7.4.2
+    
+    if (code >= 3000 && code <= 4999)
+    {
+        return 1;
+    }
+    
+    return 0;
+}
+
+/**
+ * Intercepts parsed frames before passing them on to the user defined callback.
+ */
+void invokeFrameCallback(void* data, const snFrame* frame)
+{
+    snWebsocket* ws = (snWebsocket*)data;
+    
+    ws->numFramesPolled++;
+    
+    snError headerValidationResult = snFrameHeader_validate(&frame->header);
+    if (headerValidationResult != SN_NO_ERROR)
+    {
+        //TODO: error handling
+        return;
+    }
+        
+    if (ws->frameCallback)
+    {
+        ws->frameCallback(ws->callbackData, frame);
+    }
+    
+    if (frame->header.opcode == SN_OPCODE_CONNECTION_CLOSE)
+    {
+        
+        int closeCode = SN_STATUS_NORMAL_CLOSURE;
+        if (frame->header.payloadSize == 1)
+        {
+            closeCode = SN_STATUS_PROTOCOL_ERROR;
+        }
+        else if (frame->header.payloadSize >= 2)
+        {
+            closeCode = (((unsigned char*)frame->payload)[0] << 8) |
+                        (((unsigned char*)frame->payload)[1] << 0);
+            if (!isValidCloseCode(closeCode))
+            {
+                closeCode = SN_STATUS_PROTOCOL_ERROR;
+            }
+            
+            const int messageSize = frame->header.payloadSize - 2;
+            char* temp = malloc(messageSize + 1);
+            memcpy(temp, &frame->payload[2], messageSize);
+            temp[messageSize] = '\0';
+            if (!snUTF8ValidateString(temp))
+            {
+                closeCode = SN_STATUS_INCONSISTENT_DATA;
+            }
+            free(temp);
+        }
+        
+        disconnectAfterFlushing(ws, closeCode);
+    }
+    else if (frame->header.opcode == SN_OPCODE_PING)
+    {
+        snWebsocket_sendFrame(ws, SN_OPCODE_PONG, frame->header.payloadSize, frame->payload);
+    }
+}
+
+/**
+ * The space a message takes up in the receive queue, keeping headers aligned.
+ */
+static size_t queuedMessageSize(int numBytes)
+{
+    const size_t size = sizeof(snQueuedMessage) + numBytes + 1;
+    return (size + 7) & ~(size_t)7;
+}
+
+/**
+ * Wakes up a thread waiting for a message or state change
+ * in \c snWebsocket_receiveBatch, if any.
+ */
+static void notifyConsumer(snIOThread* thread)
+{
+    if (__atomic_load_n(&thread->isConsumerWaiting, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock(&thread->ringMutex);
+        pthread_cond_signal(&thread->messageAvailable);
+        pthread_mutex_unlock(&thread->ringMutex);
+    }
+}
+
+/**
+ * Hands a copy of a received message over to the application
+ * through the ring of the I/O thread.
+ * @return Zero if the ring is full.
+ */
+static int pushReceivedMessage(snWebsocket* ws, snOpcode opcode, const char* bytes, int numBytes)
+{
+    snIOThread* thread = ws->ioThread;
+    
+    if (snSpscRing_isFull(&thread->messages))
+    {
+        return 0;
+    }
+    
+    char* messageBytes = malloc(numBytes + 1);
+    if (messageBytes == NULL)
+    {
+        if (ws->errorCallback)
+        {
+            ws->errorCallback(ws->callbackData, SN_OUT_OF_MEMORY);
+        }
+        return 1;
+    }
+    
+    memcpy(messageBytes, bytes, numBytes);
+    messageBytes[numBytes] = '\0';
+    
+    snReceivedMessage message;
+    message.opcode = opcode;
+    message.bytes = messageBytes;
+    message.numBytes = numBytes;
+    snSpscRing_push(&thread->messages, &message);
+    
+    notifyConsumer(thread);
+    
+    return 1;
+}
+
+/**
+ * Moves messages received while the ring of the I/O
+ * thread was full to the ring, as far as they fit.
+ */
+static void moveOverflowToRing(snWebsocket* ws)
+{
+    while (ws->receiveQueueStart < ws->receiveQueueEnd)
+    {
+        const snQueuedMessage* message = (const snQueuedMessage*)&ws->receiveQueue[ws->receiveQueueStart];
+        if (!pushReceivedMessage(ws, message->opcode, (const char*)(message + 1), message->numBytes))
+        {
+            return;
+        }
+        ws->receiveQueueStart += queuedMessageSize(message->numBytes);
+    }
+    
+    ws->receiveQueueStart = ws->receiveQueueEnd = 0;
+}
+
+/**
+ * Checks if the I/O thread of a websocket has kept so many messages that
+ * didn't fit in its ring that it should stop reading from the connection.
+ * It keeps reading while closing, so the closing handshake can complete.
+ */
+static int isReadPaused(snWebsocket* ws)
+{
+    return ws->ioThread != NULL &&
+           ws->websocketState != SN_STATE_CLOSING &&
+           ws->receiveQueueEnd - ws->receiveQueueStart >= ws->ioThread->maxOverflowSize;
+}
+
+/**
+ * Makes the state of a websocket polled by an I/O thread visible to
+ * other threads. A closed websocket is reported as closing until
+ * all its messages have been handed over.
+ */
+static void publishState(snWebsocket* ws)
+{
+    snIOThread* thread = ws->ioThread;
+    
+    snReadyState state = ws->websocketState;
+    if (state == SN_STATE_CLOSED && ws->receiveQueueStart < ws->receiveQueueEnd)
+    {
+        state = SN_STATE_CLOSING;
+    }
+    
+    if (__atomic_exchange_n(&thread->publishedState, state, __ATOMIC_SEQ_CST) != state)
+    {
+        notifyConsumer(thread);
+    }
+}
+
+/**
+ * Used as the message callback of websockets without one,
+ * to keep messages for \c snWebsocket_receive.
+ */
+static void queueReceivedMessage(void* data, snOpcode opcode, const char* bytes, int numBytes)
+{
+    snWebsocket* ws = (snWebsocket*)data;
+    
+    //pings and pongs are answered by the websocket
+    if (opcode != SN_OPCODE_TEXT && opcode != SN_OPCODE_BINARY)
+    {
+        return;
+    }
+    
+    //messages only wait in the receive queue while the ring is full,
+    //so they are handed over in the order they arrived
+    if (ws->ioThread &&
+        ws->receiveQueueStart == ws->receiveQueueEnd &&
+        pushReceivedMessage(ws, opcode, bytes, numBytes))
+    {
+        return;
+    }
+    
+    const size_t size = queuedMessageSize(numBytes);
+    
+    if (ws->receiveQueueStart > 0 &&
+        ws->receiveQueueEnd + size > ws->receiveQueueCapacity)
+    {
+        //make room by moving the queued messages to the front
+        const size_t numQueuedBytes = ws->receiveQueueEnd - ws->receiveQueueStart;
+        memmove(ws->receiveQueue, ws->receiveQueue + ws->receiveQueueStart, numQueuedBytes);
+        ws->receiveQueueStart = 0;
+        ws->receiveQueueEnd = numQueuedBytes;
+    }
+    
+    if (ws->receiveQueueEnd + size > ws->receiveQueueCapacity)
+    {
+        size_t capacity = ws->receiveQueueCapacity > 0 ? 2 * ws->receiveQueueCapacity : SN_MIN_RECEIVE_QUEUE_SIZE;
+        while (capacity < ws->receiveQueueEnd + size)
+        {
+            capacity *= 2;
+        }
+        
+        char* queue = realloc(ws->receiveQueue, capacity);
+        if (queue == NULL)
+        {
+            if (ws->errorCallback)
+            {
+                ws->errorCallback(ws->callbackData, SN_OUT_OF_MEMORY);
+            }
+            return;
+        }
+        
+        ws->receiveQueue = queue;
+        ws->receiveQueueCapacity = capacity;
+    }
+    
+    snQueuedMessage* message = (snQueuedMessage*)&ws->receiveQueue[ws->receiveQueueEnd];
+    message->opcode = opcode;
+    message->numBytes = numBytes;
+    char* messageBytes = (char*)(message + 1);
+    memcpy(messageBytes, bytes, numBytes);
+    messageBytes[numBytes] = '\0';
+    
+    ws->receiveQueueEnd += size;
+}
+
+snWebsocket* snWebsocket_create(snOpenCallback openCallback,
+                                snMessageCallback messageCallback,
+                                snCloseCallback closeCallback,
+                                snErrorCallback errorCallback,
+                                void* callbackData,
+                                const snWebsocketSettings* settings)
+{
+    if (settings == NULL ||
+        settings->cryptoCallbacks == NULL)
+      return NULL;
+    
+    //the I/O thread blocks in the wait callback and
+    //other threads interrupt it with the wake callback
+    if (settings->useIOThread &&
+        (settings->ioCallbacks == NULL ||
+         settings->ioCallbacks->waitCallback == NULL ||
+         settings->ioCallbacks->wakeCallback == NULL))
+      return NULL;
+
+    snWebsocket* ws = (snWebsocket*)malloc(sizeof(snWebsocket));
+    memset(ws, 0, sizeof(snWebsocket));
+
+    ws->isSansIO = settings->ioCallbacks == NULL;
+    memcpy(&ws->ioCallbacks, ws->isSansIO ? &sansIOCallbacks : settings->ioCallbacks, sizeof(snIOCallbacks));
+    memcpy(&ws->cryptoCallbacks, settings->cryptoCallbacks, sizeof(snCryptoCallbacks));
+
+    ws->ioCallbacks.initCallback(&ws->ioObject);
+    
+    snMpscQueue_init(&ws->postedFrames);
+
+    ws->callbackData = callbackData;
+    ws->openCallback = openCallback;
+    ws->closeCallback = closeCallback;
+    ws->errorCallback = errorCallback;
+
+    ws->maxFrameSize = SN_DEFAULT_MAX_FRAME_SIZE;
+
+    ws->websocketState = SN_STATE_CLOSED;
+
+    ws->logCallback = snSilentLogCallback;
+
+    if (settings->maxFrameSize != 0)
+    {
+        ws->maxFrameSize = settings->maxFrameSize;
+    }
+
+    if (settings->logCallback)
+    {
+        ws->logCallback = settings->logCallback;
+    }
+
+    if (settings->frameCallback)
+    {
+        ws->frameCallback = settings->frameCallback;
+    }
+
+    if (settings->cancelCallback)
+    {
+        ws->cancelCallback = settings->cancelCallback;
+    }
+
+    ws->writeChunkSize = SN_DEFAULT_WRITE_CHUNK_SIZE;
+    ws->writeChunkBuffer = malloc(ws->writeChunkSize);
+    
+    //outgoing frames must fit within the max frame size
+    ws->fragmentSize = settings->fragmentSize > 0 ? settings->fragmentSize : SN_DEFAULT_FRAGMENT_SIZE;
+    if (ws->fragmentSize > (int)ws->maxFrameSize - SN_MAX_HEADER_SIZE)
+    {
+        ws->fragmentSize = ws->maxFrameSize - SN_MAX_HEADER_SIZE;
+    }
+    
+    //received bytes are passed in by the application without an I/O object
+    ws->recvBufferSize = settings->readBufferSize > 0 ? settings->readBufferSize : SN_DEFAULT_READ_BUFFER_SIZE;
+    ws->recvBuffer = ws->isSansIO ? NULL : malloc(ws->recvBufferSize);
+    
+    ws->maxBytesPerPoll = settings->maxBytesPerPoll > 0 ? settings->maxBytesPerPoll :
+                          SN_DEFAULT_MAX_READS_PER_POLL * ws->recvBufferSize;
+    ws->maxFramesPerPoll = settings->maxFramesPerPoll;
+
+    //only kept for snWebsocket_receive when asked for, since
+    //a queue nobody takes messages from would grow forever
+    const int shouldQueueMessages = settings->queueMessages &&
+                                    messageCallback == NULL &&
+                                    settings->messageChunkCallback == NULL;
+    
+    snFrameParser_init(&ws->frameParser,
+                       invokeFrameCallback,
+                       ws,
+                       shouldQueueMessages ? queueReceivedMessage : messageCallback,
+                       shouldQueueMessages ? (void*)ws : callbackData,
+                       NULL, //grows on demand, up to maxFrameSize
+                       ws->maxFrameSize);
+    ws->frameParser.zeroCopy = settings->zeroCopyMessages;
+    ws->frameParser.chunkCallback = settings->messageChunkCallback;
+    
+    if (settings->useIOThread &&
+        startIOThread(ws,
+                      settings->messageRingSize > 0 ? settings->messageRingSize : SN_DEFAULT_MESSAGE_RING_SIZE,
+                      settings->maxReceiveQueueSize > 0 ? settings->maxReceiveQueueSize : SN_DEFAULT_MAX_RECEIVE_QUEUE_SIZE) != SN_NO_ERROR)
+    {
+        snWebsocket_delete(ws);
+        return NULL;
+    }
+    
+    return ws;
+}
+
+
+void snWebsocket_delete(snWebsocket* ws)
+{
+    if (ws->ioThread)
+    {
+        stopIOThread(ws);
+    }
+    
+    if (ws->ioObject)
+    {
+        ws->ioCallbacks.deinitCallback(ws->ioObject);
+    }
+    
+    snFrameParser_deinit(&ws->frameParser);
+    snOpeningHandshakeParser_deinit(&ws->openingHandshakeParser);
+    
+    snMutableString_deinit(&ws->host);
+    snMutableString_deinit(&ws->path);
+    snMutableString_deinit(&ws->query);
+    
+    free(ws->writeChunkBuffer);
+    free(ws->outputQueue);
+    free(ws->fragmentBuffer);
+    free(ws->receiveQueue);
+    
+    free(ws->recvBuffer);
+    
+    discardPostedFrames(ws);
+
+    free(ws);
+}
+
+static void sendOpeningHandshake(snWebsocket* ws)
+{
+    snMutableString* req = malloc(sizeof(snMutableString));
+    snMutableString_init(req);
+    
+    snOpeningHandshakeParser_createOpeningHandshakeRequest(&ws->openingHandshakeParser,
+                                                           snMutableString_getString(&ws->host),
+                                                           ws->port,
+                                                           snMutableString_getString(&ws->path),
+                                                           snMutableString_getString(&ws->query),
+                                                           req);
+    
+    snIOBuffer buffer;
+    buffer.data = snMutableString_getString(req);
+    buffer.size = (int)strlen(buffer.data);
+    
+    sendBuffers(ws, &buffer, 1);
+    
+    snMutableString_deinit(req);
+    free(req);
+}
+
+static snError connectWebsocket(snWebsocket* ws, const char* host, const char* path, const char* query, int port, snHTTPHeader* headers, int numHeaders)
+{
+    if (host == NULL)
+      return SN_BAD_ARGS;
+
+    snMutableString_deinit(&ws->host);
+    snMutableString_deinit(&ws->path);
+    snMutableString_deinit(&ws->query);
+    
+    snFrameParser_reset(&ws->frameParser);
+    snOpeningHandshakeParser_init(&ws->openingHandshakeParser, &ws->cryptoCallbacks, headers, numHeaders);
+    
+    invokeStateCallback(ws, SN_STATE_CONNECTING);
+    
+    ws->port = port;
+    snMutableString_append(&ws->host, host);
+
+    if (path != NULL)
+        snMutableString_append(&ws->path, path);
+
+    if (query != NULL)
+        snMutableString_append(&ws->query, query);
+        
+    if (ws->port < 0)
+    {
+        //no port given in the url. use default port 80
+        ws->port = 80;
+    }
+        
+    snError e = ws->ioCallbacks.connectCallback(ws->ioObject,
+                                                snMutableString_getString(&ws->host),
+                                                ws->port,
+                                                ws->cancelCallback);
+    
+    if (e != SN_NO_ERROR)
+    {
+        invokeStateCallback(ws, SN_STATE_CLOSED);
+        return e;
+    }
+    
+    ws->hasCompletedOpeningHandshake = 0;
+    ws->hasSentCloseFrame = 0;
+    ws->isDisconnectPending = 0;
+    ws->outputQueueStart = ws->outputQueueEnd = 0;
+    ws->isSendingMessage = 0;
+    
+    if (ws->ioCallbacks.pollConnectCallback)
+    {
+        //the handshake is sent by snWebsocket_poll once connected
+        ws->isConnectingIOObject = 1;
+        return SN_NO_ERROR;
+    }
+    
+    sendOpeningHandshake(ws);
+    
+    return SN_NO_ERROR;
+}
+
+snError snWebsocket_connect(snWebsocket* ws, const char* host, const char* path, const char* query, int port, snHTTPHeader* headers, int numHeaders)
+{
+    if (ws->ioThread && !isOnIOThread(ws))
+    {
+        beginCallFromOtherThread(ws);
+        snError e = connectWebsocket(ws, host, path, query, port, headers, numHeaders);
+        endCallFromOtherThread(ws);
+        return e;
+    }
+    
+    return connectWebsocket(ws, host, path, query, port, headers, numHeaders);
+}
+
+static void disconnectWebsocket(snWebsocket* ws, int disconnectImmediately)
+{
+    if (disconnectImmediately || ws->isConnectingIOObject)
+    {
+        disconnectWithStatus(ws, SN_STATUS_ENDPOINT_GOING_AWAY, SN_NO_ERROR);
+    }
+    else
+    {
+        sendCloseFrame(ws, SN_STATUS_NORMAL_CLOSURE);
+        invokeStateCallback(ws, SN_STATE_CLOSING);
+    }
+}
+
+void snWebsocket_disconnect(snWebsocket* ws, int disconnectImmediately)
+{
+    if (ws->ioThread && !isOnIOThread(ws))
+    {
+        beginCallFromOtherThread(ws);
+        disconnectWebsocket(ws, disconnectImmediately);
+        endCallFromOtherThread(ws);
+        return;
+    }
+    
+    disconnectWebsocket(ws, disconnectImmediately);
+}
+
+snReadyState snWebsocket_getState(snWebsocket* ws)
+{
+    //the websocket state is only touched by the I/O thread
+    //or while it's waiting for another thread to finish
+    if (ws->ioThread && !isOnIOThread(ws))
+    {
+        return __atomic_load_n(&ws->ioThread->publishedState, __ATOMIC_SEQ_CST);
+    }
+    
+    return ws->websocketState;
+}
+
+void* snWebsocket_getIOObject(snWebsocket* ws)
+{
+    return ws->ioObject;
+}
+
+const snIOCallbacks* snWebsocket_getIOCallbacks(snWebsocket* ws)
+{
+    return &ws->ioCallbacks;
+}
+
+int snWebsocket_hasPendingInput(snWebsocket* ws)
+{
+    return ws->hasPendingInput;
+}
+
+snError snWebsocket_sendPing(snWebsocket* ws, int payloadSize, const char* payload)
+{
+    return snWebsocket_sendFrame(ws, SN_OPCODE_PING, payloadSize, payload);
+}
+
+snError snWebsocket_sendTextData(snWebsocket* ws, const char* payload)
+{
+    return snWebsocket_sendFrame(ws, SN_OPCODE_TEXT, strlen(payload), payload);
+}
+
+snError snWebsocket_sendBinaryData(snWebsocket* ws, int payloadSize, const char* payload)
+{
+    return snWebsocket_sendFrame(ws, SN_OPCODE_BINARY, payloadSize, payload);
+}
+
+static void handlePaserResult(snWebsocket* ws, snError error)
+{
+    if (error == SN_NO_ERROR)
+    {
+        return;
+    }
+    
+    //printf("handle parser result: error %d\n", error);
+    
+    snStatusCode status = SN_STATUS_PROTOCOL_ERROR;
+    
+    if (error == SN_INVALID_UTF8)
+    {
+        status = SN_STATUS_INCONSISTENT_DATA;
+    }
+    
+    if (ws->errorCallback)
+    {
+        ws->errorCallback(ws->callbackData, error);
+    }
+    
+    disconnectWithStatus(ws, status, error);
+}
+
+/**
+ * Passes newly received bytes on to the opening handshake parser
+ * or the frame parser.
+ * @param ws The websocket.
+ * @param bytes The received bytes.
+ * @param numBytesRead The number of bytes in \c bytes.
+ * @return The error that made the websocket disconnect, if any.
+ */
+static snError processReceivedBytes(snWebsocket* ws, const char* bytes, int numBytesRead)
+{
+    int i;
+
+    if (0)
+    {
+        sn_log(ws, "bytes from socket:\n");
+        sn_log(ws, "-----------------------\n");
+        for (i = 0; i < numBytesRead; i++)
+        {
+            sn_log(ws, "%c", bytes[i]);
+        }
+        
+        sn_log(ws, "\n-----------------------\n");
+    }
+
+    int readOffset = 0;
+    
+    if (ws->hasCompletedOpeningHandshake == 0)
+    {
+        int done = 0;
+        //printf("hasCompletedOpeningHandshake %d\n", ws->hasCompletedOpeningHandshake);
+        snError result = snOpeningHandshakeParser_processBytes(&ws->openingHandshakeParser,
+                                                               bytes,
+                                                               numBytesRead,
+                                                               &readOffset,
+                                                               &done);
+        
+        ws->hasCompletedOpeningHandshake = done;
+        //printf("first character after header %c. after header '%s'\n", ws->recvBuffer[readOffset], &ws->recvBuffer[readOffset]);
+        
+        if (result != SN_NO_ERROR)
+        {
+            snOpeningHandshakeParser_deinit(&ws->openingHandshakeParser);
+            handlePaserResult(ws, result);
+            return result;
+        }
+        
+        if (ws->hasCompletedOpeningHandshake)
+        {
+            invokeStateCallback(ws, SN_STATE_OPEN);
+            snOpeningHandshakeParser_deinit(&ws->openingHandshakeParser);
+        }
+        
+    }
+    
+    assert(numBytesRead >= readOffset);
+    
+    if (ws->hasCompletedOpeningHandshake && readOffset < numBytesRead)
+    {
+        snError result = snFrameParser_processBytes(&ws->frameParser,
+                                                    &bytes[readOffset],
+                                                    numBytesRead - readOffset);
+        handlePaserResult(ws, result);
+        return result;
+    }
+    
+    return SN_NO_ERROR;
+}
+
+void snWebsocket_poll(snWebsocket* ws)
+{
+    //without an I/O object, there is nothing to poll
+    if (ws->websocketState == SN_STATE_CLOSED || ws->isSansIO)
+    {
+        return;
+    }
+
+    //update timer
+    {
+        int firstPoll = ws->prevPollTime == 0.0f;
 
         const double newPollTime = ws->ioCallbacks.timeCallback();
         const double dt = newPollTime - ws->prevPollTime;
 
-        if (!firstPoll)
+        if (!firstPoll)
+        {
+            if (ws->hasSentCloseFrame)
+            {
+                ws->closingHandshakeTimer += dt;
+                if (ws->closingHandshakeTimer >= SN_CLOSING_HANDSHAKE_TIMEOUT)
+                {
+                    disconnectWithStatus(ws, SN_STATUS_ENDPOINT_GOING_AWAY, SN_NO_ERROR);
+                }
+            }
+            
+            //release memory held on to after receiving a large message
+            ws->readIdleTimer += dt;
+            if (ws->readIdleTimer >= SN_READ_BUFFER_SHRINK_DELAY)
+            {
+                ws->readIdleTimer = 0.0f;
+                snFrameParser_shrinkBuffer(&ws->frameParser);
+            }
+        }
+
+        ws->prevPollTime = newPollTime;
+    }
+
+    if (ws->isConnectingIOObject)
+    {
+        int isConnected = 0;
+        snError e = ws->ioCallbacks.pollConnectCallback(ws->ioObject, &isConnected);
+        if (e != SN_NO_ERROR)
+        {
+            disconnectWithStatus(ws, SN_STATUS_UNEXPECTED_ERROR, e);
+            return;
+        }
+        
+        if (!isConnected)
+        {
+            return;
+        }
+        
+        ws->isConnectingIOObject = 0;
+        sendOpeningHandshake(ws);
+    }
+    
+    //write what the I/O object didn't accept earlier
+    snError e = flushOutput(ws);
+    if (e != SN_NO_ERROR)
+    {
+        disconnectWithStatus(ws, SN_STATUS_UNEXPECTED_ERROR, e);
+        return;
+    }
+    
+    //keep reading until the socket has no more data or
+    //the byte or frame budget for this poll is used up
+    int numBytesPolled = 0;
+    ws->numFramesPolled = 0;
+    ws->hasPendingInput = 0;
+    
+    //nothing is read after the closing handshake, or while
+    //the application is behind on taking received messages
+    while (ws->websocketState != SN_STATE_CLOSED && !ws->isDisconnectPending && !isReadPaused(ws))
+    {
+        int numBytesRead = 0;
+        e = ws->ioCallbacks.readCallback(ws->ioObject,
+                                         ws->recvBuffer,
+                                         ws->recvBufferSize,
+                                         &numBytesRead);
+        
+        if (e != SN_NO_ERROR)
+        {
+            disconnectWithStatus(ws, SN_STATUS_UNEXPECTED_ERROR, e);
+            return;
+        }
+        
+        if (numBytesRead == 0)
+        {
+            break;
+        }
+        
+        ws->readIdleTimer = 0.0f;
+        
+        processReceivedBytes(ws, ws->recvBuffer, numBytesRead);
+        
+        numBytesPolled += numBytesRead;
+        
+        if (numBytesRead < ws->recvBufferSize)
+        {
+            //a short read means the socket was drained. skip
+            //the read that would only report that it would block.
+            break;
+        }
+        
+        if (numBytesPolled >= ws->maxBytesPerPoll ||
+            (ws->maxFramesPerPoll > 0 && ws->numFramesPolled >= ws->maxFramesPerPoll))
+        {
+            ws->hasPendingInput = 1;
+            break;
+        }
+    }
+    
+    //write replies queued while processing received frames, along with
+    //posted frames, which may have become sendable by the websocket opening
+    sendPostedFrames(ws);
+    if (ws->websocketState != SN_STATE_CLOSED)
+    {
+        e = flushOutput(ws);
+        if (e != SN_NO_ERROR)
+        {
+            disconnectWithStatus(ws, SN_STATUS_UNEXPECTED_ERROR, e);
+        }
+        else if (ws->isDisconnectPending && ws->outputQueueStart == ws->outputQueueEnd)
+        {
+            //the close frame has been written
+            disconnectWithStatus(ws, ws->pendingCloseStatus, SN_NO_ERROR);
+        }
+    }
+}
+
+snError snWebsocket_feed(snWebsocket* ws, const char* bytes, int numBytes)
+{
+    if (ws->websocketState == SN_STATE_CLOSED)
+    {
+        return SN_WEBSOCKET_CONNECTION_IS_NOT_OPEN;
+    }
+    
+    if (numBytes <= 0)
+    {
+        return SN_NO_ERROR;
+    }
+    
+    return processReceivedBytes(ws, bytes, numBytes);
+}
+
+int snWebsocket_drainOutput(snWebsocket* ws, const char** bytes)
+{
+    sendPostedFrames(ws);
+    
+    const size_t numQueued = ws->outputQueueEnd - ws->outputQueueStart;
+    *bytes = numQueued > 0 ? &ws->outputQueue[ws->outputQueueStart] : NULL;
+    return numQueued < INT_MAX ? (int)numQueued : INT_MAX;
+}
+
+void snWebsocket_consumeOutput(snWebsocket* ws, int numBytes)
+{
+    const size_t numQueued = ws->outputQueueEnd - ws->outputQueueStart;
+    if (numBytes <= 0 || numQueued == 0)
+    {
+        return;
+    }
+    
+    removeOutput(ws, (size_t)numBytes < numQueued ? (size_t)numBytes : numQueued);
+}
+
+/**
+ * Returns the number of milliseconds until the closing handshake
+ * times out, or -1 if no closing handshake is in progress.
+ */
+static int getClosingHandshakeTimeout(snWebsocket* ws)
+{
+    if (!ws->hasSentCloseFrame || ws->prevPollTime == 0.0)
+    {
+        return -1;
+    }
+    
+    const double elapsed = ws->ioCallbacks.timeCallback() - ws->prevPollTime;
+    const double remaining = SN_CLOSING_HANDSHAKE_TIMEOUT - ws->closingHandshakeTimer - elapsed;
+    
+    //round up, so the timeout has passed when polling again
+    return remaining > 0.0 ? (int)(remaining * 1000.0) + 1 : 0;
+}
+
+/**
+ * Returns the number of milliseconds until the frame parser buffer
+ * is shrunk for lack of received data, or -1 if there is nothing to shrink.
+ */
+static int getReadIdleTimeout(snWebsocket* ws)
+{
+    if (!snFrameParser_canShrinkBuffer(&ws->frameParser) || ws->prevPollTime == 0.0)
+    {
+        return -1;
+    }
+    
+    const double elapsed = ws->ioCallbacks.timeCallback() - ws->prevPollTime;
+    const double remaining = SN_READ_BUFFER_SHRINK_DELAY - ws->readIdleTimer - elapsed;
+    
+    return remaining > 0.0 ? (int)(remaining * 1000.0) + 1 : 0;
+}
+
+/**
+ * Returns the number of milliseconds until a poll is due to run
+ * one of the timers of a websocket, or -1 if none is running.
+ */
+static int getTimerTimeout(snWebsocket* ws)
+{
+    const int closingTimeoutMs = getClosingHandshakeTimeout(ws);
+    const int readIdleTimeoutMs = getReadIdleTimeout(ws);
+    
+    if (closingTimeoutMs < 0 || (readIdleTimeoutMs >= 0 && readIdleTimeoutMs < closingTimeoutMs))
+    {
+        return readIdleTimeoutMs;
+    }
+    
+    return closingTimeoutMs;
+}
+
+/**
+ * Gets the file descriptor to watch, the events to watch it for
+ * and the time until the websocket must be polled regardless.
+ */
+static int getPollState(snWebsocket* ws, int* interest, int* timeoutMs)
+{
+    *interest = 0;
+    *timeoutMs = -1;
+    
+    if (ws->websocketState == SN_STATE_CLOSED)
+    {
+        return -1;
+    }
+    
+    if (ws->isConnectingIOObject)
+    {
+        //a connection attempt completes when the socket becomes writable
+        *interest = SN_IO_WRITE;
+    }
+    else if (ws->isDisconnectPending)
+    {
+        //only the close frame is left to write
+        *interest = SN_IO_WRITE;
+    }
+    else
+    {
+        *interest = SN_IO_READ;
+        if (ws->outputQueueEnd > ws->outputQueueStart)
+        {
+            *interest |= SN_IO_WRITE;
+        }
+    }
+    
+    int fileDescriptor = -1;
+    if (ws->ioCallbacks.getFileDescriptorCallback)
+    {
+        fileDescriptor = ws->ioCallbacks.getFileDescriptorCallback(ws->ioObject, interest, timeoutMs);
+    }
+    
+    const int timerTimeoutMs = getTimerTimeout(ws);
+    if (timerTimeoutMs >= 0 && (*timeoutMs < 0 || timerTimeoutMs < *timeoutMs))
+    {
+        *timeoutMs = timerTimeoutMs;
+    }
+    
+    //the last poll left data unread that won't be signalled
+    //again, or frames were posted since
+    if (ws->hasPendingInput || hasPostedFramesToSend(ws))
+    {
+        *timeoutMs = 0;
+    }
+    
+    return fileDescriptor;
+}
+
+int snWebsocket_getFileDescriptor(snWebsocket* ws)
+{
+    int interest = 0;
+    int timeoutMs = -1;
+    return getPollState(ws, &interest, &timeoutMs);
+}
+
+int snWebsocket_getInterest(snWebsocket* ws)
+{
+    int interest = 0;
+    int timeoutMs = -1;
+    getPollState(ws, &interest, &timeoutMs);
+    return interest;
+}
+
+int snWebsocket_getTimeout(snWebsocket* ws)
+{
+    int interest = 0;
+    int timeoutMs = -1;
+    getPollState(ws, &interest, &timeoutMs);
+    return timeoutMs;
+}
+
+/**
+ * Gets the time to wait for I/O before polling, given the
+ * maximum time to wait, or -1 to wait indefinitely.
+ */
+static int getPollWaitTimeout(snWebsocket* ws, int timeoutMs)
+{
+    //don't wait if the last poll left data unread or frames were posted since
+    if (ws->hasPendingInput || hasPostedFramesToSend(ws))
+    {
+        return 0;
+    }
+    
+    //wake up in time for the closing handshake timeout
+    //or to release memory held on to by an idle websocket
+    const int remainingMs = getTimerTimeout(ws);
+    if (remainingMs >= 0 && (timeoutMs < 0 || remainingMs < timeoutMs))
+    {
+        return remainingMs;
+    }
+    
+    return timeoutMs;
+}
+
+snError snWebsocket_pollWait(snWebsocket* ws, int timeoutMs)
+{
+    if (ws->websocketState == SN_STATE_CLOSED)
+    {
+        return SN_WEBSOCKET_CONNECTION_IS_NOT_OPEN;
+    }
+    
+    if (ws->ioCallbacks.waitCallback)
+    {
+        const int waitMs = getPollWaitTimeout(ws, timeoutMs);
+        if (waitMs != 0)
         {
-            if (ws->hasSentCloseFrame)
+            const int hasQueuedOutput = ws->outputQueueEnd > ws->outputQueueStart;
+            snError e = ws->ioCallbacks.waitCallback(ws->ioObject, hasQueuedOutput, waitMs);
+            if (e != SN_NO_ERROR)
             {
-                ws->closingHandshakeTimer += dt;
-                if (ws->closingHandshakeTimer >= SN_CLOSING_HANDSHAKE_TIMEOUT)
-                {
-                    disconnectWithStatus(ws, SN_STATUS_ENDPOINT_GOING_AWAY, SN_NO_ERROR);
-                }
+                disconnectWithStatus(ws, SN_STATUS_UNEXPECTED_ERROR, e);
+                return e;
             }
         }
+    }
+    
+    snWebsocket_poll(ws);
+    
+    return SN_NO_ERROR;
+}
 
-        ws->prevPollTime = newPollTime;
+/**
+ * Gets messages from the receive queue, polling until there are some.
+ */
+static snError receiveFromQueue(snWebsocket* ws,
+                                snReceivedMessage* messages,
+                                int maxMessages,
+                                int* numMessages,
+                                int timeoutMs)
+{
+    //release the messages returned by the previous call
+    ws->receiveQueueStart += ws->receivedMessageSize;
+    ws->receivedMessageSize = 0;
+    if (ws->receiveQueueStart == ws->receiveQueueEnd)
+    {
+        ws->receiveQueueStart = ws->receiveQueueEnd = 0;
+    }
+    
+    const double startTime = ws->ioCallbacks.timeCallback();
+    int hasPolled = 0;
+    
+    while (ws->receiveQueueStart == ws->receiveQueueEnd)
+    {
+        if (ws->websocketState == SN_STATE_CLOSED)
+        {
+            return SN_WEBSOCKET_CONNECTION_IS_NOT_OPEN;
+        }
+        
+        //there is no I/O object to wait for
+        if (ws->isSansIO)
+        {
+            return SN_TIMED_OUT;
+        }
+        
+        int waitMs = -1;
+        if (timeoutMs >= 0)
+        {
+            const int elapsedMs = (int)((ws->ioCallbacks.timeCallback() - startTime) * 1000.0);
+            if (hasPolled && elapsedMs >= timeoutMs)
+            {
+                return SN_TIMED_OUT;
+            }
+            waitMs = elapsedMs < timeoutMs ? timeoutMs - elapsedMs : 0;
+        }
+        
+        snWebsocket_pollWait(ws, waitMs);
+        hasPolled = 1;
     }
+    
+    //the queued messages are consecutive, so they are released together
+    size_t offset = ws->receiveQueueStart;
+    while (*numMessages < maxMessages && offset < ws->receiveQueueEnd)
+    {
+        const snQueuedMessage* message = (const snQueuedMessage*)&ws->receiveQueue[offset];
+        messages[*numMessages].opcode = message->opcode;
+        messages[*numMessages].bytes = (const char*)(message + 1);
+        messages[*numMessages].numBytes = message->numBytes;
+        (*numMessages)++;
+        offset += queuedMessageSize(message->numBytes);
+    }
+    ws->receivedMessageSize = offset - ws->receiveQueueStart;
+    
+    return SN_NO_ERROR;
+}
+
+/**
+ * Gets the time a number of milliseconds from now, for \c pthread_cond_timedwait.
+ */
+static void getDeadline(struct timespec* deadline, int timeoutMs)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    const long long ns = (long long)now.tv_usec * 1000 + (long long)(timeoutMs % 1000) * 1000000;
+    deadline->tv_sec = now.tv_sec + timeoutMs / 1000 + (time_t)(ns / 1000000000);
+    deadline->tv_nsec = (long)(ns % 1000000000);
+}
 
-    int numBytesRead = 0;
-    snError e = ws->ioCallbacks.readCallback(ws->ioObject,
-                                             ws->recvBuffer,
-                                             1024,
-                                             &numBytesRead);
+/**
+ * Gets messages handed over by the I/O thread, waiting until there are some.
+ */
+static snError receiveFromIOThread(snWebsocket* ws,
+                                   snReceivedMessage* messages,
+                                   int maxMessages,
+                                   int* numMessages,
+                                   int timeoutMs)
+{
+    snIOThread* thread = ws->ioThread;
     
-    if (e != SN_NO_ERROR)
+    //release the messages returned by the previous call
+    for (int i = 0; i < thread->numHeldMessages; i++)
     {
-        disconnectWithStatus(ws, SN_STATUS_UNEXPECTED_ERROR, e);
-        return;
+        free((char*)thread->heldMessages[i].bytes);
     }
+    thread->numHeldMessages = 0;
     
-    if (numBytesRead == 0)
+    if (maxMessages > thread->heldMessagesCapacity)
     {
-        return;
+        snReceivedMessage* heldMessages = realloc(thread->heldMessages, maxMessages * sizeof(snReceivedMessage));
+        if (heldMessages == NULL)
+        {
+            return SN_OUT_OF_MEMORY;
+        }
+        thread->heldMessages = heldMessages;
+        thread->heldMessagesCapacity = maxMessages;
     }
     
-    if (0)
+    //check the state first, since messages are pushed
+    //before the state they were received in is published
+    snReadyState state = __atomic_load_n(&thread->publishedState, __ATOMIC_SEQ_CST);
+    int n = snSpscRing_pop(&thread->messages, messages, maxMessages);
+    
+    if (n == 0 && state != SN_STATE_CLOSED)
     {
-        sn_log(ws, "bytes from socket:\n");
-        sn_log(ws, "-----------------------\n");
-        for (i = 0; i < numBytesRead; i++)
+        struct timespec deadline;
+        if (timeoutMs > 0)
         {
-            sn_log(ws, "%c", ws->recvBuffer[i]);
+            getDeadline(&deadline, timeoutMs);
         }
         
-        sn_log(ws, "\n-----------------------\n");
+        pthread_mutex_lock(&thread->ringMutex);
+        __atomic_store_n(&thread->isConsumerWaiting, 1, __ATOMIC_SEQ_CST);
+        
+        int hasTimedOut = timeoutMs == 0;
+        while (!hasTimedOut)
+        {
+            state = __atomic_load_n(&thread->publishedState, __ATOMIC_SEQ_CST);
+            n = snSpscRing_pop(&thread->messages, messages, maxMessages);
+            if (n > 0 || state == SN_STATE_CLOSED)
+            {
+                break;
+            }
+            
+            if (timeoutMs < 0)
+            {
+                pthread_cond_wait(&thread->messageAvailable, &thread->ringMutex);
+            }
+            else
+            {
+                hasTimedOut = pthread_cond_timedwait(&thread->messageAvailable, &thread->ringMutex, &deadline) == ETIMEDOUT;
+            }
+        }
+        
+        __atomic_store_n(&thread->isConsumerWaiting, 0, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&thread->ringMutex);
+    }
+    
+    if (n == 0)
+    {
+        return state == SN_STATE_CLOSED ? SN_WEBSOCKET_CONNECTION_IS_NOT_OPEN : SN_TIMED_OUT;
+    }
+    
+    //the I/O thread may be waiting to move the messages
+    //that didn't fit in the ring to the room just made
+    if (__atomic_load_n(&thread->isProducerWaiting, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock(&thread->mutex);
+        pthread_cond_broadcast(&thread->stateChanged);
+        pthread_mutex_unlock(&thread->mutex);
+    }
+    else if (__atomic_load_n(&thread->hasOverflow, __ATOMIC_SEQ_CST))
+    {
+        ws->ioCallbacks.wakeCallback(ws->ioObject);
+    }
+    
+    memcpy(thread->heldMessages, messages, n * sizeof(snReceivedMessage));
+    thread->numHeldMessages = n;
+    *numMessages = n;
+    
+    return SN_NO_ERROR;
+}
+
+snError snWebsocket_receiveBatch(snWebsocket* ws,
+                                 snReceivedMessage* messages,
+                                 int maxMessages,
+                                 int* numMessages,
+                                 int timeoutMs)
+{
+    *numMessages = 0;
+    
+    if (maxMessages <= 0 || ws->frameParser.messageCallback != queueReceivedMessage)
+    {
+        return SN_BAD_ARGS;
+    }
+    
+    if (ws->ioThread)
+    {
+        return receiveFromIOThread(ws, messages, maxMessages, numMessages, timeoutMs);
     }
+    
+    return receiveFromQueue(ws, messages, maxMessages, numMessages, timeoutMs);
+}
 
-    int readOffset = 0;
+snError snWebsocket_receive(snWebsocket* ws,
+                            snOpcode* opcode,
+                            const char** bytes,
+                            int* numBytes,
+                            int timeoutMs)
+{
+    snReceivedMessage message;
+    int numMessages = 0;
     
-    if (ws->hasCompletedOpeningHandshake == 0)
+    snError e = snWebsocket_receiveBatch(ws, &message, 1, &numMessages, timeoutMs);
+    if (e != SN_NO_ERROR)
     {
-        int done = 0;
-        //printf("hasCompletedOpeningHandshake %d\n", ws->hasCompletedOpeningHandshake);
-        snError result = snOpeningHandshakeParser_processBytes(&ws->openingHandshakeParser,
-                                                               ws->recvBuffer,
-                                                               numBytesRead,
-                                                               &readOffset,
-                                                               &done);
+        return e;
+    }
+    
+    *opcode = message.opcode;
+    *bytes = message.bytes;
+    *numBytes = message.numBytes;
+    
+    return SN_NO_ERROR;
+}
+
+static int isOnIOThread(snWebsocket* ws)
+{
+    return pthread_equal(pthread_self(), ws->ioThread->thread);
+}
+
+/**
+ * Takes over a websocket polled by an I/O thread, waiting
+ * for the thread to return from the wait callback if needed.
+ */
+static void beginCallFromOtherThread(snWebsocket* ws)
+{
+    snIOThread* thread = ws->ioThread;
+    
+    pthread_mutex_lock(&thread->mutex);
+    
+    //keeps the thread from waiting for I/O again until the call is done
+    thread->numPendingCalls++;
+    while (thread->isWaitingForIO)
+    {
+        ws->ioCallbacks.wakeCallback(ws->ioObject);
+        pthread_cond_wait(&thread->stateChanged, &thread->mutex);
+    }
+}
+
+/**
+ * Hands a websocket taken over with \c beginCallFromOtherThread
+ * back to its I/O thread.
+ */
+static void endCallFromOtherThread(snWebsocket* ws)
+{
+    snIOThread* thread = ws->ioThread;
+    
+    thread->numPendingCalls--;
+    publishState(ws);
+    pthread_cond_broadcast(&thread->stateChanged);
+    
+    pthread_mutex_unlock(&thread->mutex);
+}
+
+/**
+ * Waits until the application has taken messages from the ring of the
+ * I/O thread, a frame is posted, another thread has called into the
+ * websocket or, unless \c timeoutMs is -1, a number of milliseconds
+ * have passed.
+ */
+static void waitForRingSpace(snWebsocket* ws, int timeoutMs)
+{
+    snIOThread* thread = ws->ioThread;
+    
+    __atomic_store_n(&thread->isProducerWaiting, 1, __ATOMIC_SEQ_CST);
+    if (snSpscRing_isFull(&thread->messages) && !hasPostedFramesToSend(ws))
+    {
+        if (timeoutMs < 0)
+        {
+            pthread_cond_wait(&thread->stateChanged, &thread->mutex);
+        }
+        else
+        {
+            struct timespec deadline;
+            getDeadline(&deadline, timeoutMs);
+            pthread_cond_timedwait(&thread->stateChanged, &thread->mutex, &deadline);
+        }
+    }
+    __atomic_store_n(&thread->isProducerWaiting, 0, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Polls a websocket until it's deleted, waiting for I/O in between.
+ */
+static void* runIOThread(void* data)
+{
+    snWebsocket* ws = (snWebsocket*)data;
+    snIOThread* thread = ws->ioThread;
+    
+    pthread_mutex_lock(&thread->mutex);
+    
+    while (!thread->isStopping)
+    {
+        moveOverflowToRing(ws);
+        publishState(ws);
         
-        ws->hasCompletedOpeningHandshake = done;
-        //printf("first character after header %c. after header '%s'\n", ws->recvBuffer[readOffset], &ws->recvBuffer[readOffset]);
+        const int hasOverflow = ws->receiveQueueStart < ws->receiveQueueEnd;
         
-        if (result != SN_NO_ERROR)
+        //let other threads use the websocket, or wait until they do if closed
+        if (thread->numPendingCalls > 0 ||
+            (ws->websocketState == SN_STATE_CLOSED && !hasOverflow))
         {
-            snOpeningHandshakeParser_deinit(&ws->openingHandshakeParser);
-            handlePaserResult(ws, result);
-            return;
+            pthread_cond_wait(&thread->stateChanged, &thread->mutex);
+            continue;
         }
         
-        if (ws->hasCompletedOpeningHandshake)
+        //a closed websocket only has its last messages left to hand over
+        if (ws->websocketState == SN_STATE_CLOSED)
         {
-            invokeStateCallback(ws, SN_STATE_OPEN);
-            snOpeningHandshakeParser_deinit(&ws->openingHandshakeParser);
+            waitForRingSpace(ws, -1);
+            continue;
+        }
+        
+        //messages that don't fit in the ring are kept in the receive
+        //queue, so pings are still answered while the ring is full
+        snWebsocket_poll(ws);
+        publishState(ws);
+        
+        const int waitMs = getPollWaitTimeout(ws, -1);
+        if (ws->websocketState == SN_STATE_CLOSED || waitMs == 0)
+        {
+            continue;
+        }
+        
+        const int hasQueuedOutput = ws->outputQueueEnd > ws->outputQueueStart;
+        
+        //past the size limit of the receive queue, only stop reading. the
+        //socket stays readable, so its writability is checked by polling.
+        if (isReadPaused(ws))
+        {
+            int pausedWaitMs = waitMs;
+            if (hasQueuedOutput && (pausedWaitMs < 0 || pausedWaitMs > SN_READ_PAUSED_WRITE_RETRY_MS))
+            {
+                pausedWaitMs = SN_READ_PAUSED_WRITE_RETRY_MS;
+            }
+            waitForRingSpace(ws, pausedWaitMs);
+            continue;
+        }
+        
+        //the application makes room in the ring while the thread waits,
+        //and then wakes it up to hand over the rest of the messages
+        if (ws->receiveQueueStart < ws->receiveQueueEnd)
+        {
+            __atomic_store_n(&thread->hasOverflow, 1, __ATOMIC_SEQ_CST);
+            moveOverflowToRing(ws);
+            if (ws->receiveQueueStart == ws->receiveQueueEnd)
+            {
+                __atomic_store_n(&thread->hasOverflow, 0, __ATOMIC_SEQ_CST);
+                continue;
+            }
         }
         
+        thread->isWaitingForIO = 1;
+        pthread_mutex_unlock(&thread->mutex);
+        
+        snError e = ws->ioCallbacks.waitCallback(ws->ioObject, hasQueuedOutput, waitMs);
+        
+        pthread_mutex_lock(&thread->mutex);
+        thread->isWaitingForIO = 0;
+        __atomic_store_n(&thread->hasOverflow, 0, __ATOMIC_SEQ_CST);
+        pthread_cond_broadcast(&thread->stateChanged);
+        
+        if (e != SN_NO_ERROR && ws->websocketState != SN_STATE_CLOSED)
+        {
+            disconnectWithStatus(ws, SN_STATUS_UNEXPECTED_ERROR, e);
+        }
     }
     
-    assert(numBytesRead >= readOffset);
+    pthread_mutex_unlock(&thread->mutex);
     
-    if (ws->hasCompletedOpeningHandshake && readOffset < numBytesRead)
+    return NULL;
+}
+
+static snError startIOThread(snWebsocket* ws, int messageRingSize, size_t maxOverflowSize)
+{
+    snIOThread* thread = malloc(sizeof(snIOThread));
+    if (thread == NULL)
     {
-        snError result = snFrameParser_processBytes(&ws->frameParser,
-                                                    &ws->recvBuffer[readOffset],
-                                                    numBytesRead - readOffset);
-        handlePaserResult(ws, result);
+        return SN_OUT_OF_MEMORY;
+    }
+    memset(thread, 0, sizeof(snIOThread));
+    
+    snError e = snSpscRing_init(&thread->messages, sizeof(snReceivedMessage), messageRingSize);
+    if (e != SN_NO_ERROR)
+    {
+        free(thread);
+        return e;
+    }
+    
+    thread->publishedState = ws->websocketState;
+    thread->maxOverflowSize = maxOverflowSize;
+    pthread_mutex_init(&thread->mutex, NULL);
+    pthread_cond_init(&thread->stateChanged, NULL);
+    pthread_mutex_init(&thread->ringMutex, NULL);
+    pthread_cond_init(&thread->messageAvailable, NULL);
+    
+    ws->ioThread = thread;
+    
+    //the thread starts by taking the mutex, so thread->thread
+    //is set by the time it checks which thread it's on
+    pthread_mutex_lock(&thread->mutex);
+    const int result = pthread_create(&thread->thread, NULL, runIOThread, ws);
+    pthread_mutex_unlock(&thread->mutex);
+    
+    if (result != 0)
+    {
+        ws->ioThread = NULL;
+        pthread_cond_destroy(&thread->messageAvailable);
+        pthread_mutex_destroy(&thread->ringMutex);
+        pthread_cond_destroy(&thread->stateChanged);
+        pthread_mutex_destroy(&thread->mutex);
+        snSpscRing_deinit(&thread->messages);
+        free(thread);
+        return SN_OUT_OF_MEMORY;
     }
+    
+    return SN_NO_ERROR;
 }
 
+static void stopIOThread(snWebsocket* ws)
+{
+    snIOThread* thread = ws->ioThread;
+    
+    pthread_mutex_lock(&thread->mutex);
+    thread->isStopping = 1;
+    pthread_cond_broadcast(&thread->stateChanged);
+    ws->ioCallbacks.wakeCallback(ws->ioObject);
+    pthread_mutex_unlock(&thread->mutex);
+    
+    pthread_join(thread->thread, NULL);
+    
+    //free the messages the application never took
+    for (int i = 0; i < thread->numHeldMessages; i++)
+    {
+        free((char*)thread->heldMessages[i].bytes);
+    }
+    free(thread->heldMessages);
+    
+    snReceivedMessage message;
+    while (snSpscRing_pop(&thread->messages, &message, 1) > 0)
+    {
+        free((char*)message.bytes);
+    }
+    snSpscRing_deinit(&thread->messages);
+    
+    pthread_cond_destroy(&thread->messageAvailable);
+    pthread_mutex_destroy(&thread->ringMutex);
+    pthread_cond_destroy(&thread->stateChanged);
+    pthread_mutex_destroy(&thread->mutex);
+    
+    free(thread);
+    ws->ioThread = NULL;
+}
@@ -42,6 +42,7 @@
 #include "iocallbacks.h"
 #include "cryptocallbacks.h"
 #include "logging.h"
+#include "preparedmessage.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -196,10 +197,30 @@ extern "C"
      * @param bytes The message data.
      * @param numBytes The number of message bytes. If \c opcode is \c SN_OPCODE_TEXT,
      * \c bytes is null terminated and \c numBytes is the message size excluding the
-     * last null byte.
+     * last null byte. Text messages delivered in place, see
+     * \c snWebsocketSettings.zeroCopyMessages, are not null terminated.
      */
     typedef void (*snMessageCallback)(void* userData, snOpcode opcode, const char* bytes, int numBytes);
     
+    /**
+     * Called as the payload of an incoming text or binary message arrives,
+     * across frame and fragment boundaries. Used instead of \c snMessageCallback
+     * for text and binary messages when set in \c snWebsocketSettings.
+     * @param userData Custom user data.
+     * @param opcode The message type. One of \c SN_OPCODE_TEXT and \c SN_OPCODE_BINARY.
+     * @param chunk The next payload bytes of the message. Not null terminated.
+     * @param chunkSize The number of bytes in \c chunk. May be zero for the last chunk.
+     * @param isFirst Non-zero if this is the first chunk of a new message.
+     * @param isLast Non-zero if this is the last chunk of the message. For text
+     * messages, the concatenated chunks have been validated as UTF-8 at this point.
+     */
+    typedef void (*snMessageChunkCallback)(void* userData,
+                                           snOpcode opcode,
+                                           const char* chunk,
+                                           int chunkSize,
+                                           int isFirst,
+                                           int isLast);
+    
     /**
      * Notifies the application when the opening handshake has been completed.
      * @param userData
@@ -228,6 +249,19 @@ extern "C"
      */
     /** @{ */
     
+    /**
+     * A message to send using \c snWebsocket_sendBatch.
+     */
+    typedef struct snOutgoingMessage
+    {
+        /** The opcode of the message. */
+        snOpcode opcode;
+        /** The message payload. */
+        const char* payload;
+        /** The size of the payload in bytes. */
+        int payloadSize;
+    } snOutgoingMessage;
+    
     /**
      * Websocket creation settings.
      */
@@ -235,26 +269,99 @@ extern "C"
     {
         /** 
          * The desired maximum frame size in bytes. If 0, the default
-         * max size will be used.
+         * max size will be used. Does not apply to text and binary
+         * messages if \c messageChunkCallback is set.
          */
         int maxFrameSize;
         /** */
         snLogCallback logCallback;
         /** A callback to pass received frames to. Ignored if NULL. */
         snFrameCallback frameCallback;
-        /** If NULL, default socket I/O is used. */
+        /**
+         * If NULL, the websocket does no I/O of its own. Received bytes are
+         * then passed in with \c snWebsocket_feed and outgoing bytes taken with
+         * \c snWebsocket_drainOutput, and the closing handshake is not timed out.
+         */
         const snIOCallbacks* ioCallbacks;
         /** */
         const snCryptoCallbacks* cryptoCallbacks;
         /** Gets called to see if time consuming I/O operations should be cancelled. Ignored if NULL. */
         snIOCancelCallback cancelCallback;
+        /**
+         * If non-zero, complete unfragmented messages are passed to the
+         * message callback as pointers into the receive buffer instead of
+         * being copied into the reassembly buffer first. Fragmented messages
+         * and frames split across reads are still reassembled.
+         */
+        int zeroCopyMessages;
+        /**
+         * If not NULL, text and binary messages are passed to this callback
+         * in chunks as they arrive instead of being assembled and passed to
+         * the message callback, which then only receives pings and pongs.
+         * Frames passed to \c frameCallback have no payload in this mode.
+         */
+        snMessageChunkCallback messageChunkCallback;
+        /** The number of bytes to read from the I/O object at a time. If 0, a default size is used. */
+        int readBufferSize;
+        /**
+         * \c snWebsocket_poll keeps reading until no more data is available or
+         * this many bytes have been received. If 0, the limit is 64 reads.
+         */
+        int maxBytesPerPoll;
+        /**
+         * \c snWebsocket_poll stops reading after receiving at least this
+         * many frames. If 0, the number of frames is not limited.
+         */
+        int maxFramesPerPoll;
+        /**
+         * The maximum payload size of the frames sent by \c snWebsocket_appendMessage.
+         * If 0, a default size of 16 KB is used. Limited by \c maxFrameSize.
+         */
+        int fragmentSize;
+        /**
+         * If non-zero, \c snWebsocket_create starts a thread that polls the
+         * websocket while it's connected, so pings are answered and closing
+         * handshakes time out even while the application is busy. All callbacks
+         * are invoked on that thread. With \c queueMessages set, messages are
+         * passed to the application through \c snWebsocket_receive and
+         * \c snWebsocket_receiveBatch. Other threads may only call
+         * \c snWebsocket_connect, \c snWebsocket_disconnect, \c snWebsocket_getState,
+         * \c snWebsocket_postFrame, the receive functions and \c snWebsocket_delete,
+         * while callbacks may call anything but the last three. Requires the
+         * \c waitCallback and \c wakeCallback I/O callbacks.
+         */
+        int useIOThread;
+        /**
+         * The number of received messages the I/O thread can hand over before
+         * the application takes them. Messages that don't fit are kept until
+         * they do, up to \c maxReceiveQueueSize. If 0, room is made for 256 messages.
+         */
+        int messageRingSize;
+        /**
+         * The number of bytes of messages the I/O thread keeps while its message
+         * ring is full. Once reached, the thread stops reading from the connection
+         * until the application takes messages, but still sends frames and times
+         * out the closing handshake. Pings arriving before that are answered.
+         * If 0, the limit is 1 MB.
+         */
+        int maxReceiveQueueSize;
+        /**
+         * If non-zero, and there is neither a message callback nor a
+         * \c messageChunkCallback, text and binary messages are queued until
+         * taken with \c snWebsocket_receive or \c snWebsocket_receiveBatch.
+         * Without an I/O thread, the queue is not limited in size, so messages
+         * must be taken as they arrive.
+         */
+        int queueMessages;
     } snWebsocketSettings;
     
     /**
      * Initializes a web socket using custom settings.
      * @param openCallback A function to call when the opening handshake has been completed. Ignored if NULL.
      * @param messageCallback A function to call when receiving pings, pongs or
-     * full text or binary messages. Ignored if NULL.
+     * full text or binary messages. If NULL, and there is no \c messageChunkCallback
+     * in \c settings, text and binary messages are dropped unless
+     * \c snWebsocketSettings.queueMessages is set.
      * @param closeCallback A function to call when the websocket connection is closed. Ignored if NULL.
      * @param errorCallback A function to call when an error occurs. Ignored if NULL.
      * @param callbackData A pointer passed to \c openCallback, \c messageCallback, \c closeCallback and \c errorCallback.
@@ -283,7 +390,8 @@ extern "C"
     snError snWebsocket_connect(snWebsocket* ws, const char* host, const char* path, const char* query, int port, snHTTPHeader* headers, int numHeaders);
     
     /**
-     * Disconnect from the current host, if any.
+     * Disconnect from the current host, if any. Messages already handed over
+     * by the I/O thread, if used, can still be received.
      * @param ws The websocket to disconnect.
      * @param disconnectImmediately If non-zero, the closing handshake
      * is not performed and the connection is dropped immediately with status
@@ -293,11 +401,36 @@ extern "C"
     void snWebsocket_disconnect(snWebsocket* ws, int disconnectImmediately);
     
     /**
-     * Check the state of a websocket.
+     * Check the state of a websocket. When called from outside the I/O thread,
+     * if used, the state is the one last seen by that thread and stays
+     * \c SN_STATE_CLOSING until all received messages have been taken.
      * @param ws The websocket.
      * @return The websocket state.
      */
     snReadyState snWebsocket_getState(snWebsocket* ws);
+    
+    /**
+     * Gets the object passed to the I/O callbacks, e.g a socket.
+     * @param ws The websocket.
+     * @return The I/O object.
+     */
+    void* snWebsocket_getIOObject(snWebsocket* ws);
+    
+    /**
+     * Gets the I/O callbacks a websocket was created with.
+     * @param ws The websocket.
+     * @return The I/O callbacks.
+     */
+    const snIOCallbacks* snWebsocket_getIOCallbacks(snWebsocket* ws);
+    
+    /**
+     * Checks if the last call to \c snWebsocket_poll stopped reading
+     * because the byte or frame budget was used up, in which case more
+     * data may be available without the I/O object signalling it again.
+     * @param ws The websocket.
+     * @return Non-zero if there may be unread data.
+     */
+    int snWebsocket_hasPendingInput(snWebsocket* ws);
         
     /**
      * Send a ping message.
@@ -327,22 +460,281 @@ extern "C"
     snError snWebsocket_sendBinaryData(snWebsocket* ws, int payloadSize, const char* payload);
     
     /**
-     * Send a frame with a given opcode and payload.
+     * Send a frame with a given opcode and payload. Does not wait for the
+     * I/O object to accept the data; whatever can't be written right away
+     * is queued and written by \c snWebsocket_poll.
      * @param ws The websocket.
      * @param opcode The opcode of the frame to send.
      * @param payloadSize The size of the payload in bytes.
      * @param payload The payload data.
-     * @return An error code.
+     * @return An error code, \c SN_BAD_ARGS if the frame would be larger
+     * than the max frame size of the websocket.
      */
     snError snWebsocket_sendFrame(snWebsocket* ws, snOpcode opcode, int payloadSize, const char* payload);
     
+    /**
+     * Send a frame whose payload is the concatenation of a number of buffers,
+     * without the caller having to concatenate them first.
+     * @param ws The websocket.
+     * @param opcode The opcode of the frame to send.
+     * @param buffers The payload buffers, in order.
+     * @param numBuffers The number of payload buffers.
+     * @return An error code, \c SN_BAD_ARGS if the frame would be larger
+     * than the max frame size of the websocket.
+     */
+    snError snWebsocket_sendFrameVectored(snWebsocket* ws, snOpcode opcode, const snIOBuffer* buffers, int numBuffers);
+    
+    /**
+     * Send a frame, masking the payload in place instead of copying it.
+     * Avoids a copy of every payload byte when the caller has no further
+     * use for the payload after sending it.
+     * @param ws The websocket.
+     * @param opcode The opcode of the frame to send.
+     * @param payloadSize The size of the payload in bytes.
+     * @param payload The payload data. Masked on return, i.e its contents
+     * are no longer the original payload.
+     * @return An error code, \c SN_BAD_ARGS if the frame would be larger
+     * than the max frame size of the websocket.
+     */
+    snError snWebsocket_sendFrameInPlace(snWebsocket* ws, snOpcode opcode, int payloadSize, char* payload);
+    
+    /**
+     * Gets the number of bytes that have been sent but not yet written
+     * to the I/O object, including frame headers.
+     * @param ws The websocket.
+     * @return The number of queued bytes.
+     */
+    unsigned long long snWebsocket_getBufferedAmount(snWebsocket* ws);
+    
+    /**
+     * Starts collecting outgoing frames in the output queue instead of writing
+     * them as they are sent, so that a burst of small messages can be written
+     * using a single write. Calls can be nested.
+     * @param ws The websocket.
+     * @see snWebsocket_uncork
+     */
+    void snWebsocket_cork(snWebsocket* ws);
+    
+    /**
+     * Undoes a call to \c snWebsocket_cork. When the outermost cork is removed,
+     * the collected frames are written.
+     * @param ws The websocket.
+     * @return An error code.
+     */
+    snError snWebsocket_uncork(snWebsocket* ws);
+    
+    /**
+     * Sends a number of messages, writing them using a single write if possible.
+     * @param ws The websocket.
+     * @param messages The messages to send.
+     * @param numMessages The number of messages.
+     * @return An error code. If sending a message fails, the remaining messages
+     * are not sent.
+     */
+    snError snWebsocket_sendBatch(snWebsocket* ws, const snOutgoingMessage* messages, int numMessages);
+
+    /**
+     * Queues a frame for the thread polling the websocket to send. Unlike the
+     * other functions in this file, safe to call from any thread. The payload is
+     * copied. Posted frames are sent in order once the websocket is open and
+     * no fragmented message is being sent, with all frames posted since the
+     * previous poll written together. They are discarded if the websocket
+     * disconnects. If the I/O callbacks have a \c wakeCallback, a thread blocked
+     * in \c snWebsocket_pollWait or an event loop is woken up to send the frame.
+     * @param ws The websocket.
+     * @param opcode The opcode of the frame to send.
+     * @param payloadSize The size of the payload in bytes.
+     * @param payload The payload data.
+     * @return An error code, \c SN_BAD_ARGS if the payload is larger than
+     * \c maxFrameSize minus \c SN_MAX_HEADER_SIZE.
+     */
+    snError snWebsocket_postFrame(snWebsocket* ws, snOpcode opcode, int payloadSize, const char* payload);
+
+    /**
+     * Sends a prepared message. Cheaper than \c snWebsocket_sendFrame since
+     * the message has already been validated and encoded.
+     * @param ws The websocket.
+     * @param message The message to send.
+     * @return An error code, \c SN_BAD_ARGS if the message would be larger
+     * than the max frame size of the websocket.
+     */
+    snError snWebsocket_sendPreparedMessage(snWebsocket* ws, const snPreparedMessage* message);
+    
+    /**
+     * Sends a prepared message to a number of websockets.
+     * @param websockets The websockets to send to.
+     * @param numWebsockets The number of websockets.
+     * @param message The message to send.
+     * @return The first error that occurred, if any. The message is sent to
+     * all websockets regardless of errors sending to some of them.
+     */
+    snError snWebsocket_broadcastPreparedMessage(snWebsocket** websockets,
+                                                 int numWebsockets,
+                                                 const snPreparedMessage* message);
+    
+    /**
+     * Starts sending a message whose payload is produced piece by piece. The
+     * payload is passed to \c snWebsocket_appendMessage and sent as a sequence of
+     * frames, so it doesn't need to be in memory all at once and has no size
+     * limit. Control frames may be sent while the message is in progress, other
+     * messages may not.
+     * @param ws The websocket.
+     * @param opcode \c SN_OPCODE_TEXT or \c SN_OPCODE_BINARY.
+     * @return An error code.
+     * @see snWebsocket_endMessage
+     */
+    snError snWebsocket_beginMessage(snWebsocket* ws, snOpcode opcode);
+    
+    /**
+     * Appends data to the message being sent. A frame is sent every
+     * time \c fragmentSize bytes have been collected.
+     * @param ws The websocket.
+     * @param numBytes The number of bytes to append.
+     * @param bytes The bytes to append.
+     * @return An error code.
+     */
+    snError snWebsocket_appendMessage(snWebsocket* ws, int numBytes, const char* bytes);
+    
+    /**
+     * Sends the remaining data of the message being sent, as its final frame.
+     * @param ws The websocket.
+     * @return An error code.
+     */
+    snError snWebsocket_endMessage(snWebsocket* ws);
+    
     /**
      * Receives incoming data, if any, and notifies the caller of newly available frames
-     * and connection state changes.
+     * and connection state changes. Reads until no more data is available or
+     * the per poll limits in \c snWebsocketSettings are reached. Also writes
+     * as much queued outgoing data as the I/O object accepts. Does nothing
+     * for websockets without I/O callbacks.
      * @param ws The websocket
      */
     void snWebsocket_poll(snWebsocket* ws);
     
+    /**
+     * Processes bytes received by the application, for websockets created
+     * without I/O callbacks. Frames, messages and state changes are reported
+     * through the callbacks before this returns, and replies such as pongs
+     * are queued for \c snWebsocket_drainOutput.
+     * @param ws The websocket.
+     * @param bytes The received bytes. Not referenced after this returns.
+     * @param numBytes The number of bytes.
+     * @return An error code. On protocol errors, the websocket is closed.
+     */
+    snError snWebsocket_feed(snWebsocket* ws, const char* bytes, int numBytes);
+    
+    /**
+     * Gets the queued outgoing bytes, for websockets created without I/O
+     * callbacks, starting with the opening handshake request. The bytes stay
+     * queued until passed to \c snWebsocket_consumeOutput, and the pointer is
+     * valid until the next call that sends or consumes data.
+     * @param ws The websocket.
+     * @param bytes Set to the first queued byte, or NULL if there are none.
+     * @return The number of queued bytes.
+     */
+    int snWebsocket_drainOutput(snWebsocket* ws, const char** bytes);
+    
+    /**
+     * Removes bytes the application has sent from the front of the output queue.
+     * @param ws The websocket.
+     * @param numBytes The number of bytes sent, at most the number
+     * returned by \c snWebsocket_drainOutput.
+     */
+    void snWebsocket_consumeOutput(snWebsocket* ws, int numBytes);
+    
+    /**
+     * Gets the file descriptor to watch when driving the websocket from
+     * an external event loop. May change while connecting, so check it again
+     * after each call to \c snWebsocket_poll.
+     * @param ws The websocket.
+     * @return The file descriptor, or -1 if there is none or the I/O
+     * callbacks don't provide one.
+     */
+    int snWebsocket_getFileDescriptor(snWebsocket* ws);
+    
+    /**
+     * Gets the events to watch the file descriptor of a websocket for.
+     * Write interest is reported while output is queued, and
+     * \c SN_IO_SHARED if other websockets use the same descriptor.
+     * @param ws The websocket.
+     * @return A combination of \c snIOInterest flags, or 0 if closed.
+     */
+    int snWebsocket_getInterest(snWebsocket* ws);
+    
+    /**
+     * Gets the time until \c snWebsocket_poll must be called even if the
+     * file descriptor is not ready, e.g to time out a closing handshake or to
+     * release a large receive buffer once no data has arrived for a while.
+     * @param ws The websocket.
+     * @return The timeout in milliseconds, 0 to poll right away or -1 for no limit.
+     */
+    int snWebsocket_getTimeout(snWebsocket* ws);
+    
+    /**
+     * Like \c snWebsocket_poll, but first blocks until there is data to read,
+     * queued output can be written, the closing handshake times out or a timeout
+     * expires, whichever comes first. Requires \c snIOCallbacks.waitCallback,
+     * without which this does not block.
+     * @param ws The websocket.
+     * @param timeoutMs The maximum time to wait in milliseconds, or -1 to wait indefinitely.
+     * @return An error code.
+     */
+    snError snWebsocket_pollWait(snWebsocket* ws, int timeoutMs);
+    
+    /**
+     * Gets the next received text or binary message, polling with
+     * \c snWebsocket_pollWait until one arrives, or waiting for the I/O thread
+     * to hand one over if \c snWebsocketSettings.useIOThread is set. Only available
+     * for websockets created with \c snWebsocketSettings.queueMessages set and
+     * without a message callback or a message chunk callback. Pings and pongs
+     * are handled by the websocket.
+     * @param ws The websocket.
+     * @param opcode Set to \c SN_OPCODE_TEXT or \c SN_OPCODE_BINARY.
+     * @param bytes Set to the message data, which stays valid until the next call to
+     * \c snWebsocket_receive or \c snWebsocket_poll. Text messages are null terminated.
+     * @param numBytes Set to the message size in bytes, excluding the null terminator.
+     * @param timeoutMs The maximum time to wait in milliseconds, or -1 to wait indefinitely.
+     * @return \c SN_NO_ERROR if a message was received, \c SN_TIMED_OUT if none arrived in
+     * time, \c SN_WEBSOCKET_CONNECTION_IS_NOT_OPEN if the connection closed first, or
+     * \c SN_BAD_ARGS if the websocket doesn't queue messages.
+     */
+    snError snWebsocket_receive(snWebsocket* ws,
+                                snOpcode* opcode,
+                                const char** bytes,
+                                int* numBytes,
+                                int timeoutMs);
+    
+    /**
+     * A message returned by \c snWebsocket_receiveBatch.
+     */
+    typedef struct snReceivedMessage
+    {
+        /** \c SN_OPCODE_TEXT or \c SN_OPCODE_BINARY. */
+        snOpcode opcode;
+        /** The message data. Text messages are null terminated. */
+        const char* bytes;
+        /** The message size in bytes, excluding the null terminator. */
+        int numBytes;
+    } snReceivedMessage;
+    
+    /**
+     * Like \c snWebsocket_receive, but gets all received messages up to a
+     * given number at once. Only waits if no message has been received.
+     * @param ws The websocket.
+     * @param messages Receives the messages, which stay valid until the next
+     * call to one of the receive functions or \c snWebsocket_poll.
+     * @param maxMessages The number of messages \c messages has room for.
+     * @param numMessages Set to the number of messages stored in \c messages.
+     * @param timeoutMs The maximum time to wait in milliseconds, or -1 to wait indefinitely.
+     * @return An error code, as for \c snWebsocket_receive.
+     */
+    snError snWebsocket_receiveBatch(snWebsocket* ws,
+                                     snReceivedMessage* messages,
+                                     int maxMessages,
+                                     int* numMessages,
+                                     int timeoutMs);
+    
     /** @} */
     
 #ifdef __cplusplus
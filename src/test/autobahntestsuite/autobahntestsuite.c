@@ -31,11 +31,13 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <unistd.h>
 
 #include <snacka/websocket.h>
 #include <snacka/logging.h>
 #include <snacka/frameparser.h>
+#include <snacka/backends/bsdsocket/iocallbacks_socket.h>
+
+#include <external/sha1/sha1.h>
 
 
 typedef struct AutobahnTestState
@@ -70,6 +72,22 @@ void messageCallback(void* userData, snOpcode opcode, const char* data, int numB
     }
 }
 
+static void autobahnRand(uint8_t* buffer, uint32_t bufferSize)
+{
+    for (uint32_t i = 0; i < bufferSize; i++)
+    {
+        buffer[i] = (uint8_t)rand();
+    }
+}
+
+static void autobahnSha(const uint8_t* buffer, uint32_t bufferSize, uint8_t* hash)
+{
+    sha1nfo s;
+    sha1_init(&s);
+    sha1_write(&s, buffer, bufferSize);
+    memcpy(hash, sha1_result(&s), 20);
+}
+
 /**
  * A client that connects to a fuzzingserver instance,
  * runs its tests and generates test reports as specified
@@ -81,35 +99,54 @@ int main(int argc, const char* argv[])
     test.testCount = 0;
     test.isFetchingCaseCount = 1;
     
+    static snIOCallbacks ioCallbacks =
+    {
+        snSocketInitCallback,
+        snSocketDeinitCallback,
+        snSocketConnectCallback,
+        snSocketDisconnectCallback,
+        snSocketReadCallback,
+        snSocketWriteCallback,
+        snSocketTimeCallback,
+        snSocketWritevCallback,
+        NULL, //connect blocks, so no pollConnect callback
+        snSocketWaitCallback
+    };
+    static snCryptoCallbacks cryptoCallbacks =
+    {
+        autobahnRand,
+        autobahnSha
+    };
+    
     //override the default read buffer size
     //since some autobahn tests involve
     //large payloads
     snWebsocketSettings s;
     memset(&s, 0, sizeof(snWebsocketSettings));
     s.maxFrameSize = 1 << 25;
+    s.ioCallbacks = &ioCallbacks;
+    s.cryptoCallbacks = &cryptoCallbacks;
     
-    snWebsocket* ws = snWebsocket_createWithSettings(NULL, //skip open callback
-                                                     messageCallback,
-                                                     NULL, //skip close callback
-                                                     NULL, //skip error callback
-                                                     &test,
-                                                     &s);
+    snWebsocket* ws = snWebsocket_create(NULL, //skip open callback
+                                         messageCallback,
+                                         NULL, //skip close callback
+                                         NULL, //skip error callback
+                                         &test,
+                                         &s);
     test.websocket = ws;
     
-    const int pollDurationMs = 1;
     const char* agentName = "snacka";
     
     //fetch test case count
     {
-        snWebsocket_connect(ws, "localhost", "getCaseCount", NULL, 9001);
+        snWebsocket_connect(ws, "localhost", "getCaseCount", NULL, 9001, NULL, 0);
         
         printf("Fetching test count...\n");
         printf("----------------------\n");
         while (test.isFetchingCaseCount == 1 &&
                snWebsocket_getState(ws) != SN_STATE_CLOSED)
         {
-            snWebsocket_poll(ws);
-            usleep(1000 * pollDurationMs);
+            snWebsocket_pollWait(ws, -1);
         }
         printf("Fetched test count %d\n", test.testCount);
         printf("\n");
@@ -127,14 +164,13 @@ int main(int argc, const char* argv[])
             char testCaseURL[1024];
             const int testNumber = i + 1;
             sprintf(testCaseURL, "case=%d&agent=%s", testNumber, agentName);
-            snWebsocket_connect(ws, "localhost", "runCase", testCaseURL, 9001);
+            snWebsocket_connect(ws, "localhost", "runCase", testCaseURL, 9001, NULL, 0);
             
             //run the test
             printf("Running test %d/%d, ws://localhost:9001/runCase%s\n", testNumber, test.testCount, testCaseURL);
             while (snWebsocket_getState(ws) != SN_STATE_CLOSED)
             {
-                snWebsocket_poll(ws);
-                usleep(1000 * pollDurationMs);
+                snWebsocket_pollWait(ws, -1);
             }
         }
         
@@ -148,11 +184,10 @@ int main(int argc, const char* argv[])
         
         char updateReportsURL[1024];
         sprintf(updateReportsURL, "agent=%s", agentName);
-        snWebsocket_connect(ws, "localhost", "updateReports", updateReportsURL, 9001);
+        snWebsocket_connect(ws, "localhost", "updateReports", updateReportsURL, 9001, NULL, 0);
         while (snWebsocket_getState(ws) != SN_STATE_CLOSED)
         {
-            snWebsocket_poll(ws);
-            usleep(1000 * pollDurationMs);
+            snWebsocket_pollWait(ws, -1);
         }
         
         printf("Done.\n");
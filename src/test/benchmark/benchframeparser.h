@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2013, Per Gantelius
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the copyright holders.
+ */
+
+#ifndef SN_BENCH_FRAME_PARSER_H
+#define SN_BENCH_FRAME_PARSER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <snacka/frameparser.h>
+
+static int benchParsedMessageCount;
+
+static void benchMessageCallback(void* userData, snOpcode opcode, const char* bytes, int numBytes)
+{
+    benchParsedMessageCount++;
+}
+
+/**
+ * Measures how many frames per second the frame parser gets through
+ * when fed a stream of back-to-back small binary frames, in chunks the size
+ * of a typical socket read.
+ * @param zeroCopy If non-zero, complete frames are delivered in place.
+ */
+static void benchFrameParserSmallFrames(int zeroCopy)
+{
+    const int numFrames = 1 << 16;
+    const int numIterations = 512;
+    const int readSize = 1024;
+    const int minPayloadSize = 40;
+    const int maxPayloadSize = 80;
+    
+    char* stream = malloc(numFrames * (SN_MAX_HEADER_SIZE + maxPayloadSize));
+    int streamSize = 0;
+    
+    for (int i = 0; i < numFrames; i++)
+    {
+        snFrameHeader h;
+        memset(&h, 0, sizeof(snFrameHeader));
+        h.opcode = SN_OPCODE_BINARY;
+        h.isFinal = 1;
+        h.payloadSize = minPayloadSize + (i % (maxPayloadSize - minPayloadSize + 1));
+        
+        uint32_t headerSize = 0;
+        snFrameHeader_toBytes(&h, &stream[streamSize], &headerSize);
+        streamSize += headerSize;
+        memset(&stream[streamSize], 'a' + (i % 26), h.payloadSize);
+        streamSize += h.payloadSize;
+    }
+    
+    const int bufferSize = 1 << 12;
+    char* buffer = malloc(bufferSize);
+    snFrameParser p;
+    snFrameParser_init(&p, NULL, NULL, benchMessageCallback, NULL, buffer, bufferSize);
+    p.zeroCopy = zeroCopy;
+    
+    benchParsedMessageCount = 0;
+    const clock_t start = clock();
+    
+    for (int i = 0; i < numIterations; i++)
+    {
+        for (int offset = 0; offset < streamSize; offset += readSize)
+        {
+            const int chunkSize = streamSize - offset < readSize ? streamSize - offset : readSize;
+            snFrameParser_processBytes(&p, &stream[offset], chunkSize);
+        }
+    }
+    
+    const double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    
+    printf("%d frames of %d-%d payload bytes%s in %.3f s: %.2f M frames/s\n",
+           benchParsedMessageCount,
+           minPayloadSize,
+           maxPayloadSize,
+           zeroCopy ? ", zero copy" : "",
+           seconds,
+           benchParsedMessageCount / seconds / 1.0e6);
+    
+    snFrameParser_deinit(&p);
+    free(buffer);
+    free(stream);
+}
+
+#endif /*SN_BENCH_FRAME_PARSER_H*/
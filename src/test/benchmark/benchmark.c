@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2013, Per Gantelius
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the copyright holders.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+
+#include "benchframeparser.h"
+#include "benchmasking.h"
+#include "benchsend.h"
+#include "benchutf8.h"
+
+/**
+ * Runs a set of microbenchmarks of performance critical code paths.
+ */
+int main(int argc, const char* argv[])
+{
+    printf("snFrameParser benchmarks\n");
+    printf("----------------------\n");
+    benchFrameParserSmallFrames(0);
+    benchFrameParserSmallFrames(1);
+    printf("\n");
+    
+    printf("Masking benchmarks\n");
+    printf("------------------\n");
+    benchMasking(2048, 1);
+    benchMasking(2048, 0);
+    benchMasking(125, 1);
+    benchMasking(125, 0);
+    printf("\n");
+    
+    printf("Send benchmarks\n");
+    printf("---------------\n");
+    benchSendFrames(128, 0);
+    benchSendFrames(128, 1);
+    benchSendFrames(1 << 16, 0);
+    benchSendFrames(1 << 16, 1);
+    benchSendBursts(50, 0);
+    benchSendBursts(50, 1);
+    benchBroadcast(100, 256, 0);
+    benchBroadcast(100, 256, 1);
+    benchCrossThreadSend(4, 0);
+    benchCrossThreadSend(4, 1);
+    printf("\n");
+    
+    printf("UTF-8 validation benchmarks\n");
+    printf("---------------------------\n");
+    benchUTF8Validation("ASCII JSON", "{\"id\": 1234, \"name\": \"snacka\", \"tags\": [\"a\", \"b\"]}, ");
+    benchUTF8Validation("mixed", "{\"name\": \"Gr\xc3\xbc\xc3\x9f Gott\", \"price\": \"12 \xe2\x82\xac\"}, ");
+    benchUTF8Validation("non-ASCII", "\xce\xba\xe1\xbd\xb9\xcf\x83\xce\xbc\xce\xb5 \xe6\x97\xa5\xe6\x9c\xac\xf0\x9f\x98\x80");
+    printf("\n");
+    
+    return 0;
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2013, Per Gantelius
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the copyright holders.
+ */
+
+#ifndef SN_BENCH_MASKING_H
+#define SN_BENCH_MASKING_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <snacka/frameheader.h>
+
+/**
+ * The original byte-at-a-time masking loop, as a baseline.
+ */
+static void benchApplyMaskBytewise(snFrameHeader* h, char* payload, int numBytes, int offset)
+{
+    unsigned char maskBytes[4];
+    for (int i = 0; i < 4; i++)
+    {
+        maskBytes[i] = (unsigned char)((unsigned int)h->maskingKey >> ((3 - i) * 8));
+    }
+    
+    for (int i = 0; i < numBytes; i++)
+    {
+        payload[i] = payload[i] ^ maskBytes[(i + offset) % 4];
+    }
+}
+
+/**
+ * Measures masking throughput when masking a payload in chunks, the way
+ * outgoing frames are masked before being written.
+ * @param chunkSize The number of bytes masked per call.
+ * @param bytewise If non-zero, the baseline loop is measured instead of
+ * snFrameHeader_applyMask.
+ */
+static void benchMasking(int chunkSize, int bytewise)
+{
+    const int payloadSize = 1 << 16;
+    const int numIterations = 8192;
+    
+    char* payload = malloc(payloadSize);
+    memset(payload, 'x', payloadSize);
+    
+    snFrameHeader h;
+    memset(&h, 0, sizeof(snFrameHeader));
+    h.isMasked = 1;
+    h.maskingKey = 0x1a2b3c4d;
+    
+    const clock_t start = clock();
+    
+    for (int i = 0; i < numIterations; i++)
+    {
+        for (int offset = 0; offset < payloadSize; offset += chunkSize)
+        {
+            const int numBytes = payloadSize - offset < chunkSize ? payloadSize - offset : chunkSize;
+            if (bytewise)
+            {
+                benchApplyMaskBytewise(&h, &payload[offset], numBytes, offset);
+            }
+            else
+            {
+                snFrameHeader_applyMask(&h, &payload[offset], numBytes, offset);
+            }
+        }
+    }
+    
+    const double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    
+    printf("masked %d x %d bytes in %d byte chunks%s in %.3f s: %.2f MB/s (checksum %d)\n",
+           numIterations,
+           payloadSize,
+           chunkSize,
+           bytewise ? ", byte by byte" : "",
+           seconds,
+           (double)numIterations * payloadSize / seconds / 1.0e6,
+           payload[payloadSize / 2]);
+    
+    free(payload);
+}
+
+#endif /*SN_BENCH_MASKING_H*/
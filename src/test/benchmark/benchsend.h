@@ -0,0 +1,435 @@
+/*
+ * Copyright (c) 2013, Per Gantelius
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the copyright holders.
+ */
+
+#ifndef SN_BENCH_SEND_H
+#define SN_BENCH_SEND_H
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <snacka/websocket.h>
+
+/*
+ * A websocket connected to nothing. The opening handshake response is
+ * "read" on the first poll and everything written is discarded, so
+ * benchmarks measure the cost of producing outgoing frames only.
+ */
+
+static const char* benchHandshakeResponse =
+    "HTTP/1.1 101 Switching Protocols\r\n"
+    "Upgrade: websocket\r\n"
+    "Connection: Upgrade\r\n"
+    "Sec-WebSocket-Accept: AAAAAAAAAAAAAAAAAAAAAAAAAAA=\r\n\r\n";
+
+static int benchHandshakeSent;
+static long long benchNumBytesWritten;
+static int benchNumWrites;
+
+static snError benchIOInit(void** ioObject)
+{
+    *ioObject = NULL;
+    return SN_NO_ERROR;
+}
+
+static snError benchIODeinit(void* ioObject)
+{
+    return SN_NO_ERROR;
+}
+
+static snError benchIOConnect(void* ioObject, const char* host, int port, snIOCancelCallback cancelCallback)
+{
+    benchHandshakeSent = 0;
+    return SN_NO_ERROR;
+}
+
+static snError benchIODisconnect(void* ioObject)
+{
+    return SN_NO_ERROR;
+}
+
+static snError benchIORead(void* ioObject, char* buffer, int bufferSize, int* numBytesRead)
+{
+    *numBytesRead = 0;
+    if (!benchHandshakeSent)
+    {
+        *numBytesRead = (int)strlen(benchHandshakeResponse);
+        memcpy(buffer, benchHandshakeResponse, *numBytesRead);
+        benchHandshakeSent = 1;
+    }
+    return SN_NO_ERROR;
+}
+
+static snError benchIOWrite(void* ioObject, const char* buffer, int bufferSize, int* numBytesWritten, snIOCancelCallback cancelCallback)
+{
+    benchNumWrites++;
+    benchNumBytesWritten += bufferSize;
+    *numBytesWritten = bufferSize;
+    return SN_NO_ERROR;
+}
+
+static snError benchIOWritev(void* ioObject, const snIOBuffer* buffers, int numBuffers, int* numBytesWritten, snIOCancelCallback cancelCallback)
+{
+    benchNumWrites++;
+    *numBytesWritten = 0;
+    for (int i = 0; i < numBuffers; i++)
+    {
+        *numBytesWritten += buffers[i].size;
+    }
+    benchNumBytesWritten += *numBytesWritten;
+    return SN_NO_ERROR;
+}
+
+static float benchTime(void)
+{
+    return (float)clock() / CLOCKS_PER_SEC;
+}
+
+static void benchRand(uint8_t* buffer, uint32_t bufferSize)
+{
+    //xorshift64, standing in for a bulk random source
+    static uint64_t state = 0x2545f4914f6cdd1dULL;
+    for (uint32_t i = 0; i < bufferSize; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        buffer[i] = (uint8_t)(state >> 32);
+    }
+}
+
+static void benchSha(const uint8_t* buffer, uint32_t bufferSize, uint8_t* hash)
+{
+    memset(hash, 0, 20);
+}
+
+/**
+ * Creates an open websocket that discards everything written to it.
+ */
+static snWebsocket* benchCreateWebsocket(void)
+{
+    static snIOCallbacks ioCallbacks =
+    {
+        benchIOInit,
+        benchIODeinit,
+        benchIOConnect,
+        benchIODisconnect,
+        benchIORead,
+        benchIOWrite,
+        benchTime,
+        benchIOWritev
+    };
+    static snCryptoCallbacks cryptoCallbacks =
+    {
+        benchRand,
+        benchSha
+    };
+    
+    snWebsocketSettings settings;
+    memset(&settings, 0, sizeof(snWebsocketSettings));
+    settings.maxFrameSize = 1 << 24;
+    settings.ioCallbacks = &ioCallbacks;
+    settings.cryptoCallbacks = &cryptoCallbacks;
+    
+    snWebsocket* ws = snWebsocket_create(NULL, NULL, NULL, NULL, NULL, &settings);
+    snWebsocket_connect(ws, "localhost", NULL, NULL, 80, NULL, 0);
+    snWebsocket_poll(ws);
+    
+    return ws;
+}
+
+/**
+ * Measures the throughput of sending binary messages of a given size.
+ * @param payloadSize The size of each message.
+ * @param inPlace If non-zero, messages are sent with snWebsocket_sendFrameInPlace.
+ */
+static void benchSendFrames(int payloadSize, int inPlace)
+{
+    const long long numBytesToSend = 1LL << 30;
+    const int numMessages = (int)(numBytesToSend / payloadSize);
+    
+    snWebsocket* ws = benchCreateWebsocket();
+    char* payload = malloc(payloadSize);
+    memset(payload, 'x', payloadSize);
+    
+    benchNumWrites = 0;
+    benchNumBytesWritten = 0;
+    const clock_t start = clock();
+    
+    for (int i = 0; i < numMessages; i++)
+    {
+        if (inPlace)
+        {
+            snWebsocket_sendFrameInPlace(ws, SN_OPCODE_BINARY, payloadSize, payload);
+        }
+        else
+        {
+            snWebsocket_sendFrame(ws, SN_OPCODE_BINARY, payloadSize, payload);
+        }
+    }
+    
+    const double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    
+    printf("sent %d messages of %d bytes%s in %.3f s: %.2f MB/s, %d writes\n",
+           numMessages,
+           payloadSize,
+           inPlace ? " in place" : "",
+           seconds,
+           benchNumBytesWritten / seconds / 1.0e6,
+           benchNumWrites);
+    
+    free(payload);
+    snWebsocket_delete(ws);
+}
+
+/**
+ * Measures the cost of sending bursts of small text messages, one
+ * message at a time or as a batch.
+ * @param burstSize The number of messages per burst.
+ * @param batch If non-zero, each burst is sent with snWebsocket_sendBatch.
+ */
+static void benchSendBursts(int burstSize, int batch)
+{
+    const int numBursts = 1 << 16;
+    const char* text = "{\"price\": 101.25, \"size\": 300}";
+    
+    snWebsocket* ws = benchCreateWebsocket();
+    snOutgoingMessage* messages = malloc(burstSize * sizeof(snOutgoingMessage));
+    for (int i = 0; i < burstSize; i++)
+    {
+        messages[i].opcode = SN_OPCODE_TEXT;
+        messages[i].payload = text;
+        messages[i].payloadSize = (int)strlen(text);
+    }
+    
+    benchNumWrites = 0;
+    benchNumBytesWritten = 0;
+    const clock_t start = clock();
+    
+    for (int i = 0; i < numBursts; i++)
+    {
+        if (batch)
+        {
+            snWebsocket_sendBatch(ws, messages, burstSize);
+        }
+        else
+        {
+            for (int j = 0; j < burstSize; j++)
+            {
+                snWebsocket_sendTextData(ws, text);
+            }
+        }
+    }
+    
+    const double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    
+    printf("sent %d bursts of %d messages%s in %.3f s: %.2f M messages/s, %.1f writes per burst\n",
+           numBursts,
+           burstSize,
+           batch ? " as batches" : "",
+           seconds,
+           (double)numBursts * burstSize / seconds / 1.0e6,
+           (double)benchNumWrites / numBursts);
+    
+    free(messages);
+    snWebsocket_delete(ws);
+}
+
+/**
+ * Measures the cost of sending the same text message to a number of
+ * websockets, either encoding it for each websocket or preparing it once.
+ * @param numWebsockets The number of websockets to send to.
+ * @param payloadSize The size of the message.
+ * @param prepared If non-zero, the message is prepared once and sent with
+ * snWebsocket_broadcastPreparedMessage.
+ */
+static void benchBroadcast(int numWebsockets, int payloadSize, int prepared)
+{
+    const int numMessages = (int)((1LL << 30) / ((long long)payloadSize * numWebsockets));
+    
+    snWebsocket** websockets = malloc(numWebsockets * sizeof(snWebsocket*));
+    for (int i = 0; i < numWebsockets; i++)
+    {
+        websockets[i] = benchCreateWebsocket();
+    }
+    
+    char* payload = malloc(payloadSize);
+    memset(payload, 'x', payloadSize);
+    
+    benchNumWrites = 0;
+    benchNumBytesWritten = 0;
+    const clock_t start = clock();
+    
+    for (int i = 0; i < numMessages; i++)
+    {
+        if (prepared)
+        {
+            snPreparedMessage message;
+            snPreparedMessage_init(&message, SN_OPCODE_TEXT, payloadSize, payload);
+            snWebsocket_broadcastPreparedMessage(websockets, numWebsockets, &message);
+            snPreparedMessage_deinit(&message);
+        }
+        else
+        {
+            for (int j = 0; j < numWebsockets; j++)
+            {
+                snWebsocket_sendFrame(websockets[j], SN_OPCODE_TEXT, payloadSize, payload);
+            }
+        }
+    }
+    
+    const double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    
+    printf("broadcast %d messages of %d bytes to %d websockets%s in %.3f s: %.2f MB/s\n",
+           numMessages,
+           payloadSize,
+           numWebsockets,
+           prepared ? " prepared" : "",
+           seconds,
+           benchNumBytesWritten / seconds / 1.0e6);
+    
+    free(payload);
+    for (int i = 0; i < numWebsockets; i++)
+    {
+        snWebsocket_delete(websockets[i]);
+    }
+    free(websockets);
+}
+
+/**
+ * State shared by the threads of \c benchCrossThreadSend.
+ */
+typedef struct benchCrossThreadState
+{
+    snWebsocket* ws;
+    /** Serializes access to \c ws when not posting. */
+    pthread_mutex_t mutex;
+    int post;
+    int numMessagesPerThread;
+    /** The number of producer threads that are done sending. */
+    int numThreadsDone;
+} benchCrossThreadState;
+
+static void* benchCrossThreadProducer(void* data)
+{
+    benchCrossThreadState* state = (benchCrossThreadState*)data;
+    const char* text = "{\"price\": 101.25, \"size\": 300}";
+    const int textSize = (int)strlen(text);
+    
+    for (int i = 0; i < state->numMessagesPerThread; i++)
+    {
+        if (state->post)
+        {
+            snWebsocket_postFrame(state->ws, SN_OPCODE_TEXT, textSize, text);
+        }
+        else
+        {
+            pthread_mutex_lock(&state->mutex);
+            snWebsocket_sendFrame(state->ws, SN_OPCODE_TEXT, textSize, text);
+            pthread_mutex_unlock(&state->mutex);
+        }
+    }
+    
+    __atomic_add_fetch(&state->numThreadsDone, 1, __ATOMIC_RELEASE);
+    
+    return NULL;
+}
+
+/**
+ * Measures the cost of sending small text messages from a number of
+ * threads while another thread polls the websocket, either serializing
+ * on a mutex or posting the messages with snWebsocket_postFrame.
+ * @param numThreads The number of sending threads.
+ * @param post If non-zero, messages are sent with snWebsocket_postFrame.
+ */
+static void benchCrossThreadSend(int numThreads, int post)
+{
+    benchCrossThreadState state;
+    state.ws = benchCreateWebsocket();
+    pthread_mutex_init(&state.mutex, NULL);
+    state.post = post;
+    state.numMessagesPerThread = (1 << 21) / numThreads;
+    state.numThreadsDone = 0;
+    
+    pthread_t* threads = malloc(numThreads * sizeof(pthread_t));
+    
+    benchNumWrites = 0;
+    benchNumBytesWritten = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    
+    for (int i = 0; i < numThreads; i++)
+    {
+        pthread_create(&threads[i], NULL, benchCrossThreadProducer, &state);
+    }
+    
+    //the polling thread, e.g an event loop
+    int isDone = 0;
+    while (!isDone)
+    {
+        isDone = __atomic_load_n(&state.numThreadsDone, __ATOMIC_ACQUIRE) == numThreads;
+        
+        if (post)
+        {
+            snWebsocket_poll(state.ws);
+        }
+        else
+        {
+            pthread_mutex_lock(&state.mutex);
+            snWebsocket_poll(state.ws);
+            pthread_mutex_unlock(&state.mutex);
+        }
+    }
+    
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1.0e9;
+    const int numMessages = state.numMessagesPerThread * numThreads;
+    
+    for (int i = 0; i < numThreads; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    
+    printf("sent %d messages from %d threads%s in %.3f s: %.2f M messages/s, %.1f messages per write\n",
+           numMessages,
+           numThreads,
+           post ? " posting" : " with a mutex",
+           seconds,
+           numMessages / seconds / 1.0e6,
+           benchNumWrites > 0 ? (double)numMessages / benchNumWrites : 0.0);
+    
+    free(threads);
+    pthread_mutex_destroy(&state.mutex);
+    snWebsocket_delete(state.ws);
+}
+
+#endif /*SN_BENCH_SEND_H*/
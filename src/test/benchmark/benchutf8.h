@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2013, Per Gantelius
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the copyright holders.
+ */
+
+#ifndef SN_BENCH_UTF8_H
+#define SN_BENCH_UTF8_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <snacka/utf8.h>
+
+/**
+ * Measures UTF-8 validation throughput on a text message made up of
+ * repetitions of a given snippet.
+ * @param label A short description of the text, for the output.
+ * @param snippet The text to repeat.
+ */
+static void benchUTF8Validation(const char* label, const char* snippet)
+{
+    const int messageSize = 1 << 16;
+    const int numIterations = 4096;
+    const int snippetSize = (int)strlen(snippet);
+    
+    char* message = malloc(messageSize);
+    for (int i = 0; i < messageSize; i++)
+    {
+        message[i] = snippet[i % snippetSize];
+    }
+    /* Don't end in the middle of a code point. */
+    int messageEnd = messageSize - messageSize % snippetSize;
+    
+    int numValid = 0;
+    const clock_t start = clock();
+    
+    for (int i = 0; i < numIterations; i++)
+    {
+        uint32_t state = 0;
+        numValid += snUTF8ValidateStringIncremental(message, messageEnd, &state) && state == 0;
+    }
+    
+    const double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    
+    printf("%d %d byte %s messages (%d valid) in %.3f s: %.2f MB/s\n",
+           numIterations,
+           messageEnd,
+           label,
+           numValid,
+           seconds,
+           (double)numIterations * messageEnd / seconds / 1.0e6);
+    
+    free(message);
+}
+
+#endif /*SN_BENCH_UTF8_H*/
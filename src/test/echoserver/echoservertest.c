@@ -30,10 +30,17 @@
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/time.h>
 
 #include "websocket.h"
 #include "frameparser.h"
-#include <unistd.h>
+
+static long long currentTimeMs(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000LL + tv.tv_usec / 1000;
+}
 
 static void messageCallback(void* userData, snOpcode opcode, const char* data, int numBytes)
 {
@@ -71,20 +78,17 @@ int main(int argc, const char* argv[])
         return 0;
     }
     
-    const int sleepDurationMs = 10;
     const int sendIntervalMs = 1000;
     const int numFramesToSend = 5;
     int sentFrameCount = 0;
-    int sendTimer = 0;
+    long long nextSendTime = currentTimeMs() + sendIntervalMs;
     int sendText = 0;
 
     while (snWebsocket_getState(ws) != SN_STATE_CLOSED)
     {
-        sendTimer += sleepDurationMs;
-        
-        if (snWebsocket_getState(ws) == SN_STATE_OPEN && sendTimer >= sendIntervalMs)
+        if (snWebsocket_getState(ws) == SN_STATE_OPEN && currentTimeMs() >= nextSendTime)
         {
-            sendTimer = 0;
+            nextSendTime = currentTimeMs() + sendIntervalMs;
             
             char payload[256];
             sprintf(payload, "Frame %d payload.", sentFrameCount + 1);
@@ -110,9 +114,10 @@ int main(int argc, const char* argv[])
             } 
         }
         
-        usleep(1000 * sleepDurationMs);
-        
-        snWebsocket_poll(ws);
+        //sleep until something arrives or it's time to send. there's
+        //nothing to send until the websocket is open.
+        const long long waitMs = nextSendTime - currentTimeMs();
+        snWebsocket_pollWait(ws, waitMs > 0 ? (int)waitMs : -1);
     }
     
     snWebsocket_delete(ws);
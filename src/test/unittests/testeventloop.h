@@ -0,0 +1,432 @@
+/*
+ * Copyright (c) 2013, Per Gantelius
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the copyright holders.
+ */
+
+#ifndef SN_TEST_EVENT_LOOP_H
+#define SN_TEST_EVENT_LOOP_H
+
+#ifdef __linux__
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sput.h"
+
+#include "backends/bsdsocket/eventloop.h"
+#include "backends/bsdsocket/iocallbacks_socket.h"
+#include "backends/iouring/iocallbacks_uring.h"
+#include "backends/iouring/uringsocket.h"
+#include "testwebsocket.h"
+
+/** Socket I/O, but with the clock of the tests. */
+static const snIOCallbacks loopbackIOCallbacks = {
+    snSocketInitCallback,
+    snSocketDeinitCallback,
+    snSocketConnectCallback,
+    snSocketDisconnectCallback,
+    snSocketReadCallback,
+    snSocketWriteCallback,
+    testIOTime,
+    snSocketWritevCallback
+};
+
+/** Socket I/O that can be woken up by \c snWebsocket_postFrame. */
+static const snIOCallbacks wakingLoopbackIOCallbacks = {
+    snSocketInitCallback,
+    snSocketDeinitCallback,
+    snSocketConnectCallback,
+    snSocketDisconnectCallback,
+    snSocketReadCallback,
+    snSocketWriteCallback,
+    testIOTime,
+    snSocketWritevCallback,
+    NULL,
+    snSocketWaitCallback,
+    snSocketGetFileDescriptorCallback,
+    snSocketWakeCallback
+};
+
+/** io_uring socket I/O, with the clock of the tests. */
+static const snIOCallbacks uringLoopbackIOCallbacks = {
+    snUringInitCallback,
+    snUringDeinitCallback,
+    snUringConnectCallback,
+    snUringDisconnectCallback,
+    snUringReadCallback,
+    snUringWriteCallback,
+    testIOTime,
+    snUringWritevCallback,
+    NULL,
+    NULL,
+    snUringGetFileDescriptorCallback
+};
+
+static long long loopbackTimeMs(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+/**
+ * Creates a socket listening on a loopback port.
+ */
+static int createLoopbackListener(int* port)
+{
+    const int listener = socket(AF_INET, SOCK_STREAM, 0);
+    
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(listener, (struct sockaddr*)&address, sizeof(address));
+    listen(listener, 16);
+    
+    socklen_t addressSize = sizeof(address);
+    getsockname(listener, (struct sockaddr*)&address, &addressSize);
+    *port = ntohs(address.sin_port);
+    
+    return listener;
+}
+
+/**
+ * Connects a websocket created with the given settings to a listening loopback
+ * socket and answers its opening handshake. The websocket opens the next time
+ * it is polled.
+ * @param serverSocket Receives the server end of the connection.
+ */
+static snWebsocket* connectLoopbackWebsocketWithSettings(snWebsocketSettings* settings,
+                                                         snMessageCallback messageCallback,
+                                                         void* callbackData,
+                                                         int listener,
+                                                         int port,
+                                                         int* serverSocket)
+{
+    snWebsocket* ws = snWebsocket_create(NULL, messageCallback, NULL, NULL, callbackData, settings);
+    snWebsocket_connect(ws, "127.0.0.1", "/", NULL, port, NULL, 0);
+    
+    *serverSocket = accept(listener, NULL, NULL);
+    
+    //read the request up to the blank line ending it
+    char request[4096];
+    int requestSize = 0;
+    while (requestSize < 4 || memcmp(&request[requestSize - 4], "\r\n\r\n", 4) != 0)
+    {
+        if (read(*serverSocket, &request[requestSize], 1) != 1)
+        {
+            break;
+        }
+        requestSize++;
+    }
+    
+    const int responseSize = (int)strlen(TEST_HANDSHAKE_RESPONSE);
+    if (write(*serverSocket, TEST_HANDSHAKE_RESPONSE, responseSize) != responseSize)
+    {
+        //the websocket won't open, which the tests check
+    }
+    
+    return ws;
+}
+
+/**
+ * Connects a websocket to a listening loopback socket and answers its opening
+ * handshake. The websocket opens the next time it is polled.
+ * @param serverSocket Receives the server end of the connection.
+ */
+static snWebsocket* connectLoopbackWebsocket(const snIOCallbacks* ioCallbacks,
+                                             snMessageCallback messageCallback,
+                                             void* callbackData,
+                                             int listener,
+                                             int port,
+                                             int* serverSocket)
+{
+    snWebsocketSettings settings;
+    memset(&settings, 0, sizeof(snWebsocketSettings));
+    settings.ioCallbacks = ioCallbacks;
+    settings.cryptoCallbacks = &testCryptoCallbacks;
+    
+    return connectLoopbackWebsocketWithSettings(&settings, messageCallback, callbackData, listener, port, serverSocket);
+}
+
+static void* wakeLoopLater(void* loop)
+{
+    usleep(200 * 1000);
+    snEventLoop_wake((snEventLoop*)loop);
+    return NULL;
+}
+
+static void testEventLoopWaitsForActivity()
+{
+    int port = 0;
+    const int listener = createLoopbackListener(&port);
+    int serverSocket = -1;
+    snWebsocket* ws = connectLoopbackWebsocket(&loopbackIOCallbacks, NULL, NULL, listener, port, &serverSocket);
+    
+    snEventLoop* loop = snEventLoop_create();
+    snEventLoop_add(loop, ws);
+    for (int i = 0; i < 100 && snWebsocket_getState(ws) != SN_STATE_OPEN; i++)
+    {
+        snEventLoop_runOnce(loop, 10);
+    }
+    sput_fail_unless(snWebsocket_getState(ws) == SN_STATE_OPEN, "A websocket in the loop should open");
+    
+    //nothing is due, so only the wake up ends the wait
+    pthread_t thread;
+    pthread_create(&thread, NULL, wakeLoopLater, loop);
+    const long long startTime = loopbackTimeMs();
+    snEventLoop_runOnce(loop, -1);
+    const long long elapsedMs = loopbackTimeMs() - startTime;
+    pthread_join(thread, NULL);
+    sput_fail_unless(elapsedMs >= 150, "An idle loop should wait until woken up");
+    
+    snEventLoop_remove(loop, ws);
+    snEventLoop_delete(loop);
+    snWebsocket_delete(ws);
+    close(serverSocket);
+    close(listener);
+}
+
+static void testEventLoopClosingTimeout()
+{
+    int port = 0;
+    const int listener = createLoopbackListener(&port);
+    int serverSocket = -1;
+    snWebsocket* ws = connectLoopbackWebsocket(&loopbackIOCallbacks, NULL, NULL, listener, port, &serverSocket);
+    
+    snEventLoop* loop = snEventLoop_create();
+    snEventLoop_add(loop, ws);
+    for (int i = 0; i < 100 && snWebsocket_getState(ws) != SN_STATE_OPEN; i++)
+    {
+        snEventLoop_runOnce(loop, 10);
+    }
+    
+    //the peer never answers the close frame. waking the loop
+    //makes it notice the closing handshake started outside it.
+    snWebsocket_disconnect(ws, 0);
+    testTime += 1.9f;
+    snEventLoop_wake(loop);
+    snEventLoop_runOnce(loop, 0);
+    sput_fail_unless(snWebsocket_getState(ws) == SN_STATE_CLOSING, "The closing handshake should be in progress");
+    
+    //the closing handshake timer ends the wait
+    testTime += 1.0f;
+    const long long startTime = loopbackTimeMs();
+    snEventLoop_runOnce(loop, 2000);
+    const long long elapsedMs = loopbackTimeMs() - startTime;
+    sput_fail_unless(snWebsocket_getState(ws) == SN_STATE_CLOSED, "The closing handshake should time out");
+    sput_fail_unless(elapsedMs < 1000, "The loop should wake up for the closing handshake timeout");
+    sput_fail_unless(snEventLoop_run(loop) == SN_NO_ERROR, "Running a loop of closed websockets should return");
+    
+    snEventLoop_remove(loop, ws);
+    snEventLoop_delete(loop);
+    snWebsocket_delete(ws);
+    close(serverSocket);
+    close(listener);
+}
+
+static void countLoopbackMessage(void* userData, snOpcode opcode, const char* bytes, int numBytes)
+{
+    if (opcode == SN_OPCODE_TEXT && numBytes == 5 && memcmp(bytes, "hello", 5) == 0)
+    {
+        (*(int*)userData)++;
+    }
+}
+
+/**
+ * Reads a number of bytes from a socket, giving up after a second without data.
+ */
+static int readLoopbackBytes(int fileDescriptor, char* bytes, int numBytes)
+{
+    int numRead = 0;
+    while (numRead < numBytes)
+    {
+        struct pollfd pfd;
+        pfd.fd = fileDescriptor;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 1000) != 1)
+        {
+            return 0;
+        }
+        
+        const ssize_t result = read(fileDescriptor, &bytes[numRead], numBytes - numRead);
+        if (result <= 0)
+        {
+            return 0;
+        }
+        numRead += (int)result;
+    }
+    
+    return 1;
+}
+
+static void testEventLoopUringWebsockets()
+{
+    enum { NUM_WEBSOCKETS = 3 };
+    
+    int port = 0;
+    const int listener = createLoopbackListener(&port);
+    int numMessages = 0;
+    snWebsocket* websockets[NUM_WEBSOCKETS];
+    int serverSockets[NUM_WEBSOCKETS];
+    
+    snEventLoop* loop = snEventLoop_create();
+    for (int i = 0; i < NUM_WEBSOCKETS; i++)
+    {
+        websockets[i] = connectLoopbackWebsocket(&uringLoopbackIOCallbacks,
+                                                 countLoopbackMessage,
+                                                 &numMessages,
+                                                 listener,
+                                                 port,
+                                                 &serverSockets[i]);
+        sput_fail_unless(snEventLoop_add(loop, websockets[i]) == SN_NO_ERROR,
+                         "Websockets using io_uring should be accepted by the loop");
+    }
+    
+    int numOpen = 0;
+    for (int i = 0; i < 100 && numOpen < NUM_WEBSOCKETS; i++)
+    {
+        snEventLoop_runOnce(loop, 10);
+        numOpen = 0;
+        for (int j = 0; j < NUM_WEBSOCKETS; j++)
+        {
+            numOpen += snWebsocket_getState(websockets[j]) == SN_STATE_OPEN;
+        }
+    }
+    sput_fail_unless(numOpen == NUM_WEBSOCKETS, "Websockets using io_uring should open in the loop");
+    
+    //where io_uring is available, the websockets of the thread share its ring
+    if (snUringSocket_isUsingRing((snUringSocket*)snWebsocket_getIOObject(websockets[0])))
+    {
+        int numShared = 0;
+        for (int i = 0; i < NUM_WEBSOCKETS; i++)
+        {
+            numShared += (snWebsocket_getInterest(websockets[i]) & SN_IO_SHARED) != 0 &&
+                         snWebsocket_getFileDescriptor(websockets[i]) == snWebsocket_getFileDescriptor(websockets[0]);
+        }
+        sput_fail_unless(numShared == NUM_WEBSOCKETS, "The websockets of a thread should share a ring");
+    }
+    
+    //unmasked text frames from the server
+    const char frame[] = { (char)0x81, 5, 'h', 'e', 'l', 'l', 'o' };
+    for (int i = 0; i < NUM_WEBSOCKETS; i++)
+    {
+        if (write(serverSockets[i], frame, sizeof(frame)) != (ssize_t)sizeof(frame))
+        {
+            //the message count check fails
+        }
+    }
+    for (int i = 0; i < 100 && numMessages < NUM_WEBSOCKETS; i++)
+    {
+        snEventLoop_runOnce(loop, 10);
+    }
+    sput_fail_unless(numMessages == NUM_WEBSOCKETS, "Each websocket should receive its message");
+    
+    //sent outside of the loop, so only submitted once the loop runs
+    for (int i = 0; i < NUM_WEBSOCKETS; i++)
+    {
+        snWebsocket_sendTextData(websockets[i], "hello");
+    }
+    snEventLoop_runOnce(loop, 0);
+    
+    int numReceived = 0;
+    for (int i = 0; i < NUM_WEBSOCKETS; i++)
+    {
+        //a masked frame with a five byte payload
+        char bytes[11];
+        numReceived += readLoopbackBytes(serverSockets[i], bytes, sizeof(bytes)) &&
+                       bytes[0] == (char)0x81 &&
+                       bytes[1] == (char)0x85;
+    }
+    sput_fail_unless(numReceived == NUM_WEBSOCKETS, "Each websocket should send its message");
+    
+    for (int i = 0; i < NUM_WEBSOCKETS; i++)
+    {
+        snEventLoop_remove(loop, websockets[i]);
+        snWebsocket_delete(websockets[i]);
+        close(serverSockets[i]);
+    }
+    snEventLoop_delete(loop);
+    close(listener);
+}
+
+static void* postFrameLater(void* ws)
+{
+    usleep(200 * 1000);
+    snWebsocket_postFrame((snWebsocket*)ws, SN_OPCODE_TEXT, 5, "hello");
+    return NULL;
+}
+
+static void testEventLoopPostFrame()
+{
+    int port = 0;
+    const int listener = createLoopbackListener(&port);
+    int serverSocket = -1;
+    snWebsocket* ws = connectLoopbackWebsocket(&wakingLoopbackIOCallbacks, NULL, NULL, listener, port, &serverSocket);
+    
+    snEventLoop* loop = snEventLoop_create();
+    snEventLoop_add(loop, ws);
+    for (int i = 0; i < 100 && snWebsocket_getState(ws) != SN_STATE_OPEN; i++)
+    {
+        snEventLoop_runOnce(loop, 10);
+    }
+    sput_fail_unless(snWebsocket_getState(ws) == SN_STATE_OPEN, "A websocket in the loop should open");
+    
+    //the frame posted from another thread ends the wait and is sent
+    pthread_t thread;
+    pthread_create(&thread, NULL, postFrameLater, ws);
+    const long long startTime = loopbackTimeMs();
+    snEventLoop_runOnce(loop, 2000);
+    const long long elapsedMs = loopbackTimeMs() - startTime;
+    pthread_join(thread, NULL);
+    snEventLoop_runOnce(loop, 0);
+    sput_fail_unless(elapsedMs < 1000, "A posted frame should wake up the loop");
+    
+    //a masked frame with a five byte payload
+    char bytes[11];
+    sput_fail_unless(readLoopbackBytes(serverSocket, bytes, sizeof(bytes)) &&
+                     bytes[0] == (char)0x81 &&
+                     bytes[1] == (char)0x85,
+                     "The loop should send the posted frame");
+    
+    snEventLoop_remove(loop, ws);
+    snEventLoop_delete(loop);
+    snWebsocket_delete(ws);
+    close(serverSocket);
+    close(listener);
+}
+
+#endif /* __linux__ */
+
+#endif /*SN_TEST_EVENT_LOOP_H*/
@@ -105,7 +105,100 @@ static void testFrameHeaderValidation()
 
 static void testMasking()
 {
-    //TODO
+    const int payloadSize = 300;
+    const int maskingKey = 0x37fa213d;
+    const unsigned char keyBytes[4] = {0x37, 0xfa, 0x21, 0x3d};
+    
+    char payload[payloadSize + 32];
+    char masked[payloadSize + 32];
+    for (int i = 0; i < payloadSize + 32; i++)
+    {
+        payload[i] = (char)(i * 7);
+    }
+    
+    snFrameHeader h;
+    memset(&h, 0, sizeof(snFrameHeader));
+    h.isMasked = 1;
+    h.maskingKey = maskingKey;
+    
+    //mask every sub range of the payload in place, starting at different
+    //alignments, and compare against the byte-by-byte definition
+    int numFailures = 0;
+    for (int alignment = 0; alignment < 32; alignment += 3)
+    {
+        for (int start = 0; start < payloadSize; start += 17)
+        {
+            for (int numBytes = 0; start + numBytes <= payloadSize; numBytes += 13)
+            {
+                memcpy(&masked[alignment], &payload[start], numBytes);
+                snFrameHeader_applyMask(&h, &masked[alignment], numBytes, start);
+                
+                for (int i = 0; i < numBytes; i++)
+                {
+                    const char expected = payload[start + i] ^ keyBytes[(start + i) % 4];
+                    if (masked[alignment + i] != expected)
+                    {
+                        numFailures++;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    sput_fail_unless(numFailures == 0, "Masked bytes should match the reference mask");
+    
+    //masking twice gives back the original payload
+    memcpy(masked, payload, payloadSize);
+    snFrameHeader_applyMask(&h, masked, payloadSize, 3);
+    sput_fail_unless(memcmp(masked, payload, payloadSize) != 0, "Masking should change the payload");
+    snFrameHeader_applyMask(&h, masked, payloadSize, 3);
+    sput_fail_unless(memcmp(masked, payload, payloadSize) == 0, "Masking twice should restore the payload");
+    
+    h.maskingKey = 0;
+    sput_fail_unless(snFrameHeader_applyMask(&h, masked, payloadSize, 0) == SN_MASKING_KEY_IS_ZERO,
+                     "A zero masking key should be rejected");
+}
+
+static void testPreparedMessage()
+{
+    const char* text = "prepared";
+    const int textSize = (int)strlen(text);
+    
+    snPreparedMessage message;
+    sput_fail_unless(snPreparedMessage_init(&message, SN_OPCODE_TEXT, textSize, text) == SN_NO_ERROR,
+                     "Preparing a valid text message should succeed");
+    
+    //the header written for a given key must match a regularly serialized header
+    snFrameHeader h;
+    memset(&h, 0, sizeof(snFrameHeader));
+    h.isFinal = 1;
+    h.isMasked = 1;
+    h.opcode = SN_OPCODE_TEXT;
+    h.payloadSize = textSize;
+    h.maskingKey = 0x12345678;
+    
+    char expectedBytes[SN_MAX_HEADER_SIZE];
+    uint32_t expectedSize = 0;
+    snFrameHeader_toBytes(&h, expectedBytes, &expectedSize);
+    
+    char headerBytes[SN_MAX_HEADER_SIZE];
+    snPreparedMessage_writeHeader(&message, h.maskingKey, headerBytes);
+    sput_fail_unless(message.headerSize == expectedSize &&
+                     memcmp(headerBytes, expectedBytes, expectedSize) == 0,
+                     "Prepared header should match the serialized header");
+    
+    //copying while masking should give the same bytes as masking in place
+    char masked[16];
+    char copied[16];
+    memcpy(masked, message.payload, textSize);
+    snFrameHeader_applyMask(&h, masked, textSize, 0);
+    snFrameHeader_copyMasked(&h, copied, message.payload, textSize, 0);
+    sput_fail_unless(memcmp(masked, copied, textSize) == 0, "Copying masked bytes should match masking in place");
+    
+    snPreparedMessage_deinit(&message);
+    
+    sput_fail_unless(snPreparedMessage_init(&message, SN_OPCODE_TEXT, 2, "\xc3\x28") == SN_INVALID_UTF8,
+                     "Preparing a text message with invalid UTF-8 should fail");
 }
 
 #endif //SN_TEST_WEBSOCKET_FRAME_H
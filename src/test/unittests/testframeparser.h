@@ -96,4 +96,301 @@ static void testFrameParserHeaderEquality()
     snFrameParser_deinit(&p);
 }
 
+static int parsedFrameCount;
+
+static const snFrameHeader* expectedHeaders;
+static int numHeadersOk;
+
+static void comparingFrameCallback(void* userData, const snFrame* frame)
+{
+    if (snFrameHeader_equals(&frame->header, &expectedHeaders[parsedFrameCount]))
+    {
+        numHeadersOk++;
+    }
+    parsedFrameCount++;
+}
+
+static void testFrameParserWholeHeader()
+{
+    //feed back-to-back frames in chunks of varying size, so that
+    //headers are decoded both by the whole header fast path and
+    //by the per byte state machine.
+    static char buffer[1 << 17];
+    static char stream[1 << 18];
+    snFrameParser p;
+    snFrameParser_init(&p, comparingFrameCallback, NULL, NULL, NULL, buffer, sizeof(buffer));
+    
+    const int numCases = 6;
+    int maskFlags[numCases] = {0, 1, 0, 1, 0, 1};
+    int maskingKeys[numCases] = {0, 0x12345678, 0, -2, 0, 9999};
+    unsigned long long payloadSizes[numCases] = {0, 5, 125, 126, (1 << 16) - 1, (1 << 16) + 1};
+    
+    snFrameHeader headers[numCases];
+    expectedHeaders = headers;
+    int streamSize = 0;
+    for (int i = 0; i < numCases; i++)
+    {
+        snFrameHeader* h = &headers[i];
+        memset(h, 0, sizeof(snFrameHeader));
+        h->opcode = SN_OPCODE_BINARY;
+        h->isFinal = 1;
+        h->isMasked = maskFlags[i];
+        h->maskingKey = maskingKeys[i];
+        h->payloadSize = payloadSizes[i];
+        
+        uint32_t headerSize = 0;
+        snFrameHeader_toBytes(h, &stream[streamSize], &headerSize);
+        streamSize += headerSize;
+        memset(&stream[streamSize], 'x', h->payloadSize);
+        streamSize += h->payloadSize;
+    }
+    
+    const int chunkSizes[] = {1, 3, 13, 14, 1024, sizeof(stream)};
+    for (int c = 0; c < sizeof(chunkSizes) / sizeof(chunkSizes[0]); c++)
+    {
+        snFrameParser_reset(&p);
+        parsedFrameCount = 0;
+        numHeadersOk = 0;
+        
+        //each header is compared in the frame callback, since
+        //one call may parse several frames
+        snError result = SN_NO_ERROR;
+        int offset = 0;
+        while (offset < streamSize && result == SN_NO_ERROR)
+        {
+            const int chunkSize = streamSize - offset < chunkSizes[c] ? streamSize - offset : chunkSizes[c];
+            result = snFrameParser_processBytes(&p, &stream[offset], chunkSize);
+            offset += chunkSize;
+        }
+        
+        sput_fail_unless(result == SN_NO_ERROR, "Parsing valid frames should succeed");
+        sput_fail_unless(parsedFrameCount == numCases, "All frames in the stream should be parsed");
+        sput_fail_unless(numHeadersOk == numCases, "The parsed frame headers should equal the input frame headers");
+    }
+    
+    snFrameParser_deinit(&p);
+}
+
+static const char* deliveredMessage;
+static int deliveredMessageSize;
+
+static void zeroCopyMessageCallback(void* userData, snOpcode opcode, const char* bytes, int numBytes)
+{
+    deliveredMessage = bytes;
+    deliveredMessageSize = numBytes;
+}
+
+static void testFrameParserZeroCopy()
+{
+    char buffer[1 << 10];
+    snFrameParser p;
+    snFrameParser_init(&p, NULL, NULL, zeroCopyMessageCallback, NULL, buffer, sizeof(buffer));
+    p.zeroCopy = 1;
+    
+    snFrameHeader h;
+    memset(&h, 0, sizeof(snFrameHeader));
+    h.opcode = SN_OPCODE_BINARY;
+    h.isFinal = 1;
+    h.payloadSize = 100;
+    
+    char frame[SN_MAX_HEADER_SIZE + 100];
+    uint32_t headerSize = 0;
+    snFrameHeader_toBytes(&h, frame, &headerSize);
+    memset(&frame[headerSize], 'x', h.payloadSize);
+    const int frameSize = headerSize + h.payloadSize;
+    
+    //a frame contained in a single read is delivered in place
+    deliveredMessage = NULL;
+    snFrameParser_processBytes(&p, frame, frameSize);
+    sput_fail_unless(deliveredMessage == &frame[headerSize], "A complete frame should be delivered without copying");
+    sput_fail_unless(deliveredMessageSize == h.payloadSize, "The delivered message should have the frame's payload size");
+    
+    //a frame split across reads is reassembled in the parser buffer
+    deliveredMessage = NULL;
+    snFrameParser_processBytes(&p, frame, frameSize / 2);
+    snFrameParser_processBytes(&p, &frame[frameSize / 2], frameSize - frameSize / 2);
+    sput_fail_unless(deliveredMessage == buffer, "A split frame should be delivered from the parser buffer");
+    sput_fail_unless(memcmp(deliveredMessage, &frame[headerSize], h.payloadSize) == 0, "A split frame should be reassembled");
+    
+    snFrameParser_deinit(&p);
+}
+
+static char streamedMessage[256];
+static int streamedMessageSize;
+static int streamedFirstCount;
+static int streamedLastCount;
+
+static void chunkCallback(void* userData, snOpcode opcode, const char* chunk, int chunkSize, int isFirst, int isLast)
+{
+    if (isFirst)
+    {
+        streamedMessageSize = 0;
+        streamedFirstCount++;
+    }
+    memcpy(&streamedMessage[streamedMessageSize], chunk, chunkSize);
+    streamedMessageSize += chunkSize;
+    streamedLastCount += isLast;
+}
+
+static int writeTextFragment(char* dst, const char* text, int numBytes, int isFirst, int isFinal)
+{
+    snFrameHeader h;
+    memset(&h, 0, sizeof(snFrameHeader));
+    h.opcode = isFirst ? SN_OPCODE_TEXT : SN_OPCODE_CONTINUATION;
+    h.isFinal = isFinal;
+    h.payloadSize = numBytes;
+    
+    uint32_t headerSize = 0;
+    snFrameHeader_toBytes(&h, dst, &headerSize);
+    memcpy(&dst[headerSize], text, numBytes);
+    return headerSize + numBytes;
+}
+
+static void testFrameParserChunks()
+{
+    //"a\u00e5\u20ac b", with both multi-byte code points split across fragments
+    const char text[] = "a\xc3\xa5\xe2\x82\xac b";
+    const int textSize = sizeof(text) - 1;
+    
+    char stream[256];
+    int streamSize = 0;
+    streamSize += writeTextFragment(&stream[streamSize], text, 2, 1, 0);
+    streamSize += writeTextFragment(&stream[streamSize], &text[2], 0, 0, 0);
+    streamSize += writeTextFragment(&stream[streamSize], &text[2], 3, 0, 0);
+    streamSize += writeTextFragment(&stream[streamSize], &text[5], textSize - 5, 0, 1);
+    
+    for (int chunkSize = 1; chunkSize <= streamSize; chunkSize++)
+    {
+        snFrameParser p;
+        snFrameParser_init(&p, NULL, NULL, NULL, NULL, NULL, 16);
+        p.chunkCallback = chunkCallback;
+        
+        streamedMessageSize = 0;
+        streamedFirstCount = 0;
+        streamedLastCount = 0;
+        
+        snError result = SN_NO_ERROR;
+        for (int offset = 0; offset < streamSize && result == SN_NO_ERROR; offset += chunkSize)
+        {
+            const int numBytes = streamSize - offset < chunkSize ? streamSize - offset : chunkSize;
+            result = snFrameParser_processBytes(&p, &stream[offset], numBytes);
+        }
+        
+        if (result != SN_NO_ERROR ||
+            streamedFirstCount != 1 ||
+            streamedLastCount != 1 ||
+            streamedMessageSize != textSize ||
+            memcmp(streamedMessage, text, textSize) != 0)
+        {
+            sput_fail_if(1, "A streamed message should be delivered in chunks without buffering");
+        }
+        
+        snFrameParser_deinit(&p);
+    }
+    
+    //a message ending in the middle of a code point must be rejected
+    snFrameParser p;
+    snFrameParser_init(&p, NULL, NULL, NULL, NULL, NULL, 16);
+    p.chunkCallback = chunkCallback;
+    streamSize = writeTextFragment(stream, text, 2, 1, 1);
+    sput_fail_unless(snFrameParser_processBytes(&p, stream, streamSize) == SN_INVALID_UTF8, "Incomplete UTF-8 should be rejected");
+    snFrameParser_deinit(&p);
+}
+
+static unsigned long long streamedByteCount;
+static int streamedMessageCount;
+
+static void countingChunkCallback(void* userData, snOpcode opcode, const char* chunk, int chunkSize, int isFirst, int isLast)
+{
+    streamedByteCount += chunkSize;
+    streamedMessageCount += isLast;
+}
+
+static void testFrameParserHugeStreamedFrame()
+{
+    snFrameParser p;
+    snFrameParser_init(&p, NULL, NULL, NULL, NULL, NULL, 16);
+    p.chunkCallback = countingChunkCallback;
+    streamedByteCount = 0;
+    streamedMessageCount = 0;
+    
+    //a binary frame larger than 4 GB, followed by a small one
+    const unsigned long long payloadSize = (1ULL << 32) + 10;
+    snFrameHeader h;
+    memset(&h, 0, sizeof(snFrameHeader));
+    h.opcode = SN_OPCODE_BINARY;
+    h.isFinal = 1;
+    h.payloadSize = payloadSize;
+    
+    static char bytes[1 << 20];
+    uint32_t headerSize = 0;
+    snFrameHeader_toBytes(&h, bytes, &headerSize);
+    snError result = snFrameParser_processBytes(&p, bytes, headerSize);
+    
+    memset(bytes, 0, sizeof(bytes));
+    unsigned long long numBytesLeft = payloadSize;
+    while (numBytesLeft > 0 && result == SN_NO_ERROR)
+    {
+        const int numBytes = numBytesLeft < sizeof(bytes) ? (int)numBytesLeft : (int)sizeof(bytes);
+        result = snFrameParser_processBytes(&p, bytes, numBytes);
+        numBytesLeft -= numBytes;
+    }
+    
+    h.payloadSize = 3;
+    snFrameHeader_toBytes(&h, bytes, &headerSize);
+    if (result == SN_NO_ERROR)
+    {
+        result = snFrameParser_processBytes(&p, bytes, headerSize + 3);
+    }
+    
+    sput_fail_unless(result == SN_NO_ERROR &&
+                     streamedMessageCount == 2 &&
+                     streamedByteCount == payloadSize + 3,
+                     "A streamed frame larger than 4 GB should not throw the parser off");
+    
+    snFrameParser_deinit(&p);
+}
+
+static void testFrameParserBufferGrowth()
+{
+    const int maxFrameSize = 1 << 16;
+    snFrameParser p;
+    snFrameParser_init(&p, NULL, NULL, zeroCopyMessageCallback, NULL, NULL, maxFrameSize);
+    sput_fail_unless(p.buffer == NULL, "No buffer should be allocated up front");
+    
+    static char frame[1 << 17];
+    snFrameHeader h;
+    memset(&h, 0, sizeof(snFrameHeader));
+    h.opcode = SN_OPCODE_BINARY;
+    h.isFinal = 1;
+    
+    const int payloadSizes[3] = {10, 5000, maxFrameSize};
+    for (int i = 0; i < 3; i++)
+    {
+        h.payloadSize = payloadSizes[i];
+        uint32_t headerSize = 0;
+        snFrameHeader_toBytes(&h, frame, &headerSize);
+        memset(&frame[headerSize], 'a' + i, h.payloadSize);
+        
+        deliveredMessageSize = 0;
+        snError result = snFrameParser_processBytes(&p, frame, headerSize + h.payloadSize);
+        
+        if (i < 2)
+        {
+            sput_fail_unless(result == SN_NO_ERROR && deliveredMessageSize == payloadSizes[i], "A message within the size limit should be delivered");
+            sput_fail_unless(p.bufferSize > payloadSizes[i] && p.bufferSize <= maxFrameSize, "The buffer should grow to fit the message");
+        }
+        else
+        {
+            sput_fail_unless(result == SN_EXCEEDED_MAX_PAYLOAD_SIZE, "A message exceeding the size limit should be rejected");
+        }
+    }
+    
+    snFrameParser_reset(&p);
+    snFrameParser_shrinkBuffer(&p);
+    sput_fail_unless(p.bufferSize < 5000, "The buffer should shrink when idle");
+    
+    snFrameParser_deinit(&p);
+}
+
 #endif //SN_TEST_FRAME_PARSER_H
@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2013, Per Gantelius
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the copyright holders.
+ */
+
+#ifndef SN_TEST_IO_THREAD_H
+#define SN_TEST_IO_THREAD_H
+
+#ifdef __linux__
+
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sput.h"
+
+#include "testeventloop.h"
+
+/**
+ * Connects a loopback websocket polled by an I/O thread
+ * and waits for the thread to open it.
+ */
+static snWebsocket* openIOThreadWebsocket(int messageRingSize,
+                                          int maxReceiveQueueSize,
+                                          int listener,
+                                          int port,
+                                          int* serverSocket)
+{
+    snWebsocketSettings settings;
+    memset(&settings, 0, sizeof(snWebsocketSettings));
+    settings.ioCallbacks = &wakingLoopbackIOCallbacks;
+    settings.cryptoCallbacks = &testCryptoCallbacks;
+    settings.useIOThread = 1;
+    settings.queueMessages = 1;
+    settings.messageRingSize = messageRingSize;
+    settings.maxReceiveQueueSize = maxReceiveQueueSize;
+    
+    snWebsocket* ws = connectLoopbackWebsocketWithSettings(&settings, NULL, NULL, listener, port, serverSocket);
+    for (int i = 0; i < 1000 && snWebsocket_getState(ws) != SN_STATE_OPEN; i++)
+    {
+        usleep(1000);
+    }
+    
+    return ws;
+}
+
+/**
+ * Receives text messages until a number of them have
+ * arrived, or none has for a second.
+ * @return The number of "hello" messages received.
+ */
+static int receiveIOThreadMessages(snWebsocket* ws, int numMessages)
+{
+    int numReceived = 0;
+    int numHello = 0;
+    while (numReceived < numMessages)
+    {
+        snReceivedMessage messages[4];
+        int n = 0;
+        if (snWebsocket_receiveBatch(ws, messages, 4, &n, 1000) != SN_NO_ERROR)
+        {
+            break;
+        }
+        
+        for (int i = 0; i < n; i++)
+        {
+            numHello += messages[i].numBytes == 5 && memcmp(messages[i].bytes, "hello", 5) == 0;
+        }
+        numReceived += n;
+    }
+    
+    return numHello;
+}
+
+/** Unmasked text frames from the server. */
+static const char ioThreadFrames[] = {
+    (char)0x81, 5, 'h', 'e', 'l', 'l', 'o',
+    (char)0x81, 5, 'h', 'e', 'l', 'l', 'o',
+    (char)0x81, 5, 'h', 'e', 'l', 'l', 'o',
+    (char)0x81, 5, 'h', 'e', 'l', 'l', 'o'
+};
+
+/** An unmasked ping from the server. */
+static const char ioThreadPing[] = { (char)0x89, 2, 'h', 'i' };
+
+static void testIOThreadPingWhileRingIsFull()
+{
+    int port = 0;
+    const int listener = createLoopbackListener(&port);
+    int serverSocket = -1;
+    snWebsocket* ws = openIOThreadWebsocket(2, 0, listener, port, &serverSocket);
+    sput_fail_unless(snWebsocket_getState(ws) == SN_STATE_OPEN, "The I/O thread should open the websocket");
+    
+    //the application takes nothing while more messages
+    //than fit in the ring arrive, followed by a ping
+    if (write(serverSocket, ioThreadFrames, sizeof(ioThreadFrames)) != (ssize_t)sizeof(ioThreadFrames) ||
+        write(serverSocket, ioThreadPing, sizeof(ioThreadPing)) != (ssize_t)sizeof(ioThreadPing))
+    {
+        //the pong check fails
+    }
+    
+    //a masked pong with a two byte payload
+    char pong[8];
+    sput_fail_unless(readLoopbackBytes(serverSocket, pong, sizeof(pong)) &&
+                     pong[0] == (char)0x8A &&
+                     pong[1] == (char)0x82,
+                     "A ping should be answered while the ring is full");
+    sput_fail_unless(receiveIOThreadMessages(ws, 4) == 4, "The messages that didn't fit should be received in order");
+    
+    snWebsocket_delete(ws);
+    close(serverSocket);
+    close(listener);
+}
+
+static void testIOThreadPausesReads()
+{
+    int port = 0;
+    const int listener = createLoopbackListener(&port);
+    int serverSocket = -1;
+    snWebsocket* ws = openIOThreadWebsocket(1, 1, listener, port, &serverSocket);
+    
+    //one message fills the ring and the next one the receive queue
+    if (write(serverSocket, ioThreadFrames, 14) != 14)
+    {
+        //the message checks fail
+    }
+    usleep(100 * 1000);
+    if (write(serverSocket, ioThreadPing, sizeof(ioThreadPing)) != (ssize_t)sizeof(ioThreadPing))
+    {
+        //the pong check fails
+    }
+    
+    struct pollfd pfd;
+    pfd.fd = serverSocket;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    sput_fail_unless(poll(&pfd, 1, 200) == 0, "Nothing should be read while the receive queue is full");
+    
+    //a masked frame with a five byte payload
+    char bytes[11];
+    snWebsocket_postFrame(ws, SN_OPCODE_TEXT, 5, "hello");
+    sput_fail_unless(readLoopbackBytes(serverSocket, bytes, sizeof(bytes)) &&
+                     bytes[0] == (char)0x81 &&
+                     bytes[1] == (char)0x85,
+                     "Posted frames should be sent while reads are paused");
+    
+    //taking a message makes room for the rest, and reading resumes
+    sput_fail_unless(receiveIOThreadMessages(ws, 1) == 1, "The message in the ring should be received");
+    char pong[8];
+    sput_fail_unless(readLoopbackBytes(serverSocket, pong, sizeof(pong)) &&
+                     pong[0] == (char)0x8A &&
+                     pong[1] == (char)0x82,
+                     "The ping should be answered once reading resumes");
+    sput_fail_unless(receiveIOThreadMessages(ws, 1) == 1, "The kept message should be received");
+    
+    snWebsocket_delete(ws);
+    close(serverSocket);
+    close(listener);
+}
+
+#endif /* __linux__ */
+
+#endif /*SN_TEST_IO_THREAD_H*/
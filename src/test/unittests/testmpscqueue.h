@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2013, Per Gantelius
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the copyright holders.
+ */
+
+#ifndef SN_TEST_MPSC_QUEUE_H
+#define SN_TEST_MPSC_QUEUE_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+
+#include "sput.h"
+
+#include "mpscqueue.h"
+
+/** An item pushed by a test producer. */
+typedef struct snTestMpscItem
+{
+    /** Must be first. */
+    snMpscNode node;
+    /** The index of the producer that pushed the item. */
+    int producer;
+    /** The position of the item among those of its producer. */
+    int sequence;
+} snTestMpscItem;
+
+/** A producer pushing its items from a thread of its own. */
+typedef struct snTestMpscProducer
+{
+    snMpscQueue* queue;
+    snTestMpscItem* items;
+    int numItems;
+} snTestMpscProducer;
+
+static void* runTestMpscProducer(void* data)
+{
+    snTestMpscProducer* producer = (snTestMpscProducer*)data;
+    for (int i = 0; i < producer->numItems; i++)
+    {
+        snMpscQueue_push(producer->queue, &producer->items[i].node);
+    }
+    return NULL;
+}
+
+static void testMpscQueueOrder()
+{
+    snMpscQueue queue;
+    snMpscQueue_init(&queue);
+    sput_fail_unless(snMpscQueue_isEmpty(&queue) && snMpscQueue_pop(&queue) == NULL,
+                     "A new queue should be empty");
+    
+    snTestMpscItem items[3];
+    for (int i = 0; i < 3; i++)
+    {
+        items[i].sequence = i;
+        snMpscQueue_push(&queue, &items[i].node);
+    }
+    sput_fail_unless(!snMpscQueue_isEmpty(&queue), "A queue with pushed nodes should not be empty");
+    
+    int numInOrder = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        numInOrder += snMpscQueue_pop(&queue) == &items[i].node;
+    }
+    sput_fail_unless(numInOrder == 3, "Nodes should be popped in the order they were pushed");
+    sput_fail_unless(snMpscQueue_isEmpty(&queue) && snMpscQueue_pop(&queue) == NULL,
+                     "A queue should be empty once all nodes are popped");
+    
+    //the queue keeps working after running empty
+    snMpscQueue_push(&queue, &items[0].node);
+    sput_fail_unless(snMpscQueue_pop(&queue) == &items[0].node && snMpscQueue_pop(&queue) == NULL,
+                     "A queue should be reusable once empty");
+}
+
+static void testMpscQueueProducers()
+{
+    enum { NUM_PRODUCERS = 4, NUM_ITEMS = 20000 };
+    
+    snMpscQueue queue;
+    snMpscQueue_init(&queue);
+    
+    snTestMpscItem* items = (snTestMpscItem*)malloc(NUM_PRODUCERS * NUM_ITEMS * sizeof(snTestMpscItem));
+    snTestMpscProducer producers[NUM_PRODUCERS];
+    pthread_t threads[NUM_PRODUCERS];
+    for (int p = 0; p < NUM_PRODUCERS; p++)
+    {
+        producers[p].queue = &queue;
+        producers[p].items = &items[p * NUM_ITEMS];
+        producers[p].numItems = NUM_ITEMS;
+        for (int i = 0; i < NUM_ITEMS; i++)
+        {
+            producers[p].items[i].producer = p;
+            producers[p].items[i].sequence = i;
+        }
+    }
+    for (int p = 0; p < NUM_PRODUCERS; p++)
+    {
+        pthread_create(&threads[p], NULL, runTestMpscProducer, &producers[p]);
+    }
+    
+    //popped while the producers are pushing
+    int nextSequences[NUM_PRODUCERS] = {0};
+    int numPopped = 0;
+    int numOutOfOrder = 0;
+    while (numPopped < NUM_PRODUCERS * NUM_ITEMS)
+    {
+        snTestMpscItem* item = (snTestMpscItem*)snMpscQueue_pop(&queue);
+        if (item == NULL)
+        {
+            sched_yield();
+            continue;
+        }
+        
+        if (item->sequence != nextSequences[item->producer])
+        {
+            numOutOfOrder++;
+        }
+        nextSequences[item->producer] = item->sequence + 1;
+        numPopped++;
+    }
+    
+    for (int p = 0; p < NUM_PRODUCERS; p++)
+    {
+        pthread_join(threads[p], NULL);
+    }
+    
+    sput_fail_unless(numOutOfOrder == 0, "The nodes of each producer should be popped in the order they were pushed");
+    sput_fail_unless(snMpscQueue_isEmpty(&queue) && snMpscQueue_pop(&queue) == NULL,
+                     "Every node should be popped exactly once");
+    
+    free(items);
+}
+
+#endif /*SN_TEST_MPSC_QUEUE_H*/
@@ -30,18 +30,70 @@
 #ifndef SN_TEST_OPENING_HANDSHAKE_PARSER_H
 #define SN_TEST_OPENING_HANDSHAKE_PARSER_H
 
+#include <string.h>
+
+#include "sput.h"
+
 #include "openinghandshakeparser.h"
 
 static const char* const SEC_WEBSOCKET_KEY = "TODO";
 
+static void handshakeTestRand(uint8_t* bytes, uint32_t numBytes)
+{
+    memset(bytes, 1, numBytes);
+}
+
+static void handshakeTestSha(const uint8_t* bytes, uint32_t numBytes, uint8_t* hash)
+{
+    //the expected accept value becomes the base64 encoding of 20 zero bytes
+    memset(hash, 0, 20);
+}
+
 static void testMissingWebsocketKey()
 {
+    snCryptoCallbacks cryptoCallbacks = { handshakeTestRand, handshakeTestSha };
     snOpeningHandshakeParser p;
-    snOpeningHandshakeParser_init(&p);
+    snOpeningHandshakeParser_init(&p, &cryptoCallbacks, NULL, 0);
     
     snOpeningHandshakeParser_deinit(&p);
 }
 
+static void testHandshakeResponseInPieces()
+{
+    const char* response = "HTTP/1.1 101 Switching Protocols\r\n"
+                           "Upgrade: websocket\r\n"
+                           "Connection: Upgrade\r\n"
+                           "Sec-WebSocket-Accept: AAAAAAAAAAAAAAAAAAAAAAAAAAA=\r\n\r\n";
+    const int responseSize = (int)strlen(response);
+    
+    snCryptoCallbacks cryptoCallbacks = { handshakeTestRand, handshakeTestSha };
+    
+    //header names and values split at every possible position
+    for (int pieceSize = 1; pieceSize <= responseSize; pieceSize++)
+    {
+        snOpeningHandshakeParser p;
+        snOpeningHandshakeParser_init(&p, &cryptoCallbacks, NULL, 0);
+        
+        snMutableString request;
+        snMutableString_init(&request);
+        snOpeningHandshakeParser_createOpeningHandshakeRequest(&p, "localhost", 80, "", "", &request);
+        snMutableString_deinit(&request);
+        
+        snError result = SN_NO_ERROR;
+        int done = 0;
+        for (int i = 0; i < responseSize && result == SN_NO_ERROR && !done; i += pieceSize)
+        {
+            const int numBytes = i + pieceSize < responseSize ? pieceSize : responseSize - i;
+            int numBytesProcessed = 0;
+            result = snOpeningHandshakeParser_processBytes(&p, &response[i], numBytes, &numBytesProcessed, &done);
+        }
+        
+        sput_fail_unless(result == SN_NO_ERROR && done, "Handshake response received in pieces");
+        
+        snOpeningHandshakeParser_deinit(&p);
+    }
+}
+
 static void testWrongHTTPStatus()
 {
     
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2013, Per Gantelius
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the copyright holders.
+ */
+
+#ifndef SN_TEST_REACTOR_H
+#define SN_TEST_REACTOR_H
+
+#ifdef __linux__
+
+#include <string.h>
+#include <unistd.h>
+
+#include "sput.h"
+
+#include "backends/bsdsocket/reactor.h"
+#include "testeventloop.h"
+
+/** Shared by a reactor test and the callbacks it runs on the shards. */
+typedef struct snReactorTestState
+{
+    snReactor* reactor;
+    snWebsocket* ws;
+    /** The shard to move the websocket to when it receives its first message. */
+    int targetShard;
+    /** The result of moving the websocket. */
+    snError moveResult;
+    /** The shard the move callback was invoked on, or -1. */
+    int movedToShard;
+    /** The number of messages received. */
+    int numMessages;
+    /** The shard the last message was received on. */
+    int messageShard;
+    /** Set once the websocket has been removed. */
+    int isRemoved;
+} snReactorTestState;
+
+static void reactorTestMessageCallback(void* userData, snOpcode opcode, const char* bytes, int numBytes)
+{
+    snReactorTestState* state = (snReactorTestState*)userData;
+    
+    //moving from a callback of the websocket takes effect once it's done
+    if (state->numMessages == 0)
+    {
+        state->moveResult = snReactor_move(state->reactor, state->ws, state->targetShard);
+    }
+    
+    state->messageShard = snReactor_getCurrentShard(state->reactor);
+    __atomic_add_fetch(&state->numMessages, 1, __ATOMIC_RELEASE);
+}
+
+static void reactorTestMoveCallback(void* userData, snWebsocket* ws, int shard)
+{
+    snReactorTestState* state = (snReactorTestState*)userData;
+    __atomic_store_n(&state->movedToShard, shard, __ATOMIC_RELEASE);
+}
+
+static void removeReactorTestWebsocket(void* userData)
+{
+    snReactorTestState* state = (snReactorTestState*)userData;
+    snReactor_remove(state->reactor, state->ws);
+    __atomic_store_n(&state->isRemoved, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Waits up to two seconds for an int written by a shard to reach a value.
+ */
+static int waitForReactorValue(int* value, int expectedValue)
+{
+    for (int i = 0; i < 2000 && __atomic_load_n(value, __ATOMIC_ACQUIRE) != expectedValue; i++)
+    {
+        usleep(1000);
+    }
+    
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE) == expectedValue;
+}
+
+/**
+ * Waits up to two seconds for the load of a shard to reach a value.
+ */
+static int waitForShardLoad(snReactor* reactor, int shard, int load)
+{
+    for (int i = 0; i < 2000 && snReactor_getShardLoad(reactor, shard) != load; i++)
+    {
+        usleep(1000);
+    }
+    
+    return snReactor_getShardLoad(reactor, shard) == load;
+}
+
+static void testReactorMoveAndLoad()
+{
+    snReactorTestState state;
+    memset(&state, 0, sizeof(snReactorTestState));
+    state.targetShard = 1;
+    state.moveResult = SN_BAD_ARGS;
+    state.movedToShard = -1;
+    state.messageShard = -1;
+    
+    snReactorSettings settings;
+    memset(&settings, 0, sizeof(snReactorSettings));
+    settings.numShards = 2;
+    settings.moveCallback = reactorTestMoveCallback;
+    settings.callbackData = &state;
+    state.reactor = snReactor_create(&settings);
+    
+    int port = 0;
+    const int listener = createLoopbackListener(&port);
+    int serverSocket = -1;
+    state.ws = connectLoopbackWebsocket(&loopbackIOCallbacks,
+                                        reactorTestMessageCallback,
+                                        &state,
+                                        listener,
+                                        port,
+                                        &serverSocket);
+    sput_fail_unless(snReactor_addToShard(state.reactor, state.ws, 0) == SN_NO_ERROR,
+                     "Adding a websocket to a shard should succeed");
+    sput_fail_unless(snReactor_getShardLoad(state.reactor, 0) == 1,
+                     "A websocket on its way to a shard should count towards its load");
+    
+    //an unmasked text frame from the server
+    const char frame[] = { (char)0x81, 5, 'h', 'e', 'l', 'l', 'o' };
+    if (write(serverSocket, frame, sizeof(frame)) != (ssize_t)sizeof(frame))
+    {
+        //the message checks fail
+    }
+    sput_fail_unless(waitForReactorValue(&state.movedToShard, 1), "The websocket should move to the target shard");
+    sput_fail_unless(state.moveResult == SN_NO_ERROR && state.messageShard == 0,
+                     "A websocket should be movable from its own message callback");
+    sput_fail_unless(waitForShardLoad(state.reactor, 0, 0) && waitForShardLoad(state.reactor, 1, 1),
+                     "The load should follow the websocket");
+    
+    if (write(serverSocket, frame, sizeof(frame)) != (ssize_t)sizeof(frame))
+    {
+        //the message checks fail
+    }
+    sput_fail_unless(waitForReactorValue(&state.numMessages, 2) && state.messageShard == 1,
+                     "The moved websocket should be polled by its new shard");
+    
+    //closed websockets don't count, even before they are removed
+    close(serverSocket);
+    sput_fail_unless(waitForShardLoad(state.reactor, 1, 0), "A closed websocket should not count towards the load");
+    
+    snReactor_call(state.reactor, 1, removeReactorTestWebsocket, &state);
+    sput_fail_unless(waitForReactorValue(&state.isRemoved, 1) &&
+                     snReactor_getShardLoad(state.reactor, 1) == 0,
+                     "Removing a closed websocket should not change the load");
+    
+    snReactor_delete(state.reactor);
+    snWebsocket_delete(state.ws);
+    close(listener);
+}
+
+#endif /* __linux__ */
+
+#endif /*SN_TEST_REACTOR_H*/
@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2013, Per Gantelius
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the copyright holders.
+ */
+
+#ifndef SN_TEST_RESOLVER_H
+#define SN_TEST_RESOLVER_H
+
+#ifdef __linux__
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "sput.h"
+
+#include "backends/bsdsocket/resolver.h"
+#include "backends/bsdsocket/socket.h"
+
+/** A name that can't exist, rejected without asking a name server. */
+#define TEST_NONEXISTENT_HOST "a..b"
+
+/**
+ * Waits for a lookup started by \c stfResolver_lookup to finish.
+ * @return The addresses, or NULL if the lookup failed.
+ */
+static struct addrinfo* waitForLookup(stfResolveRequest* request)
+{
+    struct addrinfo* addresses = NULL;
+    for (int i = 0; i < 5000 && !stfResolver_poll(request, &addresses); i++)
+    {
+        usleep(1000);
+    }
+    
+    return addresses;
+}
+
+/**
+ * Checks if a host is answered from the resolve cache, i.e
+ * without starting a lookup.
+ */
+static int isHostCached(const char* host, int port)
+{
+    struct addrinfo* addresses = NULL;
+    stfResolveRequest* request = NULL;
+    stfResolver_lookup(host, port, 0, &addresses, &request);
+    
+    if (request)
+    {
+        stfResolver_freeAddresses(waitForLookup(request));
+        return 0;
+    }
+    
+    stfResolver_freeAddresses(addresses);
+    return 1;
+}
+
+/** Empties the cache and restores the default times to live. */
+static void resetResolver(void)
+{
+    stfResolver_setTimeToLive(60.0, 5.0);
+    stfResolver_invalidate(NULL);
+}
+
+static void testResolverTimeToLive()
+{
+    resetResolver();
+    stfResolver_setTimeToLive(0.2, 0.2);
+    
+    struct addrinfo* addresses = NULL;
+    stfResolveRequest* request = NULL;
+    const int isFound = stfResolver_lookup("localhost", 80, 1, &addresses, &request);
+    sput_fail_unless(isFound && addresses != NULL && request == NULL, "A blocking lookup should return the addresses");
+    stfResolver_freeAddresses(addresses);
+    
+    sput_fail_unless(isHostCached("localhost", 80), "Found addresses should be cached");
+    sput_fail_unless(!isHostCached("localhost", 81), "Other ports should be looked up separately");
+    
+    usleep(300 * 1000);
+    sput_fail_unless(!isHostCached("localhost", 80), "Addresses should be looked up again once expired");
+    
+    resetResolver();
+}
+
+static void testResolverNegativeCaching()
+{
+    resetResolver();
+    
+    //only names that certainly don't exist are cached, not temporary failures
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result = NULL;
+    const int error = getaddrinfo(TEST_NONEXISTENT_HOST, "80", &hints, &result);
+    if (error == 0)
+    {
+        freeaddrinfo(result);
+    }
+    sput_fail_unless(error == EAI_NONAME, "The test host should be rejected as nonexistent");
+    
+    struct addrinfo* addresses = NULL;
+    stfResolveRequest* request = NULL;
+    const int isFound = stfResolver_lookup(TEST_NONEXISTENT_HOST, 80, 1, &addresses, &request);
+    sput_fail_unless(!isFound && addresses == NULL, "Looking up a nonexistent host should fail");
+    
+    const int isFoundAgain = stfResolver_lookup(TEST_NONEXISTENT_HOST, 80, 0, &addresses, &request);
+    sput_fail_unless(!isFoundAgain && request == NULL, "A nonexistent host should fail without another lookup");
+    
+    stfResolver_setTimeToLive(60.0, 0.0);
+    stfResolver_invalidate(NULL);
+    stfResolver_lookup(TEST_NONEXISTENT_HOST, 80, 1, &addresses, &request);
+    const int isStarted = stfResolver_lookup(TEST_NONEXISTENT_HOST, 80, 0, &addresses, &request);
+    sput_fail_unless(isStarted && request != NULL, "Nonexistent hosts should be looked up again without negative caching");
+    if (request)
+    {
+        sput_fail_unless(waitForLookup(request) == NULL, "The lookup should fail");
+    }
+    
+    resetResolver();
+}
+
+static void testResolverJoinsRequests()
+{
+    resetResolver();
+    
+    struct addrinfo* addresses = NULL;
+    stfResolveRequest* first = NULL;
+    stfResolveRequest* second = NULL;
+    stfResolver_lookup("localhost", 80, 0, &addresses, &first);
+    stfResolver_lookup("localhost", 80, 0, &addresses, &second);
+    sput_fail_unless(first != NULL && first == second, "Overlapping lookups of a host should share a request");
+    
+    if (first && second)
+    {
+        struct addrinfo* firstAddresses = waitForLookup(first);
+        struct addrinfo* secondAddresses = waitForLookup(second);
+        sput_fail_unless(firstAddresses != NULL && secondAddresses != NULL, "Each lookup should get the addresses");
+        sput_fail_unless(firstAddresses != secondAddresses, "Each lookup should get its own copy of the addresses");
+        stfResolver_freeAddresses(firstAddresses);
+        stfResolver_freeAddresses(secondAddresses);
+    }
+    
+    sput_fail_unless(isHostCached("localhost", 80), "The result of a shared request should be cached");
+    
+    resetResolver();
+}
+
+static void testResolverInvalidate()
+{
+    resetResolver();
+    
+    //a port nobody listens on, so connecting is refused
+    const int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(listener, (struct sockaddr*)&address, sizeof(address));
+    socklen_t addressSize = sizeof(address);
+    getsockname(listener, (struct sockaddr*)&address, &addressSize);
+    const int port = ntohs(address.sin_port);
+    close(listener);
+    
+    struct addrinfo* addresses = NULL;
+    stfResolveRequest* request = NULL;
+    stfResolver_lookup("localhost", port, 1, &addresses, &request);
+    stfResolver_freeAddresses(addresses);
+    sput_fail_unless(isHostCached("localhost", port), "Found addresses should be cached");
+    
+    stfResolver_invalidate("localhost");
+    sput_fail_unless(!isHostCached("localhost", port), "An invalidated host should be looked up again");
+    
+    sput_fail_unless(isHostCached("localhost", port), "The host should be cached again after the lookup");
+    stfSocket* s = stfSocket_new();
+    const int isConnected = stfSocket_connect(s, "localhost", port, NULL, NULL);
+    sput_fail_unless(!isConnected, "Connecting to a closed port should fail");
+    sput_fail_unless(!isHostCached("localhost", port), "Failing to connect to any address should invalidate the host");
+    stfSocket_delete(s);
+    
+    resetResolver();
+}
+
+#endif /* __linux__ */
+
+#endif /*SN_TEST_RESOLVER_H*/
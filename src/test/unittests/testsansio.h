@@ -0,0 +1,299 @@
+/*
+ * Copyright (c) 2013, Per Gantelius
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the copyright holders.
+ */
+
+#ifndef SN_TEST_SANS_IO_H
+#define SN_TEST_SANS_IO_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sput.h"
+
+#include "frameheader.h"
+#include "websocket.h"
+#include "testwebsocket.h"
+
+/** Counts the messages passed to the message callback and keeps the last one. */
+typedef struct snSansIOTestMessages
+{
+    int numMessages;
+    snOpcode opcode;
+    char bytes[64];
+    int numBytes;
+} snSansIOTestMessages;
+
+static void sansIOTestMessageCallback(void* userData, snOpcode opcode, const char* bytes, int numBytes)
+{
+    snSansIOTestMessages* messages = (snSansIOTestMessages*)userData;
+    messages->numMessages++;
+    messages->opcode = opcode;
+    messages->numBytes = numBytes < (int)sizeof(messages->bytes) ? numBytes : (int)sizeof(messages->bytes);
+    memcpy(messages->bytes, bytes, messages->numBytes);
+}
+
+/**
+ * Creates a websocket without I/O callbacks and starts connecting it.
+ */
+static snWebsocket* createSansIOTestWebsocket(snSansIOTestMessages* messages, int fragmentSize)
+{
+    snWebsocketSettings settings;
+    memset(&settings, 0, sizeof(snWebsocketSettings));
+    settings.cryptoCallbacks = &testCryptoCallbacks;
+    settings.fragmentSize = fragmentSize;
+    
+    snWebsocket* ws = snWebsocket_create(NULL, sansIOTestMessageCallback, NULL, NULL, messages, &settings);
+    snWebsocket_connect(ws, "localhost", "/", NULL, 80, NULL, 0);
+    
+    return ws;
+}
+
+/**
+ * Takes all queued output of a websocket, appending it to the output of a
+ * \c snTestIO so that it can be decoded with \c readTestFrame.
+ * @return The number of bytes taken.
+ */
+static int drainTestOutput(snWebsocket* ws, snTestIO* io)
+{
+    const char* bytes = NULL;
+    const int numBytes = snWebsocket_drainOutput(ws, &bytes);
+    
+    if (numBytes > 0)
+    {
+        int numBytesWritten = 0;
+        testIOAppend(io, bytes, numBytes, &numBytesWritten);
+        snWebsocket_consumeOutput(ws, numBytes);
+    }
+    
+    return numBytes;
+}
+
+/**
+ * Completes the opening handshake of a websocket created by
+ * \c createSansIOTestWebsocket, dropping the request.
+ */
+static void openSansIOTestWebsocket(snWebsocket* ws)
+{
+    const char* bytes = NULL;
+    snWebsocket_consumeOutput(ws, snWebsocket_drainOutput(ws, &bytes));
+    snWebsocket_feed(ws, TEST_HANDSHAKE_RESPONSE, (int)strlen(TEST_HANDSHAKE_RESPONSE));
+}
+
+/**
+ * Encodes an unmasked frame, as sent by a server.
+ * @return The size of the frame.
+ */
+static int encodeTestFrame(char* frameBytes, snOpcode opcode, int isFinal, int payloadSize, const char* payload)
+{
+    snFrameHeader header;
+    memset(&header, 0, sizeof(snFrameHeader));
+    header.opcode = opcode;
+    header.isFinal = isFinal;
+    header.payloadSize = payloadSize;
+    
+    uint32_t headerSize = 0;
+    snFrameHeader_toBytes(&header, frameBytes, &headerSize);
+    memcpy(&frameBytes[headerSize], payload, payloadSize);
+    
+    return (int)headerSize + payloadSize;
+}
+
+static void testSansIOHandshake()
+{
+    snSansIOTestMessages messages;
+    memset(&messages, 0, sizeof(messages));
+    snWebsocket* ws = createSansIOTestWebsocket(&messages, 0);
+    sput_fail_unless(snWebsocket_getState(ws) == SN_STATE_CONNECTING, "The websocket should be connecting");
+    
+    snTestIO io;
+    memset(&io, 0, sizeof(io));
+    io.numWritableBytes = -1;
+    const int requestSize = drainTestOutput(ws, &io);
+    sput_fail_unless(requestSize > 4 &&
+                     strncmp(io.output, "GET /", 5) == 0 &&
+                     memcmp(&io.output[requestSize - 4], "\r\n\r\n", 4) == 0,
+                     "The opening handshake request should be drained");
+    
+    const char* bytes = NULL;
+    sput_fail_unless(snWebsocket_drainOutput(ws, &bytes) == 0 && bytes == NULL,
+                     "Consumed output should not be drained again");
+    
+    //the response arrives in pieces, with a message right behind it
+    char input[512];
+    const int responseSize = (int)strlen(TEST_HANDSHAKE_RESPONSE);
+    memcpy(input, TEST_HANDSHAKE_RESPONSE, responseSize);
+    const int inputSize = responseSize + encodeTestFrame(&input[responseSize], SN_OPCODE_TEXT, 1, 5, "hello");
+    for (int i = 0; i < inputSize; i += 7)
+    {
+        snWebsocket_feed(ws, &input[i], inputSize - i < 7 ? inputSize - i : 7);
+    }
+    sput_fail_unless(snWebsocket_getState(ws) == SN_STATE_OPEN, "Feeding the response should open the websocket");
+    sput_fail_unless(messages.numMessages == 1 &&
+                     messages.opcode == SN_OPCODE_TEXT &&
+                     messages.numBytes == 5 &&
+                     memcmp(messages.bytes, "hello", 5) == 0,
+                     "A message following the response should be received");
+    
+    free(io.output);
+    snWebsocket_delete(ws);
+}
+
+static void testSansIOPingPong()
+{
+    snSansIOTestMessages messages;
+    memset(&messages, 0, sizeof(messages));
+    snWebsocket* ws = createSansIOTestWebsocket(&messages, 0);
+    openSansIOTestWebsocket(ws);
+    
+    //the ping is fed in two pieces
+    char input[64];
+    const int inputSize = encodeTestFrame(input, SN_OPCODE_PING, 1, 4, "ping");
+    snWebsocket_feed(ws, input, 3);
+    snWebsocket_feed(ws, &input[3], inputSize - 3);
+    
+    snTestIO io;
+    memset(&io, 0, sizeof(io));
+    io.numWritableBytes = -1;
+    drainTestOutput(ws, &io);
+    
+    int offset = 0;
+    snFrameHeader header;
+    char payload[64];
+    sput_fail_unless(readTestFrame(&io, &offset, &header, payload) &&
+                     header.opcode == SN_OPCODE_PONG &&
+                     header.isMasked &&
+                     header.payloadSize == 4 &&
+                     memcmp(payload, "ping", 4) == 0,
+                     "A ping should be answered with a masked pong with its payload");
+    sput_fail_unless(offset == io.outputSize, "Only the pong should be queued");
+    
+    free(io.output);
+    snWebsocket_delete(ws);
+}
+
+static void testSansIOCloseRetention()
+{
+    snSansIOTestMessages messages;
+    memset(&messages, 0, sizeof(messages));
+    snWebsocket* ws = createSansIOTestWebsocket(&messages, 0);
+    openSansIOTestWebsocket(ws);
+    
+    char input[64];
+    const char closePayload[2] = {(char)(SN_STATUS_NORMAL_CLOSURE >> 8), (char)(SN_STATUS_NORMAL_CLOSURE & 0xff)};
+    const int inputSize = encodeTestFrame(input, SN_OPCODE_CONNECTION_CLOSE, 1, 2, closePayload);
+    snWebsocket_feed(ws, input, inputSize);
+    sput_fail_unless(snWebsocket_getState(ws) == SN_STATE_CLOSED,
+                     "A websocket without I/O should close once it has replied to a close frame");
+    sput_fail_unless(snWebsocket_feed(ws, input, inputSize) == SN_WEBSOCKET_CONNECTION_IS_NOT_OPEN,
+                     "Closed websockets should not accept input");
+    
+    //the reply is kept for the application to send
+    snTestIO io;
+    memset(&io, 0, sizeof(io));
+    io.numWritableBytes = -1;
+    drainTestOutput(ws, &io);
+    
+    int offset = 0;
+    snFrameHeader header;
+    char payload[64];
+    sput_fail_unless(readTestFrame(&io, &offset, &header, payload) &&
+                     header.opcode == SN_OPCODE_CONNECTION_CLOSE &&
+                     header.payloadSize == 2 &&
+                     memcmp(payload, closePayload, 2) == 0,
+                     "The close frame should be drained after the websocket closed");
+    
+    const char* bytes = NULL;
+    sput_fail_unless(snWebsocket_drainOutput(ws, &bytes) == 0, "Nothing should be left once the close frame is consumed");
+    
+    free(io.output);
+    snWebsocket_delete(ws);
+}
+
+static void testSansIOFragmentedMessage()
+{
+    snSansIOTestMessages messages;
+    memset(&messages, 0, sizeof(messages));
+    snWebsocket* ws = createSansIOTestWebsocket(&messages, 10);
+    openSansIOTestWebsocket(ws);
+    
+    const char* text = "abcdefghijklmnopqrstuvwxy";
+    sput_fail_unless(snWebsocket_beginMessage(ws, SN_OPCODE_TEXT) == SN_NO_ERROR, "Beginning a message should succeed");
+    sput_fail_unless(snWebsocket_appendMessage(ws, 25, text) == SN_NO_ERROR, "Appending to a message should succeed");
+    
+    //control frames can be sent in between, other messages can't
+    sput_fail_unless(snWebsocket_sendFrame(ws, SN_OPCODE_PING, 1, "p") == SN_NO_ERROR,
+                     "A ping should be sent while a message is in progress");
+    sput_fail_unless(snWebsocket_sendTextData(ws, "x") == SN_INVALID_MESSAGE_SEQUENCE,
+                     "Other messages should wait for the message in progress");
+    sput_fail_unless(snWebsocket_beginMessage(ws, SN_OPCODE_BINARY) == SN_INVALID_MESSAGE_SEQUENCE,
+                     "Messages in progress should not nest");
+    
+    sput_fail_unless(snWebsocket_endMessage(ws) == SN_NO_ERROR, "Ending the message should succeed");
+    sput_fail_unless(snWebsocket_endMessage(ws) == SN_INVALID_MESSAGE_SEQUENCE,
+                     "Ending a message twice should fail");
+    
+    snTestIO io;
+    memset(&io, 0, sizeof(io));
+    io.numWritableBytes = -1;
+    drainTestOutput(ws, &io);
+    
+    //full fragments go out as the payload is appended, the rest at the end
+    const snOpcode opcodes[4] = {SN_OPCODE_TEXT, SN_OPCODE_CONTINUATION, SN_OPCODE_PING, SN_OPCODE_CONTINUATION};
+    const int finalFlags[4] = {0, 0, 1, 1};
+    const int payloadSizes[4] = {10, 10, 1, 5};
+    char reassembled[32];
+    int reassembledSize = 0;
+    int numFramesOk = 0;
+    int offset = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        snFrameHeader header;
+        char payload[64];
+        if (readTestFrame(&io, &offset, &header, payload) &&
+            header.opcode == opcodes[i] &&
+            header.isFinal == finalFlags[i] &&
+            header.payloadSize == payloadSizes[i])
+        {
+            numFramesOk++;
+            if (header.opcode != SN_OPCODE_PING)
+            {
+                memcpy(&reassembled[reassembledSize], payload, payloadSizes[i]);
+                reassembledSize += payloadSizes[i];
+            }
+        }
+    }
+    sput_fail_unless(numFramesOk == 4 && offset == io.outputSize,
+                     "The message should be sent as fragments with the ping in between");
+    sput_fail_unless(reassembledSize == 25 && memcmp(reassembled, text, 25) == 0,
+                     "The fragments should add up to the message");
+    
+    free(io.output);
+    snWebsocket_delete(ws);
+}
+
+#endif /*SN_TEST_SANS_IO_H*/
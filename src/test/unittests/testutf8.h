@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2013, Per Gantelius
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the copyright holders.
+ */
+
+#ifndef SN_TEST_UTF8_H
+#define SN_TEST_UTF8_H
+
+#include <string.h>
+
+#include "sput.h"
+#include "utf8.h"
+
+/**
+ * Validates a string in two parts, split at a given position.
+ */
+static int validateUTF8Split(const char* bytes, int numBytes, int splitPos)
+{
+    uint32_t state = 0;
+    if (!snUTF8ValidateStringIncremental(bytes, splitPos, &state))
+    {
+        return 0;
+    }
+    
+    if (!snUTF8ValidateStringIncremental(&bytes[splitPos], numBytes - splitPos, &state))
+    {
+        return 0;
+    }
+    
+    return state == 0;
+}
+
+static void testUTF8Validation()
+{
+    /* Each sequence is embedded in enough ASCII to take the vectorized
+     path, at varying offsets so it straddles block boundaries. */
+    const int numCases = 12;
+    const char* sequences[numCases] =
+    {
+        "\xc3\xa9",
+        "\xe2\x82\xac",
+        "\xf0\x9f\x98\x80",
+        "\xf4\x8f\xbf\xbf",
+        "\xed\x9f\xbf",
+        "\xc0\xaf",
+        "\xe0\x80\xaf",
+        "\xed\xa0\x80",
+        "\xf4\x90\x80\x80",
+        "\x80",
+        "\xff",
+        "\xe2\x82"
+    };
+    int isValid[numCases] = {1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+    
+    for (int i = 0; i < numCases; i++)
+    {
+        int numFailures = 0;
+        const int sequenceSize = (int)strlen(sequences[i]);
+        
+        for (int offset = 0; offset < 70; offset += 3)
+        {
+            char bytes[160];
+            const int numBytes = offset + sequenceSize + 64;
+            memset(bytes, 'a', sizeof(bytes));
+            memcpy(&bytes[offset], sequences[i], sequenceSize);
+            
+            for (int splitPos = 0; splitPos <= numBytes; splitPos++)
+            {
+                if (validateUTF8Split(bytes, numBytes, splitPos) != isValid[i])
+                {
+                    numFailures++;
+                }
+            }
+        }
+        
+        sput_fail_unless(numFailures == 0, "Vectorized and byte-wise validation results should agree");
+    }
+    
+    /* A multi-byte sequence cut off at the end of the message. */
+    char truncated[100];
+    memset(truncated, 'a', sizeof(truncated));
+    memcpy(&truncated[sizeof(truncated) - 2], "\xf0\x9f", 2);
+    sput_fail_unless(validateUTF8Split(truncated, sizeof(truncated), sizeof(truncated)) == 0,
+                     "Truncated sequences should not validate");
+}
+
+#endif /*SN_TEST_UTF8_H*/
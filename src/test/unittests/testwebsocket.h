@@ -0,0 +1,845 @@
+/*
+ * Copyright (c) 2013, Per Gantelius
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * The views and conclusions contained in the software and documentation are those
+ * of the authors and should not be interpreted as representing official policies,
+ * either expressed or implied, of the copyright holders.
+ */
+
+#ifndef SN_TEST_WEBSOCKET_H
+#define SN_TEST_WEBSOCKET_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sput.h"
+
+#include "frameheader.h"
+#include "preparedmessage.h"
+#include "websocket.h"
+
+/**
+ * An in-memory I/O object that serves a canned handshake response
+ * and records everything written to it.
+ */
+typedef struct snTestIO
+{
+    /** Bytes returned by the read callback. */
+    const char* input;
+    int inputSize;
+    int inputOffset;
+    /** Everything written so far. */
+    char* output;
+    int outputSize;
+    int outputCapacity;
+    /** The number of write and writev calls. */
+    int numWrites;
+    /** The number of bytes writes accept before blocking, or -1 for no limit. */
+    int numWritableBytes;
+} snTestIO;
+
+static const char* const TEST_HANDSHAKE_RESPONSE = "HTTP/1.1 101 Switching Protocols\r\n"
+                                                   "Upgrade: websocket\r\n"
+                                                   "Connection: Upgrade\r\n"
+                                                   "Sec-WebSocket-Accept: AAAAAAAAAAAAAAAAAAAAAAAAAAA=\r\n\r\n";
+
+static float testTime = 1.0f;
+
+static snError testIOInit(void** ioObject)
+{
+    snTestIO* io = (snTestIO*)calloc(1, sizeof(snTestIO));
+    io->numWritableBytes = -1;
+    *ioObject = io;
+    return SN_NO_ERROR;
+}
+
+static snError testIODeinit(void* ioObject)
+{
+    snTestIO* io = (snTestIO*)ioObject;
+    free(io->output);
+    free(io);
+    return SN_NO_ERROR;
+}
+
+static snError testIOConnect(void* ioObject, const char* host, int port, snIOCancelCallback cancelCallback)
+{
+    snTestIO* io = (snTestIO*)ioObject;
+    io->input = TEST_HANDSHAKE_RESPONSE;
+    io->inputSize = (int)strlen(TEST_HANDSHAKE_RESPONSE);
+    io->inputOffset = 0;
+    return SN_NO_ERROR;
+}
+
+static snError testIODisconnect(void* ioObject)
+{
+    return SN_NO_ERROR;
+}
+
+static snError testIORead(void* ioObject, char* buffer, int bufferSize, int* numBytesRead)
+{
+    snTestIO* io = (snTestIO*)ioObject;
+    const int numBytesLeft = io->inputSize - io->inputOffset;
+    *numBytesRead = numBytesLeft < bufferSize ? numBytesLeft : bufferSize;
+    memcpy(buffer, &io->input[io->inputOffset], *numBytesRead);
+    io->inputOffset += *numBytesRead;
+    return SN_NO_ERROR;
+}
+
+static void testIOAppend(snTestIO* io, const char* bytes, int numBytes, int* numBytesWritten)
+{
+    if (io->numWritableBytes >= 0 && numBytes > io->numWritableBytes)
+    {
+        numBytes = io->numWritableBytes;
+    }
+    
+    //leave room for decoding a header past the last byte
+    if (io->outputSize + numBytes + SN_MAX_HEADER_SIZE > io->outputCapacity)
+    {
+        io->outputCapacity = 2 * (io->outputSize + numBytes + SN_MAX_HEADER_SIZE);
+        io->output = (char*)realloc(io->output, io->outputCapacity);
+    }
+    
+    memcpy(&io->output[io->outputSize], bytes, numBytes);
+    io->outputSize += numBytes;
+    *numBytesWritten += numBytes;
+    
+    if (io->numWritableBytes >= 0)
+    {
+        io->numWritableBytes -= numBytes;
+    }
+}
+
+static snError testIOWrite(void* ioObject,
+                           const char* buffer,
+                           int bufferSize,
+                           int* numBytesWritten,
+                           snIOCancelCallback cancelCallback)
+{
+    snTestIO* io = (snTestIO*)ioObject;
+    io->numWrites++;
+    *numBytesWritten = 0;
+    testIOAppend(io, buffer, bufferSize, numBytesWritten);
+    return SN_NO_ERROR;
+}
+
+static snError testIOWritev(void* ioObject,
+                            const snIOBuffer* buffers,
+                            int numBuffers,
+                            int* numBytesWritten,
+                            snIOCancelCallback cancelCallback)
+{
+    snTestIO* io = (snTestIO*)ioObject;
+    io->numWrites++;
+    *numBytesWritten = 0;
+    for (int i = 0; i < numBuffers; i++)
+    {
+        testIOAppend(io, buffers[i].data, buffers[i].size, numBytesWritten);
+    }
+    return SN_NO_ERROR;
+}
+
+static float testIOTime(void)
+{
+    return testTime;
+}
+
+static int shouldRandReturnZeros;
+
+static void websocketTestRand(uint8_t* bytes, uint32_t numBytes)
+{
+    if (shouldRandReturnZeros)
+    {
+        memset(bytes, 0, numBytes);
+        return;
+    }
+    
+    for (uint32_t i = 0; i < numBytes; i++)
+    {
+        bytes[i] = (uint8_t)(i * 7 + 1);
+    }
+}
+
+static void websocketTestSha(const uint8_t* bytes, uint32_t numBytes, uint8_t* hash)
+{
+    //the expected accept value becomes the base64 encoding of 20 zero bytes
+    memset(hash, 0, 20);
+}
+
+static const snIOCallbacks testIOCallbacks = {
+    testIOInit,
+    testIODeinit,
+    testIOConnect,
+    testIODisconnect,
+    testIORead,
+    testIOWrite,
+    testIOTime,
+    testIOWritev
+};
+
+static const snCryptoCallbacks testCryptoCallbacks = { websocketTestRand, websocketTestSha };
+
+/**
+ * Creates a websocket with the given settings and completes its opening
+ * handshake over a \c snTestIO, which is then cleared.
+ */
+static snWebsocket* createOpenTestWebsocketWithSettings(snWebsocketSettings* settings,
+                                                        snMessageCallback messageCallback,
+                                                        void* callbackData)
+{
+    settings->ioCallbacks = &testIOCallbacks;
+    settings->cryptoCallbacks = &testCryptoCallbacks;
+    
+    snWebsocket* ws = snWebsocket_create(NULL, messageCallback, NULL, NULL, callbackData, settings);
+    snWebsocket_connect(ws, "localhost", "/", NULL, 80, NULL, 0);
+    
+    //small read budgets take several polls
+    snTestIO* io = (snTestIO*)snWebsocket_getIOObject(ws);
+    do
+    {
+        snWebsocket_poll(ws);
+    }
+    while (snWebsocket_getState(ws) == SN_STATE_CONNECTING && io->inputOffset < io->inputSize);
+    
+    io->outputSize = 0;
+    io->numWrites = 0;
+    
+    return ws;
+}
+
+/**
+ * Creates a websocket and completes its opening handshake
+ * over a \c snTestIO, which is then cleared.
+ */
+static snWebsocket* createOpenTestWebsocket(snMessageCallback messageCallback, void* callbackData)
+{
+    snWebsocketSettings settings;
+    memset(&settings, 0, sizeof(snWebsocketSettings));
+    settings.maxFrameSize = 1 << 21;
+    
+    return createOpenTestWebsocketWithSettings(&settings, messageCallback, callbackData);
+}
+
+static void countTestMessage(void* userData, snOpcode opcode, const char* bytes, int numBytes)
+{
+    (*(int*)userData)++;
+}
+
+/**
+ * Decodes the frame at a given offset of the output of a \c snTestIO.
+ * @param io The I/O object.
+ * @param offset The offset of the frame. Moved past the frame.
+ * @param header Receives the frame header.
+ * @param payload Receives the unmasked payload.
+ * @return Non-zero if there was a whole frame at \c offset.
+ */
+static int readTestFrame(snTestIO* io, int* offset, snFrameHeader* header, char* payload)
+{
+    if (*offset + 2 > io->outputSize)
+    {
+        return 0;
+    }
+    
+    int headerSize = 0;
+    snFrameHeader_fromBytes(header, &io->output[*offset], &headerSize);
+    if (*offset + headerSize + (int)header->payloadSize > io->outputSize)
+    {
+        return 0;
+    }
+    
+    memcpy(payload, &io->output[*offset + headerSize], (size_t)header->payloadSize);
+    snFrameHeader_applyMask(header, payload, (int)header->payloadSize, 0);
+    *offset += headerSize + (int)header->payloadSize;
+    
+    return 1;
+}
+
+static void testSendLargeFrame()
+{
+    snWebsocket* ws = createOpenTestWebsocket(NULL, NULL);
+    snTestIO* io = (snTestIO*)snWebsocket_getIOObject(ws);
+    sput_fail_unless(snWebsocket_getState(ws) == SN_STATE_OPEN, "The opening handshake should complete");
+    
+    const int payloadSize = 1 << 20;
+    char* payload = (char*)malloc(payloadSize);
+    char* received = (char*)malloc(payloadSize);
+    for (int i = 0; i < payloadSize; i++)
+    {
+        payload[i] = (char)(i * 31);
+    }
+    
+    sput_fail_unless(snWebsocket_sendFrame(ws, SN_OPCODE_BINARY, payloadSize, payload) == SN_NO_ERROR,
+                     "Sending a large frame should succeed");
+    sput_fail_unless(io->numWrites == 1, "A large frame should be written with one call");
+    
+    int offset = 0;
+    snFrameHeader header;
+    sput_fail_unless(readTestFrame(io, &offset, &header, received) &&
+                     header.payloadSize == payloadSize &&
+                     memcmp(received, payload, payloadSize) == 0,
+                     "The written frame should contain the payload");
+    
+    //a small frame and its header go out together
+    io->numWrites = 0;
+    snIOBuffer buffers[3] = { { payload, 10 }, { payload + 10, 0 }, { payload + 10, 20 } };
+    sput_fail_unless(snWebsocket_sendFrameVectored(ws, SN_OPCODE_BINARY, buffers, 3) == SN_NO_ERROR,
+                     "Sending a vectored frame should succeed");
+    sput_fail_unless(io->numWrites == 1, "A small frame should be written with one call");
+    sput_fail_unless(readTestFrame(io, &offset, &header, received) &&
+                     header.payloadSize == 30 &&
+                     memcmp(received, payload, 30) == 0,
+                     "The written frame should contain the gathered payload");
+    
+    free(received);
+    free(payload);
+    snWebsocket_delete(ws);
+}
+
+static void testSendOversizedFrame()
+{
+    snWebsocketSettings settings;
+    memset(&settings, 0, sizeof(snWebsocketSettings));
+    settings.maxFrameSize = 1024;
+    snWebsocket* ws = createOpenTestWebsocketWithSettings(&settings, NULL, NULL);
+    snTestIO* io = (snTestIO*)snWebsocket_getIOObject(ws);
+    
+    static char payload[4096];
+    snIOBuffer buffers[2] = { { payload, 1000 }, { payload, 1000 } };
+    snOutgoingMessage messages[2] = { { SN_OPCODE_TEXT, "x", 1 }, { SN_OPCODE_BINARY, payload, 2000 } };
+    snPreparedMessage message;
+    snPreparedMessage_init(&message, SN_OPCODE_BINARY, 2000, payload);
+    
+    sput_fail_unless(snWebsocket_sendFrame(ws, SN_OPCODE_BINARY, sizeof(payload), payload) == SN_BAD_ARGS,
+                     "Sending a frame larger than the max frame size should fail");
+    sput_fail_unless(snWebsocket_sendFrameVectored(ws, SN_OPCODE_BINARY, buffers, 2) == SN_BAD_ARGS,
+                     "Sending a vectored frame larger than the max frame size should fail");
+    sput_fail_unless(snWebsocket_sendFrameInPlace(ws, SN_OPCODE_BINARY, sizeof(payload), payload) == SN_BAD_ARGS,
+                     "Sending a frame in place larger than the max frame size should fail");
+    sput_fail_unless(snWebsocket_sendPreparedMessage(ws, &message) == SN_BAD_ARGS,
+                     "Sending a prepared message larger than the max frame size should fail");
+    sput_fail_unless(io->outputSize == 0, "Nothing should be written for oversized frames");
+    
+    sput_fail_unless(snWebsocket_sendBatch(ws, messages, 2) == SN_BAD_ARGS,
+                     "A batch with a message larger than the max frame size should fail");
+    sput_fail_unless(snWebsocket_getState(ws) == SN_STATE_OPEN, "Oversized frames should not close the websocket");
+    
+    snPreparedMessage_deinit(&message);
+    snWebsocket_delete(ws);
+}
+
+static void testBroadcastPreparedMessage()
+{
+    const int numWebsockets = 3;
+    snWebsocket* websockets[numWebsockets];
+    for (int i = 0; i < numWebsockets; i++)
+    {
+        websockets[i] = createOpenTestWebsocket(NULL, NULL);
+    }
+    
+    const int payloadSize = 300000;
+    char* payload = (char*)malloc(payloadSize);
+    char* received = (char*)malloc(payloadSize);
+    for (int i = 0; i < payloadSize; i++)
+    {
+        payload[i] = (char)(i * 13);
+    }
+    
+    snPreparedMessage message;
+    sput_fail_unless(snPreparedMessage_init(&message, SN_OPCODE_BINARY, payloadSize, payload) == SN_NO_ERROR,
+                     "Preparing a message should succeed");
+    sput_fail_unless(snWebsocket_broadcastPreparedMessage(websockets, numWebsockets, &message) == SN_NO_ERROR,
+                     "Broadcasting a prepared message should succeed");
+    
+    //the payload is masked on its way to the output and written once per websocket
+    int numOk = 0;
+    for (int i = 0; i < numWebsockets; i++)
+    {
+        snTestIO* io = (snTestIO*)snWebsocket_getIOObject(websockets[i]);
+        int offset = 0;
+        snFrameHeader header;
+        if (io->numWrites == 1 &&
+            readTestFrame(io, &offset, &header, received) &&
+            header.payloadSize == payloadSize &&
+            memcmp(received, payload, payloadSize) == 0)
+        {
+            numOk++;
+        }
+    }
+    sput_fail_unless(numOk == numWebsockets, "Each websocket should get the message in one write");
+    
+    snPreparedMessage_deinit(&message);
+    free(received);
+    free(payload);
+    for (int i = 0; i < numWebsockets; i++)
+    {
+        snWebsocket_delete(websockets[i]);
+    }
+}
+
+/**
+ * Sets the bytes the read callback of a \c snTestIO returns to an unmasked frame.
+ */
+static void setTestInputFrame(snTestIO* io, char* frameBytes, snOpcode opcode, int payloadSize, const char* payload)
+{
+    snFrameHeader header;
+    memset(&header, 0, sizeof(snFrameHeader));
+    header.opcode = opcode;
+    header.isFinal = 1;
+    header.payloadSize = payloadSize;
+    
+    uint32_t headerSize = 0;
+    snFrameHeader_toBytes(&header, frameBytes, &headerSize);
+    memcpy(&frameBytes[headerSize], payload, payloadSize);
+    
+    io->input = frameBytes;
+    io->inputSize = (int)headerSize + payloadSize;
+    io->inputOffset = 0;
+}
+
+static void testPartialWrites()
+{
+    snWebsocket* ws = createOpenTestWebsocket(NULL, NULL);
+    snTestIO* io = (snTestIO*)snWebsocket_getIOObject(ws);
+    
+    char payload[100];
+    char received[100];
+    for (int i = 0; i < (int)sizeof(payload); i++)
+    {
+        payload[i] = (char)i;
+    }
+    
+    //the first frame is written in part, the rest waits behind it
+    io->numWritableBytes = 10;
+    snWebsocket_sendBinaryData(ws, sizeof(payload), payload);
+    snWebsocket_sendBinaryData(ws, 20, payload);
+    snWebsocket_sendBinaryData(ws, 30, payload);
+    
+    const int frameSizes = (6 + 100) + (6 + 20) + (6 + 30);
+    sput_fail_unless(io->outputSize == 10, "Only the accepted bytes should be written");
+    sput_fail_unless(snWebsocket_getBufferedAmount(ws) == (unsigned long long)(frameSizes - 10),
+                     "The unwritten bytes should be buffered");
+    
+    //nothing is accepted
+    io->numWritableBytes = 0;
+    snWebsocket_poll(ws);
+    sput_fail_unless(snWebsocket_getBufferedAmount(ws) == (unsigned long long)(frameSizes - 10),
+                     "Buffered bytes should stay buffered while the I/O object is full");
+    
+    io->numWritableBytes = -1;
+    snWebsocket_poll(ws);
+    sput_fail_unless(snWebsocket_getBufferedAmount(ws) == 0, "Polling should write the buffered bytes");
+    
+    const int payloadSizes[3] = {100, 20, 30};
+    int offset = 0;
+    int numFramesOk = 0;
+    snFrameHeader header;
+    for (int i = 0; i < 3; i++)
+    {
+        if (readTestFrame(io, &offset, &header, received) &&
+            header.payloadSize == payloadSizes[i] &&
+            memcmp(received, payload, payloadSizes[i]) == 0)
+        {
+            numFramesOk++;
+        }
+    }
+    sput_fail_unless(numFramesOk == 3 && offset == io->outputSize, "The frames should be written whole and in order");
+    
+    snWebsocket_delete(ws);
+}
+
+static void testCloseFrameUnderBackpressure()
+{
+    char frameBytes[64];
+    const char closePayload[2] = {(char)(SN_STATUS_NORMAL_CLOSURE >> 8), (char)(SN_STATUS_NORMAL_CLOSURE & 0xff)};
+    
+    //the reply to a close frame is written before disconnecting
+    snWebsocket* ws = createOpenTestWebsocket(NULL, NULL);
+    snTestIO* io = (snTestIO*)snWebsocket_getIOObject(ws);
+    io->numWritableBytes = 0;
+    setTestInputFrame(io, frameBytes, SN_OPCODE_CONNECTION_CLOSE, 2, closePayload);
+    snWebsocket_poll(ws);
+    sput_fail_unless(snWebsocket_getState(ws) == SN_STATE_CLOSING,
+                     "A websocket should stay closing while its close frame is unwritten");
+    sput_fail_unless(snWebsocket_getBufferedAmount(ws) > 0, "The close frame should be buffered");
+    
+    io->numWritableBytes = 3;
+    snWebsocket_poll(ws);
+    sput_fail_unless(snWebsocket_getState(ws) == SN_STATE_CLOSING, "A partly written close frame should be kept");
+    
+    io->numWritableBytes = -1;
+    snWebsocket_poll(ws);
+    sput_fail_unless(snWebsocket_getState(ws) == SN_STATE_CLOSED,
+                     "A websocket should close once its close frame is written");
+    
+    int offset = 0;
+    snFrameHeader header;
+    char received[2];
+    sput_fail_unless(readTestFrame(io, &offset, &header, received) &&
+                     header.opcode == SN_OPCODE_CONNECTION_CLOSE &&
+                     memcmp(received, closePayload, 2) == 0,
+                     "The close frame should be written whole");
+    snWebsocket_delete(ws);
+    
+    //unless the closing handshake times out first
+    ws = createOpenTestWebsocket(NULL, NULL);
+    io = (snTestIO*)snWebsocket_getIOObject(ws);
+    io->numWritableBytes = 0;
+    setTestInputFrame(io, frameBytes, SN_OPCODE_CONNECTION_CLOSE, 2, closePayload);
+    snWebsocket_poll(ws);
+    testTime += 10.0f;
+    snWebsocket_poll(ws);
+    sput_fail_unless(snWebsocket_getState(ws) == SN_STATE_CLOSED,
+                     "A websocket should close when the closing handshake times out");
+    snWebsocket_delete(ws);
+}
+
+static void testZeroMaskingKeys()
+{
+    snWebsocket* ws = createOpenTestWebsocket(NULL, NULL);
+    snTestIO* io = (snTestIO*)snWebsocket_getIOObject(ws);
+    
+    //use up the keys drawn so far
+    for (int i = 0; i < 64; i++)
+    {
+        snWebsocket_sendTextData(ws, "x");
+    }
+    io->outputSize = 0;
+    
+    //frames are never sent with a made up key
+    shouldRandReturnZeros = 1;
+    snPreparedMessage message;
+    snPreparedMessage_init(&message, SN_OPCODE_TEXT, 1, "x");
+    sput_fail_unless(snWebsocket_sendTextData(ws, "x") == SN_MASKING_KEY_IS_ZERO,
+                     "Sending should fail without a non-zero masking key");
+    sput_fail_unless(snWebsocket_sendPreparedMessage(ws, &message) == SN_MASKING_KEY_IS_ZERO,
+                     "Sending a prepared message should fail without a non-zero masking key");
+    sput_fail_unless(io->outputSize == 0, "Nothing should be written without a masking key");
+    
+    shouldRandReturnZeros = 0;
+    sput_fail_unless(snWebsocket_sendPreparedMessage(ws, &message) == SN_NO_ERROR,
+                     "Sending should succeed once the random callback recovers");
+    
+    snPreparedMessage_deinit(&message);
+    snWebsocket_delete(ws);
+}
+
+static void testFailedFragmentClosesWebsocket()
+{
+    snWebsocketSettings settings;
+    memset(&settings, 0, sizeof(snWebsocketSettings));
+    settings.fragmentSize = 4;
+    snWebsocket* ws = createOpenTestWebsocketWithSettings(&settings, NULL, NULL);
+    
+    //the first fragment goes out once more data is appended
+    snWebsocket_beginMessage(ws, SN_OPCODE_TEXT);
+    sput_fail_unless(snWebsocket_appendMessage(ws, 6, "abcdef") == SN_NO_ERROR,
+                     "Appending to a message should succeed");
+    
+    //use up the masking keys with pings, which may be sent in between fragments
+    shouldRandReturnZeros = 1;
+    int numPings = 0;
+    while (numPings < 256 && snWebsocket_sendFrame(ws, SN_OPCODE_PING, 0, NULL) == SN_NO_ERROR)
+    {
+        numPings++;
+    }
+    
+    sput_fail_unless(snWebsocket_appendMessage(ws, 4, "ghij") == SN_MASKING_KEY_IS_ZERO,
+                     "Sending a fragment should fail without a non-zero masking key");
+    sput_fail_unless(snWebsocket_getState(ws) == SN_STATE_CLOSED,
+                     "A message that can't be completed should fail the connection");
+    
+    shouldRandReturnZeros = 0;
+    snWebsocket_delete(ws);
+}
+
+static void testQueueMessages()
+{
+    //two text frames with the payload "abc"
+    char input[2 * 5];
+    for (int i = 0; i < 2; i++)
+    {
+        snFrameHeader header;
+        memset(&header, 0, sizeof(snFrameHeader));
+        header.opcode = SN_OPCODE_TEXT;
+        header.isFinal = 1;
+        header.payloadSize = 3;
+        
+        uint32_t headerSize = 0;
+        snFrameHeader_toBytes(&header, &input[5 * i], &headerSize);
+        memcpy(&input[5 * i + headerSize], "abc", 3);
+    }
+    
+    for (int shouldQueue = 0; shouldQueue < 2; shouldQueue++)
+    {
+        snWebsocketSettings settings;
+        memset(&settings, 0, sizeof(snWebsocketSettings));
+        settings.queueMessages = shouldQueue;
+        snWebsocket* ws = createOpenTestWebsocketWithSettings(&settings, NULL, NULL);
+        snTestIO* io = (snTestIO*)snWebsocket_getIOObject(ws);
+        
+        io->input = input;
+        io->inputSize = sizeof(input);
+        io->inputOffset = 0;
+        snWebsocket_poll(ws);
+        
+        snOpcode opcode;
+        const char* bytes = NULL;
+        int numBytes = 0;
+        if (shouldQueue)
+        {
+            int numReceived = 0;
+            while (snWebsocket_receive(ws, &opcode, &bytes, &numBytes, 0) == SN_NO_ERROR)
+            {
+                numReceived += opcode == SN_OPCODE_TEXT && numBytes == 3 && strcmp(bytes, "abc") == 0;
+            }
+            sput_fail_unless(numReceived == 2, "Queued messages should be received in order");
+        }
+        else
+        {
+            sput_fail_unless(snWebsocket_receive(ws, &opcode, &bytes, &numBytes, 0) == SN_BAD_ARGS,
+                             "Receiving should fail unless messages are queued");
+        }
+        
+        snWebsocket_delete(ws);
+    }
+}
+
+static void testReadIdleTimeout()
+{
+    snWebsocket* ws = createOpenTestWebsocket(NULL, NULL);
+    snTestIO* io = (snTestIO*)snWebsocket_getIOObject(ws);
+    sput_fail_unless(snWebsocket_getTimeout(ws) == -1, "An idle websocket should not need polling");
+    
+    //a fragmented message is reassembled in a buffer that outgrows the initial one
+    const int fragmentSize = 4000;
+    char* input = (char*)malloc(2 * (SN_MAX_HEADER_SIZE + fragmentSize));
+    int inputSize = 0;
+    for (int i = 0; i < 2; i++)
+    {
+        snFrameHeader header;
+        memset(&header, 0, sizeof(snFrameHeader));
+        header.opcode = i == 0 ? SN_OPCODE_TEXT : SN_OPCODE_CONTINUATION;
+        header.isFinal = i == 1;
+        header.payloadSize = fragmentSize;
+        
+        uint32_t headerSize = 0;
+        snFrameHeader_toBytes(&header, &input[inputSize], &headerSize);
+        memset(&input[inputSize + headerSize], 'a', fragmentSize);
+        inputSize += (int)headerSize + fragmentSize;
+    }
+    io->input = input;
+    io->inputSize = inputSize;
+    io->inputOffset = 0;
+    snWebsocket_poll(ws);
+    
+    const int timeoutMs = snWebsocket_getTimeout(ws);
+    sput_fail_unless(timeoutMs > 9000 && timeoutMs <= 10001,
+                     "A websocket holding on to a large buffer should be polled when it is released");
+    
+    testTime += 10.0f;
+    sput_fail_unless(snWebsocket_getTimeout(ws) == 0, "The buffer should be due for release after 10 idle seconds");
+    snWebsocket_poll(ws);
+    sput_fail_unless(snWebsocket_getTimeout(ws) == -1, "Polling should release the buffer");
+    
+    free(input);
+    snWebsocket_delete(ws);
+}
+
+static void testReadBudget()
+{
+    //frames of 5 bytes, read one at a time
+    const int numFrames = 5;
+    char input[5 * 5];
+    for (int i = 0; i < numFrames; i++)
+    {
+        snFrameHeader header;
+        memset(&header, 0, sizeof(snFrameHeader));
+        header.opcode = SN_OPCODE_TEXT;
+        header.isFinal = 1;
+        header.payloadSize = 3;
+        
+        uint32_t headerSize = 0;
+        snFrameHeader_toBytes(&header, &input[5 * i], &headerSize);
+        memcpy(&input[5 * i + headerSize], "abc", 3);
+    }
+    
+    snWebsocketSettings settings;
+    memset(&settings, 0, sizeof(snWebsocketSettings));
+    settings.readBufferSize = 5;
+    settings.maxFramesPerPoll = 2;
+    
+    int numMessages = 0;
+    snWebsocket* ws = createOpenTestWebsocketWithSettings(&settings, countTestMessage, &numMessages);
+    snTestIO* io = (snTestIO*)snWebsocket_getIOObject(ws);
+    sput_fail_unless(snWebsocket_getState(ws) == SN_STATE_OPEN, "The opening handshake should complete in small reads");
+    
+    io->input = input;
+    io->inputSize = sizeof(input);
+    io->inputOffset = 0;
+    snWebsocket_poll(ws);
+    sput_fail_unless(numMessages == 2, "A poll should stop reading once the frame budget is used up");
+    sput_fail_unless(snWebsocket_hasPendingInput(ws) && snWebsocket_getTimeout(ws) == 0,
+                     "A websocket that stopped reading early should need polling");
+    
+    snWebsocket_poll(ws);
+    snWebsocket_poll(ws);
+    sput_fail_unless(numMessages == numFrames, "Each poll should read up to the budget");
+    sput_fail_unless(!snWebsocket_hasPendingInput(ws), "A drained websocket should have no pending input");
+    snWebsocket_delete(ws);
+    
+    //the same with a byte budget
+    memset(&settings, 0, sizeof(snWebsocketSettings));
+    settings.readBufferSize = 5;
+    settings.maxBytesPerPoll = 15;
+    
+    numMessages = 0;
+    ws = createOpenTestWebsocketWithSettings(&settings, countTestMessage, &numMessages);
+    io = (snTestIO*)snWebsocket_getIOObject(ws);
+    io->input = input;
+    io->inputSize = sizeof(input);
+    io->inputOffset = 0;
+    snWebsocket_poll(ws);
+    sput_fail_unless(numMessages == 3 && snWebsocket_hasPendingInput(ws),
+                     "A poll should stop reading once the byte budget is used up");
+    
+    snWebsocket_poll(ws);
+    sput_fail_unless(numMessages == numFrames && !snWebsocket_hasPendingInput(ws),
+                     "The next poll should read the rest");
+    snWebsocket_delete(ws);
+}
+
+/**
+ * Reads frames from the output of a \c snTestIO and checks that
+ * they are whole, unfragmented messages with the given payloads.
+ * @return The number of frames that matched.
+ */
+static int countTestTextFrames(snTestIO* io, const char** payloads, int numPayloads)
+{
+    int numFramesOk = 0;
+    int offset = 0;
+    for (int i = 0; i < numPayloads; i++)
+    {
+        snFrameHeader header;
+        char received[64];
+        const int payloadSize = (int)strlen(payloads[i]);
+        if (readTestFrame(io, &offset, &header, received) &&
+            header.opcode == SN_OPCODE_TEXT &&
+            header.isFinal &&
+            header.payloadSize == payloadSize &&
+            memcmp(received, payloads[i], payloadSize) == 0)
+        {
+            numFramesOk++;
+        }
+    }
+    
+    return offset == io->outputSize ? numFramesOk : 0;
+}
+
+static void testCorkedWrites()
+{
+    snWebsocket* ws = createOpenTestWebsocket(NULL, NULL);
+    snTestIO* io = (snTestIO*)snWebsocket_getIOObject(ws);
+    const char* payloads[3] = {"one", "two", "three"};
+    
+    //corks nest, and the frames are written when the outermost one is removed
+    snWebsocket_cork(ws);
+    snWebsocket_cork(ws);
+    for (int i = 0; i < 3; i++)
+    {
+        snWebsocket_sendTextData(ws, payloads[i]);
+    }
+    snWebsocket_uncork(ws);
+    sput_fail_unless(io->numWrites == 0 && snWebsocket_getBufferedAmount(ws) > 0,
+                     "Frames should be collected while corked");
+    
+    sput_fail_unless(snWebsocket_uncork(ws) == SN_NO_ERROR, "Uncorking should succeed");
+    sput_fail_unless(io->numWrites == 1, "The collected frames should be written with one call");
+    sput_fail_unless(countTestTextFrames(io, payloads, 3) == 3, "The frames should be written whole and in order");
+    
+    //a batch is written the same way
+    io->outputSize = 0;
+    io->numWrites = 0;
+    snOutgoingMessage messages[3];
+    for (int i = 0; i < 3; i++)
+    {
+        messages[i].opcode = SN_OPCODE_TEXT;
+        messages[i].payload = payloads[i];
+        messages[i].payloadSize = (int)strlen(payloads[i]);
+    }
+    sput_fail_unless(snWebsocket_sendBatch(ws, messages, 3) == SN_NO_ERROR, "Sending a batch should succeed");
+    sput_fail_unless(io->numWrites == 1, "A batch should be written with one call");
+    sput_fail_unless(countTestTextFrames(io, payloads, 3) == 3, "The batch should be written whole and in order");
+    
+    snWebsocket_delete(ws);
+}
+
+static void testPostFrame()
+{
+    snWebsocket* ws = createOpenTestWebsocket(NULL, NULL);
+    snTestIO* io = (snTestIO*)snWebsocket_getIOObject(ws);
+    
+    //the payloads are copied, so the buffer can be reused right away
+    char payload[8];
+    const char* payloads[3] = {"one", "two", "three"};
+    for (int i = 0; i < 3; i++)
+    {
+        strcpy(payload, payloads[i]);
+        sput_fail_unless(snWebsocket_postFrame(ws, SN_OPCODE_TEXT, (int)strlen(payload), payload) == SN_NO_ERROR,
+                         "Posting a frame should succeed");
+        memset(payload, 'x', sizeof(payload));
+    }
+    sput_fail_unless(io->numWrites == 0, "Posted frames should wait for the websocket to be polled");
+    sput_fail_unless(snWebsocket_getTimeout(ws) == 0, "A websocket with posted frames should need polling");
+    
+    snWebsocket_poll(ws);
+    sput_fail_unless(io->numWrites == 1, "The posted frames should be written with one call");
+    sput_fail_unless(countTestTextFrames(io, payloads, 3) == 3, "The posted frames should be written whole and in order");
+    sput_fail_unless(snWebsocket_getTimeout(ws) != 0, "Sent frames should not need polling again");
+    
+    //posted frames don't interrupt a fragmented message
+    io->outputSize = 0;
+    io->numWrites = 0;
+    snWebsocket_beginMessage(ws, SN_OPCODE_TEXT);
+    snWebsocket_postFrame(ws, SN_OPCODE_TEXT, 3, "two");
+    snWebsocket_poll(ws);
+    sput_fail_unless(io->outputSize == 0, "Posted frames should wait for the message being sent");
+    
+    snWebsocket_appendMessage(ws, 3, "one");
+    snWebsocket_endMessage(ws);
+    sput_fail_unless(countTestTextFrames(io, payloads, 2) == 2, "Posted frames should follow the message");
+    
+    sput_fail_unless(snWebsocket_postFrame(ws, SN_OPCODE_TEXT, -1, NULL) == SN_BAD_ARGS,
+                     "Posting a frame with a negative size should fail");
+    
+    const int maxPayloadSize = (1 << 21) - SN_MAX_HEADER_SIZE;
+    char* largePayload = calloc(maxPayloadSize + 1, 1);
+    sput_fail_unless(snWebsocket_postFrame(ws, SN_OPCODE_BINARY, maxPayloadSize + 1, largePayload) == SN_BAD_ARGS,
+                     "Posting a frame larger than the max frame size should fail");
+    sput_fail_unless(snWebsocket_postFrame(ws, SN_OPCODE_BINARY, maxPayloadSize, largePayload) == SN_NO_ERROR,
+                     "Posting a frame of the max frame size should succeed");
+    free(largePayload);
+    
+    snWebsocket_delete(ws);
+}
+
+#endif /*SN_TEST_WEBSOCKET_H*/
@@ -32,8 +32,16 @@
 #include "sput.h"
 
 #include "testframe.h"
+#include "testeventloop.h"
 #include "testframeparser.h"
+#include "testiothread.h"
+#include "testmpscqueue.h"
 #include "testopeninghandshakeparser.h"
+#include "testreactor.h"
+#include "testresolver.h"
+#include "testsansio.h"
+#include "testutf8.h"
+#include "testwebsocket.h"
 #include "testwebsocketcpp.h"
 
 /**
@@ -47,14 +55,69 @@ int main(int argc, const char * argv[])
     sput_run_test(testFrameHeaderSerialization);
     sput_run_test(testFrameHeaderValidation);
     sput_run_test(testMasking);
+    sput_run_test(testPreparedMessage);
     
     sput_enter_suite("snFrameParser tests");
     sput_run_test(testFrameParserHeaderEquality);
+    sput_run_test(testFrameParserWholeHeader);
+    sput_run_test(testFrameParserZeroCopy);
+    sput_run_test(testFrameParserChunks);
+    sput_run_test(testFrameParserBufferGrowth);
+    sput_run_test(testFrameParserHugeStreamedFrame);
+    
+    sput_enter_suite("snMpscQueue tests");
+    sput_run_test(testMpscQueueOrder);
+    sput_run_test(testMpscQueueProducers);
+    
+    sput_enter_suite("snUTF8 tests");
+    sput_run_test(testUTF8Validation);
     
     sput_enter_suite("snOpeningHandshakeParser tests");
     sput_run_test(testWrongHTTPStatus);
     sput_run_test(testMissingWebsocketKey);
     sput_run_test(testHeaderFollowedByFrames);
+    sput_run_test(testHandshakeResponseInPieces);
+    
+    sput_enter_suite("snWebsocket tests");
+    sput_run_test(testSendLargeFrame);
+    sput_run_test(testSendOversizedFrame);
+    sput_run_test(testBroadcastPreparedMessage);
+    sput_run_test(testPartialWrites);
+    sput_run_test(testCloseFrameUnderBackpressure);
+    sput_run_test(testZeroMaskingKeys);
+    sput_run_test(testFailedFragmentClosesWebsocket);
+    sput_run_test(testQueueMessages);
+    sput_run_test(testReadIdleTimeout);
+    sput_run_test(testReadBudget);
+    sput_run_test(testCorkedWrites);
+    sput_run_test(testPostFrame);
+    
+    sput_enter_suite("sans-I/O tests");
+    sput_run_test(testSansIOHandshake);
+    sput_run_test(testSansIOPingPong);
+    sput_run_test(testSansIOCloseRetention);
+    sput_run_test(testSansIOFragmentedMessage);
+    
+#ifdef __linux__
+    sput_enter_suite("snEventLoop tests");
+    sput_run_test(testEventLoopWaitsForActivity);
+    sput_run_test(testEventLoopClosingTimeout);
+    sput_run_test(testEventLoopUringWebsockets);
+    sput_run_test(testEventLoopPostFrame);
+    
+    sput_enter_suite("snReactor tests");
+    sput_run_test(testReactorMoveAndLoad);
+    
+    sput_enter_suite("I/O thread tests");
+    sput_run_test(testIOThreadPingWhileRingIsFull);
+    sput_run_test(testIOThreadPausesReads);
+    
+    sput_enter_suite("stfResolver tests");
+    sput_run_test(testResolverTimeToLive);
+    sput_run_test(testResolverNegativeCaching);
+    sput_run_test(testResolverJoinsRequests);
+    sput_run_test(testResolverInvalidate);
+#endif /* __linux__ */
     
     sput_enter_suite("c++ wrapper tests");
     sput_run_test(testWebsocketCppEcho);